@@ -0,0 +1,412 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Benchmark of the crypto used by a HomeKit accessory.
+//
+// The benchmark measures:
+//
+//   1. Session traffic. HAP frames are encrypted and decrypted with ChaCha20-Poly1305, once with the port kernel
+//      and once with mbedTLS. The frames per second of both are reported. Beforehand, both are checked against
+//      each other on different lengths and alignments.
+//
+//   2. Pair setup. The accessory side of SRP-3072 and the HKDF-SHA512 key derivations of pair setup are repeated.
+//      The latency of the M2 and M4 steps and of the key derivations is reported.
+//
+// The SHA and MPI accelerators are used by mbedTLS when MBEDTLS_HARDWARE_SHA and MBEDTLS_HARDWARE_MPI are enabled.
+// To compare pair setup with the software implementation, disable them in menuconfig and run the benchmark again.
+
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mbedtls/chachapoly.h>
+
+#include "HAPCrypto.h"
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformChaCha20Poly1305+Init.h"
+
+/**
+ * Number of frames per session crypto measurement.
+ */
+#define kBenchmarkNumFrames ((size_t) CONFIG_BENCHMARK_NUM_FRAMES)
+
+/**
+ * Plaintext bytes per frame.
+ */
+#define kBenchmarkFrameSize ((size_t) CONFIG_BENCHMARK_FRAME_SIZE)
+
+/**
+ * Number of pair setups.
+ */
+#define kBenchmarkNumPairSetups ((size_t) CONFIG_BENCHMARK_NUM_PAIR_SETUPS)
+
+/**
+ * HAP over IP frame. The 2 byte length is the additional authenticated data.
+ */
+typedef struct {
+    uint8_t aad[2];
+    HAP_ALIGNAS(4) uint8_t bytes[kBenchmarkFrameSize];
+    uint8_t tag[CHACHA20_POLY1305_TAG_BYTES];
+} Frame;
+
+static Frame frame;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Session crypto implementation under test.
+ */
+typedef struct {
+    const char* name;
+    void (*encrypt)(
+            uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+            uint8_t* c,
+            const uint8_t* m,
+            size_t m_len,
+            const uint8_t* a,
+            size_t a_len,
+            const uint8_t n[12],
+            const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]);
+    int (*decrypt)(
+            const uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+            uint8_t* m,
+            const uint8_t* c,
+            size_t c_len,
+            const uint8_t* a,
+            size_t a_len,
+            const uint8_t n[12],
+            const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]);
+} Implementation;
+
+static void PortEncrypt(
+        uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+        uint8_t* c,
+        const uint8_t* m,
+        size_t m_len,
+        const uint8_t* a,
+        size_t a_len,
+        const uint8_t n[12],
+        const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]) {
+    HAPPlatformChaCha20Poly1305Encrypt(tag, c, m, m_len, a, a_len, n, 12, k);
+}
+
+static int PortDecrypt(
+        const uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+        uint8_t* m,
+        const uint8_t* c,
+        size_t c_len,
+        const uint8_t* a,
+        size_t a_len,
+        const uint8_t n[12],
+        const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]) {
+    return HAPPlatformChaCha20Poly1305Decrypt(tag, m, c, c_len, a, a_len, n, 12, k);
+}
+
+// The crypto PAL sets up an mbedTLS context for every frame, so the same is done here.
+
+static void MbedTLSEncrypt(
+        uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+        uint8_t* c,
+        const uint8_t* m,
+        size_t m_len,
+        const uint8_t* a,
+        size_t a_len,
+        const uint8_t n[12],
+        const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]) {
+    mbedtls_chachapoly_context ctx;
+    mbedtls_chachapoly_init(&ctx);
+    int ret = mbedtls_chachapoly_setkey(&ctx, k);
+    HAPAssert(!ret);
+    ret = mbedtls_chachapoly_encrypt_and_tag(&ctx, m_len, n, a, a_len, m, c, tag);
+    HAPAssert(!ret);
+    mbedtls_chachapoly_free(&ctx);
+}
+
+static int MbedTLSDecrypt(
+        const uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+        uint8_t* m,
+        const uint8_t* c,
+        size_t c_len,
+        const uint8_t* a,
+        size_t a_len,
+        const uint8_t n[12],
+        const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]) {
+    mbedtls_chachapoly_context ctx;
+    mbedtls_chachapoly_init(&ctx);
+    int ret = mbedtls_chachapoly_setkey(&ctx, k);
+    HAPAssert(!ret);
+    ret = mbedtls_chachapoly_auth_decrypt(&ctx, c_len, n, a, a_len, tag, c, m);
+    mbedtls_chachapoly_free(&ctx);
+    return ret ? -1 : 0;
+}
+
+static const Implementation implementations[] = {
+    { .name = "Port kernel", .encrypt = PortEncrypt, .decrypt = PortDecrypt },
+    { .name = "mbedTLS", .encrypt = MbedTLSEncrypt, .decrypt = MbedTLSDecrypt },
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Checks the port kernel against mbedTLS, including unaligned and in-place operation.
+ */
+static void CheckSessionCrypto(void) {
+    static uint8_t m[kBenchmarkFrameSize + 3];
+    static uint8_t c[kBenchmarkFrameSize + 3];
+    static uint8_t expected[kBenchmarkFrameSize + 3];
+
+    uint8_t k[CHACHA20_POLY1305_KEY_BYTES];
+    uint8_t n[12];
+    uint8_t a[16];
+    for (size_t i = 0; i < 256; i++) {
+        size_t numBytes;
+        HAPPlatformRandomNumberFill(&numBytes, sizeof numBytes);
+        numBytes %= kBenchmarkFrameSize + 1;
+        size_t offset = i % 4;
+        size_t numAADBytes = i % (sizeof a + 1);
+        HAPPlatformRandomNumberFill(k, sizeof k);
+        HAPPlatformRandomNumberFill(n, sizeof n);
+        HAPPlatformRandomNumberFill(a, sizeof a);
+        HAPPlatformRandomNumberFill(m, numBytes);
+
+        uint8_t tag[CHACHA20_POLY1305_TAG_BYTES];
+        uint8_t expectedTag[CHACHA20_POLY1305_TAG_BYTES];
+        MbedTLSEncrypt(expectedTag, expected, m, numBytes, a, numAADBytes, n, k);
+        HAPRawBufferCopyBytes(&c[offset], m, numBytes);
+        PortEncrypt(tag, &c[offset], &c[offset], numBytes, a, numAADBytes, n, k);
+        if (!HAPRawBufferAreEqual(tag, expectedTag, sizeof tag) ||
+            !HAPRawBufferAreEqual(&c[offset], expected, numBytes)) {
+            HAPLogError(
+                    &kHAPLog_Default,
+                    "Port kernel encryption differs from mbedTLS (%lu bytes).",
+                    (unsigned long) numBytes);
+            HAPFatalError();
+        }
+        if (PortDecrypt(tag, &c[offset], &c[offset], numBytes, a, numAADBytes, n, k) ||
+            !HAPRawBufferAreEqual(&c[offset], m, numBytes)) {
+            HAPLogError(&kHAPLog_Default, "Port kernel decryption failed (%lu bytes).", (unsigned long) numBytes);
+            HAPFatalError();
+        }
+        tag[0] ^= 1;
+        if (!PortDecrypt(tag, c, expected, numBytes, a, numAADBytes, n, k)) {
+            HAPLogError(&kHAPLog_Default, "Port kernel accepted a forged tag (%lu bytes).", (unsigned long) numBytes);
+            HAPFatalError();
+        }
+    }
+    HAPLogInfo(&kHAPLog_Default, "Port kernel matches mbedTLS.");
+}
+
+static void BenchmarkSessionCrypto(const Implementation* implementation) {
+    HAPPrecondition(implementation);
+
+    uint8_t k[CHACHA20_POLY1305_KEY_BYTES];
+    HAPPlatformRandomNumberFill(k, sizeof k);
+    HAPPlatformRandomNumberFill(frame.bytes, kBenchmarkFrameSize);
+    frame.aad[0] = (uint8_t) kBenchmarkFrameSize;
+    frame.aad[1] = (uint8_t)(kBenchmarkFrameSize >> 8);
+
+    // Frames are encrypted in place with the session nonce, like the IP security protocol does.
+    uint8_t n[12] = { 0 };
+    int64_t startTime = esp_timer_get_time();
+    for (size_t i = 0; i < kBenchmarkNumFrames; i++) {
+        n[4] = (uint8_t) i;
+        n[5] = (uint8_t)(i >> 8);
+        implementation->encrypt(
+                frame.tag, frame.bytes, frame.bytes, kBenchmarkFrameSize, frame.aad, sizeof frame.aad, n, k);
+    }
+    int64_t encryptTime = esp_timer_get_time() - startTime;
+
+    // The last frame is decrypted repeatedly, so that every tag matches.
+    static uint8_t plaintext[kBenchmarkFrameSize];
+    startTime = esp_timer_get_time();
+    for (size_t i = 0; i < kBenchmarkNumFrames; i++) {
+        int ret = implementation->decrypt(
+                frame.tag, plaintext, frame.bytes, kBenchmarkFrameSize, frame.aad, sizeof frame.aad, n, k);
+        HAPAssert(!ret);
+    }
+    int64_t decryptTime = esp_timer_get_time() - startTime;
+
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  %-12s encrypt: %6lu frames/s (%5lu KiB/s)  decrypt: %6lu frames/s (%5lu KiB/s)",
+            implementation->name,
+            (unsigned long) (kBenchmarkNumFrames * 1000000 / (uint64_t) encryptTime),
+            (unsigned long) (kBenchmarkNumFrames * kBenchmarkFrameSize * 1000000 / 1024 / (uint64_t) encryptTime),
+            (unsigned long) (kBenchmarkNumFrames * 1000000 / (uint64_t) decryptTime),
+            (unsigned long) (kBenchmarkNumFrames * kBenchmarkFrameSize * 1000000 / 1024 / (uint64_t) decryptTime));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Latency of one pair setup step.
+ */
+typedef struct {
+    const char* name;
+    int64_t minTime;
+    int64_t maxTime;
+    int64_t totalTime;
+} Step;
+
+static void RecordStep(Step* step, int64_t startTime) {
+    HAPPrecondition(step);
+
+    int64_t duration = esp_timer_get_time() - startTime;
+    if (!step->totalTime || duration < step->minTime) {
+        step->minTime = duration;
+    }
+    if (duration > step->maxTime) {
+        step->maxTime = duration;
+    }
+    step->totalTime += duration;
+}
+
+static void ReportStep(const Step* step) {
+    HAPPrecondition(step);
+
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  %-28s avg = %7lu us  min = %7lu us  max = %7lu us",
+            step->name,
+            (unsigned long) (step->totalTime / (int64_t) kBenchmarkNumPairSetups),
+            (unsigned long) step->minTime,
+            (unsigned long) step->maxTime);
+}
+
+/**
+ * Repeats the accessory side crypto of pair setup.
+ *
+ * The controller public key is a random value below the SRP prime, as the controller side is not part of the PAL.
+ */
+static void BenchmarkPairSetup(void) {
+    static uint8_t salt[SRP_SALT_BYTES];
+    static uint8_t v[SRP_VERIFIER_BYTES];
+    static uint8_t b[SRP_SECRET_KEY_BYTES];
+    static uint8_t pub_a[SRP_PUBLIC_KEY_BYTES];
+    static uint8_t pub_b[SRP_PUBLIC_KEY_BYTES];
+    static uint8_t u[SRP_SCRAMBLING_PARAMETER_BYTES];
+    static uint8_t s[SRP_PREMASTER_SECRET_BYTES];
+    static uint8_t sessionKey[SRP_SESSION_KEY_BYTES];
+    static uint8_t m1[SRP_PROOF_BYTES];
+    static uint8_t m2[SRP_PROOF_BYTES];
+    static const uint8_t user[] = "Pair-Setup";
+    static const uint8_t setupCode[] = "111-22-333";
+
+    Step steps[] = {
+        { .name = "M2: B = kv + g^b" },
+        { .name = "M4: premaster secret" },
+        { .name = "M4: session key and proofs" },
+        { .name = "M4-M6: HKDF-SHA512" },
+        { .name = "Total" },
+    };
+
+    HAPPlatformRandomNumberFill(salt, sizeof salt);
+    HAP_srp_verifier(v, salt, user, sizeof user - 1, setupCode, sizeof setupCode - 1);
+
+    for (size_t i = 0; i < kBenchmarkNumPairSetups; i++) {
+        HAPPlatformRandomNumberFill(b, sizeof b);
+        HAPPlatformRandomNumberFill(pub_a, sizeof pub_a);
+        pub_a[0] &= 0x7F;
+
+        int64_t setupStartTime = esp_timer_get_time();
+        int64_t startTime = setupStartTime;
+        HAP_srp_public_key(pub_b, b, v);
+        RecordStep(&steps[0], startTime);
+
+        startTime = esp_timer_get_time();
+        HAP_srp_scrambling_parameter(u, pub_a, pub_b);
+        int ret = HAP_srp_premaster_secret(s, pub_a, b, u, v);
+        HAPAssert(!ret);
+        RecordStep(&steps[1], startTime);
+
+        startTime = esp_timer_get_time();
+        HAP_srp_session_key(sessionKey, s);
+        HAP_srp_proof_m1(m1, user, sizeof user - 1, salt, pub_a, pub_b, sessionKey);
+        HAP_srp_proof_m2(m2, pub_a, m1, sessionKey);
+        RecordStep(&steps[2], startTime);
+
+        // Pair-Setup-Encrypt-Key, Pair-Setup-Controller-Sign-Key and Pair-Setup-Accessory-Sign-Key.
+        startTime = esp_timer_get_time();
+        for (size_t j = 0; j < 3; j++) {
+            uint8_t key[CHACHA20_POLY1305_KEY_BYTES];
+            const char* salts[] = { "Pair-Setup-Encrypt-Salt",
+                                    "Pair-Setup-Controller-Sign-Salt",
+                                    "Pair-Setup-Accessory-Sign-Salt" };
+            const char* infos[] = { "Pair-Setup-Encrypt-Info",
+                                    "Pair-Setup-Controller-Sign-Info",
+                                    "Pair-Setup-Accessory-Sign-Info" };
+            HAP_hkdf_sha512(
+                    key,
+                    sizeof key,
+                    sessionKey,
+                    sizeof sessionKey,
+                    (const uint8_t*) salts[j],
+                    HAPStringGetNumBytes(salts[j]),
+                    (const uint8_t*) infos[j],
+                    HAPStringGetNumBytes(infos[j]));
+        }
+        RecordStep(&steps[3], startTime);
+        RecordStep(&steps[4], setupStartTime);
+    }
+
+    for (size_t i = 0; i < HAPArrayCount(steps); i++) {
+        ReportStep(&steps[i]);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void main_task() {
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "Session crypto: %s. mbedTLS accelerators: SHA %s, MPI %s, AES %s.",
+#if CONFIG_HAP_CRYPTO_CHACHA20_POLY1305
+            "port kernel",
+#else
+            "mbedTLS",
+#endif
+#if CONFIG_MBEDTLS_HARDWARE_SHA
+            "on",
+#else
+            "off",
+#endif
+#if CONFIG_MBEDTLS_HARDWARE_MPI
+            "on",
+#else
+            "off",
+#endif
+#if CONFIG_MBEDTLS_HARDWARE_AES
+            "on");
+#else
+            "off");
+#endif
+
+    CheckSessionCrypto();
+
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "==== ChaCha20-Poly1305, %lu frames of %lu bytes ====",
+            (unsigned long) kBenchmarkNumFrames,
+            (unsigned long) kBenchmarkFrameSize);
+    for (size_t i = 0; i < HAPArrayCount(implementations); i++) {
+        BenchmarkSessionCrypto(&implementations[i]);
+    }
+
+    HAPLogInfo(&kHAPLog_Default, "==== Pair setup, %lu runs ====", (unsigned long) kBenchmarkNumPairSetups);
+    BenchmarkPairSetup();
+
+    HAPLogInfo(&kHAPLog_Default, "Benchmark done.");
+    vTaskDelete(NULL);
+}
+
+void app_main() {
+    xTaskCreate(main_task, "main_task", 8 * 1024, NULL, 6, NULL);
+}
@@ -0,0 +1,508 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Benchmark of the key-value store on real flash.
+//
+// The benchmark replays the access patterns of a HomeKit accessory against the key-value store:
+//
+//   1. Pairings. Up to 16 pairings are added. Every pair verify enumerates the pairings and reads one of them.
+//      Controllers are removed and added again.
+//
+//   2. Configuration number churn. The configuration number is read, incremented and written back.
+//
+//   3. App state. A small state blob is saved, alternately changed and unchanged.
+//
+//   4. Factory partition. The setup info is read from the factory partition.
+//
+// Each pattern is repeated with the nvs partition filled with unrelated data to different levels.
+// For every pattern, the latency percentiles, the NVS operations issued by the key-value store,
+// and the number of free NVS entries are reported.
+
+#include <stdlib.h>
+
+#include <esp_err.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <nvs.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformKeyValueStore+SDKDomains.h"
+
+/**
+ * Partition holding the benchmark data.
+ */
+#define kBenchmarkPartitionName "nvs"
+
+/**
+ * Namespace prefix of the benchmark key-value store. Distinct from the examples, so that their data is not touched.
+ */
+#define kBenchmarkNamespacePrefix "bench"
+
+/**
+ * NVS namespace of the data used to fill the partition.
+ */
+#define kBenchmarkFillNamespace "bench.fill"
+
+/**
+ * Domain used for pairings.
+ */
+#define kBenchmarkKeyValueStoreDomain_Pairings ((HAPPlatformKeyValueStoreDomain) 0x00)
+
+/**
+ * Domain used for the configuration number.
+ */
+#define kBenchmarkKeyValueStoreDomain_Configuration ((HAPPlatformKeyValueStoreDomain) 0x01)
+
+/**
+ * Domain used for app state.
+ */
+#define kBenchmarkKeyValueStoreDomain_App ((HAPPlatformKeyValueStoreDomain) 0x02)
+
+/**
+ * Number of pairings. HomeKit accessories support at least 16 pairings.
+ */
+#define kBenchmarkNumPairings ((size_t) 16)
+
+/**
+ * Number of iterations per pattern.
+ */
+#define kBenchmarkNumIterations ((size_t) CONFIG_BENCHMARK_NUM_ITERATIONS)
+
+/**
+ * Serialized pairing, laid out like the pairings stored by the accessory server.
+ */
+typedef struct {
+    uint8_t identifier[36];
+    uint8_t numIdentifierBytes;
+    uint8_t publicKey[32];
+    uint8_t permissions;
+} BenchmarkPairing;
+
+/**
+ * App state, sized like the state of the Lightstrip example.
+ */
+typedef struct {
+    uint8_t bytes[10];
+} BenchmarkState;
+
+/**
+ * Latency samples of one operation.
+ */
+typedef struct {
+    const char* name;
+    size_t numSamples;
+    uint32_t samples[kBenchmarkNumIterations * 2];
+} Measurement;
+
+static HAPPlatformKeyValueStore keyValueStore;
+static HAPPlatformKeyValueStore factoryKeyValueStore;
+
+static Measurement measurements[2];
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void BeginMeasurement(Measurement* measurement, const char* name) {
+    HAPPrecondition(measurement);
+    HAPPrecondition(name);
+
+    measurement->name = name;
+    measurement->numSamples = 0;
+}
+
+static void RecordSample(Measurement* measurement, int64_t startTime) {
+    HAPPrecondition(measurement);
+
+    int64_t duration = esp_timer_get_time() - startTime;
+    if (measurement->numSamples < HAPArrayCount(measurement->samples)) {
+        measurement->samples[measurement->numSamples++] = (uint32_t) duration;
+    }
+}
+
+static int CompareSamples(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Reports the latency percentiles of an operation in microseconds.
+ */
+static void ReportMeasurement(Measurement* measurement) {
+    HAPPrecondition(measurement);
+
+    if (!measurement->numSamples) {
+        return;
+    }
+    qsort(measurement->samples, measurement->numSamples, sizeof measurement->samples[0], CompareSamples);
+    size_t n = measurement->numSamples;
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  %-28s n = %4lu  p50 = %6lu us  p90 = %6lu us  p99 = %6lu us  max = %6lu us",
+            measurement->name,
+            (unsigned long) n,
+            (unsigned long) measurement->samples[n * 50 / 100],
+            (unsigned long) measurement->samples[n * 90 / 100],
+            (unsigned long) measurement->samples[n * 99 / 100],
+            (unsigned long) measurement->samples[n - 1]);
+}
+
+/**
+ * Snapshot of the NVS operations and the NVS fill level at the start of a pattern.
+ */
+typedef struct {
+    HAPPlatformKeyValueStoreStatistics statistics;
+    nvs_stats_t nvsStats;
+} Snapshot;
+
+static void TakeSnapshot(HAPPlatformKeyValueStoreRef store, const char* partitionName, Snapshot* snapshot) {
+    HAPPrecondition(store);
+    HAPPrecondition(partitionName);
+    HAPPrecondition(snapshot);
+
+    HAPPlatformKeyValueStoreGetStatistics(store, &snapshot->statistics);
+    ESP_ERROR_CHECK(nvs_get_stats(partitionName, &snapshot->nvsStats));
+}
+
+/**
+ * Reports the NVS operations that were issued since a snapshot, and the trend of free NVS entries.
+ */
+static void ReportSnapshot(HAPPlatformKeyValueStoreRef store, const char* partitionName, const Snapshot* snapshot) {
+    HAPPrecondition(store);
+    HAPPrecondition(partitionName);
+    HAPPrecondition(snapshot);
+
+    Snapshot now;
+    TakeSnapshot(store, partitionName, &now);
+    const HAPPlatformKeyValueStoreStatistics* a = &snapshot->statistics;
+    const HAPPlatformKeyValueStoreStatistics* b = &now.statistics;
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  NVS: %lu reads, %lu writes (%lu skipped), %lu erases, %lu commits, %lu opens; "
+            "cache hits %lu, index hits %lu",
+            (unsigned long) (b->numNVSReads - a->numNVSReads),
+            (unsigned long) (b->numNVSWrites - a->numNVSWrites),
+            (unsigned long) (b->numSkippedWrites - a->numSkippedWrites),
+            (unsigned long) (b->numNVSErases - a->numNVSErases),
+            (unsigned long) (b->numNVSCommits - a->numNVSCommits),
+            (unsigned long) (b->numNVSOpens - a->numNVSOpens),
+            (unsigned long) (b->numCacheHits - a->numCacheHits),
+            (unsigned long) (b->numIndexHits - a->numIndexHits));
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  NVS free entries: %lu -> %lu (of %lu)",
+            (unsigned long) snapshot->nvsStats.free_entries,
+            (unsigned long) now.nvsStats.free_entries,
+            (unsigned long) now.nvsStats.total_entries);
+}
+
+static void CheckError(HAPError err) {
+    if (err) {
+        HAPAssert(err == kHAPError_Unknown);
+        HAPFatalError();
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Fills the nvs partition with unrelated data until the given percentage of its entries is used.
+ *
+ * @param      fillLevel            Fill level in percent.
+ */
+static void FillPartition(unsigned int fillLevel) {
+    nvs_handle handle;
+    ESP_ERROR_CHECK(nvs_open_from_partition(kBenchmarkPartitionName, kBenchmarkFillNamespace, NVS_READWRITE, &handle));
+
+    nvs_stats_t stats;
+    ESP_ERROR_CHECK(nvs_get_stats(kBenchmarkPartitionName, &stats));
+    for (unsigned int i = 0; stats.used_entries * 100 < stats.total_entries * fillLevel; i++) {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        uint8_t bytes[32];
+        HAPPlatformRandomNumberFill(bytes, sizeof bytes);
+        HAPError err = HAPStringWithFormat(key, sizeof key, "f%04u", i);
+        HAPAssert(!err);
+        esp_err_t e = nvs_set_blob(handle, key, bytes, sizeof bytes);
+        if (e == ESP_ERR_NVS_NOT_ENOUGH_SPACE) {
+            break;
+        }
+        ESP_ERROR_CHECK(e);
+        ESP_ERROR_CHECK(nvs_get_stats(kBenchmarkPartitionName, &stats));
+    }
+    ESP_ERROR_CHECK(nvs_commit(handle));
+    nvs_close(handle);
+
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "NVS fill level: %lu of %lu entries used.",
+            (unsigned long) stats.used_entries,
+            (unsigned long) stats.total_entries);
+}
+
+static void ClearPartition(void) {
+    nvs_handle handle;
+    ESP_ERROR_CHECK(nvs_open_from_partition(kBenchmarkPartitionName, kBenchmarkFillNamespace, NVS_READWRITE, &handle));
+    ESP_ERROR_CHECK(nvs_erase_all(handle));
+    ESP_ERROR_CHECK(nvs_commit(handle));
+    nvs_close(handle);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void MakePairing(BenchmarkPairing* pairing, HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(pairing);
+
+    HAPRawBufferZero(pairing, sizeof *pairing);
+    HAPPlatformRandomNumberFill(pairing->identifier, sizeof pairing->identifier);
+    pairing->identifier[0] = key;
+    pairing->numIdentifierBytes = sizeof pairing->identifier;
+    HAPPlatformRandomNumberFill(pairing->publicKey, sizeof pairing->publicKey);
+    pairing->permissions = key == 0 ? 0x01 : 0x00;
+}
+
+typedef struct {
+    uint8_t identifier;
+    bool found;
+} FindPairingContext;
+
+HAP_RESULT_USE_CHECK
+static HAPError FindPairingCallback(
+        void* _Nullable context_,
+        HAPPlatformKeyValueStoreRef store,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        bool* shouldContinue) {
+    HAPPrecondition(context_);
+    HAPPrecondition(shouldContinue);
+    FindPairingContext* context = context_;
+
+    // Pair verify looks up the controller by reading pairings until the identifier matches.
+    BenchmarkPairing pairing;
+    bool found;
+    size_t numBytes;
+    HAPError err = HAPPlatformKeyValueStoreGet(store, domain, key, &pairing, sizeof pairing, &numBytes, &found);
+    if (err) {
+        return err;
+    }
+    if (found && numBytes == sizeof pairing && pairing.identifier[0] == context->identifier) {
+        context->found = true;
+        *shouldContinue = false;
+    }
+    return kHAPError_None;
+}
+
+static void BenchmarkPairings(void) {
+    HAPError err;
+
+    HAPLogInfo(&kHAPLog_Default, "Pairings (%lu):", (unsigned long) kBenchmarkNumPairings);
+    Snapshot snapshot;
+    TakeSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+
+    BeginMeasurement(&measurements[0], "Add pairing");
+    for (size_t i = 0; i < kBenchmarkNumPairings; i++) {
+        BenchmarkPairing pairing;
+        MakePairing(&pairing, (HAPPlatformKeyValueStoreKey) i);
+        int64_t startTime = esp_timer_get_time();
+        err = HAPPlatformKeyValueStoreSet(
+                &keyValueStore,
+                kBenchmarkKeyValueStoreDomain_Pairings,
+                (HAPPlatformKeyValueStoreKey) i,
+                &pairing,
+                sizeof pairing);
+        RecordSample(&measurements[0], startTime);
+        CheckError(err);
+    }
+    ReportMeasurement(&measurements[0]);
+
+    BeginMeasurement(&measurements[0], "Pair verify lookup");
+    BeginMeasurement(&measurements[1], "Remove and add pairing");
+    for (size_t i = 0; i < kBenchmarkNumIterations; i++) {
+        FindPairingContext context = { .identifier = (uint8_t)(esp_random() % kBenchmarkNumPairings) };
+        int64_t startTime = esp_timer_get_time();
+        err = HAPPlatformKeyValueStoreEnumerate(
+                &keyValueStore, kBenchmarkKeyValueStoreDomain_Pairings, FindPairingCallback, &context);
+        RecordSample(&measurements[0], startTime);
+        CheckError(err);
+        HAPAssert(context.found);
+
+        if (i % 8 == 0) {
+            HAPPlatformKeyValueStoreKey key = (HAPPlatformKeyValueStoreKey)(1 + esp_random() % (kBenchmarkNumPairings - 1));
+            BenchmarkPairing pairing;
+            MakePairing(&pairing, key);
+            startTime = esp_timer_get_time();
+            err = HAPPlatformKeyValueStoreRemove(&keyValueStore, kBenchmarkKeyValueStoreDomain_Pairings, key);
+            if (!err) {
+                err = HAPPlatformKeyValueStoreSet(
+                        &keyValueStore, kBenchmarkKeyValueStoreDomain_Pairings, key, &pairing, sizeof pairing);
+            }
+            RecordSample(&measurements[1], startTime);
+            CheckError(err);
+        }
+    }
+    ReportMeasurement(&measurements[0]);
+    ReportMeasurement(&measurements[1]);
+    ReportSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+}
+
+static void BenchmarkConfigurationNumber(void) {
+    HAPError err;
+
+    HAPLogInfo(&kHAPLog_Default, "Configuration number churn:");
+    Snapshot snapshot;
+    TakeSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+
+    BeginMeasurement(&measurements[0], "Bump configuration number");
+    for (size_t i = 0; i < kBenchmarkNumIterations; i++) {
+        int64_t startTime = esp_timer_get_time();
+        uint32_t configurationNumber = 0;
+        bool found;
+        size_t numBytes;
+        err = HAPPlatformKeyValueStoreGet(
+                &keyValueStore,
+                kBenchmarkKeyValueStoreDomain_Configuration,
+                0x00,
+                &configurationNumber,
+                sizeof configurationNumber,
+                &numBytes,
+                &found);
+        if (!err) {
+            configurationNumber = found && numBytes == sizeof configurationNumber ? configurationNumber + 1 : 1;
+            err = HAPPlatformKeyValueStoreSet(
+                    &keyValueStore,
+                    kBenchmarkKeyValueStoreDomain_Configuration,
+                    0x00,
+                    &configurationNumber,
+                    sizeof configurationNumber);
+        }
+        RecordSample(&measurements[0], startTime);
+        CheckError(err);
+    }
+    ReportMeasurement(&measurements[0]);
+    ReportSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+}
+
+static void BenchmarkAppState(void) {
+    HAPError err;
+
+    HAPLogInfo(&kHAPLog_Default, "App state:");
+    Snapshot snapshot;
+    TakeSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+
+    BeginMeasurement(&measurements[0], "Save changed state");
+    BeginMeasurement(&measurements[1], "Save unchanged state");
+    BenchmarkState state;
+    HAPRawBufferZero(&state, sizeof state);
+    for (size_t i = 0; i < kBenchmarkNumIterations; i++) {
+        // Every other save repeats the previous state, as after an effect that ends where it started.
+        bool isChanged = i % 2 == 0;
+        if (isChanged) {
+            state.bytes[i % sizeof state.bytes]++;
+        }
+        int64_t startTime = esp_timer_get_time();
+        err = HAPPlatformKeyValueStoreSet(&keyValueStore, kBenchmarkKeyValueStoreDomain_App, 0x00, &state, sizeof state);
+        RecordSample(&measurements[isChanged ? 0 : 1], startTime);
+        CheckError(err);
+    }
+    ReportMeasurement(&measurements[0]);
+    ReportMeasurement(&measurements[1]);
+    ReportSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+}
+
+static void BenchmarkPurge(void) {
+    HAPError err;
+
+    HAPLogInfo(&kHAPLog_Default, "Purge:");
+    Snapshot snapshot;
+    TakeSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+
+    static const HAPPlatformKeyValueStoreDomain domains[] = { kBenchmarkKeyValueStoreDomain_Pairings,
+                                                              kBenchmarkKeyValueStoreDomain_Configuration,
+                                                              kBenchmarkKeyValueStoreDomain_App };
+    BeginMeasurement(&measurements[0], "Purge domain");
+    for (size_t i = 0; i < HAPArrayCount(domains); i++) {
+        int64_t startTime = esp_timer_get_time();
+        err = HAPPlatformKeyValueStorePurgeDomain(&keyValueStore, domains[i]);
+        RecordSample(&measurements[0], startTime);
+        CheckError(err);
+    }
+    ReportMeasurement(&measurements[0]);
+    ReportSnapshot(&keyValueStore, kBenchmarkPartitionName, &snapshot);
+}
+
+static void BenchmarkFactoryPartition(void) {
+    HAPError err;
+
+    HAPLogInfo(&kHAPLog_Default, "Factory partition (%s):", CONFIG_BENCHMARK_FACTORY_PARTITION_NAME);
+    Snapshot snapshot;
+    TakeSnapshot(&factoryKeyValueStore, CONFIG_BENCHMARK_FACTORY_PARTITION_NAME, &snapshot);
+
+    BeginMeasurement(&measurements[0], "Read setup info");
+    bool found = false;
+    for (size_t i = 0; i < kBenchmarkNumIterations; i++) {
+        uint8_t setupInfo[128];
+        size_t numBytes;
+        int64_t startTime = esp_timer_get_time();
+        err = HAPPlatformKeyValueStoreGet(
+                &factoryKeyValueStore,
+                kSDKKeyValueStoreDomain_Provisioning,
+                kSDKKeyValueStoreKey_Provisioning_SetupInfo,
+                setupInfo,
+                sizeof setupInfo,
+                &numBytes,
+                &found);
+        RecordSample(&measurements[0], startTime);
+        CheckError(err);
+    }
+    if (!found) {
+        HAPLogInfo(&kHAPLog_Default, "  Setup info not found. Write accessory_setup.bin to measure reads of a present key.");
+    }
+    ReportMeasurement(&measurements[0]);
+    ReportSnapshot(&factoryKeyValueStore, CONFIG_BENCHMARK_FACTORY_PARTITION_NAME, &snapshot);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void main_task() {
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) { .part_name = kBenchmarkPartitionName,
+                                                       .namespace_prefix = kBenchmarkNamespacePrefix });
+    HAPPlatformKeyValueStoreCreate(
+            &factoryKeyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) { .part_name = CONFIG_BENCHMARK_FACTORY_PARTITION_NAME,
+                                                       .namespace_prefix = "hap",
+                                                       .read_only = true });
+
+    // Start from a clean state in case a previous run was interrupted.
+    ClearPartition();
+    BenchmarkPurge();
+
+    for (unsigned int fillLevel = 0; fillLevel <= CONFIG_BENCHMARK_MAX_FILL_LEVEL; fillLevel += 25) {
+        HAPLogInfo(&kHAPLog_Default, "==== Target NVS fill level: %u%% ====", fillLevel);
+        FillPartition(fillLevel);
+
+        BenchmarkPairings();
+        BenchmarkConfigurationNumber();
+        BenchmarkAppState();
+        BenchmarkPurge();
+        BenchmarkFactoryPartition();
+    }
+
+    ClearPartition();
+    HAPLogInfo(&kHAPLog_Default, "Benchmark done.");
+    vTaskDelete(NULL);
+}
+
+void app_main() {
+    xTaskCreate(main_task, "main_task", 6 * 1024, NULL, 6, NULL);
+}
@@ -26,9 +26,13 @@
 //   6. Callbacks that notify the server in case their associated value has changed.
 
 #include "HAP.h"
+#include "HAPPlatformPersistedState+Init.h"
 
 #include "App.h"
 #include "DB.h"
+#if CONFIG_HAP_DIAGNOSTICS
+#include "HAPPlatformDiagnostics+Init.h"
+#endif
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
@@ -53,9 +57,10 @@
 typedef struct {
     struct {
         bool lightBulbOn;
-    } state;
+    } state, flushedState;
     HAPAccessoryServerRef* server;
     HAPPlatformKeyValueStoreRef keyValueStore;
+    HAPPlatformPersistedState persistedState;
 } AccessoryConfiguration;
 
 static AccessoryConfiguration accessoryConfiguration;
@@ -97,21 +102,11 @@ static void LoadAccessoryState(void) {
 
 /**
  * Save the accessory state to persistent memory.
+ *
+ * - The state is written once it stopped changing for a while. Unchanged state is not written.
  */
 static void SaveAccessoryState(void) {
-    HAPPrecondition(accessoryConfiguration.keyValueStore);
-
-    HAPError err;
-    err = HAPPlatformKeyValueStoreSet(
-            accessoryConfiguration.keyValueStore,
-            kAppKeyValueStoreDomain_Configuration,
-            kAppKeyValueStoreKey_Configuration_State,
-            &accessoryConfiguration.state,
-            sizeof accessoryConfiguration.state);
-    if (err) {
-        HAPAssert(err == kHAPError_Unknown);
-        HAPFatalError();
-    }
+    HAPPlatformPersistedStateMarkDirty(&accessoryConfiguration.persistedState);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -133,6 +128,9 @@ static HAPAccessory accessory = { .aid = 1,
                                                                             &hapProtocolInformationService,
                                                                             &pairingService,
                                                                             &lightBulbService,
+#if CONFIG_HAP_DIAGNOSTICS
+                                                                            &diagnosticsService,
+#endif
                                                                             NULL },
                                   .callbacks = { .identify = IdentifyAccessory } };
 
@@ -177,6 +175,86 @@ HAPError HandleLightBulbOnWrite(
     return kHAPError_None;
 }
 
+#if CONFIG_HAP_DIAGNOSTICS
+HAP_RESULT_USE_CHECK
+HAPError HandleDiagnosticsUInt32Read(
+        HAPAccessoryServerRef* server HAP_UNUSED,
+        const HAPUInt32CharacteristicReadRequest* request,
+        uint32_t* value,
+        void* _Nullable context HAP_UNUSED) {
+    HAPPlatformDiagnosticsSnapshot snapshot;
+    HAPPlatformDiagnosticsGetSnapshot(&snapshot);
+
+    const HAPUInt32Characteristic* characteristic = request->characteristic;
+    if (characteristic == &diagnosticsFreeInternalHeapCharacteristic) {
+        *value = snapshot.heap.internal.freeBytes;
+    } else if (characteristic == &diagnosticsMinFreeInternalHeapCharacteristic) {
+        *value = snapshot.heap.internal.minFreeBytes;
+    } else if (characteristic == &diagnosticsLargestInternalBlockCharacteristic) {
+        *value = snapshot.heap.internal.largestFreeBlock;
+    } else if (characteristic == &diagnosticsFreeSPIRAMCharacteristic) {
+        *value = snapshot.heap.spiram.freeBytes;
+    } else if (characteristic == &diagnosticsMinFreeSPIRAMCharacteristic) {
+        *value = snapshot.heap.spiram.minFreeBytes;
+    } else if (characteristic == &diagnosticsMainTaskStackCharacteristic) {
+        *value = snapshot.stackHighWaterMarks.mainTask;
+    } else if (characteristic == &diagnosticsTimerTaskStackCharacteristic) {
+        *value = snapshot.stackHighWaterMarks.timerTask;
+    } else if (characteristic == &diagnosticsMDNSTaskStackCharacteristic) {
+        *value = snapshot.stackHighWaterMarks.mdnsTask;
+    } else if (characteristic == &diagnosticsSocketsInUseCharacteristic) {
+        *value = snapshot.sockets.numSocketsInUse;
+    } else {
+        HAPLogError(&kHAPLog_Default, "%s: Unknown characteristic.", __func__);
+        return kHAPError_InvalidState;
+    }
+
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HandleDiagnosticsCountersRead(
+        HAPAccessoryServerRef* server HAP_UNUSED,
+        const HAPStringCharacteristicReadRequest* request HAP_UNUSED,
+        char* value,
+        size_t maxValueBytes,
+        void* _Nullable context HAP_UNUSED) {
+    HAPPlatformDiagnosticsSnapshot snapshot;
+    HAPPlatformDiagnosticsGetSnapshot(&snapshot);
+
+    HAPError err = HAPStringWithFormat(
+            value,
+            maxValueBytes,
+            "wakeups %lu/%lu/%lu max us %lu/%lu/%lu tcp %lu/%lu/%lu +%lu -%lu evicted %lu "
+            "kvs gets %lu hits %lu nvs r %lu w %lu c %lu tasks %lu",
+            (unsigned long) snapshot.runLoop.numTimerWakeups,
+            (unsigned long) snapshot.runLoop.numFileHandleWakeups,
+            (unsigned long) snapshot.runLoop.numLoopbackWakeups,
+            (unsigned long) snapshot.runLoop.maxFileHandleCallbackDuration,
+            (unsigned long) snapshot.runLoop.maxTimerCallbackDuration,
+            (unsigned long) snapshot.runLoop.maxScheduledCallbackDuration,
+            (unsigned long) snapshot.tcpStreamManager.numTCPStreams,
+            (unsigned long) snapshot.tcpStreamManager.maxConcurrentTCPStreams,
+            (unsigned long) snapshot.tcpStreamManager.maxTCPStreams,
+            (unsigned long) snapshot.tcpStreamManager.numAcceptedTCPStreams,
+            (unsigned long) snapshot.tcpStreamManager.numRejectedTCPStreams,
+            (unsigned long) snapshot.tcpStreamManager.numEvictedTCPStreams,
+            (unsigned long) snapshot.keyValueStore.numGets,
+            (unsigned long) snapshot.keyValueStore.numCacheHits,
+            (unsigned long) snapshot.keyValueStore.numNVSReads,
+            (unsigned long) snapshot.keyValueStore.numNVSWrites,
+            (unsigned long) snapshot.keyValueStore.numNVSCommits,
+            (unsigned long) snapshot.numTasks);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&kHAPLog_Default, "%s: Value too long.", __func__);
+        return err;
+    }
+
+    return kHAPError_None;
+}
+#endif
+
 //----------------------------------------------------------------------------------------------------------------------
 
 void AccessoryNotification(
@@ -199,9 +277,18 @@ void AppCreate(HAPAccessoryServerRef* server, HAPPlatformKeyValueStoreRef keyVal
     accessoryConfiguration.server = server;
     accessoryConfiguration.keyValueStore = keyValueStore;
     LoadAccessoryState();
+    HAPPlatformPersistedStateCreate(
+            &accessoryConfiguration.persistedState,
+            &(const HAPPlatformPersistedStateOptions) { .keyValueStore = keyValueStore,
+                                                        .domain = kAppKeyValueStoreDomain_Configuration,
+                                                        .key = kAppKeyValueStoreKey_Configuration_State,
+                                                        .bytes = &accessoryConfiguration.state,
+                                                        .flushedBytes = &accessoryConfiguration.flushedState,
+                                                        .numBytes = sizeof accessoryConfiguration.state });
 }
 
 void AppRelease(void) {
+    HAPPlatformPersistedStateRelease(&accessoryConfiguration.persistedState);
 }
 
 void AppAccessoryServerStart(void) {
@@ -17,6 +17,8 @@
 extern "C" {
 #endif
 
+#include <sdkconfig.h>
+
 #include "HAP.h"
 
 #if __has_feature(nullability)
@@ -52,6 +54,29 @@ HAPError HandleLightBulbOnWrite(
         bool value,
         void* _Nullable context);
 
+#if CONFIG_HAP_DIAGNOSTICS
+/**
+ * Handle read request to a numeric characteristic of the Diagnostics service.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HandleDiagnosticsUInt32Read(
+        HAPAccessoryServerRef* server,
+        const HAPUInt32CharacteristicReadRequest* request,
+        uint32_t* value,
+        void* _Nullable context);
+
+/**
+ * Handle read request to the 'Counters' characteristic of the Diagnostics service.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HandleDiagnosticsCountersRead(
+        HAPAccessoryServerRef* server,
+        const HAPStringCharacteristicReadRequest* request,
+        char* value,
+        size_t maxValueBytes,
+        void* _Nullable context);
+#endif
+
 /**
  * Initialize the application.
  */
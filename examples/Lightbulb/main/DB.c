@@ -5,7 +5,8 @@
 // See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
 
 // This file contains the accessory attribute database that defines the accessory information service, HAP Protocol
-// Information Service, the Pairing service and finally the service signature exposed by the light bulb.
+// Information Service, the Pairing service, the service signature exposed by the light bulb and finally, with
+// CONFIG_HAP_DIAGNOSTICS, the Diagnostics service.
 
 #include "App.h"
 #include "DB.h"
@@ -41,7 +42,26 @@
 #define kIID_LightBulbName             ((uint64_t) 0x0032)
 #define kIID_LightBulbOn               ((uint64_t) 0x0033)
 
+#if CONFIG_HAP_DIAGNOSTICS
+#define kIID_Diagnostics                      ((uint64_t) 0x0040)
+#define kIID_DiagnosticsServiceSignature      ((uint64_t) 0x0041)
+#define kIID_DiagnosticsFreeInternalHeap      ((uint64_t) 0x0042)
+#define kIID_DiagnosticsMinFreeInternalHeap   ((uint64_t) 0x0043)
+#define kIID_DiagnosticsLargestInternalBlock  ((uint64_t) 0x0044)
+#define kIID_DiagnosticsFreeSPIRAM            ((uint64_t) 0x0045)
+#define kIID_DiagnosticsMinFreeSPIRAM         ((uint64_t) 0x0046)
+#define kIID_DiagnosticsMainTaskStack         ((uint64_t) 0x0047)
+#define kIID_DiagnosticsTimerTaskStack        ((uint64_t) 0x0048)
+#define kIID_DiagnosticsMDNSTaskStack         ((uint64_t) 0x0049)
+#define kIID_DiagnosticsSocketsInUse          ((uint64_t) 0x004A)
+#define kIID_DiagnosticsCounters              ((uint64_t) 0x004B)
+#endif
+
+#if CONFIG_HAP_DIAGNOSTICS
+HAP_STATIC_ASSERT(kAttributeCount == 9 + 3 + 5 + 4 + 12, AttributeCount_mismatch);
+#else
 HAP_STATIC_ASSERT(kAttributeCount == 9 + 3 + 5 + 4, AttributeCount_mismatch);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -477,3 +497,349 @@ const HAPService lightBulbService = {
                                                             &lightBulbOnCharacteristic,
                                                             NULL }
 };
+
+#if CONFIG_HAP_DIAGNOSTICS
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Vendor-specific UUID of the Diagnostics service and its characteristics: D1A0xxxx-5A0B-4C2E-9C6E-3D3B6F8C0E10.
+ */
+#define kDiagnosticsUUID(n) \
+    { { 0x10, 0x0E, 0x8C, 0x6F, 0x3B, 0x3D, 0x6E, 0x9C, 0x2E, 0x4C, 0x0B, 0x5A, HAPExpandLittleUInt16(n), 0xA0, 0xD1 } }
+
+static const HAPUUID kServiceType_Diagnostics = kDiagnosticsUUID(0x0001);
+static const HAPUUID kCharacteristicType_DiagnosticsFreeInternalHeap = kDiagnosticsUUID(0x0002);
+static const HAPUUID kCharacteristicType_DiagnosticsMinFreeInternalHeap = kDiagnosticsUUID(0x0003);
+static const HAPUUID kCharacteristicType_DiagnosticsLargestInternalBlock = kDiagnosticsUUID(0x0004);
+static const HAPUUID kCharacteristicType_DiagnosticsFreeSPIRAM = kDiagnosticsUUID(0x0005);
+static const HAPUUID kCharacteristicType_DiagnosticsMinFreeSPIRAM = kDiagnosticsUUID(0x0006);
+static const HAPUUID kCharacteristicType_DiagnosticsMainTaskStack = kDiagnosticsUUID(0x0007);
+static const HAPUUID kCharacteristicType_DiagnosticsTimerTaskStack = kDiagnosticsUUID(0x0008);
+static const HAPUUID kCharacteristicType_DiagnosticsMDNSTaskStack = kDiagnosticsUUID(0x0009);
+static const HAPUUID kCharacteristicType_DiagnosticsSocketsInUse = kDiagnosticsUUID(0x000A);
+static const HAPUUID kCharacteristicType_DiagnosticsCounters = kDiagnosticsUUID(0x000B);
+
+/**
+ * The 'Service Signature' characteristic of the Diagnostics service.
+ */
+static const HAPDataCharacteristic diagnosticsServiceSignatureCharacteristic = {
+    .format = kHAPCharacteristicFormat_Data,
+    .iid = kIID_DiagnosticsServiceSignature,
+    .characteristicType = &kHAPCharacteristicType_ServiceSignature,
+    .debugDescription = kHAPCharacteristicDebugDescription_ServiceSignature,
+    .manufacturerDescription = NULL,
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = true },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .constraints = { .maxLength = 2097152 },
+    .callbacks = { .handleRead = HAPHandleServiceSignatureRead, .handleWrite = NULL }
+};
+
+/**
+ * Free internal heap.
+ */
+const HAPUInt32Characteristic diagnosticsFreeInternalHeapCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsFreeInternalHeap,
+    .characteristicType = &kCharacteristicType_DiagnosticsFreeInternalHeap,
+    .debugDescription = "diagnostics-free-internal-heap",
+    .manufacturerDescription = "Free Internal Heap (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Minimum free internal heap since boot.
+ */
+const HAPUInt32Characteristic diagnosticsMinFreeInternalHeapCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsMinFreeInternalHeap,
+    .characteristicType = &kCharacteristicType_DiagnosticsMinFreeInternalHeap,
+    .debugDescription = "diagnostics-min-free-internal-heap",
+    .manufacturerDescription = "Minimum Free Internal Heap (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Largest free internal heap block.
+ */
+const HAPUInt32Characteristic diagnosticsLargestInternalBlockCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsLargestInternalBlock,
+    .characteristicType = &kCharacteristicType_DiagnosticsLargestInternalBlock,
+    .debugDescription = "diagnostics-largest-internal-block",
+    .manufacturerDescription = "Largest Internal Block (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Free PSRAM.
+ */
+const HAPUInt32Characteristic diagnosticsFreeSPIRAMCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsFreeSPIRAM,
+    .characteristicType = &kCharacteristicType_DiagnosticsFreeSPIRAM,
+    .debugDescription = "diagnostics-free-spiram",
+    .manufacturerDescription = "Free PSRAM (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Minimum free PSRAM since boot.
+ */
+const HAPUInt32Characteristic diagnosticsMinFreeSPIRAMCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsMinFreeSPIRAM,
+    .characteristicType = &kCharacteristicType_DiagnosticsMinFreeSPIRAM,
+    .debugDescription = "diagnostics-min-free-spiram",
+    .manufacturerDescription = "Minimum Free PSRAM (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Stack high-water mark of the main task.
+ */
+const HAPUInt32Characteristic diagnosticsMainTaskStackCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsMainTaskStack,
+    .characteristicType = &kCharacteristicType_DiagnosticsMainTaskStack,
+    .debugDescription = "diagnostics-main-task-stack",
+    .manufacturerDescription = "Main Task Free Stack (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Stack high-water mark of the esp_timer task.
+ */
+const HAPUInt32Characteristic diagnosticsTimerTaskStackCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsTimerTaskStack,
+    .characteristicType = &kCharacteristicType_DiagnosticsTimerTaskStack,
+    .debugDescription = "diagnostics-timer-task-stack",
+    .manufacturerDescription = "esp_timer Task Free Stack (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Stack high-water mark of the mDNS task.
+ */
+const HAPUInt32Characteristic diagnosticsMDNSTaskStackCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsMDNSTaskStack,
+    .characteristicType = &kCharacteristicType_DiagnosticsMDNSTaskStack,
+    .debugDescription = "diagnostics-mdns-task-stack",
+    .manufacturerDescription = "mDNS Task Free Stack (bytes)",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Number of lwIP sockets in use.
+ */
+const HAPUInt32Characteristic diagnosticsSocketsInUseCharacteristic = {
+    .format = kHAPCharacteristicFormat_UInt32,
+    .iid = kIID_DiagnosticsSocketsInUse,
+    .characteristicType = &kCharacteristicType_DiagnosticsSocketsInUse,
+    .debugDescription = "diagnostics-sockets-in-use",
+    .manufacturerDescription = "Sockets In Use",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .units = kHAPCharacteristicUnits_None,
+    .constraints = { .minimumValue = 0,
+                     .maximumValue = UINT32_MAX,
+                     .stepValue = 1 },
+    .callbacks = { .handleRead = HandleDiagnosticsUInt32Read, .handleWrite = NULL }
+};
+
+/**
+ * Run loop, TCP stream and key-value store counters, as one line of text:
+ *
+ * - wakeups: timer / file handle / loopback.
+ * - max us: longest file handle / timer / scheduled callback.
+ * - tcp: open / most open at once / limit, +accepted, -rejected, evicted.
+ * - kvs: gets, cache hits, NVS reads, writes and commits.
+ *
+ * All values fit into the maximum length even with 10 digits each.
+ */
+const HAPStringCharacteristic diagnosticsCountersCharacteristic = {
+    .format = kHAPCharacteristicFormat_String,
+    .iid = kIID_DiagnosticsCounters,
+    .characteristicType = &kCharacteristicType_DiagnosticsCounters,
+    .debugDescription = "diagnostics-counters",
+    .manufacturerDescription = "Counters",
+    .properties = { .readable = true,
+                    .writable = false,
+                    .supportsEventNotification = false,
+                    .hidden = false,
+                    .requiresTimedWrite = false,
+                    .supportsAuthorizationData = false,
+                    .ip = { .controlPoint = false, .supportsWriteResponse = false },
+                    .ble = { .supportsBroadcastNotification = false,
+                             .supportsDisconnectedNotification = false,
+                             .readableWithoutSecurity = false,
+                             .writableWithoutSecurity = false } },
+    .constraints = { .maxLength = 256 },
+    .callbacks = { .handleRead = HandleDiagnosticsCountersRead, .handleWrite = NULL }
+};
+
+/**
+ * The Diagnostics service that exposes the heap, stack and socket usage of the accessory.
+ *
+ * - Hidden, so that it is not shown in the Home app. Third-party HomeKit apps still list and read it.
+ */
+const HAPService diagnosticsService = {
+    .iid = kIID_Diagnostics,
+    .serviceType = &kServiceType_Diagnostics,
+    .debugDescription = "diagnostics",
+    .name = NULL,
+    .properties = { .primaryService = false, .hidden = true, .ble = { .supportsConfiguration = false } },
+    .linkedServices = NULL,
+    .characteristics = (const HAPCharacteristic* const[]) { &diagnosticsServiceSignatureCharacteristic,
+                                                            &diagnosticsFreeInternalHeapCharacteristic,
+                                                            &diagnosticsMinFreeInternalHeapCharacteristic,
+                                                            &diagnosticsLargestInternalBlockCharacteristic,
+                                                            &diagnosticsFreeSPIRAMCharacteristic,
+                                                            &diagnosticsMinFreeSPIRAMCharacteristic,
+                                                            &diagnosticsMainTaskStackCharacteristic,
+                                                            &diagnosticsTimerTaskStackCharacteristic,
+                                                            &diagnosticsMDNSTaskStackCharacteristic,
+                                                            &diagnosticsSocketsInUseCharacteristic,
+                                                            &diagnosticsCountersCharacteristic,
+                                                            NULL }
+};
+#endif
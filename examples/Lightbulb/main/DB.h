@@ -14,6 +14,8 @@
 extern "C" {
 #endif
 
+#include <sdkconfig.h>
+
 #include "HAP.h"
 
 #if __has_feature(nullability)
@@ -23,7 +25,11 @@ extern "C" {
 /**
  * Total number of services and characteristics contained in the accessory.
  */
+#if CONFIG_HAP_DIAGNOSTICS
+#define kAttributeCount ((size_t) 33)
+#else
 #define kAttributeCount ((size_t) 21)
+#endif
 
 /**
  * HomeKit Accessory Information service.
@@ -62,6 +68,27 @@ extern const HAPService lightBulbService;
  */
 extern const HAPBoolCharacteristic lightBulbOnCharacteristic;
 
+#if CONFIG_HAP_DIAGNOSTICS
+/**
+ * Diagnostics service.
+ */
+extern const HAPService diagnosticsService;
+
+/**
+ * Characteristics to expose the diagnostics snapshot (associated with Diagnostics service).
+ */
+extern const HAPUInt32Characteristic diagnosticsFreeInternalHeapCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsMinFreeInternalHeapCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsLargestInternalBlockCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsFreeSPIRAMCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsMinFreeSPIRAMCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsMainTaskStackCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsTimerTaskStackCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsMDNSTaskStackCharacteristic;
+extern const HAPUInt32Characteristic diagnosticsSocketsInUseCharacteristic;
+extern const HAPStringCharacteristic diagnosticsCountersCharacteristic;
+#endif
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
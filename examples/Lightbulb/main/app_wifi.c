@@ -44,15 +44,14 @@ void app_wifi_init(void)
 {
     esp_event_loop_create_default();
     ESP_ERROR_CHECK(esp_netif_init());
+}
 
+esp_err_t app_wifi_connect(void)
+{
     esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-}
-
-esp_err_t app_wifi_connect(void)
-{
 
     esp_event_handler_instance_t instance_any_id;
     esp_event_handler_instance_t instance_got_ip;
@@ -25,14 +25,12 @@
 //
 //   6. Callbacks that notify the server in case their associated value has changed.
 
-#define VOLTS       5
-#define MILLIAMPS   3300
-#define LED_PIN     12 // TODO: Why does naming this DATA_PIN cause compile errors?
-#define NUM_LEDS    84
+#define VOLTS       CONFIG_EXAMPLE_POWER_VOLTS
+#define MILLIAMPS   CONFIG_EXAMPLE_POWER_MILLIAMPS
 #define LED_TYPE    WS2812B
 #define COLOR_ORDER GRB
 
-#define STEP 5 // Granuality to change patterns
+#define STEP 5 // Granuality of the identify routine
 #define FPS  60
 
 #define HUE_DEFAULT        125 // TODO: Use Kconfig.projbuild for these
@@ -49,16 +47,71 @@
 
 #include "esp_err.h"
 #include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <atomic>
 #include <unistd.h>
 
 #include "FastLED.h"
 #include "HAP.h"
+#include "HAPPlatformEventCoalescer+Init.h"
+#include "HAPPlatformPersistedState+Init.h"
 
 #include "App.h"
 #include "DB.h"
+#include "Effects.h"
+#include "Renderer.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+/**
+ * Number of LEDs of the segments. 0 for segments that are not configured.
+ */
+/**@{*/
+#define SEGMENT1_NUM_LEDS CONFIG_EXAMPLE_SEGMENT1_NUM_LEDS
+#if CONFIG_EXAMPLE_NUM_SEGMENTS >= 2
+#define SEGMENT2_NUM_LEDS CONFIG_EXAMPLE_SEGMENT2_NUM_LEDS
+#else
+#define SEGMENT2_NUM_LEDS 0
+#endif
+#if CONFIG_EXAMPLE_NUM_SEGMENTS >= 3
+#define SEGMENT3_NUM_LEDS CONFIG_EXAMPLE_SEGMENT3_NUM_LEDS
+#else
+#define SEGMENT3_NUM_LEDS 0
+#endif
+#if CONFIG_EXAMPLE_NUM_SEGMENTS >= 4
+#define SEGMENT4_NUM_LEDS CONFIG_EXAMPLE_SEGMENT4_NUM_LEDS
+#else
+#define SEGMENT4_NUM_LEDS 0
+#endif
+/**@}*/
+
+/**
+ * Total number of LEDs. The segments are rendered as one continuous strip.
+ */
+#define NUM_LEDS (SEGMENT1_NUM_LEDS + SEGMENT2_NUM_LEDS + SEGMENT3_NUM_LEDS + SEGMENT4_NUM_LEDS)
+
+/**
+ * Duration of a transition to a new color or brightness in microseconds.
+ */
+#define kAppTransitionDuration ((uint32_t) CONFIG_EXAMPLE_TRANSITION_DURATION * 1000)
+
+/**
+ * Effect rendered across the strip.
+ */
+#if CONFIG_EXAMPLE_EFFECT_GRADIENT
+#define kAppEffect kEffectType_Gradient
+#elif CONFIG_EXAMPLE_EFFECT_CHASE
+#define kAppEffect kEffectType_Chase
+#else
+#define kAppEffect kEffectType_Solid
+#endif
+
+/**
+ * Maximum number of attempts to copy the displayed state before the previous copy is used.
+ */
+#define kAppMaxSnapshotReadAttempts ((size_t) 8)
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
@@ -93,119 +146,63 @@ typedef struct {
     struct {
         lightstrip current;
         lightstrip target;
-    } state;
+    } state, flushedState;
     HAPAccessoryServerRef* server;
     HAPPlatformKeyValueStoreRef keyValueStore;
+    HAPPlatformEventCoalescer eventCoalescer;
+    HAPPlatformPersistedState persistedState;
 } AccessoryConfiguration;
 
 static AccessoryConfiguration accessoryConfiguration;
 
-CRGB leds[NUM_LEDS];
-esp_timer_handle_t periodic_timer;
-// Dynamically calculated, inversely proprotional
-// to saturation.
-uint8_t max_brightness = MAX_BRIGHTNESS_COLOR;
-
-// Forward declared. TODO: Better way to do this?
-static void SaveAccessoryState(void);
-
-//----------------------------------------------------------------------------------------------------------------------
-
 /**
- * Attempt to start the timer if it is not already going.
- */
-void update() {
-    esp_err_t err;
-    err = esp_timer_start_periodic(periodic_timer, 1000000 / FPS);
-    // ESP_ERR_INVALID_STATE if the timer is already running
-    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
-        ESP_ERROR_CHECK(err);
-    }
-}
-
-/**
- * Smoothly blend towards target
+ * Lightstrip state that is published by one task and read by another, protected by a sequence lock.
+ *
+ * - The sequence is odd while the state is being written. Readers retry or keep their previous copy if the
+ *   sequence was odd or changed while they copied the state.
  */
-void nblendU8TowardU8(uint8_t& current, const uint8_t target) {
-    if (current == target) {
-        return;
-    }
-
-    uint8_t direction = 0;
-
-    if (current < target) {
-        if (target - current <= 180) {
-            direction = 1;
-        } else {
-            direction = -1;
-        }
-    } else {
-        if (current - target <= 180) {
-            direction = -1;
-        } else {
-            direction = 1;
-        }
-    }
-
-    if (current < target) {
-        uint8_t delta = target - current;
-        delta = scale8_video(delta, STEP);
-        current += delta * direction;
-    } else {
-        uint8_t delta = current - target;
-        delta = scale8_video(delta, STEP);
-        current += delta * direction;
-    }
-}
+typedef struct {
+    std::atomic<uint32_t> sequence;
+    lightstrip state;
+} LightstripSnapshot;
 
 /**
- * Callback to blend current LEDs towards target LEDs.
+ * Animation state. Owned by the timer callback, except for the snapshots and the last read displayed state.
  */
-void periodic_timer_callback(void* arg) {
-    // Adjust to the correct brightness if the lightstrip was turned on/off
-    if (accessoryConfiguration.state.current.on != accessoryConfiguration.state.target.on) {
-        uint8_t current_brightness = accessoryConfiguration.state.current.brightness;
-        uint8_t target_brightness = accessoryConfiguration.state.target.brightness;
-
-        if (accessoryConfiguration.state.target.on) {
-            if (target_brightness >= current_brightness) {
-                if (target_brightness - current_brightness < STEP) {
-                    current_brightness = target_brightness;
-                    accessoryConfiguration.state.current.on = true;
-                } else {
-                    current_brightness += STEP;
-                }
-            }
-        } else {
-            if (current_brightness >= target_brightness) {
-                if (current_brightness - target_brightness < STEP) {
-                    current_brightness = target_brightness;
-                    accessoryConfiguration.state.current.on = false;
-                } else {
-                    current_brightness -= STEP;
-                }
-            }
-        }
-        accessoryConfiguration.state.current.brightness = current_brightness;
-        FastLED.setBrightness(max_brightness * current_brightness / UINT8_MAX);
-    } else {
-        nblendU8TowardU8(accessoryConfiguration.state.current.led.val, accessoryConfiguration.state.target.led.val);
-        FastLED.setBrightness(max_brightness * accessoryConfiguration.state.current.led.val / UINT8_MAX);
-    }
-
-    nblendU8TowardU8(accessoryConfiguration.state.current.led.hue, accessoryConfiguration.state.target.led.hue);
-    nblendU8TowardU8(accessoryConfiguration.state.current.led.sat, accessoryConfiguration.state.target.led.sat);
-
-    fill_solid(leds, NUM_LEDS, accessoryConfiguration.state.current.led);
-    FastLED.show();
-
-    if (accessoryConfiguration.state.current.led == accessoryConfiguration.state.target.led &&
-        accessoryConfiguration.state.current.on == accessoryConfiguration.state.target.on) {
-        ESP_ERROR_CHECK(esp_timer_stop(periodic_timer));
-        // After an effect is done, save the state.
-        SaveAccessoryState();
-    }
-}
+static struct {
+    /**
+     * Target state, published by the HAP handlers.
+     */
+    LightstripSnapshot targetSnapshot;
+
+    /**
+     * Displayed state, published by the timer callback.
+     */
+    LightstripSnapshot currentSnapshot;
+
+    /**
+     * Last consistent copy of the displayed state. Owned by the run loop.
+     */
+    lightstrip lastReadCurrent;
+
+    lightstrip target;
+    uint32_t targetSequence;
+    lightstrip current;
+
+    /**
+     * Transition from the displayed color to the target color.
+     */
+    EffectsTransition transition;
+
+    /**
+     * Color that is displayed. The value is the output level, 0 while off.
+     */
+    CHSV displayedColor;
+} animation;
+
+// Frame that is composed by the effects and submitted to the renderer. Owned by the timer callback.
+CRGB leds[NUM_LEDS];
+esp_timer_handle_t periodic_timer;
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -256,21 +253,178 @@ static void LoadAccessoryState(void) {
 
 /**
  * Save the accessory state to persistent memory.
+ *
+ * - The state is written once it stopped changing for a while. Unchanged state is not written.
  */
 static void SaveAccessoryState(void) {
-    HAPPrecondition(accessoryConfiguration.keyValueStore);
+    HAPPlatformPersistedStateMarkDirty(&accessoryConfiguration.persistedState);
+}
 
-    HAPError err;
-    err = HAPPlatformKeyValueStoreSet(
-            accessoryConfiguration.keyValueStore,
-            kAppKeyValueStoreDomain_Configuration,
-            kAppKeyValueStoreKey_Configuration_State,
-            &accessoryConfiguration.state,
-            sizeof accessoryConfiguration.state);
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Publishes a state. Only one task may publish into a snapshot.
+ */
+static void PublishSnapshot(LightstripSnapshot* snapshot, const lightstrip& state) {
+    uint32_t sequence = snapshot->sequence.load(std::memory_order_relaxed);
+    snapshot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    snapshot->state = state;
+    snapshot->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+/**
+ * Copies a published state without waiting for the publisher.
+ *
+ * @return true                     If a consistent copy was taken.
+ * @return false                    If the state was being published. The copy must be discarded.
+ */
+static bool TryReadSnapshot(const LightstripSnapshot* snapshot, lightstrip* state, uint32_t* sequence) {
+    uint32_t sequenceBefore = snapshot->sequence.load(std::memory_order_acquire);
+    if (sequenceBefore & 1) {
+        return false;
+    }
+    *state = snapshot->state;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    *sequence = sequenceBefore;
+    return snapshot->sequence.load(std::memory_order_relaxed) == sequenceBefore;
+}
+
+/**
+ * Copies the displayed state. Called on the run loop.
+ *
+ * - If the timer callback is publishing during every attempt, e.g. because it was preempted while publishing,
+ *   the state of the previous successful call is returned.
+ */
+static lightstrip ReadCurrentState(void) {
+    lightstrip state;
+    uint32_t sequence;
+    for (size_t i = 0; i < kAppMaxSnapshotReadAttempts; i++) {
+        if (TryReadSnapshot(&animation.currentSnapshot, &state, &sequence)) {
+            animation.lastReadCurrent = state;
+            return state;
+        }
+        taskYIELD();
+    }
+    return animation.lastReadCurrent;
+}
+
+/**
+ * Publishes the target state and attempts to start the timer if it is not already going.
+ *
+ * - The timer callback transitions from the displayed color to the new target.
+ */
+void update() {
+    PublishSnapshot(&animation.targetSnapshot, accessoryConfiguration.state.target);
+
+    esp_err_t err;
+    err = esp_timer_start_periodic(periodic_timer, 1000000 / FPS);
+    // ESP_ERR_INVALID_STATE if the timer is already running
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+}
+
+/**
+ * Color of a lightstrip state. The value is the output level, 0 while off.
+ */
+static CHSV GetOutputColor(const lightstrip& state) {
+    return CHSV(state.led.hue, state.led.sat, state.on ? state.led.val : 0);
+}
+
+/**
+ * Brightness at full level. White isn't able to get as bright as colors, so the maximum follows the saturation.
+ */
+static uint8_t GetMaxBrightness(uint8_t saturation) {
+    return MAX_BRIGHTNESS_WHITE + saturation * (MAX_BRIGHTNESS_COLOR - MAX_BRIGHTNESS_WHITE) / UINT8_MAX;
+}
+
+/**
+ * Renders the displayed color with the effect of the strip.
+ */
+static void Render(int64_t now) {
+    // The renderer outputs the frame on its own task and skips it if nothing changed.
+    EffectsRender(kAppEffect, animation.displayedColor, now, leds);
+    RendererSubmit(
+            leds,
+            EffectsGetBrightness(animation.displayedColor.val, GetMaxBrightness(animation.displayedColor.sat)));
+}
+
+/**
+ * Saves the displayed state after an effect is done. Called on the run loop.
+ */
+static void HandleEffectDone(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    accessoryConfiguration.state.current = ReadCurrentState();
+    SaveAccessoryState();
+}
+
+/**
+ * Callback to move the displayed color towards the target, and to animate the effect.
+ */
+void periodic_timer_callback(void* arg) {
+    int64_t now = esp_timer_get_time();
+
+    // If the target is being published right now, it is picked up in the next frame.
+    lightstrip target;
+    uint32_t targetSequence;
+    if (TryReadSnapshot(&animation.targetSnapshot, &target, &targetSequence) &&
+        targetSequence != animation.targetSequence) {
+        animation.target = target;
+        animation.targetSequence = targetSequence;
+        EffectsTransitionStart(
+                &animation.transition,
+                animation.displayedColor,
+                GetOutputColor(animation.target),
+                now,
+                kAppTransitionDuration);
+    }
+    bool isDone = EffectsTransitionGetColor(&animation.transition, now, &animation.displayedColor);
+
+    lightstrip* current = &animation.current;
+    if (isDone) {
+        *current = animation.target;
+    } else {
+        current->led.hue = animation.displayedColor.hue;
+        current->led.sat = animation.displayedColor.sat;
+        current->brightness = animation.displayedColor.val;
+        if (animation.target.on) {
+            current->led.val = animation.displayedColor.val;
+        }
+    }
+    PublishSnapshot(&animation.currentSnapshot, *current);
+    Render(now);
+
+    // Animated effects keep running while the strip is on.
+    if (!isDone || (current->on && EffectsIsAnimated(kAppEffect))) {
+        return;
+    }
+
+    // A target that was published before the timer stopped would be lost, so check again afterwards.
+    ESP_ERROR_CHECK(esp_timer_stop(periodic_timer));
+    if (animation.targetSnapshot.sequence.load(std::memory_order_acquire) != animation.targetSequence) {
+        ESP_ERROR_CHECK(esp_timer_start_periodic(periodic_timer, 1000000 / FPS));
+        return;
+    }
+
+    // After an effect is done, save the state.
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleEffectDone, NULL, 0);
     if (err) {
-        HAPAssert(err == kHAPError_Unknown);
-        HAPFatalError();
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&kHAPLog_Default, "Cannot schedule saving the state.");
     }
+
+    RendererStatistics statistics;
+    RendererTakeStatistics(&statistics);
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "Effect done: %lu frames rendered, %lu skipped, %lu dropped; frame time avg %lu us, max %lu us.",
+            (unsigned long) statistics.numRenderedFrames,
+            (unsigned long) statistics.numSkippedFrames,
+            (unsigned long) statistics.numDroppedFrames,
+            (unsigned long) (statistics.numRenderedFrames ?
+                                     statistics.totalFrameTime / statistics.numRenderedFrames :
+                                     0),
+            (unsigned long) statistics.maxFrameTime);
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -304,31 +458,33 @@ HAPError IdentifyAccessory(
         void* _Nullable context HAP_UNUSED) {
     HAPLogInfo(&kHAPLog_Default, "%s", __func__);
 
-    uint8_t brightness = accessoryConfiguration.state.current.brightness;
+    // Identify composes its own frame, as the frame of the timer callback may change concurrently.
+    static CRGB identifyLeds[NUM_LEDS];
+    lightstrip current = ReadCurrentState();
+    uint8_t max_brightness = GetMaxBrightness(current.led.sat);
+    EffectsRender(kEffectType_Solid, current.led, 0, identifyLeds);
+
+    uint8_t brightness = current.brightness;
 
     // Flash the lights to max, then zero, then original to identify
     while (brightness < UINT8_MAX) {
-        FastLED.setBrightness(max_brightness * brightness / UINT8_MAX);
-        FastLED.show();
+        RendererSubmit(identifyLeds, max_brightness * brightness / UINT8_MAX);
         usleep(1000000 / FPS);
         brightness += STEP;
     }
     brightness -= STEP;
     while (brightness > 0) {
-        FastLED.setBrightness(max_brightness * brightness / UINT8_MAX);
-        FastLED.show();
+        RendererSubmit(identifyLeds, max_brightness * brightness / UINT8_MAX);
         usleep(1000000 / FPS);
         brightness -= STEP;
     }
     brightness += STEP;
-    while (brightness < accessoryConfiguration.state.current.brightness) {
-        FastLED.setBrightness(max_brightness * brightness / UINT8_MAX);
-        FastLED.show();
+    while (brightness < current.brightness) {
+        RendererSubmit(identifyLeds, max_brightness * brightness / UINT8_MAX);
         usleep(1000000 / FPS);
         brightness += STEP;
     }
-    FastLED.setBrightness(max_brightness * accessoryConfiguration.state.current.brightness / UINT8_MAX);
-    FastLED.show();
+    RendererSubmit(identifyLeds, EffectsGetBrightness(GetOutputColor(current).val, max_brightness));
 
     return kHAPError_None;
 }
@@ -339,7 +495,7 @@ HAPError HandleLightBulbOnRead(
         const HAPBoolCharacteristicReadRequest* request HAP_UNUSED,
         bool* value,
         void* _Nullable context HAP_UNUSED) {
-    *value = accessoryConfiguration.state.current.on;
+    *value = ReadCurrentState().on;
     HAPLogInfo(&kHAPLog_Default, "%s: %s", __func__, *value ? "true" : "false");
 
     return kHAPError_None;
@@ -347,7 +503,7 @@ HAPError HandleLightBulbOnRead(
 
 HAP_RESULT_USE_CHECK
 HAPError HandleLightBulbOnWrite(
-        HAPAccessoryServerRef* server,
+        HAPAccessoryServerRef* server HAP_UNUSED,
         const HAPBoolCharacteristicWriteRequest* request,
         bool value,
         void* _Nullable context HAP_UNUSED) {
@@ -362,7 +518,8 @@ HAPError HandleLightBulbOnWrite(
         }
 
         update();
-        HAPAccessoryServerRaiseEvent(server, request->characteristic, request->service, request->accessory);
+        HAPPlatformEventCoalescerRaiseEvent(
+                &accessoryConfiguration.eventCoalescer, request->characteristic, request->service, request->accessory);
     }
 
     return kHAPError_None;
@@ -375,7 +532,7 @@ HAPError HandleLightBulbHueRead(
         float* value,
         void* _Nullable context HAP_UNUSED) {
     // HomeKit value is 0-360, FastLED is 0-255
-    *value = (accessoryConfiguration.state.current.led.hue * 360) / 255;
+    *value = (ReadCurrentState().led.hue * 360) / 255;
     HAPLogInfo(&kHAPLog_Default, "%s: %g", __func__, *value);
 
     return kHAPError_None;
@@ -383,7 +540,7 @@ HAPError HandleLightBulbHueRead(
 
 HAP_RESULT_USE_CHECK
 HAPError HandleLightBulbHueWrite(
-        HAPAccessoryServerRef* server,
+        HAPAccessoryServerRef* server HAP_UNUSED,
         const HAPFloatCharacteristicWriteRequest* request,
         float value,
         void* _Nullable context HAP_UNUSED) {
@@ -396,7 +553,8 @@ HAPError HandleLightBulbHueWrite(
         accessoryConfiguration.state.target.led.hue = value;
 
         update();
-        HAPAccessoryServerRaiseEvent(server, request->characteristic, request->service, request->accessory);
+        HAPPlatformEventCoalescerRaiseEvent(
+                &accessoryConfiguration.eventCoalescer, request->characteristic, request->service, request->accessory);
     }
 
     return kHAPError_None;
@@ -409,7 +567,7 @@ HAPError HandleLightBulbSaturationRead(
         float* value,
         void* _Nullable context HAP_UNUSED) {
     // HomeKit value is 0-100, FastLED is 0-255
-    *value = (accessoryConfiguration.state.current.led.saturation * 100) / 255;
+    *value = (ReadCurrentState().led.saturation * 100) / 255;
     HAPLogInfo(&kHAPLog_Default, "%s: %g", __func__, *value);
 
     return kHAPError_None;
@@ -417,7 +575,7 @@ HAPError HandleLightBulbSaturationRead(
 
 HAP_RESULT_USE_CHECK
 HAPError HandleLightBulbSaturationWrite(
-        HAPAccessoryServerRef* server,
+        HAPAccessoryServerRef* server HAP_UNUSED,
         const HAPFloatCharacteristicWriteRequest* request,
         float value,
         void* _Nullable context HAP_UNUSED) {
@@ -426,14 +584,12 @@ HAPError HandleLightBulbSaturationWrite(
     // HomeKit value is 0-100, FastLED is 0-255
     value = (value * 255) / 100;
 
-    // Recalculate the maximum brightness based on the current saturation value
-    max_brightness = MAX_BRIGHTNESS_WHITE + (value / 255) * (MAX_BRIGHTNESS_COLOR - MAX_BRIGHTNESS_WHITE);
-
     if (accessoryConfiguration.state.target.led.saturation != value) {
         accessoryConfiguration.state.target.led.saturation = value;
 
         update();
-        HAPAccessoryServerRaiseEvent(server, request->characteristic, request->service, request->accessory);
+        HAPPlatformEventCoalescerRaiseEvent(
+                &accessoryConfiguration.eventCoalescer, request->characteristic, request->service, request->accessory);
     }
 
     return kHAPError_None;
@@ -446,7 +602,7 @@ HAPError HandleLightBulbBrightnessRead(
         int* value,
         void* _Nullable context HAP_UNUSED) {
     // HomeKit value is 0-100, FastLED is 0-255
-    *value = (accessoryConfiguration.state.current.led.value * 100) / 255;
+    *value = (ReadCurrentState().led.value * 100) / 255;
     HAPLogInfo(&kHAPLog_Default, "%s: %d", __func__, *value);
 
     return kHAPError_None;
@@ -454,7 +610,7 @@ HAPError HandleLightBulbBrightnessRead(
 
 HAP_RESULT_USE_CHECK
 HAPError HandleLightBulbBrightnessWrite(
-        HAPAccessoryServerRef* server,
+        HAPAccessoryServerRef* server HAP_UNUSED,
         const HAPIntCharacteristicWriteRequest* request,
         int value,
         void* _Nullable context HAP_UNUSED) {
@@ -468,7 +624,8 @@ HAPError HandleLightBulbBrightnessWrite(
         accessoryConfiguration.state.target.brightness = value;
 
         update();
-        HAPAccessoryServerRaiseEvent(server, request->characteristic, request->service, request->accessory);
+        HAPPlatformEventCoalescerRaiseEvent(
+                &accessoryConfiguration.eventCoalescer, request->characteristic, request->service, request->accessory);
     }
 
     return kHAPError_None;
@@ -496,18 +653,36 @@ void AppCreate(HAPAccessoryServerRef* server, HAPPlatformKeyValueStoreRef keyVal
     accessoryConfiguration.server = server;
     accessoryConfiguration.keyValueStore = keyValueStore;
     LoadAccessoryState();
-
-    FastLED.setBrightness(max_brightness * accessoryConfiguration.state.current.led.value / UINT8_MAX);
-
-    if (accessoryConfiguration.state.current.on) {
-        fill_solid(
-                leds,
-                NUM_LEDS,
-                CHSV(accessoryConfiguration.state.current.led.hue,
-                     accessoryConfiguration.state.current.led.saturation,
-                     accessoryConfiguration.state.current.led.value));
-        FastLED.show();
-    }
+    const HAPPlatformPersistedStateOptions persistedStateOptions = {
+        .keyValueStore = keyValueStore,
+        .domain = kAppKeyValueStoreDomain_Configuration,
+        .key = kAppKeyValueStoreKey_Configuration_State,
+        .bytes = &accessoryConfiguration.state,
+        .flushedBytes = &accessoryConfiguration.flushedState,
+        .numBytes = sizeof accessoryConfiguration.state,
+        .quietPeriod = 0,
+        .maxDelay = 0
+    };
+    HAPPlatformPersistedStateCreate(&accessoryConfiguration.persistedState, &persistedStateOptions);
+
+    // Dragging the color wheel changes hue, saturation and brightness many times per second.
+    // Merge those events. Switching the light on or off is always reported immediately.
+    static const HAPCharacteristic* const exemptCharacteristics[] = { &lightBulbOnCharacteristic, NULL };
+    const HAPPlatformEventCoalescerOptions eventCoalescerOptions = { .server = server,
+                                                                     .window = 0,
+                                                                     .exemptCharacteristics = exemptCharacteristics };
+    HAPPlatformEventCoalescerCreate(&accessoryConfiguration.eventCoalescer, &eventCoalescerOptions);
+
+    // The timer callback starts from the loaded state.
+    PublishSnapshot(&animation.targetSnapshot, accessoryConfiguration.state.target);
+    PublishSnapshot(&animation.currentSnapshot, accessoryConfiguration.state.current);
+    animation.lastReadCurrent = accessoryConfiguration.state.current;
+    animation.target = accessoryConfiguration.state.target;
+    animation.targetSequence = animation.targetSnapshot.sequence.load(std::memory_order_relaxed);
+    animation.current = accessoryConfiguration.state.current;
+    animation.displayedColor = GetOutputColor(animation.current);
+    EffectsTransitionStart(&animation.transition, animation.displayedColor, animation.displayedColor, 0, 0);
+    Render(esp_timer_get_time());
 
     const esp_timer_create_args_t periodic_timer_args = { .callback = &periodic_timer_callback,
                                                           .arg = NULL,
@@ -515,10 +690,22 @@ void AppCreate(HAPAccessoryServerRef* server, HAPPlatformKeyValueStoreRef keyVal
                                                           .name = "periodic",
                                                           .skip_unhandled_events = true };
     ESP_ERROR_CHECK(esp_timer_create(&periodic_timer_args, &periodic_timer));
+
+    if (accessoryConfiguration.state.current.on && EffectsIsAnimated(kAppEffect)) {
+        update();
+    }
 }
 
 void AppRelease(void) {
+    // Stop a running effect, as it saves the state when done.
+    // ESP_ERR_INVALID_STATE if the timer is not running.
+    (void) esp_timer_stop(periodic_timer);
+    ESP_ERROR_CHECK(esp_timer_delete(periodic_timer));
+
+    HAPPlatformEventCoalescerRelease(&accessoryConfiguration.eventCoalescer);
+    accessoryConfiguration.state.current = ReadCurrentState();
     SaveAccessoryState();
+    HAPPlatformPersistedStateRelease(&accessoryConfiguration.persistedState);
 }
 
 void AppAccessoryServerStart(void) {
@@ -557,9 +744,39 @@ void AppInitialize(
         HAPPlatform* hapPlatform,
         HAPAccessoryServerCallbacks* hapAccessoryServerCallbacks) {
     set_max_power_in_volts_and_milliamps(VOLTS, MILLIAMPS);
-    FastLED.addLeds<LED_TYPE, LED_PIN, COLOR_ORDER>(leds, NUM_LEDS).setCorrection(TypicalLEDStrip);
+
+    // The data pin is a template parameter of the FastLED controllers, so each segment is added separately.
+    RendererSegment segments[kRenderer_MaxSegments];
+    size_t numSegments = 0;
+    CRGB* pixels = leds;
+#define ADD_SEGMENT(n) \
+    do { \
+        segments[numSegments].controller = \
+                &FastLED.addLeds<LED_TYPE, CONFIG_EXAMPLE_SEGMENT##n##_PIN, COLOR_ORDER>( \
+                                pixels, CONFIG_EXAMPLE_SEGMENT##n##_NUM_LEDS) \
+                         .setCorrection(TypicalLEDStrip); \
+        segments[numSegments].numPixels = CONFIG_EXAMPLE_SEGMENT##n##_NUM_LEDS; \
+        segments[numSegments].maxPower = (uint32_t) VOLTS * CONFIG_EXAMPLE_SEGMENT##n##_MILLIAMPS; \
+        pixels += CONFIG_EXAMPLE_SEGMENT##n##_NUM_LEDS; \
+        numSegments++; \
+    } while (0)
+    ADD_SEGMENT(1);
+#if CONFIG_EXAMPLE_NUM_SEGMENTS >= 2
+    ADD_SEGMENT(2);
+#endif
+#if CONFIG_EXAMPLE_NUM_SEGMENTS >= 3
+    ADD_SEGMENT(3);
+#endif
+#if CONFIG_EXAMPLE_NUM_SEGMENTS >= 4
+    ADD_SEGMENT(4);
+#endif
+#undef ADD_SEGMENT
+
+    RendererCreate(segments, numSegments);
+    EffectsCreate(NUM_LEDS);
 }
 
 void AppDeinitialize() {
-    /*no-op*/
+    EffectsRelease();
+    RendererRelease();
 }
@@ -0,0 +1,182 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+
+// Time-based effect engine of the Lightstrip example.
+
+#define FASTLED_INTERNAL // Disable "No hardware SPI pins defined.  All SPI
+                         // access will default to bitbanged output" message
+
+#include <math.h>
+
+#include <esp_heap_caps.h>
+
+#include "Effects.h"
+
+/**
+ * Gamma of the global brightness.
+ */
+#define kEffects_Gamma 2.2f
+
+/**
+ * Hue range covered by the gradient effect.
+ */
+#define kEffects_GradientHueSpread 64
+
+/**
+ * Speed of the chase effect in pixels per second.
+ */
+#define kEffects_ChaseSpeed 30
+
+/**
+ * Width of the band of the chase effect in pixels.
+ */
+#define kEffects_ChaseWidth 12
+
+/**
+ * Value of the background of the chase effect.
+ */
+#define kEffects_ChaseBackground 64
+
+static struct {
+    /**
+     * Ease-in-out curve, indexed by the progress of a transition.
+     */
+    uint8_t easeLUT[256];
+
+    /**
+     * Gamma curve, indexed by the output level.
+     */
+    uint8_t gammaLUT[256];
+
+    /**
+     * Per-pixel HSV colors, converted to RGB in one batch.
+     */
+    CHSV* hsvPixels;
+    size_t numPixels;
+} effects;
+
+void EffectsCreate(size_t numPixels) {
+    HAPPrecondition(numPixels);
+
+    for (size_t i = 0; i < 256; i++) {
+        // Cubic ease-in-out.
+        float x = i / 255.0f;
+        float y = x < 0.5f ? 4 * x * x * x : 1 - powf(-2 * x + 2, 3) / 2;
+        effects.easeLUT[i] = (uint8_t) lroundf(y * 255);
+
+        // Levels above 0 stay visible.
+        uint8_t gamma = (uint8_t) lroundf(powf(x, kEffects_Gamma) * 255);
+        effects.gammaLUT[i] = i && !gamma ? 1 : gamma;
+    }
+
+    effects.hsvPixels = (CHSV*) heap_caps_calloc(numPixels, sizeof(CHSV), MALLOC_CAP_INTERNAL);
+    if (!effects.hsvPixels) {
+        HAPLogError(&kHAPLog_Default, "%s: Cannot allocate HSV buffer.", __func__);
+        HAPFatalError();
+    }
+    effects.numPixels = numPixels;
+}
+
+void EffectsRelease(void) {
+    HAPPrecondition(effects.hsvPixels);
+
+    heap_caps_free(effects.hsvPixels);
+    HAPRawBufferZero(&effects, sizeof effects);
+}
+
+void EffectsTransitionStart(
+        EffectsTransition* transition,
+        const CHSV& from,
+        const CHSV& to,
+        int64_t now,
+        uint32_t duration) {
+    HAPPrecondition(transition);
+
+    transition->from = from;
+    transition->to = to;
+    transition->startTime = now;
+    transition->duration = duration;
+}
+
+static uint8_t Interpolate(uint8_t from, uint8_t to, uint8_t ease) {
+    return (uint8_t)(from + ((int) to - from) * ease / 255);
+}
+
+bool EffectsTransitionGetColor(const EffectsTransition* transition, int64_t now, CHSV* color) {
+    HAPPrecondition(transition);
+    HAPPrecondition(color);
+
+    int64_t elapsedTime = now - transition->startTime;
+    if (elapsedTime >= (int64_t) transition->duration) {
+        *color = transition->to;
+        return true;
+    }
+    uint8_t progress = elapsedTime > 0 ? (uint8_t)(elapsedTime * 255 / transition->duration) : 0;
+    uint8_t ease = effects.easeLUT[progress];
+
+    // Hue wraps around, so take the shorter way.
+    int8_t hueDelta = (int8_t)(uint8_t)(transition->to.hue - transition->from.hue);
+    color->hue = (uint8_t)(transition->from.hue + hueDelta * ease / 255);
+    color->sat = Interpolate(transition->from.sat, transition->to.sat, ease);
+    color->val = Interpolate(transition->from.val, transition->to.val, ease);
+    return false;
+}
+
+bool EffectsIsAnimated(EffectType effect) {
+    switch (effect) {
+        case kEffectType_Solid:
+        case kEffectType_Gradient: {
+            return false;
+        }
+        case kEffectType_Chase: {
+            return true;
+        }
+    }
+    HAPFatalError();
+}
+
+void EffectsRender(EffectType effect, const CHSV& color, int64_t now, CRGB* pixels) {
+    HAPPrecondition(effects.hsvPixels);
+    HAPPrecondition(pixels);
+
+    size_t numPixels = effects.numPixels;
+    switch (effect) {
+        case kEffectType_Solid: {
+            // A single conversion is enough.
+            CRGB rgb;
+            hsv2rgb_rainbow(CHSV(color.hue, color.sat, UINT8_MAX), rgb);
+            fill_solid(pixels, (int) numPixels, rgb);
+            return;
+        }
+        case kEffectType_Gradient: {
+            for (size_t i = 0; i < numPixels; i++) {
+                int offset = (int) (i * kEffects_GradientHueSpread / numPixels) - kEffects_GradientHueSpread / 2;
+                effects.hsvPixels[i] = CHSV((uint8_t)(color.hue + offset), color.sat, UINT8_MAX);
+            }
+        } break;
+        case kEffectType_Chase: {
+            // Position of the band in 1/256 pixels, so that it moves smoothly at any frame rate.
+            uint32_t position = (uint32_t)((now * kEffects_ChaseSpeed * 256 / 1000000) % (numPixels * 256));
+            for (size_t i = 0; i < numPixels; i++) {
+                uint32_t distance = (uint32_t)((i * 256 + numPixels * 256 - position) % (numPixels * 256));
+                uint8_t value = kEffects_ChaseBackground;
+                if (distance < kEffects_ChaseWidth * 256) {
+                    // Triangle across the band, shaped by the ease curve.
+                    uint32_t phase = distance * 2 / kEffects_ChaseWidth;
+                    uint8_t ramp = (uint8_t)(phase < 256 ? phase : 511 - phase);
+                    value = (uint8_t)(kEffects_ChaseBackground +
+                                      scale8(UINT8_MAX - kEffects_ChaseBackground, effects.easeLUT[ramp]));
+                }
+                effects.hsvPixels[i] = CHSV(color.hue, color.sat, value);
+            }
+        } break;
+    }
+    hsv2rgb_rainbow(effects.hsvPixels, pixels, (int) numPixels);
+}
+
+uint8_t EffectsGetBrightness(uint8_t level, uint8_t maxBrightness) {
+    return scale8(maxBrightness, effects.gammaLUT[level]);
+}
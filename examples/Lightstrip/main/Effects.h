@@ -0,0 +1,129 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+
+// Time-based effect engine of the Lightstrip example.
+//
+// Transitions interpolate from a start color to a target color over a fixed duration, independent of the frame rate.
+// Easing and gamma are applied through lookup tables that are computed once. Effects render the whole strip in HSV
+// and convert it to RGB in one batch.
+
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include "FastLED.h"
+#include "HAP.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**
+ * Effect that is rendered across the strip.
+ */
+typedef enum {
+    /**
+     * All LEDs show the color.
+     */
+    kEffectType_Solid,
+
+    /**
+     * The hue sweeps along the strip, centered on the color.
+     */
+    kEffectType_Gradient,
+
+    /**
+     * A bright band runs along the strip over a dimmed background of the color.
+     */
+    kEffectType_Chase
+} EffectType;
+
+/**
+ * Transition between two colors. The value of a color is its output level.
+ */
+typedef struct {
+    CHSV from;
+    CHSV to;
+    int64_t startTime;
+    uint32_t duration;
+} EffectsTransition;
+
+/**
+ * Computes the lookup tables and allocates the HSV buffer for a strip.
+ *
+ * @param      numPixels            Number of LEDs of the strip.
+ */
+void EffectsCreate(size_t numPixels);
+
+/**
+ * Frees the HSV buffer.
+ */
+void EffectsRelease(void);
+
+/**
+ * Starts a transition.
+ *
+ * @param[out] transition           Transition.
+ * @param      from                 Color that is displayed now.
+ * @param      to                   Target color.
+ * @param      now                  Current time in microseconds.
+ * @param      duration             Duration of the transition in microseconds.
+ */
+void EffectsTransitionStart(
+        EffectsTransition* transition,
+        const CHSV& from,
+        const CHSV& to,
+        int64_t now,
+        uint32_t duration);
+
+/**
+ * Computes the color of a transition at a point in time.
+ *
+ * - Hue takes the shorter way around the color wheel.
+ *
+ * @param      transition           Transition.
+ * @param      now                  Current time in microseconds.
+ * @param[out] color                Color.
+ *
+ * @return true                     If the transition has reached the target color.
+ * @return false                    Otherwise.
+ */
+bool EffectsTransitionGetColor(const EffectsTransition* transition, int64_t now, CHSV* color);
+
+/**
+ * Returns whether an effect changes over time even when its color does not.
+ *
+ * @param      effect               Effect.
+ *
+ * @return true                     If the effect must be rendered continuously.
+ * @return false                    If the effect only changes with its color.
+ */
+bool EffectsIsAnimated(EffectType effect);
+
+/**
+ * Renders an effect across the strip at full value. The output level is applied through the global brightness.
+ *
+ * @param      effect               Effect.
+ * @param      color                Color. The value is ignored.
+ * @param      now                  Current time in microseconds.
+ * @param[out] pixels               RGB colors of the strip.
+ */
+void EffectsRender(EffectType effect, const CHSV& color, int64_t now, CRGB* pixels);
+
+/**
+ * Maps an output level to the global brightness of the strip, gamma corrected.
+ *
+ * @param      level                Output level.
+ * @param      maxBrightness        Brightness at full level.
+ *
+ * @return Global brightness.
+ */
+uint8_t EffectsGetBrightness(uint8_t level, uint8_t maxBrightness);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#endif
@@ -0,0 +1,243 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+
+// Triple-buffered render pipeline of the Lightstrip example.
+//
+// The front buffer holds the frame that the render task outputs, the pending buffer the latest submitted frame, and
+// the back buffer the frame that is being submitted. Submitting a frame copies it into the back buffer without
+// holding the spinlock. Only swapping the back and pending buffers happens under the spinlock, so the time with
+// interrupts disabled does not grow with the length of the strip. The render task then swaps the pending and front
+// buffers and outputs the new front buffer without holding the lock. On the ESP32, FastLED outputs through the RMT
+// peripheral, whose interrupts are served on the core of the render task. Every segment has its own controller and
+// RMT channel, and FastLED.show() starts all channels before it waits for any of them, so the time to output a frame
+// depends on the longest segment instead of the total number of LEDs.
+
+#define FASTLED_INTERNAL // Disable "No hardware SPI pins defined.  All SPI
+                         // access will default to bitbanged output" message
+
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "Renderer.h"
+
+#if portNUM_PROCESSORS > 1
+#define kRenderer_CoreID ((BaseType_t) CONFIG_EXAMPLE_RENDER_CORE_ID)
+#else
+#define kRenderer_CoreID tskNO_AFFINITY
+#endif
+
+/**
+ * Frame buffer.
+ */
+typedef struct {
+    CRGB* pixels;
+    uint8_t brightness;
+} Frame;
+
+/**
+ * Lock protecting the frame buffer state and the statistics.
+ */
+static portMUX_TYPE rendererLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Render pipeline state.
+ */
+static struct {
+    RendererSegment segments[kRenderer_MaxSegments];
+    size_t numSegments;
+    size_t numPixels;
+    TaskHandle_t task;
+    SemaphoreHandle_t stopSemaphore;
+
+    // Serializes submitters. Only the submitter that holds it writes to the back buffer.
+    SemaphoreHandle_t submitMutex;
+    size_t backIndex;
+
+    // Protected by rendererLock.
+    Frame frames[3];
+    size_t frontIndex;
+    size_t pendingIndex;
+    bool isFramePending;
+    bool hasFrame;
+    bool isStopping;
+    RendererStatistics statistics;
+} renderer;
+
+static bool FramesAreEqual(const Frame* frame, const CRGB* pixels, uint8_t brightness) {
+    return frame->brightness == brightness &&
+           HAPRawBufferAreEqual(frame->pixels, pixels, renderer.numPixels * sizeof pixels[0]);
+}
+
+static void RenderTaskMain(void* _Nullable context HAP_UNUSED) {
+    for (;;) {
+        (void) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&rendererLock);
+        bool isStopping = renderer.isStopping;
+        bool isFramePending = renderer.isFramePending;
+        if (isFramePending) {
+            size_t frontIndex = renderer.frontIndex;
+            renderer.frontIndex = renderer.pendingIndex;
+            renderer.pendingIndex = frontIndex;
+            renderer.isFramePending = false;
+        }
+        portEXIT_CRITICAL(&rendererLock);
+        if (isStopping) {
+            break;
+        }
+        if (!isFramePending) {
+            continue;
+        }
+
+        // Submitters only write the back buffer, so the front buffer is read without the lock.
+        const Frame* frame = &renderer.frames[renderer.frontIndex];
+        int64_t startTime = esp_timer_get_time();
+        uint8_t brightness = frame->brightness;
+        CRGB* pixels = frame->pixels;
+        for (size_t i = 0; i < renderer.numSegments; i++) {
+            const RendererSegment* segment = &renderer.segments[i];
+            segment->controller->setLeds(pixels, (int) segment->numPixels);
+            if (segment->maxPower) {
+                brightness = calculate_max_brightness_for_power_mW(
+                        pixels, (uint16_t) segment->numPixels, brightness, segment->maxPower);
+            }
+            pixels += segment->numPixels;
+        }
+        // FastLED limits the brightness further to the total power budget.
+        FastLED.show(brightness);
+        uint32_t frameTime = (uint32_t)(esp_timer_get_time() - startTime);
+
+        portENTER_CRITICAL(&rendererLock);
+        renderer.statistics.numRenderedFrames++;
+        renderer.statistics.totalFrameTime += frameTime;
+        if (frameTime > renderer.statistics.maxFrameTime) {
+            renderer.statistics.maxFrameTime = frameTime;
+        }
+        portEXIT_CRITICAL(&rendererLock);
+    }
+
+    xSemaphoreGive(renderer.stopSemaphore);
+    vTaskDelete(NULL);
+}
+
+void RendererCreate(const RendererSegment* segments, size_t numSegments) {
+    HAPPrecondition(segments);
+    HAPPrecondition(numSegments && numSegments <= kRenderer_MaxSegments);
+
+    HAPRawBufferZero(&renderer, sizeof renderer);
+    size_t numPixels = 0;
+    for (size_t i = 0; i < numSegments; i++) {
+        HAPPrecondition(segments[i].controller);
+        HAPPrecondition(segments[i].numPixels && segments[i].numPixels <= UINT16_MAX);
+        renderer.segments[i] = segments[i];
+        numPixels += segments[i].numPixels;
+    }
+    renderer.numSegments = numSegments;
+    renderer.numPixels = numPixels;
+    for (size_t i = 0; i < HAPArrayCount(renderer.frames); i++) {
+        renderer.frames[i].pixels = (CRGB*) heap_caps_calloc(numPixels, sizeof(CRGB), MALLOC_CAP_INTERNAL);
+        if (!renderer.frames[i].pixels) {
+            HAPLogError(&kHAPLog_Default, "%s: Cannot allocate frame buffer.", __func__);
+            HAPFatalError();
+        }
+    }
+
+    renderer.frontIndex = 0;
+    renderer.pendingIndex = 1;
+    renderer.backIndex = 2;
+
+    renderer.stopSemaphore = xSemaphoreCreateBinary();
+    if (!renderer.stopSemaphore) {
+        HAPLogError(&kHAPLog_Default, "%s: Cannot create semaphore.", __func__);
+        HAPFatalError();
+    }
+    renderer.submitMutex = xSemaphoreCreateMutex();
+    if (!renderer.submitMutex) {
+        HAPLogError(&kHAPLog_Default, "%s: Cannot create mutex.", __func__);
+        HAPFatalError();
+    }
+    BaseType_t ok = xTaskCreatePinnedToCore(
+            RenderTaskMain,
+            "render",
+            CONFIG_EXAMPLE_RENDER_STACK_SIZE,
+            NULL,
+            CONFIG_EXAMPLE_RENDER_PRIORITY,
+            &renderer.task,
+            kRenderer_CoreID);
+    if (ok != pdPASS) {
+        HAPLogError(&kHAPLog_Default, "%s: Cannot create render task.", __func__);
+        HAPFatalError();
+    }
+}
+
+void RendererRelease(void) {
+    HAPPrecondition(renderer.task);
+
+    portENTER_CRITICAL(&rendererLock);
+    renderer.isStopping = true;
+    portEXIT_CRITICAL(&rendererLock);
+    xTaskNotifyGive(renderer.task);
+    (void) xSemaphoreTake(renderer.stopSemaphore, portMAX_DELAY);
+    vSemaphoreDelete(renderer.stopSemaphore);
+    vSemaphoreDelete(renderer.submitMutex);
+
+    for (size_t i = 0; i < HAPArrayCount(renderer.frames); i++) {
+        heap_caps_free(renderer.frames[i].pixels);
+    }
+    HAPRawBufferZero(&renderer, sizeof renderer);
+}
+
+void RendererSubmit(const CRGB* pixels, uint8_t brightness) {
+    HAPPrecondition(pixels);
+    HAPPrecondition(renderer.task);
+
+    (void) xSemaphoreTake(renderer.submitMutex, portMAX_DELAY);
+
+    portENTER_CRITICAL(&rendererLock);
+    renderer.statistics.numSubmittedFrames++;
+    size_t latestIndex = renderer.isFramePending ? renderer.pendingIndex : renderer.frontIndex;
+    bool hasFrame = renderer.hasFrame;
+    portEXIT_CRITICAL(&rendererLock);
+
+    // Only submitters write frames, so the latest frame does not change while the submit mutex is held,
+    // even if the render task swaps it to the front in the meantime.
+    if (hasFrame && FramesAreEqual(&renderer.frames[latestIndex], pixels, brightness)) {
+        portENTER_CRITICAL(&rendererLock);
+        renderer.statistics.numSkippedFrames++;
+        portEXIT_CRITICAL(&rendererLock);
+        xSemaphoreGive(renderer.submitMutex);
+        return;
+    }
+    Frame* backFrame = &renderer.frames[renderer.backIndex];
+    HAPRawBufferCopyBytes(backFrame->pixels, pixels, renderer.numPixels * sizeof pixels[0]);
+    backFrame->brightness = brightness;
+
+    portENTER_CRITICAL(&rendererLock);
+    if (renderer.isFramePending) {
+        renderer.statistics.numDroppedFrames++;
+    }
+    size_t pendingIndex = renderer.pendingIndex;
+    renderer.pendingIndex = renderer.backIndex;
+    renderer.backIndex = pendingIndex;
+    renderer.isFramePending = true;
+    renderer.hasFrame = true;
+    portEXIT_CRITICAL(&rendererLock);
+
+    xSemaphoreGive(renderer.submitMutex);
+    xTaskNotifyGive(renderer.task);
+}
+
+void RendererTakeStatistics(RendererStatistics* statistics) {
+    HAPPrecondition(statistics);
+
+    portENTER_CRITICAL(&rendererLock);
+    *statistics = renderer.statistics;
+    HAPRawBufferZero(&renderer.statistics, sizeof renderer.statistics);
+    portEXIT_CRITICAL(&rendererLock);
+}
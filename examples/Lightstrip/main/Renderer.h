@@ -0,0 +1,129 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+
+// Triple-buffered render pipeline of the Lightstrip example.
+//
+// Frames are composed into a back buffer, handed over through a pending buffer and output from a front buffer by a
+// dedicated render task, so that the blocking FastLED.show() runs neither in the esp_timer task nor on the HAP run
+// loop. A frame spans all segments of the strip, which are output in parallel.
+
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "FastLED.h"
+#include "HAP.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**
+ * Maximum number of segments.
+ */
+#define kRenderer_MaxSegments ((size_t) 4)
+
+/**
+ * Segment of the strip, driven by its own data pin.
+ */
+typedef struct {
+    /**
+     * FastLED controller of the segment. Its LED buffer is replaced by the frame buffers.
+     */
+    CLEDController* controller;
+
+    /**
+     * Number of LEDs of the segment.
+     */
+    size_t numPixels;
+
+    /**
+     * Power budget of the segment in milliwatts. 0 if only the total power budget applies.
+     */
+    uint32_t maxPower;
+} RendererSegment;
+
+/**
+ * Render statistics.
+ */
+typedef struct {
+    /**
+     * Number of frames that were submitted.
+     */
+    uint32_t numSubmittedFrames;
+
+    /**
+     * Number of frames that were output to the LEDs.
+     */
+    uint32_t numRenderedFrames;
+
+    /**
+     * Number of frames that were not output because their pixels and brightness were unchanged.
+     */
+    uint32_t numSkippedFrames;
+
+    /**
+     * Number of frames that were replaced by a newer frame before the render task could output them.
+     */
+    uint32_t numDroppedFrames;
+
+    /**
+     * Longest time to output a frame in microseconds.
+     */
+    uint32_t maxFrameTime;
+
+    /**
+     * Total time spent outputting frames in microseconds.
+     */
+    uint64_t totalFrameTime;
+} RendererStatistics;
+
+/**
+ * Allocates the frame buffers and starts the render task.
+ *
+ * - The render task is pinned to CONFIG_EXAMPLE_RENDER_CORE_ID, so that the LED output and its interrupts do not
+ *   compete with Wi-Fi and the HAP run loop.
+ *
+ * - A frame holds the pixels of all segments back to back, in the order of the segments.
+ *
+ * - The total power budget that is set with FastLED applies across all segments. If a segment has its own budget,
+ *   the brightness of the frame is lowered until the segment stays within it.
+ *
+ * @param      segments             Segments of the strip.
+ * @param      numSegments          Number of segments. At most kRenderer_MaxSegments.
+ */
+void RendererCreate(const RendererSegment* segments, size_t numSegments);
+
+/**
+ * Stops the render task and frees the frame buffers.
+ */
+void RendererRelease(void);
+
+/**
+ * Submits a frame. The frame is copied into the back buffer and output by the render task.
+ *
+ * - Frames that equal the previous frame are skipped.
+ *
+ * - A frame that has not been output yet is replaced by the submitted frame.
+ *
+ * - May be called from any task. Concurrent submissions are serialized.
+ *
+ * @param      pixels               Colors of the LEDs.
+ * @param      brightness           Global brightness of the frame.
+ */
+void RendererSubmit(const CRGB* pixels, uint8_t brightness);
+
+/**
+ * Fetches and resets the render statistics.
+ *
+ * @param[out] statistics           Statistics since the previous call.
+ */
+void RendererTakeStatistics(RendererStatistics* statistics);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#endif
@@ -11,6 +11,10 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <esp_event.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
 #include "App.h"
 #include "DB.h"
 
@@ -24,6 +28,8 @@
 #include "HAPPlatformMFiTokenAuth+Init.h"
 #include "HAPPlatformRunLoop+Init.h"
 #if IP
+#include "HAPPlatformArena+Init.h"
+#include "HAPPlatformIPSessionPool+Init.h"
 #include "HAPPlatformServiceDiscovery+Init.h"
 #include "HAPPlatformTCPStreamManager+Init.h"
 #endif
@@ -33,6 +39,32 @@ static bool requestedFactoryReset = false;
 static bool clearPairings = false;
 
 #define PREFERRED_ADVERTISING_INTERVAL (HAPBLEAdvertisingIntervalCreateFromMilliseconds(417.5f))
+
+#if IP
+/**
+ * Number of concurrent TCP streams and IP sessions.
+ */
+#define kIPNumSessions kHAPIPSessionStorage_MinimumNumElements
+
+/**
+ * Size of the arena backing the TCP streams.
+ */
+#define kIPArenaSize (kIPNumSessions * sizeof(HAPPlatformTCPStream) + sizeof(uint64_t))
+
+/**
+ * Heap capabilities of IP storage.
+ */
+#if CONFIG_EXAMPLE_IP_STORAGE_SPIRAM
+#define kIPStorageCapabilities (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define kIPStorageCapabilities (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#endif
+
+/**
+ * IP sessions. Their buffers are provided by the IP session pool when TCP streams are accepted.
+ */
+static HAPIPSession ipSessions[kIPNumSessions];
+#endif
 void app_wifi_init(void);
 esp_err_t app_wifi_connect(void);
 /**
@@ -51,6 +83,8 @@ static struct {
 #endif
 
 #if IP
+    HAPPlatformArena ipArena;
+    HAPPlatformIPSessionPool ipSessionPool;
     HAPPlatformTCPStreamManager tcpStreamManager;
 #endif
 
@@ -102,32 +136,52 @@ static void InitializePlatform() {
             &(const HAPPlatformAccessorySetupOptions) { .keyValueStore = &platform.factoryKeyValueStore });
     platform.hapPlatform.accessorySetup = &accessorySetup;
 
-    // Initialise Wi-Fi
+    // Initialise the network interface layer and the default event loop. Wi-Fi is started by StartWiFi.
     app_wifi_init();
 
 #if IP
-    // TCP stream manager.
+    // IP storage arena. Backs the TCP streams.
+    HAPPlatformArenaCreate(
+            &platform.ipArena,
+            &(const HAPPlatformArenaOptions) { .numBytes = kIPArenaSize, .capabilities = kIPStorageCapabilities });
+
+    // IP session pool. One buffer set is allocated now, the others on demand when TCP streams are accepted.
+    HAPPlatformIPSessionPoolCreate(
+            &platform.ipSessionPool,
+            &(const HAPPlatformIPSessionPoolOptions) {
+                    .sessions = ipSessions,
+                    .numSessions = HAPArrayCount(ipSessions),
+                    .inboundBufferSize = kHAPIPSession_MinimumInboundBufferSize,
+                    .outboundBufferSize = kHAPIPSession_MinimumOutboundBufferSize,
+                    .numEventNotifications = kAttributeCount,
+                    .capabilities = kIPStorageCapabilities });
+
+    // TCP stream manager. Depends on IP storage arena and IP session pool.
     HAPPlatformTCPStreamManagerCreate(
             &platform.tcpStreamManager,
             &(const HAPPlatformTCPStreamManagerOptions) {
                     /* Listen on all available network interfaces. */
                     .port = 0 /* Listen on unused port number from the ephemeral port range. */,
-                    .maxConcurrentTCPStreams = 9 });
+                    .maxConcurrentTCPStreams = kIPNumSessions,
+                    .arena = &platform.ipArena,
+                    .ipSessionPool = &platform.ipSessionPool });
 
     // Service discovery.
     static HAPPlatformServiceDiscovery serviceDiscovery;
     HAPPlatformServiceDiscoveryCreate(
             &serviceDiscovery,
             &(const HAPPlatformServiceDiscoveryOptions) {
-                    0, /* Register services on all available network interfaces. */
-            });
+                    .hostName = NULL, /* Register services on all available network interfaces. */
+                    .tcpStreamManager = &platform.tcpStreamManager });
     platform.hapPlatform.ip.serviceDiscovery = &serviceDiscovery;
 #endif
 
 #if (BLE)
-    // BLE peripheral manager. Depends on key-value store.
+    // BLE peripheral manager. Every service and characteristic needs at most three GATT attributes.
+    static HAPPlatformBLEPeripheralManagerAttribute blePeripheralManagerAttributes[3 * kAttributeCount];
     static HAPPlatformBLEPeripheralManagerOptions blePMOptions = { 0 };
-    blePMOptions.keyValueStore = &platform.keyValueStore;
+    blePMOptions.attributes = blePeripheralManagerAttributes;
+    blePMOptions.numAttributes = HAPArrayCount(blePeripheralManagerAttributes);
 
     static HAPPlatformBLEPeripheralManager blePeripheralManager;
     HAPPlatformBLEPeripheralManagerCreate(&blePeripheralManager, &blePMOptions);
@@ -168,9 +222,19 @@ static void DeinitializePlatform() {
     HAPPlatformMFiHWAuthRelease(&platform.mfiHWAuth);
 #endif
 
+#if (BLE)
+    // BLE peripheral manager.
+    HAPPlatformBLEPeripheralManagerRelease(HAPNonnull(platform.hapPlatform.ble.blePeripheralManager));
+#endif
+
 #if IP
+    // Service discovery.
+    HAPPlatformServiceDiscoveryRelease(HAPNonnull(platform.hapPlatform.ip.serviceDiscovery));
+
     // TCP stream manager.
     HAPPlatformTCPStreamManagerRelease(&platform.tcpStreamManager);
+    HAPPlatformIPSessionPoolRelease(&platform.ipSessionPool);
+    HAPPlatformArenaRelease(&platform.ipArena);
 #endif
 
     AppDeinitialize();
@@ -237,21 +301,167 @@ void HandleUpdatedState(HAPAccessoryServerRef* _Nonnull server, void* _Nullable
     }
 }
 
+/**
+ * Boot phases.
+ *
+ * - Times are measured by esp_timer from the start of the application, which excludes the ROM and second stage
+ *   bootloaders.
+ */
+typedef enum {
+    kBootPhase_PlatformInitialized,
+    kBootPhase_AppCreated,
+    kBootPhase_AccessoryServerStarted,
+    kBootPhase_WiFiStarted,
+    kBootPhase_WiFiConnected,
+    kBootPhase_IPAcquired
+} BootPhase;
+
+/**
+ * Number of boot phases.
+ */
+#define kBootPhase_Count ((size_t) kBootPhase_IPAcquired + 1)
+
+static const char* const bootPhaseDescriptions[kBootPhase_Count] = {
+    "Platform initialized", "App created", "Accessory server started", "Wi-Fi started", "Wi-Fi connected", "IP acquired"
+};
+
+/**
+ * Boot timing. Only accessed from the main task, which runs the run loop.
+ */
+static struct {
+    /**
+     * Times at which the boot phases were first completed in microseconds. 0 if not completed yet.
+     */
+    int64_t phaseTimes[kBootPhase_Count];
+
+    esp_event_handler_instance_t wifiEventHandler;
+    esp_event_handler_instance_t ipEventHandler;
+} boot;
+
+/**
+ * Boot phase that was completed on another task.
+ */
+typedef struct {
+    BootPhase phase;
+    int64_t time;
+} BootPhaseEvent;
+
+/**
+ * Stops tracking the boot phases.
+ */
+static void UnregisterBootEventHandlers(void) {
+    if (boot.wifiEventHandler) {
+        esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, boot.wifiEventHandler);
+        boot.wifiEventHandler = NULL;
+    }
+    if (boot.ipEventHandler) {
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, boot.ipEventHandler);
+        boot.ipEventHandler = NULL;
+    }
+}
+
+/**
+ * Records the completion of a boot phase. Once an IP address is acquired, the accessory is reachable and the boot
+ * phases are logged.
+ */
+static void RecordBootPhaseAt(BootPhase phase, int64_t time) {
+    if (boot.phaseTimes[phase]) {
+        return;
+    }
+    boot.phaseTimes[phase] = time;
+    if (phase != kBootPhase_IPAcquired) {
+        return;
+    }
+
+    for (size_t i = 0; i < kBootPhase_Count; i++) {
+        if (boot.phaseTimes[i]) {
+            HAPLogInfo(
+                    &kHAPLog_Default,
+                    "Boot: %s after %lu ms.",
+                    bootPhaseDescriptions[i],
+                    (unsigned long) (boot.phaseTimes[i] / 1000));
+        }
+    }
+    UnregisterBootEventHandlers();
+}
+
+/**
+ * Records the completion of a boot phase on the main task.
+ */
+static void RecordBootPhase(BootPhase phase) {
+    RecordBootPhaseAt(phase, esp_timer_get_time());
+}
+
+static void HandleBootPhaseEvent(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize == sizeof(BootPhaseEvent));
+    const BootPhaseEvent* event = context;
+
+    RecordBootPhaseAt(event->phase, event->time);
+}
+
+/**
+ * Records the completion of a boot phase from another task.
+ */
+static void ScheduleBootPhase(BootPhase phase) {
+    BootPhaseEvent event = { .phase = phase, .time = esp_timer_get_time() };
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleBootPhaseEvent, &event, sizeof event);
+    if (err) {
+        HAPLogError(&kHAPLog_Default, "Failed to schedule recording boot phase %s.", bootPhaseDescriptions[phase]);
+    }
+}
+
+/**
+ * Handles WIFI_EVENT_STA_CONNECTED and IP_EVENT_STA_GOT_IP on the default event loop task.
+ */
+static void HandleBootEvent(void* _Nullable arg, esp_event_base_t eventBase, int32_t eventID, void* _Nullable eventData) {
+    if (eventBase == WIFI_EVENT && eventID == WIFI_EVENT_STA_CONNECTED) {
+        ScheduleBootPhase(kBootPhase_WiFiConnected);
+    } else if (eventBase == IP_EVENT && eventID == IP_EVENT_STA_GOT_IP) {
+        ScheduleBootPhase(kBootPhase_IPAcquired);
+    }
+}
+
+static void WiFiStartTaskMain(void* _Nullable context HAP_UNUSED) {
+    app_wifi_connect();
+    ScheduleBootPhase(kBootPhase_WiFiStarted);
+    vTaskDelete(NULL);
+}
+
+/**
+ * Starts Wi-Fi on a separate task.
+ *
+ * - Initializing the Wi-Fi driver and calibrating the PHY take a while, and association and DHCP take seconds.
+ *   Meanwhile, the main task loads the accessory state, restores the outputs and starts the accessory server. The
+ *   TCP stream listener accepts connections on all interfaces, and the service discovery probes and announces the
+ *   HAP service when the station acquires an IP address, so the accessory is reachable right away.
+ */
+static void StartWiFi(void) {
+    esp_err_t err;
+    err = esp_event_handler_instance_register(
+            WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, HandleBootEvent, NULL, &boot.wifiEventHandler);
+    if (err != ESP_OK) {
+        HAPLogError(&kHAPLog_Default, "Failed to register Wi-Fi event handler: %d.", err);
+        boot.wifiEventHandler = NULL;
+    }
+    err = esp_event_handler_instance_register(
+            IP_EVENT, IP_EVENT_STA_GOT_IP, HandleBootEvent, NULL, &boot.ipEventHandler);
+    if (err != ESP_OK) {
+        HAPLogError(&kHAPLog_Default, "Failed to register IP event handler: %d.", err);
+        boot.ipEventHandler = NULL;
+    }
+
+    BaseType_t ok = xTaskCreate(WiFiStartTaskMain, "wifi_start", 4 * 1024, NULL, 6, NULL);
+    if (ok != pdPASS) {
+        HAPLogError(&kHAPLog_Default, "Failed to create Wi-Fi start task.");
+        HAPFatalError();
+    }
+}
+
 #if IP
 static void InitializeIP() {
     // Prepare accessory server storage.
-    static HAPIPSession ipSessions[kHAPIPSessionStorage_MinimumNumElements];
-    static uint8_t ipInboundBuffers[HAPArrayCount(ipSessions)][kHAPIPSession_MinimumInboundBufferSize];
-    static uint8_t ipOutboundBuffers[HAPArrayCount(ipSessions)][kHAPIPSession_MinimumOutboundBufferSize];
-    static HAPIPEventNotificationRef ipEventNotifications[HAPArrayCount(ipSessions)][kAttributeCount];
-    for (size_t i = 0; i < HAPArrayCount(ipSessions); i++) {
-        ipSessions[i].inboundBuffer.bytes = ipInboundBuffers[i];
-        ipSessions[i].inboundBuffer.numBytes = sizeof ipInboundBuffers[i];
-        ipSessions[i].outboundBuffer.bytes = ipOutboundBuffers[i];
-        ipSessions[i].outboundBuffer.numBytes = sizeof ipOutboundBuffers[i];
-        ipSessions[i].eventNotifications = ipEventNotifications[i];
-        ipSessions[i].numEventNotifications = HAPArrayCount(ipEventNotifications[i]);
-    }
+    // Session buffers and event notifications are provided by the IP session pool.
     static HAPIPReadContextRef ipReadContexts[kAttributeCount];
     static HAPIPWriteContextRef ipWriteContexts[kAttributeCount];
     static uint8_t ipScratchBuffer[kHAPIPSession_MinimumScratchBufferSize];
@@ -269,9 +479,6 @@ static void InitializeIP() {
     platform.hapAccessoryServerOptions.ip.accessoryServerStorage = &ipAccessoryServerStorage;
 
     platform.hapPlatform.ip.tcpStreamManager = &platform.tcpStreamManager;
-
-    // Connect to Wi-Fi
-    app_wifi_connect();
 }
 #endif
 
@@ -306,6 +513,10 @@ void main_task() {
 
     // Initialize global platform objects.
     InitializePlatform();
+    RecordBootPhase(kBootPhase_PlatformInitialized);
+
+    // Associate while the accessory server is set up.
+    StartWiFi();
 
 #if IP
     InitializeIP();
@@ -329,9 +540,11 @@ void main_task() {
 
     // Create app object.
     AppCreate(&accessoryServer, &platform.keyValueStore);
+    RecordBootPhase(kBootPhase_AppCreated);
 
     // Start accessory server for App.
     AppAccessoryServerStart();
+    RecordBootPhase(kBootPhase_AccessoryServerStarted);
 
     // Run main loop until explicitly stopped.
     HAPPlatformRunLoopRun();
@@ -342,6 +555,7 @@ void main_task() {
 
     HAPAccessoryServerRelease(&accessoryServer);
 
+    UnregisterBootEventHandlers();
     DeinitializePlatform();
 }
 
@@ -53,6 +53,18 @@ extern "C" {
 #define kHAPIPSession_MinimumOutboundBufferSize 1536
 #define kHAPIPSession_MinimumScratchBufferSize  1536
 
+/**
+ * HAP compatibility version of the ADK whose private headers the port has been checked against.
+ *
+ * - HAPPlatformIPSessionPool and HAPPlatformSRPEphemeralCache access ADK-private state. They fail to build when
+ *   HAP_COMPATIBILITY_VERSION differs. Only update this value after re-checking the assumptions documented there.
+ *
+ * - HAP_COMPATIBILITY_VERSION does not cover private structure layouts or call orders. Those assumptions have only
+ *   been checked against the ADK commit that the homekit_adk submodule is pinned to. Re-check them whenever the
+ *   submodule is updated.
+ */
+#define kHAPPlatform_ADKCompatibilityVersion 7
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull begin
 #endif
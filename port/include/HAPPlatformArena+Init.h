@@ -0,0 +1,148 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_ARENA_INIT_H
+#define HAP_PLATFORM_ARENA_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAPPlatform.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * Memory arena.
+ *
+ * Hands out 8-byte aligned blocks from a single region of memory that is either provided by the caller or
+ * allocated once with specific heap capabilities, e.g. MALLOC_CAP_SPIRAM to place large, rarely touched buffers
+ * into PSRAM on boards that have it. Blocks are never freed individually. All blocks are freed together when the
+ * arena is released.
+ *
+ * **Example**
+
+   @code{.c}
+   // Allocate arena object.
+   static HAPPlatformArena arena;
+
+   // Initialize arena object with 32 KB of PSRAM.
+   HAPPlatformArenaCreate(&arena, &(const HAPPlatformArenaOptions) {
+       .numBytes = 32 * 1024,
+       .capabilities = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT
+   });
+
+   // Use the arena as TCP stream storage.
+   HAPPlatformTCPStreamManagerCreate(&tcpStreamManager, &(const HAPPlatformTCPStreamManagerOptions) {
+       .port = kHAPNetworkPort_Any,
+       .maxConcurrentTCPStreams = 16,
+       .arena = &arena
+   });
+
+   @endcode
+ */
+
+/**
+ * Arena initialization options.
+ */
+typedef struct {
+    /**
+     * Memory backing the arena. NULL to allocate numBytes bytes with the given capabilities.
+     *
+     * - If provided, the memory must stay valid until the arena is released.
+     */
+    void* _Nullable bytes;
+
+    /**
+     * Size of the arena in bytes.
+     */
+    size_t numBytes;
+
+    /**
+     * Heap capabilities (MALLOC_CAP_*) used to allocate the arena if bytes is NULL. 0 uses MALLOC_CAP_8BIT.
+     */
+    uint32_t capabilities;
+} HAPPlatformArenaOptions;
+
+/**
+ * Arena.
+ */
+typedef struct HAPPlatformArena HAPPlatformArena;
+typedef struct HAPPlatformArena* HAPPlatformArenaRef;
+
+struct HAPPlatformArena {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    uint8_t* _Nullable bytes;
+    size_t numBytes;
+    size_t numUsedBytes;
+    bool isAllocated;
+    /**@endcond */
+};
+
+/**
+ * Initializes an arena.
+ *
+ * @param[out] arena                Pointer to an allocated but uninitialized HAPPlatformArena structure.
+ * @param      options              Initialization options.
+ */
+void HAPPlatformArenaCreate(HAPPlatformArenaRef arena, const HAPPlatformArenaOptions* options);
+
+/**
+ * Releases resources associated with an initialized arena.
+ *
+ * - All blocks allocated from the arena become invalid.
+ *
+ * @param      arena                Arena.
+ */
+void HAPPlatformArenaRelease(HAPPlatformArenaRef arena);
+
+/**
+ * Allocates a zero-initialized, 8-byte aligned block from an arena.
+ *
+ * @param      arena                Arena.
+ * @param      numBytes             Size of the block in bytes.
+ *
+ * @return Block if successful. NULL if the arena does not have enough space left.
+ */
+HAP_RESULT_USE_CHECK
+void* _Nullable HAPPlatformArenaAllocate(HAPPlatformArenaRef arena, size_t numBytes);
+
+/**
+ * Returns the number of bytes that are still available in an arena.
+ *
+ * @param      arena                Arena.
+ *
+ * @return Number of free bytes.
+ */
+HAP_RESULT_USE_CHECK
+size_t HAPPlatformArenaGetNumFreeBytes(HAPPlatformArenaRef arena);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,12 +25,74 @@
 extern "C" {
 #endif
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include "HAPPlatform.h"
 
 #if __has_feature(nullability)
 #pragma clang assume_nonnull begin
 #endif
 
+/**@file
+ * BLE peripheral manager using the NimBLE host of ESP IDF.
+ *
+ * - With CONFIG_BT_NIMBLE_ENABLED, the GATT database is registered with NimBLE when services are published, and the
+ *   NimBLE host task is started at that point. Advertising, connections, reads, writes, subscriptions and
+ *   indications are driven through NimBLE. Without it, only the bookkeeping is done.
+ *
+ * - NimBLE events are handled on the run loop. Read and write requests block the NimBLE host task until the
+ *   delegate has handled them on the run loop, as they must be answered synchronously. Requests that the run loop
+ *   does not start handling within kHAPPlatformBLEPeripheralManager_AccessTimeout, or that are pending when the BLE
+ *   peripheral manager is released, fail with BLE_ATT_ERR_UNLIKELY.
+ *
+ * - After connecting, the ATT MTU is negotiated up to CONFIG_HAP_BLE_ATT_MTU so that HAP-BLE PDUs need fewer
+ *   fragments. Values that exceed the MTU are served to Read Blob requests from a copy of the first read.
+ *
+ * - A policy trades latency against power consumption. A short connection interval is requested while GATT
+ *   requests or indications are exchanged, and a long one once the connection has been idle for a while. After
+ *   power on and after a central disconnected, advertising uses a fast interval for a limited time before it falls
+ *   back to the interval requested by the accessory server. Indications and advertising data updates that follow
+ *   each other closely are batched, so that the radio wakes up once per batching window.
+ *
+ * **Example**
+
+   @code{.c}
+
+   // Allocate BLE peripheral manager object and its GATT database.
+   static HAPPlatformBLEPeripheralManagerAttribute blePeripheralManagerAttributes[3 * kAttributeCount];
+   static HAPPlatformBLEPeripheralManager blePeripheralManager;
+
+   // Initialize BLE peripheral manager object.
+   HAPPlatformBLEPeripheralManagerCreate(&blePeripheralManager,
+       &(const HAPPlatformBLEPeripheralManagerOptions) {
+           .attributes = blePeripheralManagerAttributes,
+           .numAttributes = HAPArrayCount(blePeripheralManagerAttributes)
+       });
+
+   @endcode
+ */
+
+/**
+ * Maximum number of bytes of a constant characteristic or descriptor value.
+ */
+#define kHAPPlatformBLEPeripheralManager_MaxConstBytes ((size_t) 8)
+
+/**
+ * Maximum number of bytes of an attribute value. Limit of the ATT protocol.
+ */
+#define kHAPPlatformBLEPeripheralManager_MaxAttributeBytes ((size_t) 512)
+
+/**
+ * Time that a read or write request of the NimBLE host task waits for the run loop to start handling it.
+ */
+#define kHAPPlatformBLEPeripheralManager_AccessTimeout ((HAPTime)(5 * HAPSecond))
+
+/**
+ * Maximum number of characteristics whose indications can be pending in a batching window.
+ */
+#define kHAPPlatformBLEPeripheralManager_MaxPendingIndications ((size_t) 8)
+
 typedef struct {
     HAPPlatformBLEPeripheralManagerUUID type;
     bool isPrimary;
@@ -43,12 +105,18 @@ typedef struct {
     HAPPlatformBLEPeripheralManagerAttributeHandle handle;
     HAPPlatformBLEPeripheralManagerAttributeHandle valueHandle;
     HAPPlatformBLEPeripheralManagerAttributeHandle cccDescriptorHandle;
+    uint8_t constBytes[kHAPPlatformBLEPeripheralManager_MaxConstBytes];
+    uint8_t numConstBytes;
+    bool isConst : 1;
 } HAPPlatformBLEPeripheralManagerCharacteristic;
 
 typedef struct {
     HAPPlatformBLEPeripheralManagerUUID type;
     HAPPlatformBLEPeripheralManagerDescriptorProperties properties;
     HAPPlatformBLEPeripheralManagerAttributeHandle handle;
+    uint8_t constBytes[kHAPPlatformBLEPeripheralManager_MaxConstBytes];
+    uint8_t numConstBytes;
+    bool isConst : 1;
 } HAPPlatformBLEPeripheralManagerDescriptor;
 
 HAP_ENUM_BEGIN(uint8_t, HAPPlatformBLEPeripheralManagerAttributeType) {
@@ -67,12 +135,71 @@ typedef struct {
     } _;
 } HAPPlatformBLEPeripheralManagerAttribute;
 
+/**
+ * Connection and advertising policy of the BLE peripheral manager.
+ *
+ * - Fields that are 0 use the corresponding CONFIG_HAP_BLE_* default. Setting the default to 0 in menuconfig
+ *   disables fast advertising or batching.
+ */
+typedef struct {
+    /**
+     * Connection interval that is requested while GATT requests or indications are exchanged.
+     */
+    HAPTime activeConnectionInterval;
+
+    /**
+     * Connection interval that is requested once the connection has been idle for idleTimeout.
+     */
+    HAPTime idleConnectionInterval;
+
+    /**
+     * Time without GATT requests or indications after which the connection is considered idle.
+     */
+    HAPTime idleTimeout;
+
+    /**
+     * Advertising interval after power on and after a central disconnected. Longer advertising intervals that are
+     * requested by the accessory server are shortened to it.
+     */
+    HAPBLEAdvertisingInterval fastAdvertisingInterval;
+
+    /**
+     * Duration of fast advertising.
+     */
+    HAPTime fastAdvertisingDuration;
+
+    /**
+     * Window within which consecutive indications and advertising data updates are batched.
+     *
+     * - The first indication or update is sent immediately. Further ones within the window are sent when it ends.
+     *   Repeated zero-length indications of the same characteristic are merged into one.
+     */
+    HAPTime batchingWindow;
+} HAPPlatformBLEPeripheralManagerPolicy;
+
 /**
  * BLE peripheral manager initialization options.
  */
 typedef struct {
+    /**
+     * Storage for the GATT database. Services, characteristics and descriptors need one element each.
+     */
     HAPPlatformBLEPeripheralManagerAttribute* attributes;
+
+    /**
+     * Number of elements in the attributes array.
+     */
     size_t numAttributes;
+
+    /**
+     * ATT MTU to negotiate with connected centrals. 0 uses CONFIG_HAP_BLE_ATT_MTU.
+     */
+    uint16_t preferredATTMTU;
+
+    /**
+     * Connection and advertising policy.
+     */
+    HAPPlatformBLEPeripheralManagerPolicy policy;
 } HAPPlatformBLEPeripheralManagerOptions;
 
 /**
@@ -84,6 +211,20 @@ struct HAPPlatformBLEPeripheralManager {
     HAPPlatformBLEPeripheralManagerAttribute* attributes;
     size_t numAttributes;
 
+    /**
+     * Append cursor of the GATT database under construction.
+     */
+    size_t numUsedAttributes;
+    HAPPlatformBLEPeripheralManagerAttributeHandle lastHandle;
+    bool inService : 1;
+    bool inCharacteristic : 1;
+
+    /**
+     * Index from attribute handles to 1-based indexes into attributes. 0 marks unassigned handles.
+     * Built when services are published.
+     */
+    uint16_t* _Nullable attributeIndexes;
+
     HAPPlatformBLEPeripheralManagerDelegate delegate;
     HAPPlatformBLEPeripheralManagerDeviceAddress deviceAddress;
     char deviceName[64 + 1];
@@ -97,6 +238,73 @@ struct HAPPlatformBLEPeripheralManager {
     bool isDeviceAddressSet : 1;
     bool didPublishAttributes : 1;
     bool isConnected : 1;
+
+    HAPPlatformBLEPeripheralManagerConnectionHandle connectionHandle;
+    uint16_t preferredATTMTU;
+
+    /**
+     * GATT definitions handed to NimBLE, and the offset between the handles reported to the ADK and NimBLE handles.
+     */
+    void* _Nullable gattDefinitions;
+    uint16_t nimbleHandleOffset;
+
+    /**
+     * Serializes read and write requests of the NimBLE host task with the run loop.
+     * The request that the NimBLE host task waits for is guarded by accessLock.
+     */
+    SemaphoreHandle_t _Nullable accessCompleted;
+    portMUX_TYPE accessLock;
+    void* _Nullable accessRequest;
+    uint32_t accessRequestID;
+    bool isAccessRequestActive;
+    bool isReleased;
+
+    /**
+     * Value of the last read that exceeded the ATT MTU, served to the Read Blob requests that follow it.
+     * Only accessed by the NimBLE host task.
+     */
+    struct {
+        uint8_t bytes[kHAPPlatformBLEPeripheralManager_MaxAttributeBytes];
+        uint16_t numBytes;
+        uint16_t offset;
+        HAPPlatformBLEPeripheralManagerAttributeHandle attributeHandle;
+    } longRead;
+
+    /**
+     * Buffer for values of write requests. Only accessed by the NimBLE host task and the delegate it waits for.
+     */
+    uint8_t writeBytes[kHAPPlatformBLEPeripheralManager_MaxAttributeBytes];
+
+    /**
+     * Negotiated ATT MTU of the current connection. Written by the NimBLE host task.
+     */
+    volatile uint16_t attMTU;
+
+    bool isHostStarted : 1;
+    bool isHostSynced : 1;
+    bool isAdvertisingActive : 1;
+    bool isIndicationInProgress : 1;
+
+    /**
+     * Connection and advertising policy with defaults applied.
+     */
+    HAPPlatformBLEPeripheralManagerPolicy policy;
+    HAPTime lastActivityTime;
+    HAPPlatformTimerRef idleTimer;
+    HAPPlatformTimerRef fastAdvertisingTimer;
+
+    /**
+     * Indications and advertising data updates that wait for the end of the batching window.
+     */
+    HAPTime batchingWindowEnd;
+    HAPPlatformTimerRef batchingTimer;
+    HAPPlatformBLEPeripheralManagerAttributeHandle
+            pendingIndications[kHAPPlatformBLEPeripheralManager_MaxPendingIndications];
+    uint8_t numPendingIndications;
+
+    bool isConnectionActive : 1;
+    bool isFastAdvertising : 1;
+    bool isAdvertisingUpdatePending : 1;
     /**@endcond */
 };
 
@@ -110,6 +318,29 @@ void HAPPlatformBLEPeripheralManagerCreate(
         HAPPlatformBLEPeripheralManagerRef blePeripheralManager,
         const HAPPlatformBLEPeripheralManagerOptions* options);
 
+/**
+ * Deinitializes the BLE peripheral manager.
+ *
+ * - The NimBLE host keeps running. A read or write request that waits for the run loop is failed, and later
+ *   requests are rejected without waiting.
+ *
+ * @param      blePeripheralManager BLE peripheral manager.
+ */
+void HAPPlatformBLEPeripheralManagerRelease(HAPPlatformBLEPeripheralManagerRef blePeripheralManager);
+
+/**
+ * Changes the connection and advertising policy.
+ *
+ * - The connection parameters of an established connection are updated immediately. Other changes take effect
+ *   the next time they apply.
+ *
+ * @param      blePeripheralManager BLE peripheral manager.
+ * @param      policy               Connection and advertising policy.
+ */
+void HAPPlatformBLEPeripheralManagerSetPolicy(
+        HAPPlatformBLEPeripheralManagerRef blePeripheralManager,
+        const HAPPlatformBLEPeripheralManagerPolicy* policy);
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
@@ -0,0 +1,126 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_CHACHA20_POLY1305_INIT_H
+#define HAP_PLATFORM_CHACHA20_POLY1305_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAPPlatform.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * ChaCha20-Poly1305 AEAD (RFC 8439) tuned for HAP session traffic on Xtensa.
+ *
+ * - Each 64 byte ChaCha20 block is XORed a word at a time and authenticated by Poly1305 while it is still in
+ *   registers and cache, so the message is traversed once instead of once per primitive.
+ *
+ * - Poly1305 uses 26 bit limbs, so that all products fit the 32x32->64 bit multiplier of the ESP32.
+ *
+ * - With CONFIG_HAP_CRYPTO_CHACHA20_POLY1305, the HAP_chacha20_poly1305_encrypt_aad and
+ *   HAP_chacha20_poly1305_decrypt_aad functions of the crypto PAL are redirected to this implementation at link
+ *   time, so that encrypted HAP frames do not go through MbedTLS.
+ *
+ * - Nonces shorter than 12 bytes are padded with leading zeros, as done by the MbedTLS crypto PAL.
+ */
+
+/**
+ * Key length of ChaCha20-Poly1305.
+ */
+#define kHAPPlatformChaCha20Poly1305_KeyBytes ((size_t) 32)
+
+/**
+ * Maximum nonce length of ChaCha20-Poly1305.
+ */
+#define kHAPPlatformChaCha20Poly1305_MaxNonceBytes ((size_t) 12)
+
+/**
+ * Tag length of ChaCha20-Poly1305.
+ */
+#define kHAPPlatformChaCha20Poly1305_TagBytes ((size_t) 16)
+
+/**
+ * Encrypts and authenticates a message.
+ *
+ * @param[out] tag                  Authentication tag.
+ * @param[out] c                    Ciphertext. May be the same buffer as m.
+ * @param      m                    Message.
+ * @param      m_len                Length of the message.
+ * @param      a                    Additional authenticated data.
+ * @param      a_len                Length of the additional authenticated data.
+ * @param      n                    Nonce.
+ * @param      n_len                Length of the nonce.
+ * @param      k                    Key.
+ */
+void HAPPlatformChaCha20Poly1305Encrypt(
+        uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable c,
+        const uint8_t* _Nullable m,
+        size_t m_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]);
+
+/**
+ * Verifies and decrypts a message.
+ *
+ * - The message is zeroed if the tag does not match.
+ *
+ * @param      tag                  Authentication tag.
+ * @param[out] m                    Message. May be the same buffer as c.
+ * @param      c                    Ciphertext.
+ * @param      c_len                Length of the ciphertext.
+ * @param      a                    Additional authenticated data.
+ * @param      a_len                Length of the additional authenticated data.
+ * @param      n                    Nonce.
+ * @param      n_len                Length of the nonce.
+ * @param      k                    Key.
+ *
+ * @return 0                        If the tag matches.
+ * @return -1                       Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+int HAPPlatformChaCha20Poly1305Decrypt(
+        const uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable m,
+        const uint8_t* _Nullable c,
+        size_t c_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
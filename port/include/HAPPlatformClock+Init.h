@@ -0,0 +1,70 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_CLOCK_INIT_H
+#define HAP_PLATFORM_CLOCK_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAPPlatform.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * Monotonic clock.
+ *
+ * The clock is based on esp_timer, which counts microseconds since boot. It is unaffected by changes of the system
+ * time and may be read from any task. HAPPlatformClockGetCurrent and HAPPlatformClockGetCurrentMicroseconds share
+ * the same time base, so spans measured with either are consistent.
+ *
+ * **Example**
+
+   @code{.c}
+
+   uint64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+   RenderFrame();
+   uint64_t renderDuration = HAPPlatformClockGetCurrentMicroseconds() - startTime;
+
+   @endcode
+ */
+
+/**
+ * Returns the current time in microseconds since boot.
+ *
+ * - HAPPlatformClockGetCurrent returns the same time truncated to milliseconds.
+ *
+ * @return Current time in microseconds.
+ */
+HAP_RESULT_USE_CHECK
+uint64_t HAPPlatformClockGetCurrentMicroseconds(void);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,188 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_CRYPTO_EXECUTOR_INIT_H
+#define HAP_PLATFORM_CRYPTO_EXECUTOR_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "HAPPlatform.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * Crypto executor.
+ *
+ * Runs expensive computations on a worker task, preferably pinned to the core that does not run the HAP run loop.
+ * Results are handed back to the run loop through HAPPlatformRunLoopScheduleCallback, so that the run loop keeps
+ * serving other sessions while a job is running.
+ *
+ * - The crypto executor is the worker of the SRP ephemeral cache, which computes the SRP key pair of Pair Setup on
+ *   it ahead of time. It is only built with CONFIG_HAP_CRYPTO_SRP_EPHEMERAL_CACHE. See
+ *   HAPPlatformSRPEphemeralCache+Init.h.
+ *
+ * - The Curve25519 and Ed25519 operations of Pair Verify are not offloaded. The ADK runs them synchronously while
+ *   handling the Pair Verify request and offers no hook to defer the response. Redirecting the crypto PAL entry
+ *   points to the worker would still block the run loop until the result is back, so they stay on the run loop.
+ *
+ * - If the run loop does not accept a completion within one second, or while the crypto executor is being
+ *   released, the completion is dropped and logged.
+ *
+ * **Example**
+
+   @code{.c}
+   // Allocate crypto executor object.
+   static HAPPlatformCryptoExecutor cryptoExecutor;
+
+   // Initialize crypto executor object. Uses the defaults from menuconfig.
+   HAPPlatformCryptoExecutorCreate(&cryptoExecutor, &(const HAPPlatformCryptoExecutorOptions) { 0 });
+
+   // Submit a job. The job runs on the worker task, the completion on the run loop.
+   HAPError err = HAPPlatformCryptoExecutorSubmit(&cryptoExecutor, ComputeJob, HandleJobCompleted, &job, sizeof job);
+
+   @endcode
+ */
+
+/**
+ * Maximum size of a job context.
+ */
+#define kHAPPlatformCryptoExecutor_MaxContextBytes ((size_t)(UINT8_MAX - 8))
+
+/**
+ * Crypto executor.
+ */
+typedef struct HAPPlatformCryptoExecutor HAPPlatformCryptoExecutor;
+typedef struct HAPPlatformCryptoExecutor* HAPPlatformCryptoExecutorRef;
+
+/**
+ * Job that is run on the worker task.
+ *
+ * - The job may modify its context. The modified context is passed to the completion callback.
+ *
+ * @param      context              Job context. 8-byte aligned.
+ * @param      contextSize          Size of the job context.
+ */
+typedef void (*HAPPlatformCryptoExecutorJob)(void* _Nullable context, size_t contextSize);
+
+/**
+ * Completion callback that is invoked on the run loop after a job finished.
+ *
+ * @param      context              Job context, as modified by the job. 8-byte aligned.
+ * @param      contextSize          Size of the job context.
+ */
+typedef void (*HAPPlatformCryptoExecutorCompletion)(void* _Nullable context, size_t contextSize);
+
+/**
+ * Crypto executor initialization options.
+ */
+typedef struct {
+    /**
+     * Stack size of the worker task in bytes. 0 uses CONFIG_HAP_CRYPTO_EXECUTOR_STACK_SIZE.
+     */
+    uint32_t stackSize;
+
+    /**
+     * Priority of the worker task. 0 uses CONFIG_HAP_CRYPTO_EXECUTOR_PRIORITY.
+     */
+    UBaseType_t priority;
+
+    /**
+     * Maximum number of jobs that may be queued. 0 uses CONFIG_HAP_CRYPTO_EXECUTOR_QUEUE_LENGTH.
+     */
+    size_t maxQueuedJobs;
+} HAPPlatformCryptoExecutorOptions;
+
+struct HAPPlatformCryptoExecutor {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    QueueHandle_t _Nullable jobQueue;
+    SemaphoreHandle_t _Nullable stopSemaphore;
+    TaskHandle_t _Nullable task;
+    volatile bool isStopping;
+    uint32_t numSubmittedJobs;
+    uint32_t numCompletedJobs;
+    uint32_t numDroppedJobs;
+    /**@endcond */
+};
+
+/**
+ * Initializes a crypto executor and starts its worker task.
+ *
+ * @param[out] cryptoExecutor       Pointer to an allocated but uninitialized HAPPlatformCryptoExecutor structure.
+ * @param      options              Initialization options.
+ */
+void HAPPlatformCryptoExecutorCreate(
+        HAPPlatformCryptoExecutorRef cryptoExecutor,
+        const HAPPlatformCryptoExecutorOptions* options);
+
+/**
+ * Stops the worker task and releases resources associated with an initialized crypto executor.
+ *
+ * - Jobs that are still queued are run before the worker task stops. Their completions are only scheduled if the
+ *   run loop accepts them right away, and are dropped otherwise.
+ *
+ * @param      cryptoExecutor       Crypto executor.
+ */
+void HAPPlatformCryptoExecutorRelease(HAPPlatformCryptoExecutorRef cryptoExecutor);
+
+/**
+ * Submits a job to the worker task.
+ *
+ * - The context is copied. Data that does not fit into the context must be referenced by pointers and must stay
+ *   valid until the completion callback has been invoked.
+ *
+ * - The completion callback is invoked on the run loop, never synchronously. It is not invoked if the run loop does
+ *   not accept the completion in time.
+ *
+ * @param      cryptoExecutor       Crypto executor.
+ * @param      job                  Job to run on the worker task.
+ * @param      completion           Completion callback to invoke on the run loop after the job finished.
+ * @param      context              Job context.
+ * @param      contextSize          Size of the job context. At most kHAPPlatformCryptoExecutor_MaxContextBytes.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If the context is too large or the job queue is full.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformCryptoExecutorSubmit(
+        HAPPlatformCryptoExecutorRef cryptoExecutor,
+        HAPPlatformCryptoExecutorJob job,
+        HAPPlatformCryptoExecutorCompletion completion,
+        const void* _Nullable context,
+        size_t contextSize);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
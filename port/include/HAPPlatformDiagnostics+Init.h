@@ -0,0 +1,217 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_DIAGNOSTICS_INIT_H
+#define HAP_PLATFORM_DIAGNOSTICS_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sdkconfig.h>
+
+#include "HAPPlatform.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * Diagnostics.
+ *
+ * Samples the free heap per capability, the stack high-water marks of the main, esp_timer and mDNS tasks, the lwIP
+ * socket usage, and the counters of the run loop, TCP stream manager and key-value store. Stack sizes and buffers
+ * can be tuned with these samples on devices in the field. A snapshot is logged periodically and can be exposed
+ * through read-only characteristics, e.g., by the Diagnostics service of the Lightbulb example.
+ *
+ * - Only collected with CONFIG_HAP_DIAGNOSTICS.
+ *
+ * - Diagnostics are a singleton, like the run loop. They must be created and used on the run loop task, which is
+ *   recorded as the main task.
+ *
+ * **Example**
+
+   @code{.c}
+   // Initialize diagnostics after the run loop.
+   HAPPlatformDiagnosticsCreate(&(const HAPPlatformDiagnosticsOptions) {
+       .keyValueStore = &platform.keyValueStore,
+       .tcpStreamManager = &platform.tcpStreamManager
+   });
+
+   // Read a snapshot, e.g., in a characteristic read handler.
+   HAPPlatformDiagnosticsSnapshot snapshot;
+   HAPPlatformDiagnosticsGetSnapshot(&snapshot);
+
+   @endcode
+ */
+
+/**
+ * Stack high-water mark of a task that was not found.
+ */
+#define kHAPPlatformDiagnostics_UnknownStackHighWaterMark ((uint32_t) UINT32_MAX)
+
+/**
+ * Maximum age of a snapshot that is reused instead of sampling again.
+ *
+ * - Reading all diagnostics characteristics in one request thus returns values of the same snapshot.
+ */
+#define kHAPPlatformDiagnostics_MaxSnapshotAge ((HAPTime)(1 * HAPSecond))
+
+/**
+ * Diagnostics initialization options.
+ */
+typedef struct {
+    /**
+     * Key-value store whose statistics are sampled. Optional.
+     */
+    HAPPlatformKeyValueStoreRef _Nullable keyValueStore;
+
+    /**
+     * TCP stream manager whose statistics are sampled. Optional.
+     */
+    HAPPlatformTCPStreamManagerRef _Nullable tcpStreamManager;
+
+    /**
+     * Interval at which a snapshot is logged. 0 uses CONFIG_HAP_DIAGNOSTICS_REPORT_INTERVAL seconds.
+     * The log line is disabled if both are 0.
+     */
+    HAPTime reportInterval;
+} HAPPlatformDiagnosticsOptions;
+
+/**
+ * Heap usage of one capability.
+ */
+typedef struct {
+    /** Number of free bytes. */
+    uint32_t freeBytes;
+
+    /** Smallest number of free bytes since boot. */
+    uint32_t minFreeBytes;
+
+    /** Size of the largest free block in bytes. */
+    uint32_t largestFreeBlock;
+} HAPPlatformDiagnosticsHeap;
+
+/**
+ * Diagnostics snapshot.
+ */
+typedef struct {
+    /**
+     * Time at which the snapshot was taken.
+     */
+    HAPTime time;
+
+    /**
+     * Heap usage. All zero for PSRAM if it is not available.
+     */
+    struct {
+        HAPPlatformDiagnosticsHeap internal;
+        HAPPlatformDiagnosticsHeap spiram;
+    } heap;
+
+    /**
+     * Smallest amount of free stack since the tasks started, in bytes.
+     * kHAPPlatformDiagnostics_UnknownStackHighWaterMark if a task was not found.
+     */
+    struct {
+        uint32_t mainTask;
+        uint32_t timerTask;
+        uint32_t mdnsTask;
+    } stackHighWaterMarks;
+
+    /**
+     * Number of FreeRTOS tasks.
+     */
+    uint32_t numTasks;
+
+    /**
+     * lwIP socket usage. Both zero if not available.
+     */
+    struct {
+        uint32_t numSocketsInUse;
+        uint32_t maxSockets;
+    } sockets;
+
+    /**
+     * Run loop wakeup counters and longest callbacks. Zero without CONFIG_HAP_RUN_LOOP_STATISTICS.
+     */
+    struct {
+        uint32_t numTimerWakeups;
+        uint32_t numFileHandleWakeups;
+        uint32_t numLoopbackWakeups;
+        uint32_t maxFileHandleCallbackDuration;
+        uint32_t maxTimerCallbackDuration;
+        uint32_t maxScheduledCallbackDuration;
+    } runLoop;
+
+    /**
+     * TCP stream manager statistics. Zero if no TCP stream manager is sampled.
+     */
+    HAPPlatformTCPStreamManagerStatistics tcpStreamManager;
+
+    /**
+     * Key-value store statistics. Zero if no key-value store is sampled.
+     */
+    HAPPlatformKeyValueStoreStatistics keyValueStore;
+} HAPPlatformDiagnosticsSnapshot;
+
+/**
+ * Initializes diagnostics.
+ *
+ * - Must be called on the run loop task after the run loop has been created.
+ *
+ * @param      options              Initialization options.
+ */
+void HAPPlatformDiagnosticsCreate(const HAPPlatformDiagnosticsOptions* options);
+
+/**
+ * Releases diagnostics.
+ */
+void HAPPlatformDiagnosticsRelease(void);
+
+/**
+ * Gets a diagnostics snapshot.
+ *
+ * - Must be called on the run loop task.
+ *
+ * - A snapshot that is younger than kHAPPlatformDiagnostics_MaxSnapshotAge is reused.
+ *
+ * @param[out] snapshot             Snapshot. Zeroed if CONFIG_HAP_DIAGNOSTICS is disabled.
+ */
+void HAPPlatformDiagnosticsGetSnapshot(HAPPlatformDiagnosticsSnapshot* snapshot);
+
+/**
+ * Logs a new diagnostics snapshot.
+ *
+ * - Must be called on the run loop task.
+ */
+void HAPPlatformDiagnosticsLogSnapshot(void);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
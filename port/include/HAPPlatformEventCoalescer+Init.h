@@ -0,0 +1,174 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_EVENT_COALESCER_INIT_H
+#define HAP_PLATFORM_EVENT_COALESCER_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAP.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * Event coalescer.
+ *
+ * Rate limits event notifications of rapidly changing characteristics, e.g., while a user drags a color wheel.
+ * The first change of a characteristic is raised immediately. Further changes within the coalescing window are
+ * merged into a single event that is raised when the window ends, so that at most one event per characteristic
+ * and window is sent to each subscribed session. As events carry no value, the latest value is read when the
+ * merged event is delivered.
+ *
+ * **Example**
+
+   @code{.c}
+   // Allocate event coalescer object.
+   static HAPPlatformEventCoalescer eventCoalescer;
+
+   // Initialize event coalescer object. Changes of the 'On' characteristic are never delayed.
+   static const HAPCharacteristic* const exemptCharacteristics[] = { &lightBulbOnCharacteristic, NULL };
+   HAPPlatformEventCoalescerCreate(&eventCoalescer, &(const HAPPlatformEventCoalescerOptions) {
+       .server = server,
+       .window = 100 * HAPMillisecond,
+       .exemptCharacteristics = exemptCharacteristics
+   });
+
+   // Raise an event.
+   HAPPlatformEventCoalescerRaiseEvent(&eventCoalescer, request->characteristic, request->service, request->accessory);
+
+   @endcode
+ */
+
+/**
+ * Maximum number of characteristics whose events can be coalesced at the same time.
+ */
+#define kHAPPlatformEventCoalescer_MaxCharacteristics ((size_t) CONFIG_HAP_EVENT_COALESCER_MAX_CHARACTERISTICS)
+
+/**
+ * Event coalescer initialization options.
+ */
+typedef struct {
+    /**
+     * Accessory server on which events are raised.
+     */
+    HAPAccessoryServerRef* server;
+
+    /**
+     * Coalescing window. 0 uses CONFIG_HAP_EVENT_COALESCER_WINDOW milliseconds.
+     */
+    HAPTime window;
+
+    /**
+     * NULL-terminated list of characteristics whose events are always raised immediately. Optional.
+     *
+     * - The list is not copied and must remain valid until the event coalescer is released.
+     */
+    const HAPCharacteristic* _Nullable const* _Nullable exemptCharacteristics;
+} HAPPlatformEventCoalescerOptions;
+
+// Opaque type. Do not use directly.
+/**@cond */
+typedef struct {
+    const HAPCharacteristic* _Nullable characteristic;
+    const HAPService* _Nullable service;
+    const HAPAccessory* _Nullable accessory;
+    HAPTime lastRaiseTime;
+    bool isPending;
+} HAPPlatformEventCoalescerEntry;
+/**@endcond */
+
+/**
+ * Event coalescer.
+ */
+typedef struct HAPPlatformEventCoalescer HAPPlatformEventCoalescer;
+typedef struct HAPPlatformEventCoalescer* HAPPlatformEventCoalescerRef;
+
+struct HAPPlatformEventCoalescer {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    HAPAccessoryServerRef* _Nullable server;
+    HAPTime window;
+    const HAPCharacteristic* _Nullable const* _Nullable exemptCharacteristics;
+
+    HAPPlatformEventCoalescerEntry entries[kHAPPlatformEventCoalescer_MaxCharacteristics];
+    HAPPlatformTimerRef timer;
+    HAPTime timerDeadline;
+
+    uint32_t numRaisedEvents;
+    uint32_t numCoalescedEvents;
+    /**@endcond */
+};
+
+/**
+ * Initializes an event coalescer.
+ *
+ * @param[out] eventCoalescer       Pointer to an allocated but uninitialized HAPPlatformEventCoalescer structure.
+ * @param      options              Initialization options.
+ */
+void HAPPlatformEventCoalescerCreate(
+        HAPPlatformEventCoalescerRef eventCoalescer,
+        const HAPPlatformEventCoalescerOptions* options);
+
+/**
+ * Releases resources associated with an initialized event coalescer.
+ *
+ * - Pending events are discarded.
+ *
+ * @param      eventCoalescer       Event coalescer.
+ */
+void HAPPlatformEventCoalescerRelease(HAPPlatformEventCoalescerRef eventCoalescer);
+
+/**
+ * Raises an event for a characteristic, merging it with other events of the same characteristic that are raised
+ * within the coalescing window.
+ *
+ * - Takes the same arguments as HAPAccessoryServerRaiseEvent and may be used in its place.
+ *
+ * @param      eventCoalescer       Event coalescer.
+ * @param      characteristic       The characteristic whose value has changed.
+ * @param      service              The service that contains the characteristic.
+ * @param      accessory            The accessory that provides the service.
+ */
+void HAPPlatformEventCoalescerRaiseEvent(
+        HAPPlatformEventCoalescerRef eventCoalescer,
+        const HAPCharacteristic* characteristic,
+        const HAPService* service,
+        const HAPAccessory* accessory);
+
+/**
+ * Immediately raises all pending events.
+ *
+ * @param      eventCoalescer       Event coalescer.
+ */
+void HAPPlatformEventCoalescerFlush(HAPPlatformEventCoalescerRef eventCoalescer);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
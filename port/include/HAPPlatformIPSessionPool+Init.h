@@ -0,0 +1,240 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_IP_SESSION_POOL_INIT_H
+#define HAP_PLATFORM_IP_SESSION_POOL_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAP.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * IP session buffer pool.
+ *
+ * Provides the inbound buffer, outbound buffer and event notification table of IP sessions on demand instead of
+ * reserving them statically for every session. A buffer set is mapped to a session when its TCP stream is
+ * accepted and returned to a shared pool when the TCP stream is closed. Buffer sets are only allocated when more
+ * TCP streams are open concurrently than ever before, so memory use follows the peak number of connected
+ * controllers instead of the configured maximum.
+ *
+ * **Coupling with the ADK**
+ *
+ * The ADK has no hook to hand buffers to a session when its TCP stream is accepted. The pool therefore relies on
+ * ADK-private behavior. The build fails if HAP_COMPATIBILITY_VERSION differs from
+ * kHAPPlatform_ADKCompatibilityVersion, but that version does not cover the behavior below. It has only been
+ * checked against the ADK commit that the homekit_adk submodule is pinned to. Re-check it before updating the
+ * submodule:
+ *
+ * - After HAPPlatformTCPStreamManagerAcceptTCPStream returns, the accessory server binds the TCP stream to the first
+ *   session whose HAPIPSessionDescriptor has no server set. It copies the buffers of that session into the
+ *   descriptor before it returns to the run loop.
+ *
+ * - Every acquired buffer set is mapped to exactly that session. Other sessions are left untouched.
+ *
+ * - The next acquisition verifies that the mapped session has been bound to the buffer set and that no two sessions
+ *   in use share a buffer set. If either check fails, an error is logged and the pool falls back to a buffer set
+ *   per session for the rest of its lifetime, as if the session buffers were allocated statically. Sessions that
+ *   are bound at that point keep their buffers until they are closed. TCP streams are rejected while not every
+ *   session has a buffer set of its own.
+ *
+ * - When the pool is created, all sessions are pointed at the first buffer set, because the accessory server
+ *   validates the buffers of every session when it is created.
+ *
+ * **Example**
+
+   @code{.c}
+   // Allocate IP session pool object.
+   static HAPPlatformIPSessionPool ipSessionPool;
+
+   // Initialize IP session pool object.
+   static HAPIPSession ipSessions[kHAPIPSessionStorage_MinimumNumElements];
+   HAPPlatformIPSessionPoolCreate(&ipSessionPool, &(const HAPPlatformIPSessionPoolOptions) {
+       .sessions = ipSessions,
+       .numSessions = HAPArrayCount(ipSessions),
+       .inboundBufferSize = kHAPIPSession_MinimumInboundBufferSize,
+       .outboundBufferSize = kHAPIPSession_MinimumOutboundBufferSize,
+       .numEventNotifications = kAttributeCount
+   });
+
+   // Hand the pool to the TCP stream manager.
+   HAPPlatformTCPStreamManagerCreate(&tcpStreamManager, &(const HAPPlatformTCPStreamManagerOptions) {
+       .port = kHAPNetworkPort_Any,
+       .maxConcurrentTCPStreams = HAPArrayCount(ipSessions),
+       .ipSessionPool = &ipSessionPool
+   });
+
+   @endcode
+ */
+
+/**
+ * IP session pool initialization options.
+ */
+typedef struct {
+    /**
+     * IP sessions of the accessory server storage. Their buffers are managed by the pool.
+     */
+    HAPIPSession* sessions;
+
+    /**
+     * Number of IP sessions.
+     */
+    size_t numSessions;
+
+    /**
+     * Size of the inbound buffer of a session in bytes.
+     */
+    size_t inboundBufferSize;
+
+    /**
+     * Size of the outbound buffer of a session in bytes.
+     */
+    size_t outboundBufferSize;
+
+    /**
+     * Number of event notifications of a session. Usually the number of attributes of the accessory.
+     */
+    size_t numEventNotifications;
+
+    /**
+     * Heap capabilities (MALLOC_CAP_*) used to allocate buffer sets. 0 uses MALLOC_CAP_8BIT.
+     */
+    uint32_t capabilities;
+} HAPPlatformIPSessionPoolOptions;
+
+/**
+ * IP session pool statistics.
+ */
+typedef struct {
+    /**
+     * Number of buffer sets that are currently mapped to a session.
+     */
+    size_t numBufferSetsInUse;
+
+    /**
+     * Maximum number of buffer sets that were mapped to sessions at the same time.
+     */
+    size_t maxBufferSetsInUse;
+
+    /**
+     * Number of buffer sets that have been allocated.
+     */
+    size_t numAllocatedBufferSets;
+
+    /**
+     * Size of a buffer set in bytes.
+     */
+    size_t numBufferSetBytes;
+} HAPPlatformIPSessionPoolStatistics;
+
+/**
+ * IP session pool.
+ */
+typedef struct HAPPlatformIPSessionPool HAPPlatformIPSessionPool;
+typedef struct HAPPlatformIPSessionPool* HAPPlatformIPSessionPoolRef;
+
+struct HAPPlatformIPSessionPool {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    HAPIPSession* _Nullable sessions;
+    size_t numSessions;
+    size_t inboundBufferSize;
+    size_t outboundBufferSize;
+    size_t numEventNotifications;
+    uint32_t capabilities;
+
+    void* _Nullable freeBufferSets;
+    void* _Nullable allocatedBufferSets;
+    void* _Nullable mappedBufferSet;
+    size_t mappedSessionIndex;
+    bool isFixedMapping;
+    size_t numFixedMappedSessions;
+    HAPPlatformIPSessionPoolStatistics statistics;
+    /**@endcond */
+};
+
+/**
+ * Initializes an IP session pool.
+ *
+ * - One buffer set is allocated when the pool is created. Further buffer sets are allocated on demand when TCP streams
+ *   are accepted.
+ *
+ * @param[out] ipSessionPool        Pointer to an allocated but uninitialized HAPPlatformIPSessionPool structure.
+ * @param      options              Initialization options.
+ */
+void HAPPlatformIPSessionPoolCreate(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        const HAPPlatformIPSessionPoolOptions* options);
+
+/**
+ * Releases resources associated with an initialized IP session pool.
+ *
+ * - All buffer sets must have been returned to the pool.
+ *
+ * @param      ipSessionPool        IP session pool.
+ */
+void HAPPlatformIPSessionPoolRelease(HAPPlatformIPSessionPoolRef ipSessionPool);
+
+/**
+ * Acquires a buffer set and maps it to the session that the accessory server binds the next accepted TCP stream to.
+ *
+ * @param      ipSessionPool        IP session pool.
+ * @param[out] bufferSet            Acquired buffer set. Must be passed to HAPPlatformIPSessionPoolReleaseBuffers.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If all sessions are in use or no memory is available.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformIPSessionPoolAcquireBuffers(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        void* _Nonnull* _Nonnull bufferSet);
+
+/**
+ * Returns a buffer set to the pool.
+ *
+ * @param      ipSessionPool        IP session pool.
+ * @param      bufferSet            Buffer set that was acquired with HAPPlatformIPSessionPoolAcquireBuffers.
+ */
+void HAPPlatformIPSessionPoolReleaseBuffers(HAPPlatformIPSessionPoolRef ipSessionPool, void* bufferSet);
+
+/**
+ * Fetches the statistics of an IP session pool.
+ *
+ * @param      ipSessionPool        IP session pool.
+ * @param[out] statistics           Statistics.
+ */
+void HAPPlatformIPSessionPoolGetStatistics(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        HAPPlatformIPSessionPoolStatistics* statistics);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
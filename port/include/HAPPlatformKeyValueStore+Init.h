@@ -25,6 +25,10 @@
 extern "C" {
 #endif
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <nvs.h>
+
 #include "HAPPlatform.h"
 
 #if __has_feature(nullability)
@@ -51,10 +55,27 @@ extern "C" {
    @endcode
  */
 
+/**
+ * Number of values that are cached in RAM per key-value store.
+ */
+#define kHAPPlatformKeyValueStore_NumCachedItems ((size_t) CONFIG_HAP_KVS_READ_CACHE_SIZE)
+
+/**
+ * Number of NVS handles that are kept open per key-value store.
+ */
+#define kHAPPlatformKeyValueStore_NumCachedHandles ((size_t) CONFIG_HAP_KVS_MAX_OPEN_HANDLES)
+
+/**
+ * Number of domains whose keys are indexed in RAM per key-value store.
+ */
+#define kHAPPlatformKeyValueStore_NumIndexedDomains ((size_t) CONFIG_HAP_KVS_MAX_INDEXED_DOMAINS)
+
 /**
  * Key-value store item.
  *
- * - Each item stores the value of one key in RAM. Values are not stored persistently.
+ * - Each item stores the value of one key in RAM. Items are used as a read cache in front of NVS.
+ *
+ * - HAPPlatformKeyValueStoreSet does not write a value to flash if it equals the cached item of the key.
  */
 typedef struct {
     // Opaque type. Do not access the instance fields directly.
@@ -62,11 +83,69 @@ typedef struct {
     bool active;
     HAPPlatformKeyValueStoreDomain domain;
     HAPPlatformKeyValueStoreKey key;
+    uint32_t lastAccess;
     size_t numBytes;
     uint8_t bytes[128];
     /**@endcond */
 } HAPPlatformKeyValueStoreItem;
 
+/**
+ * Open NVS handle of a key-value store domain.
+ */
+typedef struct {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    bool active;
+    HAPPlatformKeyValueStoreDomain domain;
+    uint32_t lastAccess;
+    nvs_handle store_handle;
+    /**@endcond */
+} HAPPlatformKeyValueStoreHandle;
+
+/**
+ * Index of the keys that are present in a key-value store domain.
+ */
+typedef struct {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    bool active;
+    HAPPlatformKeyValueStoreDomain domain;
+    uint8_t keys[32];
+    /**@endcond */
+} HAPPlatformKeyValueStoreDomainIndex;
+
+/**
+ * Key-value store statistics.
+ */
+typedef struct {
+    /** Number of Get calls. */
+    uint32_t numGets;
+
+    /** Number of Get calls that were answered from the read cache. */
+    uint32_t numCacheHits;
+
+    /** Number of Get calls that were answered from the key index. */
+    uint32_t numIndexHits;
+
+    /** Number of values that were read from NVS. */
+    uint32_t numNVSReads;
+
+    /** Number of values that were written to NVS. */
+    uint32_t numNVSWrites;
+
+    /** Number of Set calls that were skipped because the value did not change. */
+    uint32_t numSkippedWrites;
+
+    /** Number of keys and namespaces that were erased from NVS. */
+    uint32_t numNVSErases;
+
+    /** Number of NVS commits. */
+    uint32_t numNVSCommits;
+
+    /** Number of NVS handles that were opened. */
+    uint32_t numNVSOpens;
+} HAPPlatformKeyValueStoreStatistics;
+
 /**
  * Key-value store initialization options.
  */
@@ -93,6 +172,15 @@ struct HAPPlatformKeyValueStore {
     const char *part_name;
     const char *namespace_prefix;
     bool read_only;
+
+    SemaphoreHandle_t _Nullable lock;
+    StaticSemaphore_t lockStorage;
+    uint32_t numAccesses;
+    HAPPlatformKeyValueStoreHandle handles[kHAPPlatformKeyValueStore_NumCachedHandles];
+    HAPPlatformKeyValueStoreItem items[kHAPPlatformKeyValueStore_NumCachedItems];
+    HAPPlatformKeyValueStoreDomainIndex indexes[kHAPPlatformKeyValueStore_NumIndexedDomains];
+    uint8_t unindexedDomains[32];
+    HAPPlatformKeyValueStoreStatistics statistics;
     /**@endcond */
 };
 
@@ -106,6 +194,16 @@ void HAPPlatformKeyValueStoreCreate(
         HAPPlatformKeyValueStoreRef keyValueStore,
         const HAPPlatformKeyValueStoreOptions* options);
 
+/**
+ * Gets statistics of the key-value store since it was initialized.
+ *
+ * @param      keyValueStore        Key-value store.
+ * @param[out] statistics           Statistics.
+ */
+void HAPPlatformKeyValueStoreGetStatistics(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreStatistics* statistics);
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
@@ -51,6 +51,44 @@ void HAPPlatformLogPOSIXError(
         const char* file,
         int line);
 
+/**
+ * Sets the log types that are enabled for log objects of a subsystem and category at runtime.
+ *
+ * - Log objects without a matching rule use the level configured by CONFIG_HAP_LOG_LEVEL.
+ *   If multiple rules match, a rule with both subsystem and category wins over a category rule,
+ *   which wins over a subsystem rule.
+ *
+ * - Messages of log types that are compiled out (see CONFIG_HAP_LOG_COMPILE_ALLOWLIST) cannot be enabled.
+ *
+ * - The subsystem and category strings must remain valid while the rule is in effect.
+ *
+ * **Example**
+
+   @code{.c}
+
+   // Debug the TCP stream manager only.
+   HAPPlatformLogSetEnabledTypes(kHAPPlatform_LogSubsystem, "TCPStreamManager", kHAPPlatformLogEnabledTypes_Debug);
+
+   @endcode
+ *
+ * @param      subsystem            Subsystem. NULL matches any subsystem.
+ * @param      category             Category. NULL matches any category.
+ * @param      enabledTypes         Enabled log types.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If CONFIG_HAP_LOG_MAX_CATEGORY_RULES rules are already in effect.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformLogSetEnabledTypes(
+        const char* _Nullable subsystem,
+        const char* _Nullable category,
+        HAPPlatformLogEnabledTypes enabledTypes);
+
+/**
+ * Removes all rules set with HAPPlatformLogSetEnabledTypes and CONFIG_HAP_LOG_CATEGORY_LEVELS.
+ */
+void HAPPlatformLogResetEnabledTypes(void);
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
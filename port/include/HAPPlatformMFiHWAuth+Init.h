@@ -31,14 +31,42 @@ extern "C" {
 #pragma clang assume_nonnull begin
 #endif
 
+/**
+ * Number of bytes of constant registers that are cached. Fits the accessory certificate and the version and
+ * device ID registers.
+ */
+#define kHAPPlatformMFiHWAuth_CacheSize ((size_t) 1296)
+
+/**
+ * Maximum number of cached register reads.
+ */
+#define kHAPPlatformMFiHWAuth_MaxCachedRegisters ((size_t) 20)
+
+// Opaque type. Do not use directly.
+/**@cond */
+typedef struct {
+    uint16_t offset;
+    uint16_t numBytes;
+    uint8_t registerAddress;
+} HAPPlatformMFiHWAuthCachedRegister;
+/**@endcond */
+
 /**
  * Apple Authentication Coprocessor provider.
+ *
+ * - Registers that never change, e.g., the accessory certificate, are read from the coprocessor once and then
+ *   served from RAM.
  */
 struct HAPPlatformMFiHWAuth {
     // Opaque type. Do not access the instance fields directly.
     /**@cond */
     uint8_t slaveAddr;
     bool poweredOn;
+
+    HAPPlatformMFiHWAuthCachedRegister cachedRegisters[kHAPPlatformMFiHWAuth_MaxCachedRegisters];
+    size_t numCachedRegisters;
+    uint8_t cacheBytes[kHAPPlatformMFiHWAuth_CacheSize];
+    uint16_t numCacheBytes;
     /**@endcond */
 };
 
@@ -0,0 +1,206 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_PERSISTED_STATE_INIT_H
+#define HAP_PLATFORM_PERSISTED_STATE_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "HAPPlatform.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * Debounced persistence of application state in a key-value store.
+ *
+ * Instead of writing its state to flash after every change, an application marks the state dirty.
+ * The state is flushed once no further change happened for a quiet period, but at the latest after a maximum
+ * delay since the first unflushed change. The state is compared against the last flushed copy, so unchanged state
+ * is never written. Pending changes are flushed synchronously before a software restart (esp_restart).
+ *
+ * A brownout resets the chip without running shutdown handlers, and flash must not be written while the supply
+ * voltage drops. The maximum delay bounds how many changes may be lost in that case.
+ *
+ * - Flushes are scheduled on the run loop, where accessory request handlers run.
+ *   Applications that modify the state from other tasks must synchronize those modifications themselves.
+ *
+ * **Example**
+
+   @code{.c}
+
+   // Allocate persisted state object.
+   static HAPPlatformPersistedState persistedState;
+   static State flushedState;
+
+   // Initialize persisted state object.
+   HAPPlatformPersistedStateCreate(&persistedState, &(const HAPPlatformPersistedStateOptions) {
+       .keyValueStore = keyValueStore,
+       .domain = kAppKeyValueStoreDomain_Configuration,
+       .key = kAppKeyValueStoreKey_Configuration_State,
+       .bytes = &state,
+       .flushedBytes = &flushedState,
+       .numBytes = sizeof state
+   });
+
+   // Modify the state.
+   state.on = true;
+   HAPPlatformPersistedStateMarkDirty(&persistedState);
+
+   @endcode
+ */
+
+/**
+ * Persisted state initialization options.
+ */
+typedef struct {
+    /**
+     * Key-value store in which the state is stored.
+     */
+    HAPPlatformKeyValueStoreRef keyValueStore;
+
+    /**
+     * Key-value store domain of the state.
+     */
+    HAPPlatformKeyValueStoreDomain domain;
+
+    /**
+     * Key-value store key of the state.
+     */
+    HAPPlatformKeyValueStoreKey key;
+
+    /**
+     * State. Must remain valid while the persisted state is initialized.
+     */
+    const void* bytes;
+
+    /**
+     * Buffer holding a copy of the last flushed state. Must remain valid while the persisted state is initialized.
+     */
+    void* flushedBytes;
+
+    /**
+     * Length of the state and of the flushed state buffer.
+     */
+    size_t numBytes;
+
+    /**
+     * Time without changes after which the state is flushed. 0 uses CONFIG_HAP_PERSISTED_STATE_QUIET_PERIOD.
+     */
+    HAPTime quietPeriod;
+
+    /**
+     * Maximum time after the first unflushed change after which the state is flushed.
+     * 0 uses CONFIG_HAP_PERSISTED_STATE_MAX_DELAY.
+     */
+    HAPTime maxDelay;
+} HAPPlatformPersistedStateOptions;
+
+/**
+ * Persisted state.
+ */
+typedef struct HAPPlatformPersistedState HAPPlatformPersistedState;
+typedef struct HAPPlatformPersistedState* HAPPlatformPersistedStateRef;
+
+struct HAPPlatformPersistedState {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    HAPPlatformKeyValueStoreRef _Nullable keyValueStore;
+    HAPPlatformKeyValueStoreDomain domain;
+    HAPPlatformKeyValueStoreKey key;
+    const void* _Nullable bytes;
+    void* _Nullable flushedBytes;
+    size_t numBytes;
+    HAPTime quietPeriod;
+    HAPTime maxDelay;
+
+    SemaphoreHandle_t _Nullable lock;
+    StaticSemaphore_t lockStorage;
+    esp_timer_handle_t _Nullable timer;
+    bool hasFlushedBytes : 1;
+    bool isDirty : 1;
+    int64_t dirtyTime;
+
+    uint32_t numWrites;
+    uint32_t numSkippedWrites;
+
+    struct HAPPlatformPersistedState* _Nullable nextPersistedState;
+    /**@endcond */
+};
+
+/**
+ * Initializes a persisted state.
+ *
+ * - Must be called on the run loop. The last flushed state is initialized from the key-value store. The state itself is not modified.
+ *
+ * @param[out] persistedState       Pointer to an allocated but uninitialized HAPPlatformPersistedState structure.
+ * @param      options              Initialization options.
+ */
+void HAPPlatformPersistedStateCreate(
+        HAPPlatformPersistedStateRef persistedState,
+        const HAPPlatformPersistedStateOptions* options);
+
+/**
+ * Releases resources associated with an initialized persisted state.
+ *
+ * - Must be called on the run loop. Pending changes are flushed.
+ *
+ * @param      persistedState       Persisted state.
+ */
+void HAPPlatformPersistedStateRelease(HAPPlatformPersistedStateRef persistedState);
+
+/**
+ * Marks the state as modified. The state is flushed after the quiet period or the maximum delay.
+ *
+ * - May be called from any task.
+ *
+ * @param      persistedState       Persisted state.
+ */
+void HAPPlatformPersistedStateMarkDirty(HAPPlatformPersistedStateRef persistedState);
+
+/**
+ * Immediately flushes pending changes.
+ *
+ * - May be called from any task.
+ *
+ * @param      persistedState       Persisted state.
+ *
+ * @return kHAPError_None           If successful or if there were no pending changes.
+ * @return kHAPError_Unknown        If writing to the key-value store failed. The flush is retried later.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformPersistedStateFlush(HAPPlatformPersistedStateRef persistedState);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -38,6 +38,13 @@ extern "C" {
  * - HAPPlatformRunLoop
  * - HAPPlatformTimer
  * - HAPPlatformFileHandle (POSIX-specific)
+ *
+ * Callbacks passed to HAPPlatformRunLoopScheduleCallback are queued in a fixed-size ring
+ * (CONFIG_HAP_RUN_LOOP_CALLBACK_QUEUE_SIZE) and the run loop is woken up with a loopback UDP datagram.
+ * - The ring is guarded by a portMUX critical section. It is not lock-free.
+ * - HAPPlatformRunLoopScheduleCallback may be called from any task but not from an ISR.
+ * - If the wakeup datagram cannot be sent, the callbacks stay queued and the datagram is sent again from an
+ *   esp_timer every 10 ms until it succeeds or the run loop drains the ring.
  */
 
 /**
@@ -50,6 +57,168 @@ typedef struct {
     HAPPlatformKeyValueStoreRef keyValueStore;
 } HAPPlatformRunLoopOptions;
 
+/**
+ * Run loop power statistics.
+ */
+typedef struct {
+    /**
+     * Time, in microseconds, spent waiting for timers and file descriptors.
+     *
+     * - With CONFIG_HAP_RUN_LOOP_PM the run loop does not hold its power management lock during that time,
+     *   so the chip may enter automatic light sleep.
+     */
+    int64_t idleTime;
+
+    /**
+     * Time, in microseconds, spent dispatching timer, file handle and scheduled callbacks.
+     */
+    int64_t activeTime;
+
+    /**
+     * Number of times the run loop woke up.
+     */
+    uint32_t numWakeups;
+} HAPPlatformRunLoopPowerStatistics;
+
+/**
+ * Registers a timer that may fire up to a given amount of time after its deadline.
+ *
+ * - Timers are coalesced: the run loop wakes up at the latest time that satisfies every registered timer,
+ *   and all timers whose deadline has passed at that time fire together, in order of their deadlines.
+ *
+ * - HAPPlatformTimerRegister uses a leeway of CONFIG_HAP_RUN_LOOP_TIMER_LEEWAY milliseconds.
+ *
+ * @param[out] timer                Non-zero timer object, if successful.
+ * @param      deadline             Deadline after which the timer expires.
+ * @param      leeway               Amount of time by which the timer may fire late.
+ * @param      callback             Function to call when the timer expires.
+ * @param      context              Context that is passed to the callback.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If not enough resources to allocate timer.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTimerRegisterWithLeeway(
+        HAPPlatformTimerRef* timer,
+        HAPTime deadline,
+        HAPTime leeway,
+        HAPPlatformTimerCallback callback,
+        void* _Nullable context);
+
+/**
+ * Gets the power statistics of the run loop.
+ *
+ * @param[out] statistics           Power statistics.
+ */
+void HAPPlatformRunLoopGetPowerStatistics(HAPPlatformRunLoopPowerStatistics* statistics);
+
+/**
+ * Number of buckets of a run loop histogram.
+ */
+#define kHAPPlatformRunLoopHistogram_NumBuckets ((size_t) 20)
+
+/**
+ * Histogram with power-of-two buckets.
+ *
+ * - Bucket 0 counts samples with value 0. Bucket i counts samples in the range [2^(i - 1), 2^i).
+ *   The last bucket also counts all larger samples.
+ */
+typedef struct {
+    /**
+     * Number of samples per bucket.
+     */
+    uint32_t buckets[kHAPPlatformRunLoopHistogram_NumBuckets];
+
+    /**
+     * Total number of samples.
+     */
+    uint32_t numSamples;
+
+    /**
+     * Sum of all samples.
+     */
+    uint64_t sum;
+
+    /**
+     * Largest sample.
+     */
+    uint32_t maxValue;
+} HAPPlatformRunLoopHistogram;
+
+/**
+ * Run loop dispatch statistics.
+ *
+ * - Only collected with CONFIG_HAP_RUN_LOOP_STATISTICS.
+ */
+typedef struct {
+    /**
+     * Number of wakeups with at least one expired timer.
+     */
+    uint32_t numTimerWakeups;
+
+    /**
+     * Number of wakeups with at least one ready file handle, excluding the loopback.
+     */
+    uint32_t numFileHandleWakeups;
+
+    /**
+     * Number of wakeups with scheduled callbacks pending.
+     */
+    uint32_t numLoopbackWakeups;
+
+    /**
+     * Time spent per file handle callback, in microseconds.
+     */
+    HAPPlatformRunLoopHistogram fileHandleCallbackDuration;
+
+    /**
+     * Time spent per expired timer callback, in microseconds.
+     */
+    HAPPlatformRunLoopHistogram timerCallbackDuration;
+
+    /**
+     * Time spent per scheduled callback, in microseconds.
+     */
+    HAPPlatformRunLoopHistogram scheduledCallbackDuration;
+
+    /**
+     * Difference between the time a timer fired and its deadline, in milliseconds.
+     */
+    HAPPlatformRunLoopHistogram timerLateness;
+
+    /**
+     * Number of scheduled callbacks pending when the run loop starts draining them.
+     */
+    HAPPlatformRunLoopHistogram loopbackQueueDepth;
+} HAPPlatformRunLoopStatistics;
+
+/**
+ * Gets the dispatch statistics of the run loop.
+ *
+ * - Must be called from the run loop.
+ *
+ * @param[out] statistics           Dispatch statistics. Zeroed if CONFIG_HAP_RUN_LOOP_STATISTICS is disabled.
+ */
+void HAPPlatformRunLoopGetStatistics(HAPPlatformRunLoopStatistics* statistics);
+
+/**
+ * Resets the dispatch statistics of the run loop.
+ *
+ * - Must be called from the run loop.
+ */
+void HAPPlatformRunLoopResetStatistics(void);
+
+/**
+ * Returns an upper bound of a given percentile of a histogram.
+ *
+ * @param      histogram            Histogram.
+ * @param      percentile           Percentile (0-100).
+ *
+ * @return Upper bound of the bucket containing the percentile, capped at the largest sample.
+ */
+HAP_RESULT_USE_CHECK
+uint32_t HAPPlatformRunLoopHistogramGetPercentile(const HAPPlatformRunLoopHistogram* histogram, unsigned int percentile);
+
 /**
  * Create run loop.
  */
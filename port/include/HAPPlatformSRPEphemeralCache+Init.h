@@ -0,0 +1,246 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HAP_PLATFORM_SRP_EPHEMERAL_CACHE_INIT_H
+#define HAP_PLATFORM_SRP_EPHEMERAL_CACHE_INIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAP.h"
+#include "HAPCrypto.h"
+#include "HAPPlatform.h"
+#include "HAPPlatformCryptoExecutor+Init.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * One-slot cache of precomputed SRP ephemeral keys for Pair Setup.
+ *
+ * Pair Setup M2 needs a fresh SRP-3072 server key pair (b, B = kv + g^b mod N). The modular exponentiation is the
+ * largest latency of pairing a new controller. This cache computes the next key pair on the crypto executor while
+ * the accessory is idle and unpaired, so that M2 can be answered right away.
+ *
+ * - A key pair is computed for one verifier. It is only handed out for that verifier, and only once.
+ *
+ * - A computation that is running while the cache is discarded is dropped when it completes.
+ *
+ * - With CONFIG_HAP_CRYPTO_SRP_EPHEMERAL_CACHE, HAP_srp_public_key of the crypto PAL is redirected to the cache with
+ *   -Wl,--wrap (see CMakeLists.txt). Pair Setup generates b into its own state right before deriving B, and reads
+ *   it back from there afterwards. On a hit, b is replaced by the precomputed one, which is just as random, and B is
+ *   copied. On a miss, B is derived from the generated b on the run loop as before. Either way, a key pair for the
+ *   next attempt is computed after kHAPPlatformSRPEphemeralCache_RefillDelay, so that the computation does not compete
+ *   with the remaining Pair Setup steps for the MPI accelerator.
+ *
+ * - Replacing b relies on ADK-private state: HAP_srp_public_key must be called with the pairSetup.b buffer of the
+ *   HAPAccessoryServer structure, after Pair Setup has generated b and before it reads b back. Neither the layout
+ *   of that structure nor this call order is covered by HAP_COMPATIBILITY_VERSION. The redirection has only been
+ *   checked against the ADK commit that the homekit_adk submodule is pinned to, and CMakeLists.txt refuses to
+ *   enable it for any other checkout. Source trees without git metadata cannot be checked and only get a warning.
+ *   Re-check these assumptions before updating the submodule. At runtime, b is
+ *   only replaced if it is exactly that buffer of the configured accessory server. Any other call is passed to the
+ *   crypto PAL unchanged.
+ *
+ * - CONFIG_HAP_CRYPTO_SRP_EPHEMERAL_CACHE is disabled by default.
+ *
+ * - Only one SRP ephemeral cache may be initialized at a time.
+ *
+ * **Example**
+
+   @code{.c}
+   // Allocate SRP ephemeral cache object.
+   static HAPPlatformSRPEphemeralCache srpEphemeralCache;
+
+   // Initialize SRP ephemeral cache object.
+   HAPPlatformSRPEphemeralCacheCreate(&srpEphemeralCache, &(const HAPPlatformSRPEphemeralCacheOptions) {
+       .cryptoExecutor = &cryptoExecutor,
+       .server = &accessoryServer
+   });
+
+   // While the accessory is idle and unpaired.
+   HAPSetupInfo setupInfo;
+   HAPPlatformAccessorySetupLoadSetupInfo(&accessorySetup, &setupInfo);
+   HAPError err = HAPPlatformSRPEphemeralCacheRefill(&srpEphemeralCache, setupInfo.verifier);
+
+   @endcode
+ */
+
+/**
+ * Delay after Pair Setup M2 before the key pair for the next attempt is computed.
+ */
+#define kHAPPlatformSRPEphemeralCache_RefillDelay ((HAPTime)(10 * HAPSecond))
+
+/**
+ * SRP ephemeral key pair.
+ */
+typedef struct {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    uint8_t verifier[SRP_VERIFIER_BYTES];
+    uint8_t b[SRP_SECRET_KEY_BYTES];
+    uint8_t B[SRP_PUBLIC_KEY_BYTES];
+    /**@endcond */
+} HAPPlatformSRPEphemeralKeyPair;
+
+/**
+ * SRP ephemeral cache initialization options.
+ */
+typedef struct {
+    /**
+     * Crypto executor on which key pairs are computed.
+     */
+    HAPPlatformCryptoExecutorRef cryptoExecutor;
+
+    /**
+     * Accessory server whose Pair Setup is served from the cache. Does not need to be initialized yet.
+     */
+    HAPAccessoryServerRef* server;
+} HAPPlatformSRPEphemeralCacheOptions;
+
+/**
+ * SRP ephemeral cache statistics.
+ */
+typedef struct {
+    /**
+     * Number of precomputed key pairs that were handed out.
+     */
+    size_t numHits;
+
+    /**
+     * Number of times no precomputed key pair was available.
+     */
+    size_t numMisses;
+
+    /**
+     * Number of key pairs that were computed.
+     */
+    size_t numComputedKeyPairs;
+} HAPPlatformSRPEphemeralCacheStatistics;
+
+/**
+ * SRP ephemeral cache.
+ */
+typedef struct HAPPlatformSRPEphemeralCache HAPPlatformSRPEphemeralCache;
+typedef struct HAPPlatformSRPEphemeralCache* HAPPlatformSRPEphemeralCacheRef;
+
+struct HAPPlatformSRPEphemeralCache {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    HAPPlatformCryptoExecutorRef _Nullable cryptoExecutor;
+    HAPAccessoryServerRef* _Nullable server;
+    HAPPlatformSRPEphemeralKeyPair keyPair;
+    HAPPlatformSRPEphemeralKeyPair pendingKeyPair;
+    uint8_t refillVerifier[SRP_VERIFIER_BYTES];
+    HAPPlatformTimerRef refillTimer;
+    uint32_t generation;
+    bool isKeyPairAvailable : 1;
+    bool isComputing : 1;
+    bool isRefillPending : 1;
+    HAPPlatformSRPEphemeralCacheStatistics statistics;
+    /**@endcond */
+};
+
+/**
+ * Initializes an SRP ephemeral cache. No key pair is computed until HAPPlatformSRPEphemeralCacheRefill is called.
+ *
+ * @param[out] srpEphemeralCache    Pointer to an allocated but uninitialized HAPPlatformSRPEphemeralCache structure.
+ * @param      options              Initialization options.
+ */
+void HAPPlatformSRPEphemeralCacheCreate(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        const HAPPlatformSRPEphemeralCacheOptions* options);
+
+/**
+ * Releases resources associated with an initialized SRP ephemeral cache.
+ *
+ * - The crypto executor must have been released first, so that no computation is running. A completion that is
+ *   still scheduled on the run loop is ignored.
+ *
+ * @param      srpEphemeralCache    SRP ephemeral cache.
+ */
+void HAPPlatformSRPEphemeralCacheRelease(HAPPlatformSRPEphemeralCacheRef srpEphemeralCache);
+
+/**
+ * Starts computing a key pair for a verifier unless one is available or being computed already.
+ *
+ * - Must be called on the run loop. A key pair for a different verifier is discarded.
+ *
+ * - If a key pair for a different verifier is being computed, it is dropped when it completes, and the computation
+ *   for the new verifier is started then.
+ *
+ * @param      srpEphemeralCache    SRP ephemeral cache.
+ * @param      verifier             SRP verifier of the current setup code.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If the job queue of the crypto executor is full.
+ */
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformSRPEphemeralCacheRefill(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        const uint8_t verifier[_Nonnull SRP_VERIFIER_BYTES]);
+
+/**
+ * Takes the precomputed key pair for a verifier. The key pair is removed from the cache.
+ *
+ * @param      srpEphemeralCache    SRP ephemeral cache.
+ * @param      verifier             SRP verifier of the current setup code.
+ * @param[out] b                    SRP private key.
+ * @param[out] B                    SRP public key.
+ *
+ * @return true                     If a key pair for the verifier was available.
+ * @return false                    Otherwise. The key pair must be computed by the caller.
+ */
+HAP_RESULT_USE_CHECK
+bool HAPPlatformSRPEphemeralCacheTake(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        const uint8_t verifier[_Nonnull SRP_VERIFIER_BYTES],
+        uint8_t b[_Nonnull SRP_SECRET_KEY_BYTES],
+        uint8_t B[_Nonnull SRP_PUBLIC_KEY_BYTES]);
+
+/**
+ * Discards the precomputed key pair, any running computation and any scheduled refill, e.g., when the accessory has
+ * been paired or the setup code changed.
+ *
+ * @param      srpEphemeralCache    SRP ephemeral cache.
+ */
+void HAPPlatformSRPEphemeralCacheDiscard(HAPPlatformSRPEphemeralCacheRef srpEphemeralCache);
+
+/**
+ * Fetches the statistics of an SRP ephemeral cache.
+ *
+ * @param      srpEphemeralCache    SRP ephemeral cache.
+ * @param[out] statistics           Statistics.
+ */
+void HAPPlatformSRPEphemeralCacheGetStatistics(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        HAPPlatformSRPEphemeralCacheStatistics* statistics);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,8 +25,12 @@
 extern "C" {
 #endif
 
+#include <esp_event.h>
+#include <sdkconfig.h>
+
 #include "HAPPlatform.h"
 #include "HAPPlatformFileHandle.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
 
 #if __has_feature(nullability)
 #pragma clang assume_nonnull begin
@@ -46,11 +50,35 @@ extern "C" {
    HAPPlatformServiceDiscoveryCreate(&platform.serviceDiscovery,
        &(const HAPPlatformServiceDiscoveryOptions) {
            // Register services on all available network interfaces.
-           .hostname = NULL
+           .hostName = NULL,
+           .tcpStreamManager = &platform.tcpStreamManager
        });
 
    @endcode
+ *
+ * - When the station acquires an IP address, e.g., after a Wi-Fi reconnect, the registered service is announced
+ *   immediately and then CONFIG_HAP_SERVICE_DISCOVERY_REANNOUNCE_COUNT more times with a doubling interval. If the
+ *   address changed, the host name and service are probed again first. The TCP stream listener is bound to all
+ *   addresses and keeps running in either case.
+ *
+ * - If a TCP stream manager is given, the time from acquiring the IP address to the first response written to a
+ *   controller is measured. See HAPPlatformServiceDiscoveryGetRediscoveryStatistics.
+ */
+
+/**
+ * Maximum number of TXT records whose published values are tracked per service discovery object.
+ */
+#define kHAPPlatformServiceDiscovery_MaxTXTRecords ((size_t) CONFIG_HAP_SERVICE_DISCOVERY_MAX_TXT_RECORDS)
+
+/**
+ * Number of bytes available for the published TXT record values, including a terminating NUL per value.
+ */
+#define kHAPPlatformServiceDiscovery_TXTBufferSize ((size_t) CONFIG_HAP_SERVICE_DISCOVERY_TXT_BUFFER_SIZE)
+
+/**
+ * Maximum length of a tracked TXT record key, excluding the terminating NUL.
  */
+#define kHAPPlatformServiceDiscovery_MaxTXTRecordKeyLength ((size_t) 15)
 
 /**
  * Service discovery initialization options.
@@ -60,16 +88,95 @@ typedef struct {
      * Hostname. A value of NULL means use default hostname.
      */
     char *_Nullable hostName;
+
+    /**
+     * TCP stream manager that serves the registered service. Optional.
+     *
+     * - If set, the time from acquiring an IP address to the first controller response is measured.
+     */
+    HAPPlatformTCPStreamManagerRef _Nullable tcpStreamManager;
 } HAPPlatformServiceDiscoveryOptions;
 
+/**
+ * Rediscovery statistics of service discovery.
+ *
+ * - Measures the time from the station acquiring an IP address, e.g., after a Wi-Fi reconnect, until the first
+ *   response is written to a controller on any TCP stream.
+ */
+typedef struct {
+    /**
+     * Number of times the station acquired an IP address.
+     */
+    uint32_t numIPAcquisitions;
+
+    /**
+     * Number of IP acquisitions that were followed by a controller response.
+     */
+    uint32_t numMeasurements;
+
+    /**
+     * Time from the most recent measured IP acquisition to the first controller response.
+     */
+    HAPTime lastTimeToFirstResponse;
+
+    /**
+     * Longest measured time from an IP acquisition to the first controller response.
+     */
+    HAPTime maxTimeToFirstResponse;
+} HAPPlatformServiceDiscoveryRediscoveryStatistics;
+
+/**
+ * Published TXT record.
+ */
+typedef struct {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    char key[kHAPPlatformServiceDiscovery_MaxTXTRecordKeyLength + 1];
+    uint16_t valueOffset;
+    uint16_t numValueBytes;
+    /**@endcond */
+} HAPPlatformServiceDiscoveryTXTRecordEntry;
+
+/**
+ * Set of published TXT records.
+ */
+typedef struct {
+    // Opaque type. Do not access the instance fields directly.
+    /**@cond */
+    HAPPlatformServiceDiscoveryTXTRecordEntry records[kHAPPlatformServiceDiscovery_MaxTXTRecords];
+    size_t numRecords;
+    char values[kHAPPlatformServiceDiscovery_TXTBufferSize];
+    /**@endcond */
+} HAPPlatformServiceDiscoveryTXTRecordTable;
+
 /**
  * Service discovery.
  */
 struct HAPPlatformServiceDiscovery {
     // Opaque type. Do not access the instance fields directly.
     /**@cond */
+    char hostName[64];
+    char protocol[64];
     char serv_type[32];
     char proto[32];
+    bool isRegistered : 1;
+
+    /**
+     * TXT records that are currently published, and scratch space for the next update.
+     * Updates are diffed against the published table so that only changed keys reach the mdns component.
+     */
+    HAPPlatformServiceDiscoveryTXTRecordTable txtRecordTables[2];
+    uint8_t publishedTXTRecordTable;
+    bool isPublishedTXTRecordTableValid : 1;
+
+    esp_event_handler_instance_t _Nullable ipEventHandler;
+    HAPPlatformTimerRef reannounceTimer;
+    HAPTime reannounceInterval;
+    uint8_t numReannouncementsRemaining;
+
+    HAPPlatformTCPStreamManagerRef _Nullable tcpStreamManager;
+    HAPTime ipAcquisitionTime;
+    HAPPlatformServiceDiscoveryRediscoveryStatistics rediscoveryStatistics;
     /**@endcond */
 };
 
@@ -83,6 +190,27 @@ void HAPPlatformServiceDiscoveryCreate(
         HAPPlatformServiceDiscoveryRef serviceDiscovery,
         const HAPPlatformServiceDiscoveryOptions* options);
 
+/**
+ * Releases resources associated with an initialized service discovery instance.
+ *
+ * - IMPORTANT: Do not use this method on service discovery structures that are not initialized!
+ *
+ * @param      serviceDiscovery     Service discovery.
+ */
+void HAPPlatformServiceDiscoveryRelease(HAPPlatformServiceDiscoveryRef serviceDiscovery);
+
+/**
+ * Gets the rediscovery statistics of service discovery.
+ *
+ * - Zero if no TCP stream manager was given in the initialization options.
+ *
+ * @param      serviceDiscovery     Service discovery.
+ * @param[out] statistics           Rediscovery statistics.
+ */
+void HAPPlatformServiceDiscoveryGetRediscoveryStatistics(
+        HAPPlatformServiceDiscoveryRef serviceDiscovery,
+        HAPPlatformServiceDiscoveryRediscoveryStatistics* statistics);
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
@@ -28,6 +28,7 @@ extern "C" {
 #include <net/if.h>
 
 #include "HAPPlatform.h"
+#include "HAPPlatformArena+Init.h"
 #include "HAPPlatformFileHandle.h"
 
 #if __has_feature(nullability)
@@ -75,6 +76,55 @@ typedef struct {
      * Maximum number of concurrent TCP streams.
      */
     size_t maxConcurrentTCPStreams;
+
+    /**
+     * TCP keepalive configuration of accepted TCP streams.
+     *
+     * - Dead connections, e.g., from controllers that left the network, are detected and closed by lwIP.
+     */
+    struct {
+        /**
+         * Idle time in seconds before the first keepalive probe is sent.
+         * 0 uses CONFIG_HAP_TCP_STREAM_KEEPALIVE_IDLE. Keepalive is disabled if both are 0.
+         */
+        uint32_t idleTime;
+
+        /**
+         * Interval in seconds between keepalive probes. 0 uses CONFIG_HAP_TCP_STREAM_KEEPALIVE_INTERVAL.
+         */
+        uint32_t interval;
+
+        /**
+         * Number of unanswered keepalive probes after which the connection is dropped.
+         * 0 uses CONFIG_HAP_TCP_STREAM_KEEPALIVE_COUNT.
+         */
+        uint32_t count;
+    } keepAlive;
+
+    /**
+     * Minimum time a TCP stream must have been inactive before it may be evicted.
+     *
+     * - When all TCP streams are in use and a new connection is pending, the least recently active TCP stream that
+     *   has been inactive for at least this duration is shut down so that its slot becomes available.
+     *
+     * - 0 uses CONFIG_HAP_TCP_STREAM_EVICTION_IDLE_TIME. Eviction is disabled if both are 0.
+     */
+    HAPTime evictionIdleTime;
+
+    /**
+     * Arena from which the TCP stream storage is allocated. NULL to allocate it from the internal heap.
+     *
+     * - The arena must stay valid until the TCP stream manager is released.
+     */
+    HAPPlatformArenaRef _Nullable arena;
+
+    /**
+     * IP session pool that provides the session buffers of accepted TCP streams. NULL if the session buffers are
+     * allocated statically.
+     *
+     * - Accepting a TCP stream fails with kHAPError_OutOfResources if no session buffers are available.
+     */
+    struct HAPPlatformIPSessionPool* _Nullable ipSessionPool;
 } HAPPlatformTCPStreamManagerOptions;
 
 // Opaque type. Do not use directly.
@@ -94,7 +144,7 @@ typedef struct {
 
 // Opaque type. Do not use directly.
 /**@cond */
-typedef struct {
+typedef struct HAPPlatformTCPStream {
     HAPPlatformTCPStreamManagerRef tcpStreamManager;
 
     int fileDescriptor;
@@ -102,9 +152,61 @@ typedef struct {
     HAPPlatformTCPStreamEvent interests;
     HAPPlatformTCPStreamEventCallback _Nullable callback;
     void* _Nullable context;
+
+    HAPTime lastActivityTime;
+    bool isEvicted;
+    void* _Nullable ipSessionBuffers;
+    struct HAPPlatformTCPStream* _Nullable nextFreeTCPStream;
 } HAPPlatformTCPStream;
 /**@endcond */
 
+/**
+ * Callback that is invoked once, the next time data is written to any TCP stream of a TCP stream manager.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      time                 Time at which the data was written.
+ * @param      context              The context parameter given to HAPPlatformTCPStreamManagerObserveNextWrite.
+ */
+typedef void (*HAPPlatformTCPStreamManagerWriteCallback)(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPTime time,
+        void* _Nullable context);
+
+/**
+ * Connection statistics of a TCP stream manager.
+ */
+typedef struct {
+    /**
+     * Number of TCP streams that are currently open.
+     */
+    size_t numTCPStreams;
+
+    /**
+     * Maximum number of concurrent TCP streams.
+     */
+    size_t maxTCPStreams;
+
+    /**
+     * Largest number of TCP streams that were open at the same time.
+     */
+    size_t maxConcurrentTCPStreams;
+
+    /**
+     * Number of TCP streams that were accepted.
+     */
+    uint32_t numAcceptedTCPStreams;
+
+    /**
+     * Number of connections that were closed right after accepting them, because no session buffers were available.
+     */
+    uint32_t numRejectedTCPStreams;
+
+    /**
+     * Number of idle TCP streams that were evicted for new connections.
+     */
+    uint32_t numEvictedTCPStreams;
+} HAPPlatformTCPStreamManagerStatistics;
+
 /**
  * TCP stream manager.
  */
@@ -118,8 +220,28 @@ struct HAPPlatformTCPStreamManager {
         HAPNetworkPort port;
     } tcpStreamListenerConfiguration;
 
+    struct {
+        uint32_t idleTime;
+        uint32_t interval;
+        uint32_t count;
+    } keepAlive;
+    HAPTime evictionIdleTime;
+    HAPPlatformTimerRef evictionTimer;
+    bool isEvictionRetryPending;
+    bool isAcceptSuspended;
+
     HAPPlatformTCPStreamListener tcpStreamListener;
     HAPPlatformTCPStream* _Nullable tcpStreams;
+    HAPPlatformTCPStream* _Nullable freeTCPStreams;
+    HAPPlatformArenaRef _Nullable arena;
+    struct HAPPlatformIPSessionPool* _Nullable ipSessionPool;
+
+    HAPPlatformTCPStreamManagerWriteCallback _Nullable writeCallback;
+    void* _Nullable writeCallbackContext;
+    size_t maxConcurrentTCPStreams;
+    uint32_t numAcceptedTCPStreams;
+    uint32_t numRejectedTCPStreams;
+    uint32_t numEvictedTCPStreams;
     /**@endcond */
 };
 
@@ -142,6 +264,30 @@ void HAPPlatformTCPStreamManagerCreate(
  */
 void HAPPlatformTCPStreamManagerRelease(HAPPlatformTCPStreamManagerRef tcpStreamManager);
 
+/**
+ * Requests a callback the next time data is written to any TCP stream.
+ *
+ * - The callback is invoked once, on the run loop, right after the write. A new request replaces a pending one.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      callback             Callback. NULL to cancel a pending request.
+ * @param      context              Context that is passed to the callback.
+ */
+void HAPPlatformTCPStreamManagerObserveNextWrite(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerWriteCallback _Nullable callback,
+        void* _Nullable context);
+
+/**
+ * Gets the connection statistics of a TCP stream manager.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param[out] statistics           Connection statistics.
+ */
+void HAPPlatformTCPStreamManagerGetStatistics(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerStatistics* statistics);
+
 #if __has_feature(nullability)
 #pragma clang assume_nonnull end
 #endif
@@ -0,0 +1,113 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <esp_heap_caps.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformArena+Init.h"
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "Arena" };
+
+/**
+ * Alignment of blocks allocated from an arena.
+ */
+#define kHAPPlatformArena_Alignment ((size_t) 8)
+
+void HAPPlatformArenaCreate(HAPPlatformArenaRef arena, const HAPPlatformArenaOptions* options) {
+    HAPPrecondition(arena);
+    HAPPrecondition(options);
+    HAPPrecondition(options->numBytes);
+
+    HAPRawBufferZero(arena, sizeof *arena);
+
+    uint8_t* bytes = options->bytes;
+    if (!bytes) {
+        uint32_t capabilities = options->capabilities ? options->capabilities : MALLOC_CAP_8BIT;
+        bytes = heap_caps_malloc(options->numBytes, capabilities);
+        if (!bytes) {
+            HAPLogError(
+                    &logObject,
+                    "Allocating arena of %lu bytes with capabilities 0x%08lX failed: out of memory.",
+                    (unsigned long) options->numBytes,
+                    (unsigned long) capabilities);
+            HAPFatalError();
+        }
+        arena->isAllocated = true;
+    }
+
+    // Align the start of the arena so that every block is aligned.
+    size_t numPaddingBytes = (kHAPPlatformArena_Alignment - ((uintptr_t) bytes % kHAPPlatformArena_Alignment)) %
+                             kHAPPlatformArena_Alignment;
+    HAPPrecondition(numPaddingBytes < options->numBytes);
+
+    arena->bytes = bytes;
+    arena->numBytes = options->numBytes;
+    arena->numUsedBytes = numPaddingBytes;
+
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: arena = %lu (%s)",
+            (unsigned long) arena->numBytes,
+            arena->isAllocated ? "allocated" : "provided");
+}
+
+void HAPPlatformArenaRelease(HAPPlatformArenaRef arena) {
+    HAPPrecondition(arena);
+    HAPPrecondition(arena->bytes);
+
+    HAPLogDebug(
+            &logObject,
+            "Arena used %lu / %lu bytes.",
+            (unsigned long) arena->numUsedBytes,
+            (unsigned long) arena->numBytes);
+
+    if (arena->isAllocated) {
+        heap_caps_free(arena->bytes);
+    }
+    HAPRawBufferZero(arena, sizeof *arena);
+}
+
+HAP_RESULT_USE_CHECK
+void* _Nullable HAPPlatformArenaAllocate(HAPPlatformArenaRef arena, size_t numBytes) {
+    HAPPrecondition(arena);
+    HAPPrecondition(arena->bytes);
+
+    size_t numBlockBytes = (numBytes + kHAPPlatformArena_Alignment - 1) & ~(kHAPPlatformArena_Alignment - 1);
+    if (numBlockBytes < numBytes || numBlockBytes > arena->numBytes - arena->numUsedBytes) {
+        HAPLog(&logObject,
+               "Cannot allocate %lu bytes from arena: %lu bytes left.",
+               (unsigned long) numBytes,
+               (unsigned long) (arena->numBytes - arena->numUsedBytes));
+        return NULL;
+    }
+
+    uint8_t* block = &arena->bytes[arena->numUsedBytes];
+    arena->numUsedBytes += numBlockBytes;
+    HAPRawBufferZero(block, numBlockBytes);
+    return block;
+}
+
+HAP_RESULT_USE_CHECK
+size_t HAPPlatformArenaGetNumFreeBytes(HAPPlatformArenaRef arena) {
+    HAPPrecondition(arena);
+    HAPPrecondition(arena->bytes);
+
+    return arena->numBytes - arena->numUsedBytes;
+}
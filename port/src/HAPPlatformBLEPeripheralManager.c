@@ -18,10 +18,1311 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include "HAPPlatform+Init.h"
 #include "HAPPlatformBLEPeripheralManager+Init.h"
 
+#if CONFIG_BT_NIMBLE_ENABLED
+#include <esp_nimble_hci.h>
+#include <host/ble_hs.h>
+#include <host/util/util.h>
+#include <nimble/nimble_port.h>
+#include <nimble/nimble_port_freertos.h>
+#include <services/gap/ble_svc_gap.h>
+#include <services/gatt/ble_svc_gatt.h>
+#endif
+
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "BLEPeripheralManager" };
 
+/**
+ * Builds the index from attribute handles to the attributes that contain them.
+ */
+static void BuildAttributeIndex(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(!blePeripheralManager->attributeIndexes);
+    HAPPrecondition(blePeripheralManager->numUsedAttributes < UINT16_MAX);
+
+    uint16_t* attributeIndexes =
+            calloc((size_t) blePeripheralManager->lastHandle + 1, sizeof blePeripheralManager->attributeIndexes[0]);
+    if (!attributeIndexes) {
+        HAPLogError(&logObject, "Allocating GATT handle index failed: out of memory.");
+        HAPFatalError();
+    }
+    for (size_t i = 0; i < blePeripheralManager->numUsedAttributes; i++) {
+        const HAPPlatformBLEPeripheralManagerAttribute* attribute = &blePeripheralManager->attributes[i];
+        uint16_t attributeIndex = (uint16_t)(i + 1);
+        switch (attribute->type) {
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Service: {
+                attributeIndexes[attribute->_.service.handle] = attributeIndex;
+            } break;
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic: {
+                attributeIndexes[attribute->_.characteristic.handle] = attributeIndex;
+                attributeIndexes[attribute->_.characteristic.valueHandle] = attributeIndex;
+                if (attribute->_.characteristic.cccDescriptorHandle) {
+                    attributeIndexes[attribute->_.characteristic.cccDescriptorHandle] = attributeIndex;
+                }
+            } break;
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor: {
+                attributeIndexes[attribute->_.descriptor.handle] = attributeIndex;
+            } break;
+            default: {
+                HAPFatalError();
+            }
+        }
+    }
+    blePeripheralManager->attributeIndexes = attributeIndexes;
+}
+
+/**
+ * Looks up the attribute that contains a handle in the published GATT database.
+ *
+ * @return Service, characteristic or descriptor that contains the handle, or NULL if the handle is not assigned.
+ */
+HAP_RESULT_USE_CHECK
+static const HAPPlatformBLEPeripheralManagerAttribute* _Nullable GetAttribute(
+        HAPPlatformBLEPeripheralManagerRef blePeripheralManager,
+        HAPPlatformBLEPeripheralManagerAttributeHandle handle) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(blePeripheralManager->attributeIndexes);
+
+    if (!handle || handle > blePeripheralManager->lastHandle) {
+        return NULL;
+    }
+    uint16_t attributeIndex = blePeripheralManager->attributeIndexes[handle];
+    return attributeIndex ? &blePeripheralManager->attributes[attributeIndex - 1] : NULL;
+}
+
+#if CONFIG_BT_NIMBLE_ENABLED
+
+/**
+ * NimBLE has a single host with global callbacks, so only one BLE peripheral manager may exist.
+ */
+static HAPPlatformBLEPeripheralManagerRef _Nullable nimblePeripheralManager;
+
+/**
+ * GATT definitions handed to NimBLE. NimBLE keeps pointers into them until the GATT server is reset.
+ */
+typedef struct {
+    struct ble_gatt_svc_def* services;
+    size_t numServices;
+    struct ble_gatt_chr_def* characteristics;
+    struct ble_gatt_dsc_def* descriptors;
+    ble_uuid128_t* uuids;
+    bool didAssignHandleOffset;
+} GATTDefinitions;
+
+/**
+ * Request of the NimBLE host task that is handled by the delegate on the run loop.
+ */
+typedef struct {
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager;
+    HAPPlatformBLEPeripheralManagerConnectionHandle connectionHandle;
+    HAPPlatformBLEPeripheralManagerAttributeHandle attributeHandle;
+    bool isWrite;
+    void* bytes;
+    size_t maxBytes;
+    size_t numBytes;
+    HAPError err;
+} AccessRequest;
+
+/**
+ * Context of the run loop callback that handles an access request.
+ */
+typedef struct {
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager;
+    uint32_t accessRequestID;
+} AccessRequestContext;
+
+HAP_ENUM_BEGIN(uint8_t, GAPEventType) {
+    kGAPEventType_HostSynced,
+    kGAPEventType_Connected,
+    kGAPEventType_ConnectionFailed,
+    kGAPEventType_Disconnected,
+    kGAPEventType_Subscribed,
+    kGAPEventType_IndicationCompleted,
+    kGAPEventType_AdvertisingCompleted
+} HAP_ENUM_END(uint8_t, GAPEventType);
+
+/**
+ * NimBLE event that is forwarded to the run loop.
+ */
+typedef struct {
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager;
+    GAPEventType type;
+    HAPPlatformBLEPeripheralManagerConnectionHandle connectionHandle;
+    HAPPlatformBLEPeripheralManagerAttributeHandle attributeHandle;
+    uint16_t cccDescriptorValue;
+} GAPEvent;
+
+static int HandleGAPEvent(struct ble_gap_event* event, void* _Nullable arg);
+
+/**
+ * Maps an ADK error to an ATT error code.
+ */
+static int GetATTError(HAPError err) {
+    switch (err) {
+        case kHAPError_None: {
+            return 0;
+        }
+        case kHAPError_OutOfResources: {
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        case kHAPError_InvalidData: {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        default: {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+    }
+}
+
+static void ScheduleGAPEvent(GAPEvent* event);
+static void HandleConnectionActivity(HAPPlatformBLEPeripheralManagerRef blePeripheralManager);
+
+/**
+ * Handles a read or write request of the NimBLE host task on the run loop.
+ */
+static void HandleAccessRequest(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize == sizeof(AccessRequestContext));
+    const AccessRequestContext* accessRequestContext = context;
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = accessRequestContext->blePeripheralManager;
+    const HAPPlatformBLEPeripheralManagerDelegate* delegate = &blePeripheralManager->delegate;
+
+    // The NimBLE host task stops waiting for requests that time out or are cancelled before they get here.
+    AccessRequest* _Nullable request = NULL;
+    portENTER_CRITICAL(&blePeripheralManager->accessLock);
+    if (blePeripheralManager->accessRequest &&
+        blePeripheralManager->accessRequestID == accessRequestContext->accessRequestID) {
+        request = blePeripheralManager->accessRequest;
+        blePeripheralManager->isAccessRequestActive = true;
+    }
+    portEXIT_CRITICAL(&blePeripheralManager->accessLock);
+    if (!request) {
+        HAPLog(&logObject, "Dropping GATT request that is no longer awaited.");
+        return;
+    }
+
+    HandleConnectionActivity(blePeripheralManager);
+
+    if (request->isWrite) {
+        request->err = delegate->handleWriteRequest ?
+                               delegate->handleWriteRequest(
+                                       blePeripheralManager,
+                                       request->connectionHandle,
+                                       request->attributeHandle,
+                                       request->bytes,
+                                       request->numBytes,
+                                       delegate->context) :
+                               kHAPError_InvalidState;
+    } else {
+        request->numBytes = 0;
+        request->err = delegate->handleReadRequest ?
+                               delegate->handleReadRequest(
+                                       blePeripheralManager,
+                                       request->connectionHandle,
+                                       request->attributeHandle,
+                                       request->bytes,
+                                       request->maxBytes,
+                                       &request->numBytes,
+                                       delegate->context) :
+                               kHAPError_InvalidState;
+        HAPAssert(request->numBytes <= request->maxBytes);
+    }
+    xSemaphoreGive(blePeripheralManager->accessCompleted);
+}
+
+/**
+ * Stops awaiting the current access request. Must be called with accessLock held.
+ */
+static void ClearAccessRequest(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    blePeripheralManager->accessRequest = NULL;
+    blePeripheralManager->isAccessRequestActive = false;
+}
+
+/**
+ * Hands a request of the NimBLE host task to the delegate on the run loop and waits for it to be handled.
+ *
+ * - If the run loop does not start handling the request within kHAPPlatformBLEPeripheralManager_AccessTimeout, or
+ *   the BLE peripheral manager is released first, the request is abandoned and kHAPError_Busy or
+ *   kHAPError_InvalidState is returned. A request that the delegate has started handling is awaited, as the
+ *   delegate writes its result into the request.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError PerformAccessRequest(AccessRequest* request) {
+    HAPPrecondition(request);
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = request->blePeripheralManager;
+
+    AccessRequestContext context = { .blePeripheralManager = blePeripheralManager };
+    portENTER_CRITICAL(&blePeripheralManager->accessLock);
+    bool isReleased = blePeripheralManager->isReleased;
+    if (!isReleased) {
+        HAPAssert(!blePeripheralManager->accessRequest);
+        blePeripheralManager->accessRequestID++;
+        blePeripheralManager->accessRequest = request;
+        context.accessRequestID = blePeripheralManager->accessRequestID;
+    }
+    portEXIT_CRITICAL(&blePeripheralManager->accessLock);
+    if (isReleased) {
+        return kHAPError_InvalidState;
+    }
+
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleAccessRequest, &context, sizeof context);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to schedule GATT request.");
+        portENTER_CRITICAL(&blePeripheralManager->accessLock);
+        ClearAccessRequest(blePeripheralManager);
+        portEXIT_CRITICAL(&blePeripheralManager->accessLock);
+        return err;
+    }
+
+    if (xSemaphoreTake(
+                blePeripheralManager->accessCompleted,
+                pdMS_TO_TICKS(kHAPPlatformBLEPeripheralManager_AccessTimeout / HAPMillisecond)) != pdTRUE) {
+        portENTER_CRITICAL(&blePeripheralManager->accessLock);
+        bool isActive = blePeripheralManager->isAccessRequestActive;
+        if (!isActive) {
+            ClearAccessRequest(blePeripheralManager);
+        }
+        portEXIT_CRITICAL(&blePeripheralManager->accessLock);
+        if (!isActive) {
+            HAPLogError(
+                    &logObject,
+                    "GATT request was not handled by the run loop within %lu ms.",
+                    (unsigned long) (kHAPPlatformBLEPeripheralManager_AccessTimeout / HAPMillisecond));
+            return kHAPError_Busy;
+        }
+        (void) xSemaphoreTake(blePeripheralManager->accessCompleted, portMAX_DELAY);
+    }
+
+    portENTER_CRITICAL(&blePeripheralManager->accessLock);
+    ClearAccessRequest(blePeripheralManager);
+    portEXIT_CRITICAL(&blePeripheralManager->accessLock);
+    return request->err;
+}
+
+/**
+ * Reads the value of a characteristic or descriptor on behalf of the NimBLE host task.
+ *
+ * NimBLE calls this again for every Read Blob request and strips the requested offset from the full value.
+ * The ADK must only be asked once per value, so values that do not fit into a single response are kept until the
+ * central has read them completely.
+ *
+ * Reads at offset 0 always fetch a fresh value, so that a central that abandoned a long read does not get stale
+ * bytes the next time it reads the attribute. NimBLE appends the value of a read at offset 0 directly to the
+ * response PDU, which already holds the ATT header. For Read Blob requests at a non-zero offset, it passes an empty
+ * buffer instead.
+ */
+static int ReadAttribute(
+        HAPPlatformBLEPeripheralManagerRef blePeripheralManager,
+        uint16_t connectionHandle,
+        HAPPlatformBLEPeripheralManagerAttributeHandle attributeHandle,
+        struct os_mbuf* om) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(om);
+
+    size_t maxChunkBytes = (size_t)(blePeripheralManager->attMTU - 1);
+    bool isAtOffsetZero = OS_MBUF_PKTLEN(om) != 0;
+    if (isAtOffsetZero || blePeripheralManager->longRead.attributeHandle != attributeHandle) {
+        blePeripheralManager->longRead.attributeHandle = 0;
+
+        AccessRequest request = { .blePeripheralManager = blePeripheralManager,
+                                  .connectionHandle = connectionHandle,
+                                  .attributeHandle = attributeHandle,
+                                  .isWrite = false,
+                                  .bytes = blePeripheralManager->longRead.bytes,
+                                  .maxBytes = sizeof blePeripheralManager->longRead.bytes };
+        HAPError err = PerformAccessRequest(&request);
+        if (err) {
+            return GetATTError(err);
+        }
+        blePeripheralManager->longRead.numBytes = (uint16_t) request.numBytes;
+        blePeripheralManager->longRead.offset = 0;
+    }
+
+    // Keep the value while the central still has to read further chunks of it.
+    size_t remainingBytes = blePeripheralManager->longRead.numBytes - blePeripheralManager->longRead.offset;
+    if (remainingBytes < maxChunkBytes) {
+        blePeripheralManager->longRead.attributeHandle = 0;
+    } else {
+        blePeripheralManager->longRead.attributeHandle = attributeHandle;
+        blePeripheralManager->longRead.offset += (uint16_t) maxChunkBytes;
+    }
+
+    int rc = os_mbuf_append(om, blePeripheralManager->longRead.bytes, blePeripheralManager->longRead.numBytes);
+    return rc ? BLE_ATT_ERR_INSUFFICIENT_RES : 0;
+}
+
+/**
+ * Writes the value of a characteristic or descriptor on behalf of the NimBLE host task.
+ */
+static int WriteAttribute(
+        HAPPlatformBLEPeripheralManagerRef blePeripheralManager,
+        uint16_t connectionHandle,
+        HAPPlatformBLEPeripheralManagerAttributeHandle attributeHandle,
+        struct os_mbuf* om) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(om);
+
+    blePeripheralManager->longRead.attributeHandle = 0;
+
+    uint16_t numBytes;
+    int rc = ble_hs_mbuf_to_flat(
+            om, blePeripheralManager->writeBytes, sizeof blePeripheralManager->writeBytes, &numBytes);
+    if (rc) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    AccessRequest request = { .blePeripheralManager = blePeripheralManager,
+                              .connectionHandle = connectionHandle,
+                              .attributeHandle = attributeHandle,
+                              .isWrite = true,
+                              .bytes = blePeripheralManager->writeBytes,
+                              .numBytes = numBytes };
+    return GetATTError(PerformAccessRequest(&request));
+}
+
+/**
+ * NimBLE access callback of characteristics and descriptors. Runs on the NimBLE host task.
+ */
+static int HandleAttributeAccess(
+        uint16_t connectionHandle,
+        uint16_t nimbleHandle HAP_UNUSED,
+        struct ble_gatt_access_ctxt* ctxt,
+        void* _Nullable arg) {
+    HAPPrecondition(ctxt);
+    HAPPrecondition(arg);
+    HAPPlatformBLEPeripheralManagerAttribute* attribute = arg;
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = HAPNonnull(nimblePeripheralManager);
+
+    HAPPlatformBLEPeripheralManagerAttributeHandle attributeHandle;
+    const uint8_t* constBytes;
+    size_t numConstBytes;
+    bool isConst;
+    if (attribute->type == kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic) {
+        attributeHandle = attribute->_.characteristic.valueHandle;
+        constBytes = attribute->_.characteristic.constBytes;
+        numConstBytes = attribute->_.characteristic.numConstBytes;
+        isConst = attribute->_.characteristic.isConst;
+    } else {
+        HAPAssert(attribute->type == kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor);
+        attributeHandle = attribute->_.descriptor.handle;
+        constBytes = attribute->_.descriptor.constBytes;
+        numConstBytes = attribute->_.descriptor.numConstBytes;
+        isConst = attribute->_.descriptor.isConst;
+    }
+
+    switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+        case BLE_GATT_ACCESS_OP_READ_DSC: {
+            if (isConst) {
+                return os_mbuf_append(ctxt->om, constBytes, numConstBytes) ? BLE_ATT_ERR_INSUFFICIENT_RES : 0;
+            }
+            return ReadAttribute(blePeripheralManager, connectionHandle, attributeHandle, ctxt->om);
+        }
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        case BLE_GATT_ACCESS_OP_WRITE_DSC: {
+            if (isConst) {
+                return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+            }
+            return WriteAttribute(blePeripheralManager, connectionHandle, attributeHandle, ctxt->om);
+        }
+        default: {
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+    }
+}
+
+/**
+ * Checks that NimBLE assigned the handles that were reported to the ADK, shifted by a constant offset for the GAP and
+ * GATT services that NimBLE registers first. Runs on the task that starts the GATT server.
+ */
+static void HandleGATTRegistration(struct ble_gatt_register_ctxt* ctxt, void* _Nullable arg HAP_UNUSED) {
+    HAPPrecondition(ctxt);
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = HAPNonnull(nimblePeripheralManager);
+    GATTDefinitions* definitions = blePeripheralManager->gattDefinitions;
+    if (!definitions) {
+        return;
+    }
+
+    switch (ctxt->op) {
+        case BLE_GATT_REGISTER_OP_SVC: {
+            if (ctxt->svc.svc_def < definitions->services ||
+                ctxt->svc.svc_def >= &definitions->services[definitions->numServices]) {
+                // GAP and GATT services.
+                return;
+            }
+            if (!definitions->didAssignHandleOffset) {
+                // The first service of the ADK has handle 1.
+                blePeripheralManager->nimbleHandleOffset = (uint16_t)(ctxt->svc.handle - 1);
+                definitions->didAssignHandleOffset = true;
+            }
+        } break;
+        case BLE_GATT_REGISTER_OP_CHR: {
+            const HAPPlatformBLEPeripheralManagerAttribute* attribute = ctxt->chr.chr_def->arg;
+            if (!attribute || !definitions->didAssignHandleOffset) {
+                return;
+            }
+            if (ctxt->chr.val_handle !=
+                attribute->_.characteristic.valueHandle + blePeripheralManager->nimbleHandleOffset) {
+                HAPLogFault(
+                        &logObject,
+                        "NimBLE assigned GATT handle %u instead of %u.",
+                        ctxt->chr.val_handle,
+                        attribute->_.characteristic.valueHandle + blePeripheralManager->nimbleHandleOffset);
+                HAPFatalError();
+            }
+        } break;
+        case BLE_GATT_REGISTER_OP_DSC: {
+            const HAPPlatformBLEPeripheralManagerAttribute* attribute = ctxt->dsc.dsc_def->arg;
+            if (!attribute || !definitions->didAssignHandleOffset) {
+                return;
+            }
+            if (ctxt->dsc.handle != attribute->_.descriptor.handle + blePeripheralManager->nimbleHandleOffset) {
+                HAPLogFault(
+                        &logObject,
+                        "NimBLE assigned GATT handle %u instead of %u.",
+                        ctxt->dsc.handle,
+                        attribute->_.descriptor.handle + blePeripheralManager->nimbleHandleOffset);
+                HAPFatalError();
+            }
+        } break;
+        default: {
+        } break;
+    }
+}
+
+/**
+ * Converts the published attributes into NimBLE GATT definitions.
+ */
+HAP_RESULT_USE_CHECK
+static GATTDefinitions* _Nullable CreateGATTDefinitions(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    size_t numServices = 0;
+    size_t numCharacteristics = 0;
+    size_t numDescriptors = 0;
+    for (size_t i = 0; i < blePeripheralManager->numUsedAttributes; i++) {
+        switch (blePeripheralManager->attributes[i].type) {
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Service: {
+                numServices++;
+            } break;
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic: {
+                numCharacteristics++;
+            } break;
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor: {
+                numDescriptors++;
+            } break;
+            default: {
+            } break;
+        }
+    }
+
+    // Every service, characteristic and descriptor list is terminated by an empty element.
+    size_t numServiceDefinitions = numServices + 1;
+    size_t numCharacteristicDefinitions = numCharacteristics + numServices;
+    size_t numDescriptorDefinitions = numDescriptors + numCharacteristics;
+    size_t numUUIDs = numServices + numCharacteristics + numDescriptors;
+    size_t numBytes = sizeof(GATTDefinitions) + numServiceDefinitions * sizeof(struct ble_gatt_svc_def) +
+                      numCharacteristicDefinitions * sizeof(struct ble_gatt_chr_def) +
+                      numDescriptorDefinitions * sizeof(struct ble_gatt_dsc_def) + numUUIDs * sizeof(ble_uuid128_t);
+    uint8_t* bytes = calloc(1, numBytes);
+    if (!bytes) {
+        HAPLogError(&logObject, "Allocating GATT definitions failed: out of memory.");
+        return NULL;
+    }
+    GATTDefinitions* definitions = (GATTDefinitions*) bytes;
+    bytes += sizeof *definitions;
+    definitions->services = (struct ble_gatt_svc_def*) bytes;
+    definitions->numServices = numServices;
+    bytes += numServiceDefinitions * sizeof(struct ble_gatt_svc_def);
+    definitions->characteristics = (struct ble_gatt_chr_def*) bytes;
+    bytes += numCharacteristicDefinitions * sizeof(struct ble_gatt_chr_def);
+    definitions->descriptors = (struct ble_gatt_dsc_def*) bytes;
+    bytes += numDescriptorDefinitions * sizeof(struct ble_gatt_dsc_def);
+    definitions->uuids = (ble_uuid128_t*) bytes;
+
+    // Each list is followed by its zeroed terminator, which is skipped when the next list begins.
+    struct ble_gatt_svc_def* service = NULL;
+    struct ble_gatt_chr_def* nextCharacteristic = definitions->characteristics;
+    struct ble_gatt_chr_def* characteristic = NULL;
+    struct ble_gatt_dsc_def* nextDescriptor = definitions->descriptors;
+    ble_uuid128_t* uuid = definitions->uuids;
+    for (size_t i = 0; i < blePeripheralManager->numUsedAttributes; i++) {
+        HAPPlatformBLEPeripheralManagerAttribute* attribute = &blePeripheralManager->attributes[i];
+        if (attribute->type != kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor && characteristic &&
+            characteristic->descriptors) {
+            nextDescriptor++;
+        }
+
+        switch (attribute->type) {
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Service: {
+                if (service) {
+                    nextCharacteristic++;
+                }
+                service = service ? service + 1 : definitions->services;
+                characteristic = NULL;
+
+                uuid->u.type = BLE_UUID_TYPE_128;
+                HAPRawBufferCopyBytes(uuid->value, attribute->_.service.type.bytes, sizeof uuid->value);
+                service->type = attribute->_.service.isPrimary ? BLE_GATT_SVC_TYPE_PRIMARY :
+                                                                  BLE_GATT_SVC_TYPE_SECONDARY;
+                service->uuid = &uuid->u;
+                service->characteristics = nextCharacteristic;
+                uuid++;
+            } break;
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic: {
+                HAPAssert(service);
+                characteristic = nextCharacteristic++;
+
+                HAPPlatformBLEPeripheralManagerCharacteristicProperties properties =
+                        attribute->_.characteristic.properties;
+                uuid->u.type = BLE_UUID_TYPE_128;
+                HAPRawBufferCopyBytes(uuid->value, attribute->_.characteristic.type.bytes, sizeof uuid->value);
+                characteristic->uuid = &uuid->u;
+                characteristic->access_cb = HandleAttributeAccess;
+                characteristic->arg = attribute;
+                characteristic->flags = (ble_gatt_chr_flags)(
+                        (properties.read ? BLE_GATT_CHR_F_READ : 0) |
+                        (properties.writeWithoutResponse ? BLE_GATT_CHR_F_WRITE_NO_RSP : 0) |
+                        (properties.write ? BLE_GATT_CHR_F_WRITE : 0) | (properties.notify ? BLE_GATT_CHR_F_NOTIFY : 0) |
+                        (properties.indicate ? BLE_GATT_CHR_F_INDICATE : 0));
+                uuid++;
+            } break;
+            case kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor: {
+                HAPAssert(characteristic);
+                if (!characteristic->descriptors) {
+                    characteristic->descriptors = nextDescriptor;
+                }
+
+                HAPPlatformBLEPeripheralManagerDescriptorProperties properties = attribute->_.descriptor.properties;
+                uuid->u.type = BLE_UUID_TYPE_128;
+                HAPRawBufferCopyBytes(uuid->value, attribute->_.descriptor.type.bytes, sizeof uuid->value);
+                nextDescriptor->uuid = &uuid->u;
+                nextDescriptor->access_cb = HandleAttributeAccess;
+                nextDescriptor->arg = attribute;
+                nextDescriptor->att_flags =
+                        (uint8_t)((properties.read ? BLE_ATT_F_READ : 0) | (properties.write ? BLE_ATT_F_WRITE : 0));
+                nextDescriptor++;
+                uuid++;
+            } break;
+            default: {
+            } break;
+        }
+    }
+    return definitions;
+}
+
+/**
+ * Registers the GAP and GATT services of NimBLE and the published attributes.
+ */
+static void RegisterGATTServices(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(blePeripheralManager->gattDefinitions);
+    GATTDefinitions* definitions = blePeripheralManager->gattDefinitions;
+
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
+    int rc = ble_svc_gap_device_name_set(blePeripheralManager->deviceName);
+    if (rc) {
+        HAPLogError(&logObject, "ble_svc_gap_device_name_set failed: %d.", rc);
+    }
+
+    rc = ble_gatts_count_cfg(definitions->services);
+    if (!rc) {
+        rc = ble_gatts_add_svcs(definitions->services);
+    }
+    if (rc) {
+        HAPLogError(&logObject, "Registering GATT services failed: %d.", rc);
+        HAPFatalError();
+    }
+}
+
+/**
+ * Handles NimBLE host resets. Runs on the NimBLE host task.
+ */
+static void HandleHostReset(int reason) {
+    HAPLogError(&logObject, "NimBLE host reset: %d.", reason);
+}
+
+/**
+ * Handles NimBLE host synchronization with the controller. Runs on the NimBLE host task.
+ */
+static void HandleHostSynced(void) {
+    GAPEvent event = { .blePeripheralManager = HAPNonnull(nimblePeripheralManager),
+                       .type = kGAPEventType_HostSynced };
+    ScheduleGAPEvent(&event);
+}
+
+static void RunHostTask(void* _Nullable param HAP_UNUSED) {
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+/**
+ * Updates the NimBLE random address. Advertising must not be active.
+ */
+static void UpdateDeviceAddress(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(!blePeripheralManager->isAdvertisingActive);
+
+    if (!blePeripheralManager->isHostSynced || !blePeripheralManager->isDeviceAddressSet) {
+        return;
+    }
+    int rc = ble_hs_id_set_rnd(blePeripheralManager->deviceAddress.bytes);
+    if (rc) {
+        HAPLogError(&logObject, "ble_hs_id_set_rnd failed: %d.", rc);
+    }
+}
+
+/**
+ * Starts NimBLE advertising if it has been requested and is currently possible.
+ */
+static void UpdateAdvertising(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (!blePeripheralManager->advertisingInterval || blePeripheralManager->isAdvertisingActive ||
+        blePeripheralManager->isConnected || !blePeripheralManager->isHostSynced) {
+        return;
+    }
+
+    int rc = ble_gap_adv_set_data(blePeripheralManager->advertisingBytes, blePeripheralManager->numAdvertisingBytes);
+    if (rc) {
+        HAPLogError(&logObject, "ble_gap_adv_set_data failed: %d.", rc);
+        return;
+    }
+    rc = ble_gap_adv_rsp_set_data(
+            blePeripheralManager->scanResponseBytes, blePeripheralManager->numScanResponseBytes);
+    if (rc) {
+        HAPLogError(&logObject, "ble_gap_adv_rsp_set_data failed: %d.", rc);
+        return;
+    }
+
+    HAPBLEAdvertisingInterval advertisingInterval = blePeripheralManager->advertisingInterval;
+    if (blePeripheralManager->isFastAdvertising) {
+        advertisingInterval = HAPMin(advertisingInterval, blePeripheralManager->policy.fastAdvertisingInterval);
+    }
+
+    // HAPBLEAdvertisingInterval and NimBLE both use units of 0.625 ms.
+    struct ble_gap_adv_params advertisingParameters = { .conn_mode = BLE_GAP_CONN_MODE_UND,
+                                                        .disc_mode = BLE_GAP_DISC_MODE_GEN,
+                                                        .itvl_min = advertisingInterval,
+                                                        .itvl_max = advertisingInterval };
+    rc = ble_gap_adv_start(
+            BLE_OWN_ADDR_RANDOM,
+            NULL,
+            BLE_HS_FOREVER,
+            &advertisingParameters,
+            HandleGAPEvent,
+            blePeripheralManager);
+    if (rc) {
+        HAPLogError(&logObject, "ble_gap_adv_start failed: %d.", rc);
+        return;
+    }
+    blePeripheralManager->isAdvertisingActive = true;
+    blePeripheralManager->isAdvertisingUpdatePending = false;
+    blePeripheralManager->batchingWindowEnd =
+            HAPPlatformClockGetCurrent() + blePeripheralManager->policy.batchingWindow;
+}
+
+static void CancelAdvertising(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (!blePeripheralManager->isAdvertisingActive) {
+        return;
+    }
+    int rc = ble_gap_adv_stop();
+    if (rc && rc != BLE_HS_EALREADY) {
+        HAPLogError(&logObject, "ble_gap_adv_stop failed: %d.", rc);
+    }
+    blePeripheralManager->isAdvertisingActive = false;
+}
+
+/**
+ * Supervision timeout that is requested together with the connection interval.
+ */
+#define kHAPPlatformBLEPeripheralManager_SupervisionTimeout ((HAPTime)(6 * HAPSecond))
+
+/**
+ * Applies the CONFIG_HAP_BLE_* defaults to the fields of a policy that are 0.
+ */
+static void ApplyPolicyDefaults(HAPPlatformBLEPeripheralManagerPolicy* policy) {
+    HAPPrecondition(policy);
+
+    if (!policy->activeConnectionInterval) {
+        policy->activeConnectionInterval = (HAPTime) CONFIG_HAP_BLE_ACTIVE_CONNECTION_INTERVAL * HAPMillisecond;
+    }
+    if (!policy->idleConnectionInterval) {
+        policy->idleConnectionInterval = (HAPTime) CONFIG_HAP_BLE_IDLE_CONNECTION_INTERVAL * HAPMillisecond;
+    }
+    if (!policy->idleTimeout) {
+        policy->idleTimeout = (HAPTime) CONFIG_HAP_BLE_IDLE_TIMEOUT * HAPMillisecond;
+    }
+    if (!policy->fastAdvertisingInterval) {
+        // Units of 0.625 ms.
+        policy->fastAdvertisingInterval = (HAPBLEAdvertisingInterval)(CONFIG_HAP_BLE_FAST_ADVERTISING_INTERVAL * 8 / 5);
+    }
+    if (!policy->fastAdvertisingDuration) {
+        policy->fastAdvertisingDuration = (HAPTime) CONFIG_HAP_BLE_FAST_ADVERTISING_DURATION * HAPMillisecond;
+    }
+    if (!policy->batchingWindow) {
+        policy->batchingWindow = (HAPTime) CONFIG_HAP_BLE_BATCHING_WINDOW * HAPMillisecond;
+    }
+
+    // Apple requires connection intervals between 15 ms and 2 s.
+    HAPPrecondition(policy->activeConnectionInterval >= 15 * HAPMillisecond);
+    HAPPrecondition(policy->activeConnectionInterval <= policy->idleConnectionInterval);
+    HAPPrecondition(policy->idleConnectionInterval + 15 * HAPMillisecond <= 2 * HAPSecond);
+}
+
+/**
+ * Requests the active or the idle connection interval from the connected central.
+ */
+static void RequestConnectionParameters(HAPPlatformBLEPeripheralManagerRef blePeripheralManager, bool isActive) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(blePeripheralManager->isConnected);
+
+    HAPTime interval = isActive ? blePeripheralManager->policy.activeConnectionInterval :
+                                  blePeripheralManager->policy.idleConnectionInterval;
+    HAPLogDebug(
+            &logObject,
+            "Requesting %s connection interval of %lu ms.",
+            isActive ? "active" : "idle",
+            (unsigned long) (interval / HAPMillisecond));
+
+    // Apple requires Interval Max >= Interval Min + 15 ms. Intervals use units of 1.25 ms, the supervision
+    // timeout units of 10 ms.
+    struct ble_gap_upd_params parameters = {
+        .itvl_min = (uint16_t)(interval / HAPMillisecond * 4 / 5),
+        .itvl_max = (uint16_t)((interval / HAPMillisecond + 15) * 4 / 5),
+        .latency = 0,
+        .supervision_timeout =
+                (uint16_t)(kHAPPlatformBLEPeripheralManager_SupervisionTimeout / (10 * HAPMillisecond))
+    };
+    int rc = ble_gap_update_params(blePeripheralManager->connectionHandle, &parameters);
+    if (rc) {
+        HAPLog(&logObject, "ble_gap_update_params failed: %d.", rc);
+    }
+    // Not retried on failure. The central may reject parameter updates.
+    blePeripheralManager->isConnectionActive = isActive;
+}
+
+static void HandleIdleTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context);
+
+static void ScheduleIdleTimer(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(!blePeripheralManager->idleTimer);
+
+    HAPError err = HAPPlatformTimerRegister(
+            &blePeripheralManager->idleTimer,
+            blePeripheralManager->lastActivityTime + blePeripheralManager->policy.idleTimeout,
+            HandleIdleTimerExpired,
+            blePeripheralManager);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to schedule idle timer. Keeping active connection interval.");
+    }
+}
+
+static void HandleIdleTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = context;
+    HAPPrecondition(timer == blePeripheralManager->idleTimer);
+    blePeripheralManager->idleTimer = 0;
+
+    if (!blePeripheralManager->isConnected) {
+        return;
+    }
+    HAPTime idleTime = blePeripheralManager->lastActivityTime + blePeripheralManager->policy.idleTimeout;
+    if (HAPPlatformClockGetCurrent() < idleTime) {
+        // Activity since the timer was scheduled.
+        ScheduleIdleTimer(blePeripheralManager);
+        return;
+    }
+    RequestConnectionParameters(blePeripheralManager, /* isActive: */ false);
+}
+
+static void CancelIdleTimer(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (blePeripheralManager->idleTimer) {
+        HAPPlatformTimerDeregister(blePeripheralManager->idleTimer);
+        blePeripheralManager->idleTimer = 0;
+    }
+}
+
+/**
+ * Switches to the active connection interval when GATT requests or indications are exchanged.
+ */
+static void HandleConnectionActivity(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (!blePeripheralManager->isConnected) {
+        return;
+    }
+    blePeripheralManager->lastActivityTime = HAPPlatformClockGetCurrent();
+    if (!blePeripheralManager->isConnectionActive) {
+        RequestConnectionParameters(blePeripheralManager, /* isActive: */ true);
+    }
+    if (!blePeripheralManager->idleTimer) {
+        ScheduleIdleTimer(blePeripheralManager);
+    }
+}
+
+static void StopFastAdvertising(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (blePeripheralManager->fastAdvertisingTimer) {
+        HAPPlatformTimerDeregister(blePeripheralManager->fastAdvertisingTimer);
+        blePeripheralManager->fastAdvertisingTimer = 0;
+    }
+    blePeripheralManager->isFastAdvertising = false;
+}
+
+static void HandleFastAdvertisingTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = context;
+    HAPPrecondition(timer == blePeripheralManager->fastAdvertisingTimer);
+    blePeripheralManager->fastAdvertisingTimer = 0;
+    blePeripheralManager->isFastAdvertising = false;
+
+    HAPLogDebug(&logObject, "Fast advertising completed.");
+    if (blePeripheralManager->isAdvertisingActive &&
+        blePeripheralManager->advertisingInterval > blePeripheralManager->policy.fastAdvertisingInterval) {
+        CancelAdvertising(blePeripheralManager);
+        UpdateAdvertising(blePeripheralManager);
+    }
+}
+
+/**
+ * Advertises with the fast advertising interval for the fast advertising duration.
+ */
+static void StartFastAdvertising(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    StopFastAdvertising(blePeripheralManager);
+    if (!blePeripheralManager->policy.fastAdvertisingDuration) {
+        return;
+    }
+    HAPError err = HAPPlatformTimerRegister(
+            &blePeripheralManager->fastAdvertisingTimer,
+            HAPPlatformClockGetCurrent() + blePeripheralManager->policy.fastAdvertisingDuration,
+            HandleFastAdvertisingTimerExpired,
+            blePeripheralManager);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to schedule fast advertising. Advertising slowly.");
+        return;
+    }
+    blePeripheralManager->isFastAdvertising = true;
+}
+
+/**
+ * Sends a Handle Value Indication.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError SendIndication(
+        HAPPlatformBLEPeripheralManagerRef blePeripheralManager,
+        HAPPlatformBLEPeripheralManagerAttributeHandle valueHandle,
+        const void* _Nullable bytes,
+        size_t numBytes) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(blePeripheralManager->isConnected);
+    HAPPrecondition(!blePeripheralManager->isIndicationInProgress);
+
+    struct os_mbuf* om = ble_hs_mbuf_from_flat(bytes ? bytes : "", (uint16_t) numBytes);
+    if (!om) {
+        return kHAPError_OutOfResources;
+    }
+    int rc = ble_gattc_indicate_custom(
+            blePeripheralManager->connectionHandle,
+            (uint16_t)(valueHandle + blePeripheralManager->nimbleHandleOffset),
+            om);
+    if (rc) {
+        HAPLogError(&logObject, "ble_gattc_indicate_custom failed: %d.", rc);
+        return rc == BLE_HS_ENOMEM ? kHAPError_OutOfResources : kHAPError_InvalidState;
+    }
+    blePeripheralManager->isIndicationInProgress = true;
+    blePeripheralManager->batchingWindowEnd =
+            HAPPlatformClockGetCurrent() + blePeripheralManager->policy.batchingWindow;
+    HandleConnectionActivity(blePeripheralManager);
+    return kHAPError_None;
+}
+
+/**
+ * Sends the oldest batched indication unless an indication is already in flight.
+ */
+static void SendPendingIndication(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    while (blePeripheralManager->numPendingIndications && !blePeripheralManager->isIndicationInProgress) {
+        HAPPlatformBLEPeripheralManagerAttributeHandle valueHandle = blePeripheralManager->pendingIndications[0];
+        blePeripheralManager->numPendingIndications--;
+        HAPRawBufferCopyBytes(
+                &blePeripheralManager->pendingIndications[0],
+                &blePeripheralManager->pendingIndications[1],
+                blePeripheralManager->numPendingIndications * sizeof blePeripheralManager->pendingIndications[0]);
+
+        HAPError err = SendIndication(blePeripheralManager, valueHandle, NULL, 0);
+        if (err) {
+            HAPLog(&logObject, "Dropping batched indication (attribute handle %u): %u.", valueHandle, err);
+        }
+    }
+}
+
+/**
+ * Sends the indications and applies the advertising data update that waited for the end of the batching window.
+ */
+static void FlushBatch(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (blePeripheralManager->isAdvertisingUpdatePending) {
+        blePeripheralManager->isAdvertisingUpdatePending = false;
+        CancelAdvertising(blePeripheralManager);
+        UpdateAdvertising(blePeripheralManager);
+    }
+    SendPendingIndication(blePeripheralManager);
+}
+
+static void HandleBatchingTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = context;
+    HAPPrecondition(timer == blePeripheralManager->batchingTimer);
+    blePeripheralManager->batchingTimer = 0;
+
+    FlushBatch(blePeripheralManager);
+}
+
+/**
+ * Schedules the batch to be flushed when the batching window ends.
+ */
+static void ScheduleBatchingTimer(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (blePeripheralManager->batchingTimer) {
+        return;
+    }
+    HAPError err = HAPPlatformTimerRegister(
+            &blePeripheralManager->batchingTimer,
+            blePeripheralManager->batchingWindowEnd,
+            HandleBatchingTimerExpired,
+            blePeripheralManager);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to schedule batch. Sending it now.");
+        FlushBatch(blePeripheralManager);
+    }
+}
+
+static void CancelBatch(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (blePeripheralManager->batchingTimer) {
+        HAPPlatformTimerDeregister(blePeripheralManager->batchingTimer);
+        blePeripheralManager->batchingTimer = 0;
+    }
+    blePeripheralManager->numPendingIndications = 0;
+    blePeripheralManager->isAdvertisingUpdatePending = false;
+}
+
+/**
+ * Applies changed advertising data, batching updates that follow the previous one within the batching window.
+ */
+static void RestartAdvertising(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (!blePeripheralManager->isAdvertisingActive) {
+        UpdateAdvertising(blePeripheralManager);
+        return;
+    }
+    if (HAPPlatformClockGetCurrent() < blePeripheralManager->batchingWindowEnd) {
+        blePeripheralManager->isAdvertisingUpdatePending = true;
+        ScheduleBatchingTimer(blePeripheralManager);
+        return;
+    }
+    CancelAdvertising(blePeripheralManager);
+    UpdateAdvertising(blePeripheralManager);
+}
+
+/**
+ * Handles a NimBLE event on the run loop.
+ */
+static void HandleGAPEventOnRunLoop(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize == sizeof(GAPEvent));
+    const GAPEvent* event = context;
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = event->blePeripheralManager;
+    const HAPPlatformBLEPeripheralManagerDelegate* delegate = &blePeripheralManager->delegate;
+
+    switch (event->type) {
+        case kGAPEventType_HostSynced: {
+            HAPLogInfo(&logObject, "NimBLE host synchronized.");
+            blePeripheralManager->isHostSynced = true;
+            blePeripheralManager->isAdvertisingActive = false;
+            UpdateDeviceAddress(blePeripheralManager);
+            StartFastAdvertising(blePeripheralManager);
+            UpdateAdvertising(blePeripheralManager);
+        } break;
+        case kGAPEventType_Connected: {
+            HAPLogInfo(&logObject, "Central connected (connection handle %u).", event->connectionHandle);
+            blePeripheralManager->isAdvertisingActive = false;
+            blePeripheralManager->isConnected = true;
+            blePeripheralManager->connectionHandle = event->connectionHandle;
+            blePeripheralManager->isIndicationInProgress = false;
+            StopFastAdvertising(blePeripheralManager);
+            CancelBatch(blePeripheralManager);
+            // Centrals connect with a short connection interval.
+            blePeripheralManager->isConnectionActive = true;
+            HandleConnectionActivity(blePeripheralManager);
+            if (delegate->handleConnectedCentral) {
+                delegate->handleConnectedCentral(blePeripheralManager, event->connectionHandle, delegate->context);
+            }
+        } break;
+        case kGAPEventType_ConnectionFailed:
+        case kGAPEventType_AdvertisingCompleted: {
+            blePeripheralManager->isAdvertisingActive = false;
+            UpdateAdvertising(blePeripheralManager);
+        } break;
+        case kGAPEventType_Disconnected: {
+            HAPLogInfo(&logObject, "Central disconnected (connection handle %u).", event->connectionHandle);
+            if (!blePeripheralManager->isConnected ||
+                blePeripheralManager->connectionHandle != event->connectionHandle) {
+                break;
+            }
+            blePeripheralManager->isConnected = false;
+            blePeripheralManager->isIndicationInProgress = false;
+            CancelIdleTimer(blePeripheralManager);
+            CancelBatch(blePeripheralManager);
+            if (delegate->handleDisconnectedCentral) {
+                delegate->handleDisconnectedCentral(blePeripheralManager, event->connectionHandle, delegate->context);
+            }
+            StartFastAdvertising(blePeripheralManager);
+            UpdateAdvertising(blePeripheralManager);
+        } break;
+        case kGAPEventType_Subscribed: {
+            // NimBLE stores the Client Characteristic Configuration itself. Forward it like a descriptor write.
+            uint8_t bytes[] = { HAPExpandLittleUInt16(event->cccDescriptorValue) };
+            HandleConnectionActivity(blePeripheralManager);
+            if (delegate->handleWriteRequest) {
+                HAPError err = delegate->handleWriteRequest(
+                        blePeripheralManager,
+                        event->connectionHandle,
+                        event->attributeHandle,
+                        bytes,
+                        sizeof bytes,
+                        delegate->context);
+                if (err) {
+                    HAPLog(&logObject, "Client Characteristic Configuration write rejected: %u.", err);
+                }
+            }
+        } break;
+        case kGAPEventType_IndicationCompleted: {
+            blePeripheralManager->isIndicationInProgress = false;
+            if (!blePeripheralManager->batchingTimer) {
+                // Drain the batch whose window has ended.
+                SendPendingIndication(blePeripheralManager);
+            }
+            if (blePeripheralManager->isConnected && !blePeripheralManager->isIndicationInProgress &&
+                delegate->handleReadyToUpdateSubscribers) {
+                delegate->handleReadyToUpdateSubscribers(
+                        blePeripheralManager, event->connectionHandle, delegate->context);
+            }
+        } break;
+    }
+}
+
+static void ScheduleGAPEvent(GAPEvent* event) {
+    HAPPrecondition(event);
+
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleGAPEventOnRunLoop, event, sizeof *event);
+    if (err) {
+        HAPLogError(&logObject, "Not enough resources to schedule BLE event %u.", event->type);
+    }
+}
+
+/**
+ * NimBLE GAP event callback. Runs on the NimBLE host task.
+ */
+static int HandleGAPEvent(struct ble_gap_event* event, void* _Nullable arg) {
+    HAPPrecondition(event);
+    HAPPrecondition(arg);
+    HAPPlatformBLEPeripheralManagerRef blePeripheralManager = arg;
+    GAPEvent gapEvent = { .blePeripheralManager = blePeripheralManager };
+
+    switch (event->type) {
+        case BLE_GAP_EVENT_CONNECT: {
+            if (event->connect.status) {
+                HAPLog(&logObject, "Connection failed: %d.", event->connect.status);
+                gapEvent.type = kGAPEventType_ConnectionFailed;
+                ScheduleGAPEvent(&gapEvent);
+                break;
+            }
+            gapEvent.type = kGAPEventType_Connected;
+            gapEvent.connectionHandle = event->connect.conn_handle;
+            blePeripheralManager->attMTU = BLE_ATT_MTU_DFLT;
+            blePeripheralManager->longRead.attributeHandle = 0;
+            ScheduleGAPEvent(&gapEvent);
+
+            // Larger ATT MTUs and link layer packets let HAP-BLE PDUs travel in fewer fragments.
+            int rc = ble_gattc_exchange_mtu(event->connect.conn_handle, NULL, NULL);
+            if (rc) {
+                HAPLog(&logObject, "ble_gattc_exchange_mtu failed: %d.", rc);
+            }
+#if CONFIG_HAP_BLE_DATA_LENGTH_EXTENSION
+            // 2120 us is the time needed to send the maximum payload on the 1M PHY.
+            rc = ble_gap_set_data_len(event->connect.conn_handle, BLE_HCI_SET_DATALEN_TX_OCTETS_MAX, 2120);
+            if (rc) {
+                HAPLogDebug(&logObject, "ble_gap_set_data_len failed: %d.", rc);
+            }
+#endif
+        } break;
+        case BLE_GAP_EVENT_DISCONNECT: {
+            HAPLogDebug(&logObject, "Disconnect reason: %d.", event->disconnect.reason);
+            gapEvent.type = kGAPEventType_Disconnected;
+            gapEvent.connectionHandle = event->disconnect.conn.conn_handle;
+            blePeripheralManager->longRead.attributeHandle = 0;
+            ScheduleGAPEvent(&gapEvent);
+        } break;
+        case BLE_GAP_EVENT_CONN_UPDATE: {
+            struct ble_gap_conn_desc connection;
+            if (!event->conn_update.status && !ble_gap_conn_find(event->conn_update.conn_handle, &connection)) {
+                HAPLogDebug(
+                        &logObject,
+                        "Connection parameters updated: interval %u x 1.25 ms, latency %u.",
+                        connection.conn_itvl,
+                        connection.conn_latency);
+            } else {
+                HAPLogDebug(&logObject, "Connection parameter update failed: %d.", event->conn_update.status);
+            }
+        } break;
+        case BLE_GAP_EVENT_MTU: {
+            HAPLogInfo(&logObject, "ATT MTU negotiated: %u.", event->mtu.value);
+            blePeripheralManager->attMTU = event->mtu.value;
+        } break;
+        case BLE_GAP_EVENT_SUBSCRIBE: {
+            if (!blePeripheralManager->attributeIndexes ||
+                event->subscribe.attr_handle <= blePeripheralManager->nimbleHandleOffset) {
+                break;
+            }
+            // NimBLE reports the characteristic value handle.
+            const HAPPlatformBLEPeripheralManagerAttribute* attribute = GetAttribute(
+                    blePeripheralManager,
+                    (HAPPlatformBLEPeripheralManagerAttributeHandle)(
+                            event->subscribe.attr_handle - blePeripheralManager->nimbleHandleOffset));
+            if (!attribute || attribute->type != kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic ||
+                !attribute->_.characteristic.cccDescriptorHandle) {
+                break;
+            }
+            gapEvent.type = kGAPEventType_Subscribed;
+            gapEvent.connectionHandle = event->subscribe.conn_handle;
+            gapEvent.attributeHandle = attribute->_.characteristic.cccDescriptorHandle;
+            gapEvent.cccDescriptorValue = (uint16_t)(
+                    (event->subscribe.cur_notify ? 0x0001 : 0) | (event->subscribe.cur_indicate ? 0x0002 : 0));
+            ScheduleGAPEvent(&gapEvent);
+        } break;
+        case BLE_GAP_EVENT_NOTIFY_TX: {
+            // Indications report BLE_HS_EDONE once acknowledged, or an error once they failed.
+            if (event->notify_tx.indication && event->notify_tx.status) {
+                gapEvent.type = kGAPEventType_IndicationCompleted;
+                gapEvent.connectionHandle = event->notify_tx.conn_handle;
+                ScheduleGAPEvent(&gapEvent);
+            }
+        } break;
+        case BLE_GAP_EVENT_ADV_COMPLETE: {
+            gapEvent.type = kGAPEventType_AdvertisingCompleted;
+            ScheduleGAPEvent(&gapEvent);
+        } break;
+        default: {
+        } break;
+    }
+    return 0;
+}
+
+/**
+ * Initializes the NimBLE host. The host task is started once services have been published.
+ */
+static void CreateNimBLEHost(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(!nimblePeripheralManager);
+
+    nimblePeripheralManager = blePeripheralManager;
+
+    blePeripheralManager->accessCompleted = xSemaphoreCreateBinary();
+    if (!blePeripheralManager->accessCompleted) {
+        HAPLogError(&logObject, "Allocating GATT request semaphore failed: out of memory.");
+        HAPFatalError();
+    }
+    blePeripheralManager->accessLock = (portMUX_TYPE) portMUX_INITIALIZER_UNLOCKED;
+
+    ESP_ERROR_CHECK(esp_nimble_hci_and_controller_init());
+    nimble_port_init();
+
+    ble_hs_cfg.reset_cb = HandleHostReset;
+    ble_hs_cfg.sync_cb = HandleHostSynced;
+    ble_hs_cfg.gatts_register_cb = HandleGATTRegistration;
+    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+
+    int rc = ble_att_set_preferred_mtu(blePeripheralManager->preferredATTMTU);
+    if (rc) {
+        HAPLogError(&logObject, "ble_att_set_preferred_mtu(%u) failed: %d.", blePeripheralManager->preferredATTMTU, rc);
+    }
+    blePeripheralManager->attMTU = BLE_ATT_MTU_DFLT;
+}
+
+/**
+ * Hands the published attributes to NimBLE and starts the host task if it is not running yet.
+ */
+static void PublishGATTServices(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    if (blePeripheralManager->isHostStarted) {
+        // The running GATT server is rebuilt from scratch. NimBLE keeps pointers into the previous definitions
+        // until it has been reset.
+        int rc = ble_gatts_reset();
+        if (rc) {
+            HAPLogError(&logObject, "ble_gatts_reset failed: %d.", rc);
+            HAPFatalError();
+        }
+        free(blePeripheralManager->gattDefinitions);
+        blePeripheralManager->gattDefinitions = NULL;
+    }
+    HAPAssert(!blePeripheralManager->gattDefinitions);
+
+    blePeripheralManager->gattDefinitions = CreateGATTDefinitions(blePeripheralManager);
+    if (!blePeripheralManager->gattDefinitions) {
+        HAPFatalError();
+    }
+    RegisterGATTServices(blePeripheralManager);
+
+    if (blePeripheralManager->isHostStarted) {
+        int rc = ble_gatts_start();
+        if (rc) {
+            HAPLogError(&logObject, "ble_gatts_start failed: %d.", rc);
+            HAPFatalError();
+        }
+        return;
+    }
+    nimble_port_freertos_init(RunHostTask);
+    blePeripheralManager->isHostStarted = true;
+}
+
+/**
+ * Releases the GATT definitions if NimBLE no longer references them.
+ */
+static void ReleaseGATTDefinitions(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    // A running GATT server keeps referencing them until it is reset by PublishGATTServices.
+    if (blePeripheralManager->gattDefinitions && !blePeripheralManager->isHostStarted) {
+        free(blePeripheralManager->gattDefinitions);
+        blePeripheralManager->gattDefinitions = NULL;
+    }
+}
+
+#endif
+
 void HAPPlatformBLEPeripheralManagerCreate(
         HAPPlatformBLEPeripheralManagerRef _Nonnull blePeripheralManager,
         const HAPPlatformBLEPeripheralManagerOptions* _Nonnull options) {
@@ -35,6 +1336,58 @@ void HAPPlatformBLEPeripheralManagerCreate(
     HAPRawBufferZero(blePeripheralManager, sizeof *blePeripheralManager);
     blePeripheralManager->attributes = options->attributes;
     blePeripheralManager->numAttributes = options->numAttributes;
+
+    blePeripheralManager->policy = options->policy;
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    blePeripheralManager->preferredATTMTU =
+            options->preferredATTMTU ? options->preferredATTMTU : (uint16_t) CONFIG_HAP_BLE_ATT_MTU;
+    ApplyPolicyDefaults(&blePeripheralManager->policy);
+    CreateNimBLEHost(blePeripheralManager);
+#else
+    blePeripheralManager->preferredATTMTU = options->preferredATTMTU;
+#endif
+}
+
+void HAPPlatformBLEPeripheralManagerRelease(HAPPlatformBLEPeripheralManagerRef _Nonnull blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    // Reject further requests of the NimBLE host task, and wake it up if it waits for a request that the run loop
+    // will not handle anymore.
+    AccessRequest* _Nullable request = NULL;
+    portENTER_CRITICAL(&blePeripheralManager->accessLock);
+    blePeripheralManager->isReleased = true;
+    if (blePeripheralManager->accessRequest && !blePeripheralManager->isAccessRequestActive) {
+        request = blePeripheralManager->accessRequest;
+        request->err = kHAPError_InvalidState;
+        ClearAccessRequest(blePeripheralManager);
+    }
+    portEXIT_CRITICAL(&blePeripheralManager->accessLock);
+    if (request) {
+        xSemaphoreGive(blePeripheralManager->accessCompleted);
+    }
+
+    CancelIdleTimer(blePeripheralManager);
+    StopFastAdvertising(blePeripheralManager);
+    CancelBatch(blePeripheralManager);
+#endif
+}
+
+void HAPPlatformBLEPeripheralManagerSetPolicy(
+        HAPPlatformBLEPeripheralManagerRef _Nonnull blePeripheralManager,
+        const HAPPlatformBLEPeripheralManagerPolicy* _Nonnull policy) {
+    HAPPrecondition(blePeripheralManager);
+    HAPPrecondition(policy);
+
+    blePeripheralManager->policy = *policy;
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    ApplyPolicyDefaults(&blePeripheralManager->policy);
+    if (blePeripheralManager->isConnected) {
+        RequestConnectionParameters(blePeripheralManager, blePeripheralManager->isConnectionActive);
+    }
+#endif
 }
 
 void HAPPlatformBLEPeripheralManagerSetDelegate(
@@ -58,6 +1411,13 @@ void HAPPlatformBLEPeripheralManagerSetDeviceAddress(
 
     blePeripheralManager->deviceAddress = *deviceAddress;
     blePeripheralManager->isDeviceAddressSet = true;
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    // The random address can only be changed while not advertising.
+    CancelAdvertising(blePeripheralManager);
+    UpdateDeviceAddress(blePeripheralManager);
+    UpdateAdvertising(blePeripheralManager);
+#endif
 }
 
 void HAPPlatformBLEPeripheralManagerSetDeviceName(
@@ -71,6 +1431,13 @@ void HAPPlatformBLEPeripheralManagerSetDeviceName(
 
     HAPRawBufferZero(blePeripheralManager->deviceName, sizeof blePeripheralManager->deviceName);
     HAPRawBufferCopyBytes(blePeripheralManager->deviceName, deviceName, numDeviceNameBytes);
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    int rc = ble_svc_gap_device_name_set(blePeripheralManager->deviceName);
+    if (rc) {
+        HAPLogError(&logObject, "ble_svc_gap_device_name_set failed: %d.", rc);
+    }
+#endif
 }
 
 void HAPPlatformBLEPeripheralManagerRemoveAllServices(
@@ -78,11 +1445,23 @@ void HAPPlatformBLEPeripheralManagerRemoveAllServices(
     HAPPrecondition(blePeripheralManager);
     HAPPrecondition(!blePeripheralManager->isConnected);
 
-    HAPAssert(blePeripheralManager->numAttributes <= SIZE_MAX / sizeof blePeripheralManager->attributes[0]);
+    HAPAssert(blePeripheralManager->numUsedAttributes <= blePeripheralManager->numAttributes);
     HAPRawBufferZero(
             blePeripheralManager->attributes,
-            blePeripheralManager->numAttributes * sizeof blePeripheralManager->attributes[0]);
+            blePeripheralManager->numUsedAttributes * sizeof blePeripheralManager->attributes[0]);
+    blePeripheralManager->numUsedAttributes = 0;
+    blePeripheralManager->lastHandle = 0;
+    blePeripheralManager->inService = false;
+    blePeripheralManager->inCharacteristic = false;
     blePeripheralManager->didPublishAttributes = false;
+
+    if (blePeripheralManager->attributeIndexes) {
+        HAPPlatformFreeSafe(blePeripheralManager->attributeIndexes);
+    }
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    ReleaseGATTDefinitions(blePeripheralManager);
+#endif
 }
 
 HAP_RESULT_USE_CHECK
@@ -94,60 +1473,31 @@ HAPError HAPPlatformBLEPeripheralManagerAddService(
     HAPPrecondition(!blePeripheralManager->didPublishAttributes);
     HAPPrecondition(type);
 
-    bool inService = false;
-    bool inCharacteristic = false;
-    HAPPlatformBLEPeripheralManagerAttributeHandle handle = 0;
-    for (size_t i = 0; i < blePeripheralManager->numAttributes; i++) {
-        HAPPlatformBLEPeripheralManagerAttribute* attribute = &blePeripheralManager->attributes[i];
-
-        switch (attribute->type) {
-            case kHAPPlatformBLEPeripheralManagerAttributeType_None: {
-                HAPPlatformBLEPeripheralManagerAttributeHandle numNeededHandles = 1;
-                if (handle >= (HAPPlatformBLEPeripheralManagerAttributeHandle)(-1 - numNeededHandles)) {
-                    HAPLog(&logObject, "Not enough resources to add GATT service (GATT database is full).");
-                    return kHAPError_OutOfResources;
-                }
-
-                HAPRawBufferZero(attribute, sizeof *attribute);
-                attribute->type = kHAPPlatformBLEPeripheralManagerAttributeType_Service;
-                attribute->_.service.type = *type;
-                attribute->_.service.isPrimary = isPrimary;
-                attribute->_.service.handle = ++handle;
-            }
-                return kHAPError_None;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Service: {
-                inService = true;
-                inCharacteristic = false;
-
-                HAPAssert(attribute->_.service.handle == handle + 1);
-                handle = attribute->_.service.handle;
-            } break;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic: {
-                HAPAssert(inService);
-                inCharacteristic = true;
-
-                HAPAssert(attribute->_.characteristic.handle == handle + 1);
-                handle = attribute->_.characteristic.handle;
-                HAPAssert(attribute->_.characteristic.valueHandle == handle + 1);
-                handle = attribute->_.characteristic.valueHandle;
+    if (blePeripheralManager->numUsedAttributes >= blePeripheralManager->numAttributes) {
+        HAPLog(&logObject,
+               "Not enough resources to add GATT service (have space for %zu GATT attributes).",
+               blePeripheralManager->numAttributes);
+        return kHAPError_OutOfResources;
+    }
+    HAPPlatformBLEPeripheralManagerAttributeHandle handle = blePeripheralManager->lastHandle;
+    HAPPlatformBLEPeripheralManagerAttributeHandle numNeededHandles = 1;
+    if (handle >= (HAPPlatformBLEPeripheralManagerAttributeHandle)(-1 - numNeededHandles)) {
+        HAPLog(&logObject, "Not enough resources to add GATT service (GATT database is full).");
+        return kHAPError_OutOfResources;
+    }
 
-                if (attribute->_.characteristic.cccDescriptorHandle) {
-                    HAPAssert(attribute->_.characteristic.cccDescriptorHandle == handle + 1);
-                    handle = attribute->_.characteristic.cccDescriptorHandle;
-                }
-            } break;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor: {
-                HAPAssert(inCharacteristic);
+    HAPPlatformBLEPeripheralManagerAttribute* attribute =
+            &blePeripheralManager->attributes[blePeripheralManager->numUsedAttributes++];
+    HAPRawBufferZero(attribute, sizeof *attribute);
+    attribute->type = kHAPPlatformBLEPeripheralManagerAttributeType_Service;
+    attribute->_.service.type = *type;
+    attribute->_.service.isPrimary = isPrimary;
+    attribute->_.service.handle = ++handle;
 
-                HAPAssert(attribute->_.descriptor.handle == handle + 1);
-                handle = attribute->_.descriptor.handle;
-            } break;
-        }
-    }
-    HAPLog(&logObject,
-           "Not enough resources to add GATT service (have space for %zu GATT attributes).",
-           blePeripheralManager->numAttributes);
-    return kHAPError_OutOfResources;
+    blePeripheralManager->lastHandle = handle;
+    blePeripheralManager->inService = true;
+    blePeripheralManager->inCharacteristic = false;
+    return kHAPError_None;
 }
 
 HAP_RESULT_USE_CHECK
@@ -161,82 +1511,58 @@ HAPError HAPPlatformBLEPeripheralManagerAddCharacteristic(
         HAPPlatformBLEPeripheralManagerAttributeHandle* _Nullable cccDescriptorHandle) {
     HAPPrecondition(blePeripheralManager);
     HAPPrecondition(!blePeripheralManager->didPublishAttributes);
+    HAPPrecondition(blePeripheralManager->inService);
     HAPPrecondition(type);
     HAPPrecondition(valueHandle);
+    HAPPrecondition(!constNumBytes || constBytes);
+    HAPPrecondition(constNumBytes <= kHAPPlatformBLEPeripheralManager_MaxConstBytes);
     if (properties.notify || properties.indicate) {
         HAPPrecondition(cccDescriptorHandle);
     } else {
         HAPPrecondition(!cccDescriptorHandle);
     }
 
-    bool inService = false;
-    bool inCharacteristic = false;
-    HAPPlatformBLEPeripheralManagerAttributeHandle handle = 0;
-    for (size_t i = 0; i < blePeripheralManager->numAttributes; i++) {
-        HAPPlatformBLEPeripheralManagerAttribute* attribute = &blePeripheralManager->attributes[i];
-
-        switch (attribute->type) {
-            case kHAPPlatformBLEPeripheralManagerAttributeType_None: {
-                HAPPrecondition(inService);
-
-                HAPPlatformBLEPeripheralManagerAttributeHandle numNeededHandles = 2;
-                if (properties.indicate || properties.notify) {
-                    numNeededHandles++;
-                }
-                if (handle >= (HAPPlatformBLEPeripheralManagerAttributeHandle)(-1 - numNeededHandles)) {
-                    HAPLog(&logObject, "Not enough resources to add GATT characteristic (GATT database is full).");
-                    return kHAPError_OutOfResources;
-                }
-
-                HAPRawBufferZero(attribute, sizeof *attribute);
-                attribute->type = kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic;
-                attribute->_.characteristic.type = *type;
-                attribute->_.characteristic.properties = properties;
-                attribute->_.characteristic.handle = ++handle;
-                attribute->_.characteristic.valueHandle = ++handle;
-                if (properties.indicate || properties.notify) {
-                    attribute->_.characteristic.cccDescriptorHandle = ++handle;
-                }
-
-                *valueHandle = attribute->_.characteristic.valueHandle;
-                if (cccDescriptorHandle) {
-                    *cccDescriptorHandle = attribute->_.characteristic.cccDescriptorHandle;
-                }
-            }
-                return kHAPError_None;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Service: {
-                inService = true;
-                inCharacteristic = false;
-
-                HAPAssert(attribute->_.service.handle == handle + 1);
-                handle = attribute->_.service.handle;
-            } break;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic: {
-                HAPAssert(inService);
-                inCharacteristic = true;
-
-                HAPAssert(attribute->_.characteristic.handle == handle + 1);
-                handle = attribute->_.characteristic.handle;
-                HAPAssert(attribute->_.characteristic.valueHandle == handle + 1);
-                handle = attribute->_.characteristic.valueHandle;
+    if (blePeripheralManager->numUsedAttributes >= blePeripheralManager->numAttributes) {
+        HAPLog(&logObject,
+               "Not enough resources to add GATT characteristic (have space for %zu GATT attributes).",
+               blePeripheralManager->numAttributes);
+        return kHAPError_OutOfResources;
+    }
+    HAPPlatformBLEPeripheralManagerAttributeHandle handle = blePeripheralManager->lastHandle;
+    HAPPlatformBLEPeripheralManagerAttributeHandle numNeededHandles = 2;
+    if (properties.indicate || properties.notify) {
+        numNeededHandles++;
+    }
+    if (handle >= (HAPPlatformBLEPeripheralManagerAttributeHandle)(-1 - numNeededHandles)) {
+        HAPLog(&logObject, "Not enough resources to add GATT characteristic (GATT database is full).");
+        return kHAPError_OutOfResources;
+    }
 
-                if (attribute->_.characteristic.cccDescriptorHandle) {
-                    HAPAssert(attribute->_.characteristic.cccDescriptorHandle == handle + 1);
-                    handle = attribute->_.characteristic.cccDescriptorHandle;
-                }
-            } break;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor: {
-                HAPAssert(inCharacteristic);
+    HAPPlatformBLEPeripheralManagerAttribute* attribute =
+            &blePeripheralManager->attributes[blePeripheralManager->numUsedAttributes++];
+    HAPRawBufferZero(attribute, sizeof *attribute);
+    attribute->type = kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic;
+    attribute->_.characteristic.type = *type;
+    attribute->_.characteristic.properties = properties;
+    attribute->_.characteristic.handle = ++handle;
+    attribute->_.characteristic.valueHandle = ++handle;
+    if (properties.indicate || properties.notify) {
+        attribute->_.characteristic.cccDescriptorHandle = ++handle;
+    }
+    if (constBytes) {
+        HAPRawBufferCopyBytes(attribute->_.characteristic.constBytes, HAPNonnullVoid(constBytes), constNumBytes);
+        attribute->_.characteristic.numConstBytes = (uint8_t) constNumBytes;
+        attribute->_.characteristic.isConst = true;
+    }
 
-                HAPAssert(attribute->_.descriptor.handle == handle + 1);
-                handle = attribute->_.descriptor.handle;
-            } break;
-        }
+    *valueHandle = attribute->_.characteristic.valueHandle;
+    if (cccDescriptorHandle) {
+        *cccDescriptorHandle = attribute->_.characteristic.cccDescriptorHandle;
     }
-    HAPLog(&logObject,
-           "Not enough resources to add GATT characteristic (have space for %zu GATT attributes).",
-           blePeripheralManager->numAttributes);
-    return kHAPError_OutOfResources;
+
+    blePeripheralManager->lastHandle = handle;
+    blePeripheralManager->inCharacteristic = true;
+    return kHAPError_None;
 }
 
 HAP_RESULT_USE_CHECK
@@ -249,67 +1575,42 @@ HAPError HAPPlatformBLEPeripheralManagerAddDescriptor(
         HAPPlatformBLEPeripheralManagerAttributeHandle* _Nonnull descriptorHandle) {
     HAPPrecondition(blePeripheralManager);
     HAPPrecondition(!blePeripheralManager->didPublishAttributes);
+    HAPPrecondition(blePeripheralManager->inCharacteristic);
     HAPPrecondition(type);
     HAPPrecondition(descriptorHandle);
+    HAPPrecondition(!constNumBytes || constBytes);
+    HAPPrecondition(constNumBytes <= kHAPPlatformBLEPeripheralManager_MaxConstBytes);
 
-    bool inService = false;
-    bool inCharacteristic = false;
-    HAPPlatformBLEPeripheralManagerAttributeHandle handle = 0;
-    for (size_t i = 0; i < blePeripheralManager->numAttributes; i++) {
-        HAPPlatformBLEPeripheralManagerAttribute* attribute = &blePeripheralManager->attributes[i];
-
-        switch (attribute->type) {
-            case kHAPPlatformBLEPeripheralManagerAttributeType_None: {
-                HAPPrecondition(inCharacteristic);
-
-                HAPPlatformBLEPeripheralManagerAttributeHandle numNeededHandles = 1;
-                if (handle >= (HAPPlatformBLEPeripheralManagerAttributeHandle)(-1 - numNeededHandles)) {
-                    HAPLog(&logObject, "Not enough resources to add GATT descriptor (GATT database is full).");
-                    return kHAPError_OutOfResources;
-                }
-
-                HAPRawBufferZero(attribute, sizeof *attribute);
-                attribute->type = kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor;
-                attribute->_.descriptor.type = *type;
-                attribute->_.descriptor.properties = properties;
-                attribute->_.descriptor.handle = ++handle;
-
-                *descriptorHandle = attribute->_.descriptor.handle;
-            }
-                return kHAPError_None;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Service: {
-                inService = true;
-                inCharacteristic = false;
-
-                HAPAssert(attribute->_.service.handle == handle + 1);
-                handle = attribute->_.service.handle;
-            } break;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic: {
-                HAPAssert(inService);
-                inCharacteristic = true;
+    if (blePeripheralManager->numUsedAttributes >= blePeripheralManager->numAttributes) {
+        HAPLog(&logObject,
+               "Not enough resources to add GATT descriptor (have space for %zu GATT attributes).",
+               blePeripheralManager->numAttributes);
+        return kHAPError_OutOfResources;
+    }
+    HAPPlatformBLEPeripheralManagerAttributeHandle handle = blePeripheralManager->lastHandle;
+    HAPPlatformBLEPeripheralManagerAttributeHandle numNeededHandles = 1;
+    if (handle >= (HAPPlatformBLEPeripheralManagerAttributeHandle)(-1 - numNeededHandles)) {
+        HAPLog(&logObject, "Not enough resources to add GATT descriptor (GATT database is full).");
+        return kHAPError_OutOfResources;
+    }
 
-                HAPAssert(attribute->_.characteristic.handle == handle + 1);
-                handle = attribute->_.characteristic.handle;
-                HAPAssert(attribute->_.characteristic.valueHandle == handle + 1);
-                handle = attribute->_.characteristic.valueHandle;
+    HAPPlatformBLEPeripheralManagerAttribute* attribute =
+            &blePeripheralManager->attributes[blePeripheralManager->numUsedAttributes++];
+    HAPRawBufferZero(attribute, sizeof *attribute);
+    attribute->type = kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor;
+    attribute->_.descriptor.type = *type;
+    attribute->_.descriptor.properties = properties;
+    attribute->_.descriptor.handle = ++handle;
+    if (constBytes) {
+        HAPRawBufferCopyBytes(attribute->_.descriptor.constBytes, HAPNonnullVoid(constBytes), constNumBytes);
+        attribute->_.descriptor.numConstBytes = (uint8_t) constNumBytes;
+        attribute->_.descriptor.isConst = true;
+    }
 
-                if (attribute->_.characteristic.cccDescriptorHandle) {
-                    HAPAssert(attribute->_.characteristic.cccDescriptorHandle == handle + 1);
-                    handle = attribute->_.characteristic.cccDescriptorHandle;
-                }
-            } break;
-            case kHAPPlatformBLEPeripheralManagerAttributeType_Descriptor: {
-                HAPAssert(inCharacteristic);
+    *descriptorHandle = attribute->_.descriptor.handle;
 
-                HAPAssert(attribute->_.descriptor.handle == handle + 1);
-                handle = attribute->_.descriptor.handle;
-            } break;
-        }
-    }
-    HAPLog(&logObject,
-           "Not enough resources to add GATT descriptor (have space for %zu GATT attributes).",
-           blePeripheralManager->numAttributes);
-    return kHAPError_OutOfResources;
+    blePeripheralManager->lastHandle = handle;
+    return kHAPError_None;
 }
 
 void HAPPlatformBLEPeripheralManagerPublishServices(HAPPlatformBLEPeripheralManagerRef _Nonnull blePeripheralManager) {
@@ -317,9 +1618,23 @@ void HAPPlatformBLEPeripheralManagerPublishServices(HAPPlatformBLEPeripheralMana
     HAPPrecondition(blePeripheralManager->isDeviceAddressSet);
     HAPPrecondition(!blePeripheralManager->didPublishAttributes);
 
+    BuildAttributeIndex(blePeripheralManager);
+#if CONFIG_BT_NIMBLE_ENABLED
+    PublishGATTServices(blePeripheralManager);
+#endif
     blePeripheralManager->didPublishAttributes = true;
 }
 
+static void ResetAdvertisingData(HAPPlatformBLEPeripheralManagerRef blePeripheralManager) {
+    HAPPrecondition(blePeripheralManager);
+
+    HAPRawBufferZero(blePeripheralManager->advertisingBytes, sizeof blePeripheralManager->advertisingBytes);
+    blePeripheralManager->numAdvertisingBytes = 0;
+    HAPRawBufferZero(blePeripheralManager->scanResponseBytes, sizeof blePeripheralManager->scanResponseBytes);
+    blePeripheralManager->numScanResponseBytes = 0;
+    blePeripheralManager->advertisingInterval = 0;
+}
+
 void HAPPlatformBLEPeripheralManagerStartAdvertising(
         HAPPlatformBLEPeripheralManagerRef _Nonnull blePeripheralManager,
         HAPBLEAdvertisingInterval advertisingInterval,
@@ -337,7 +1652,22 @@ void HAPPlatformBLEPeripheralManagerStartAdvertising(
     HAPPrecondition(!numScanResponseBytes || scanResponseBytes);
     HAPPrecondition(numScanResponseBytes <= sizeof blePeripheralManager->scanResponseBytes);
 
-    HAPPlatformBLEPeripheralManagerStopAdvertising(blePeripheralManager);
+    if (blePeripheralManager->advertisingInterval == advertisingInterval &&
+        blePeripheralManager->numAdvertisingBytes == numAdvertisingBytes &&
+        HAPRawBufferAreEqual(blePeripheralManager->advertisingBytes, advertisingBytes, numAdvertisingBytes) &&
+        blePeripheralManager->numScanResponseBytes == numScanResponseBytes &&
+        (!numScanResponseBytes ||
+         HAPRawBufferAreEqual(
+                 blePeripheralManager->scanResponseBytes, HAPNonnullVoid(scanResponseBytes), numScanResponseBytes))) {
+        // Already advertising this data.
+#if CONFIG_BT_NIMBLE_ENABLED
+        UpdateAdvertising(blePeripheralManager);
+#endif
+        return;
+    }
+
+    // NimBLE keeps advertising the previous data until the update has been applied.
+    ResetAdvertisingData(blePeripheralManager);
 
     HAPRawBufferCopyBytes(blePeripheralManager->advertisingBytes, advertisingBytes, numAdvertisingBytes);
     blePeripheralManager->numAdvertisingBytes = (uint8_t) numAdvertisingBytes;
@@ -347,6 +1677,10 @@ void HAPPlatformBLEPeripheralManagerStartAdvertising(
     }
     blePeripheralManager->numScanResponseBytes = (uint8_t) numScanResponseBytes;
     blePeripheralManager->advertisingInterval = advertisingInterval;
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    RestartAdvertising(blePeripheralManager);
+#endif
 }
 
 void HAPPlatformBLEPeripheralManagerStopAdvertising(HAPPlatformBLEPeripheralManagerRef _Nonnull blePeripheralManager) {
@@ -354,11 +1688,11 @@ void HAPPlatformBLEPeripheralManagerStopAdvertising(HAPPlatformBLEPeripheralMana
     HAPPrecondition(blePeripheralManager->isDeviceAddressSet);
     HAPPrecondition(blePeripheralManager->didPublishAttributes);
 
-    HAPRawBufferZero(blePeripheralManager->advertisingBytes, sizeof blePeripheralManager->advertisingBytes);
-    blePeripheralManager->numAdvertisingBytes = 0;
-    HAPRawBufferZero(blePeripheralManager->scanResponseBytes, sizeof blePeripheralManager->scanResponseBytes);
-    blePeripheralManager->numScanResponseBytes = 0;
-    blePeripheralManager->advertisingInterval = 0;
+#if CONFIG_BT_NIMBLE_ENABLED
+    blePeripheralManager->isAdvertisingUpdatePending = false;
+    CancelAdvertising(blePeripheralManager);
+#endif
+    ResetAdvertisingData(blePeripheralManager);
 }
 
 HAP_RESULT_USE_CHECK
@@ -427,9 +1761,16 @@ void HAPPlatformBLEPeripheralManagerCancelCentralConnection(
         HAPPlatformBLEPeripheralManagerConnectionHandle connectionHandle) {
     HAPPrecondition(blePeripheralManager);
 
+#if CONFIG_BT_NIMBLE_ENABLED
+    int rc = ble_gap_terminate(connectionHandle, BLE_ERR_REM_USER_CONN_TERM);
+    if (rc && rc != BLE_HS_ENOTCONN) {
+        HAPLogError(&logObject, "ble_gap_terminate failed: %d.", rc);
+    }
+#else
     (void) connectionHandle;
     HAPLogError(&logObject, "[NYI] %s.", __func__);
     HAPFatalError();
+#endif
 }
 
 HAPError HAPPlatformBLEPeripheralManagerSendHandleValueIndication(
@@ -441,8 +1782,47 @@ HAPError HAPPlatformBLEPeripheralManagerSendHandleValueIndication(
     HAPPrecondition(blePeripheralManager);
     HAPPrecondition(valueHandle);
     HAPPrecondition(!numBytes || bytes);
+    HAPPrecondition(blePeripheralManager->didPublishAttributes);
+    const HAPPlatformBLEPeripheralManagerAttribute* attribute = GetAttribute(blePeripheralManager, valueHandle);
+    HAPPrecondition(attribute);
+    HAPPrecondition(attribute->type == kHAPPlatformBLEPeripheralManagerAttributeType_Characteristic);
+    HAPPrecondition(attribute->_.characteristic.valueHandle == valueHandle);
+    HAPPrecondition(attribute->_.characteristic.properties.indicate);
+
+#if CONFIG_BT_NIMBLE_ENABLED
+    if (!blePeripheralManager->isConnected || blePeripheralManager->connectionHandle != connectionHandle) {
+        return kHAPError_InvalidState;
+    }
+
+    if (!blePeripheralManager->policy.batchingWindow || numBytes) {
+        if (blePeripheralManager->isIndicationInProgress) {
+            // handleReadyToUpdateSubscribers is called once the pending indication has completed.
+            return kHAPError_OutOfResources;
+        }
+        return SendIndication(blePeripheralManager, valueHandle, bytes, numBytes);
+    }
+
+    // Zero-length indications only tell the controller to read the characteristic, so repeated ones are merged.
+    for (size_t i = 0; i < blePeripheralManager->numPendingIndications; i++) {
+        if (blePeripheralManager->pendingIndications[i] == valueHandle) {
+            return kHAPError_None;
+        }
+    }
+    if (blePeripheralManager->numPendingIndications == HAPArrayCount(blePeripheralManager->pendingIndications)) {
+        // handleReadyToUpdateSubscribers is called once the batch has been sent.
+        return kHAPError_OutOfResources;
+    }
+    blePeripheralManager->pendingIndications[blePeripheralManager->numPendingIndications++] = valueHandle;
 
+    if (HAPPlatformClockGetCurrent() < blePeripheralManager->batchingWindowEnd) {
+        ScheduleBatchingTimer(blePeripheralManager);
+    } else {
+        SendPendingIndication(blePeripheralManager);
+    }
+    return kHAPError_None;
+#else
     (void) connectionHandle;
     HAPLogError(&logObject, "[NYI] %s.", __func__);
     HAPFatalError();
+#endif
 }
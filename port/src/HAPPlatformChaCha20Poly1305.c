@@ -0,0 +1,512 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sdkconfig.h>
+
+#include "HAPPlatform.h"
+#include "HAPPlatformChaCha20Poly1305+Init.h"
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+    do { \
+        a += b; \
+        d ^= a; \
+        d = ROTL32(d, 16); \
+        c += d; \
+        b ^= c; \
+        b = ROTL32(b, 12); \
+        a += b; \
+        d ^= a; \
+        d = ROTL32(d, 8); \
+        c += d; \
+        b ^= c; \
+        b = ROTL32(b, 7); \
+    } while (0)
+
+/**
+ * Word type that may alias message buffers. Only used for 4 byte aligned buffers, as Xtensa faults on unaligned
+ * word accesses.
+ */
+typedef uint32_t __attribute__((may_alias)) AliasedWord;
+
+HAP_RESULT_USE_CHECK
+static uint32_t Load32(const uint8_t* bytes) {
+    return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void Store32(uint8_t* bytes, uint32_t value) {
+    bytes[0] = (uint8_t) value;
+    bytes[1] = (uint8_t)(value >> 8);
+    bytes[2] = (uint8_t)(value >> 16);
+    bytes[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * ChaCha20 state.
+ */
+typedef struct {
+    uint32_t input[16];
+} ChaCha20;
+
+static void ChaCha20Init(ChaCha20* chacha, const uint8_t key[32], const uint8_t nonce[12], uint32_t counter) {
+    HAPPrecondition(chacha);
+    HAPPrecondition(key);
+    HAPPrecondition(nonce);
+
+    // "expand 32-byte k".
+    chacha->input[0] = 0x61707865;
+    chacha->input[1] = 0x3320646e;
+    chacha->input[2] = 0x79622d32;
+    chacha->input[3] = 0x6b206574;
+    for (size_t i = 0; i < 8; i++) {
+        chacha->input[4 + i] = Load32(&key[4 * i]);
+    }
+    chacha->input[12] = counter;
+    chacha->input[13] = Load32(&nonce[0]);
+    chacha->input[14] = Load32(&nonce[4]);
+    chacha->input[15] = Load32(&nonce[8]);
+}
+
+/**
+ * Computes the next 64 bytes of key stream and advances the block counter.
+ */
+static void ChaCha20Block(ChaCha20* chacha, uint32_t keyStream[16]) {
+    HAPPrecondition(chacha);
+    HAPPrecondition(keyStream);
+
+    // Separate variables let the compiler keep as much of the state in registers as possible.
+    const uint32_t* input = chacha->input;
+    uint32_t x0 = input[0], x1 = input[1], x2 = input[2], x3 = input[3];
+    uint32_t x4 = input[4], x5 = input[5], x6 = input[6], x7 = input[7];
+    uint32_t x8 = input[8], x9 = input[9], x10 = input[10], x11 = input[11];
+    uint32_t x12 = input[12], x13 = input[13], x14 = input[14], x15 = input[15];
+
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x0, x4, x8, x12);
+        QUARTERROUND(x1, x5, x9, x13);
+        QUARTERROUND(x2, x6, x10, x14);
+        QUARTERROUND(x3, x7, x11, x15);
+        QUARTERROUND(x0, x5, x10, x15);
+        QUARTERROUND(x1, x6, x11, x12);
+        QUARTERROUND(x2, x7, x8, x13);
+        QUARTERROUND(x3, x4, x9, x14);
+    }
+
+    keyStream[0] = x0 + input[0];
+    keyStream[1] = x1 + input[1];
+    keyStream[2] = x2 + input[2];
+    keyStream[3] = x3 + input[3];
+    keyStream[4] = x4 + input[4];
+    keyStream[5] = x5 + input[5];
+    keyStream[6] = x6 + input[6];
+    keyStream[7] = x7 + input[7];
+    keyStream[8] = x8 + input[8];
+    keyStream[9] = x9 + input[9];
+    keyStream[10] = x10 + input[10];
+    keyStream[11] = x11 + input[11];
+    keyStream[12] = x12 + input[12];
+    keyStream[13] = x13 + input[13];
+    keyStream[14] = x14 + input[14];
+    keyStream[15] = x15 + input[15];
+
+    chacha->input[12]++;
+}
+
+/**
+ * XORs up to 64 bytes with the key stream.
+ */
+static void XORKeyStream(uint8_t* output, const uint8_t* input, const uint32_t keyStream[16], size_t numBytes) {
+    HAPPrecondition(output);
+    HAPPrecondition(input);
+    HAPPrecondition(keyStream);
+    HAPPrecondition(numBytes <= 64);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (numBytes == 64 && !(((uintptr_t) output | (uintptr_t) input) & 3)) {
+        AliasedWord* outputWords = (AliasedWord*) (void*) output;
+        const AliasedWord* inputWords = (const AliasedWord*) (const void*) input;
+        for (size_t i = 0; i < 16; i++) {
+            outputWords[i] = inputWords[i] ^ keyStream[i];
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < numBytes; i++) {
+        output[i] = input[i] ^ (uint8_t)(keyStream[i / 4] >> (8 * (i % 4)));
+    }
+}
+
+/**
+ * Poly1305 state with 26 bit limbs.
+ */
+typedef struct {
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+} Poly1305;
+
+static void Poly1305Init(Poly1305* poly, const uint8_t key[32]) {
+    HAPPrecondition(poly);
+    HAPPrecondition(key);
+
+    // r &= 0xffffffc0ffffffc0ffffffc0fffffff
+    poly->r[0] = (Load32(&key[0])) & 0x3ffffff;
+    poly->r[1] = (Load32(&key[3]) >> 2) & 0x3ffff03;
+    poly->r[2] = (Load32(&key[6]) >> 4) & 0x3ffc0ff;
+    poly->r[3] = (Load32(&key[9]) >> 6) & 0x3f03fff;
+    poly->r[4] = (Load32(&key[12]) >> 8) & 0x00fffff;
+
+    for (size_t i = 0; i < 5; i++) {
+        poly->h[i] = 0;
+    }
+    for (size_t i = 0; i < 4; i++) {
+        poly->pad[i] = Load32(&key[16 + 4 * i]);
+    }
+}
+
+/**
+ * Authenticates full 16 byte blocks.
+ */
+static void Poly1305Blocks(Poly1305* poly, const uint8_t* bytes, size_t numBlocks) {
+    HAPPrecondition(poly);
+    HAPPrecondition(bytes || !numBlocks);
+
+    const uint32_t r0 = poly->r[0], r1 = poly->r[1], r2 = poly->r[2], r3 = poly->r[3], r4 = poly->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+
+    for (size_t i = 0; i < numBlocks; i++, bytes += 16) {
+        // h += m, with the 2^128 bit of a full block.
+        h0 += (Load32(&bytes[0])) & 0x3ffffff;
+        h1 += (Load32(&bytes[3]) >> 2) & 0x3ffffff;
+        h2 += (Load32(&bytes[6]) >> 4) & 0x3ffffff;
+        h3 += (Load32(&bytes[9]) >> 6) & 0x3ffffff;
+        h4 += (Load32(&bytes[12]) >> 8) | (1u << 24);
+
+        // h *= r, modulo 2^130 - 5.
+        uint64_t d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3 + (uint64_t) h3 * s2 +
+                      (uint64_t) h4 * s1;
+        uint64_t d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4 + (uint64_t) h3 * s3 +
+                      (uint64_t) h4 * s2;
+        uint64_t d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0 + (uint64_t) h3 * s4 +
+                      (uint64_t) h4 * s3;
+        uint64_t d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1 + (uint64_t) h3 * r0 +
+                      (uint64_t) h4 * s4;
+        uint64_t d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2 + (uint64_t) h3 * r1 +
+                      (uint64_t) h4 * r0;
+
+        // Partial carry propagation.
+        uint32_t c = (uint32_t)(d0 >> 26);
+        h0 = (uint32_t) d0 & 0x3ffffff;
+        d1 += c;
+        c = (uint32_t)(d1 >> 26);
+        h1 = (uint32_t) d1 & 0x3ffffff;
+        d2 += c;
+        c = (uint32_t)(d2 >> 26);
+        h2 = (uint32_t) d2 & 0x3ffffff;
+        d3 += c;
+        c = (uint32_t)(d3 >> 26);
+        h3 = (uint32_t) d3 & 0x3ffffff;
+        d4 += c;
+        c = (uint32_t)(d4 >> 26);
+        h4 = (uint32_t) d4 & 0x3ffffff;
+        h0 += c * 5;
+        c = h0 >> 26;
+        h0 &= 0x3ffffff;
+        h1 += c;
+    }
+
+    poly->h[0] = h0;
+    poly->h[1] = h1;
+    poly->h[2] = h2;
+    poly->h[3] = h3;
+    poly->h[4] = h4;
+}
+
+/**
+ * Authenticates bytes, padded with zeros to a multiple of 16 bytes.
+ */
+static void Poly1305BlocksPadded(Poly1305* poly, const uint8_t* _Nullable bytes, size_t numBytes) {
+    HAPPrecondition(poly);
+    HAPPrecondition(bytes || !numBytes);
+
+    size_t numFullBytes = numBytes & ~(size_t) 15;
+    if (numFullBytes) {
+        Poly1305Blocks(poly, HAPNonnull(bytes), numFullBytes / 16);
+    }
+    if (numBytes != numFullBytes) {
+        uint8_t block[16] = { 0 };
+        HAPRawBufferCopyBytes(block, &HAPNonnull(bytes)[numFullBytes], numBytes - numFullBytes);
+        Poly1305Blocks(poly, block, 1);
+    }
+}
+
+static void Poly1305Finish(Poly1305* poly, uint8_t tag[16]) {
+    HAPPrecondition(poly);
+    HAPPrecondition(tag);
+
+    uint32_t h0 = poly->h[0], h1 = poly->h[1], h2 = poly->h[2], h3 = poly->h[3], h4 = poly->h[4];
+
+    // Full carry propagation.
+    uint32_t c = h1 >> 26;
+    h1 &= 0x3ffffff;
+    h2 += c;
+    c = h2 >> 26;
+    h2 &= 0x3ffffff;
+    h3 += c;
+    c = h3 >> 26;
+    h3 &= 0x3ffffff;
+    h4 += c;
+    c = h4 >> 26;
+    h4 &= 0x3ffffff;
+    h0 += c * 5;
+    c = h0 >> 26;
+    h0 &= 0x3ffffff;
+    h1 += c;
+
+    // g = h - (2^130 - 5). Select h if g is negative, in constant time.
+    uint32_t g0 = h0 + 5;
+    c = g0 >> 26;
+    g0 &= 0x3ffffff;
+    uint32_t g1 = h1 + c;
+    c = g1 >> 26;
+    g1 &= 0x3ffffff;
+    uint32_t g2 = h2 + c;
+    c = g2 >> 26;
+    g2 &= 0x3ffffff;
+    uint32_t g3 = h3 + c;
+    c = g3 >> 26;
+    g3 &= 0x3ffffff;
+    uint32_t g4 = h4 + c - (1u << 26);
+
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    // tag = (h + pad) mod 2^128.
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    uint64_t f = (uint64_t) h0 + poly->pad[0];
+    Store32(&tag[0], (uint32_t) f);
+    f = (uint64_t) h1 + poly->pad[1] + (f >> 32);
+    Store32(&tag[4], (uint32_t) f);
+    f = (uint64_t) h2 + poly->pad[2] + (f >> 32);
+    Store32(&tag[8], (uint32_t) f);
+    f = (uint64_t) h3 + poly->pad[3] + (f >> 32);
+    Store32(&tag[12], (uint32_t) f);
+
+    HAPRawBufferZero(poly, sizeof *poly);
+}
+
+/**
+ * Derives the Poly1305 key from block 0 and positions the cipher at block 1.
+ */
+static void Setup(
+        ChaCha20* chacha,
+        Poly1305* poly,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[kHAPPlatformChaCha20Poly1305_KeyBytes]) {
+    HAPPrecondition(chacha);
+    HAPPrecondition(poly);
+    HAPPrecondition(n);
+    HAPPrecondition(n_len <= kHAPPlatformChaCha20Poly1305_MaxNonceBytes);
+    HAPPrecondition(k);
+
+    uint8_t nonce[kHAPPlatformChaCha20Poly1305_MaxNonceBytes] = { 0 };
+    HAPRawBufferCopyBytes(&nonce[sizeof nonce - n_len], n, n_len);
+    ChaCha20Init(chacha, k, nonce, 0);
+
+    uint32_t keyStream[16];
+    ChaCha20Block(chacha, keyStream);
+    uint8_t polyKey[32];
+    for (size_t i = 0; i < 8; i++) {
+        Store32(&polyKey[4 * i], keyStream[i]);
+    }
+    Poly1305Init(poly, polyKey);
+
+    HAPRawBufferZero(keyStream, sizeof keyStream);
+    HAPRawBufferZero(polyKey, sizeof polyKey);
+}
+
+static void AuthenticateLengths(Poly1305* poly, size_t a_len, size_t c_len) {
+    HAPPrecondition(poly);
+
+    uint8_t block[16];
+    Store32(&block[0], (uint32_t) a_len);
+    Store32(&block[4], (uint32_t)((uint64_t) a_len >> 32));
+    Store32(&block[8], (uint32_t) c_len);
+    Store32(&block[12], (uint32_t)((uint64_t) c_len >> 32));
+    Poly1305Blocks(poly, block, 1);
+}
+
+void HAPPlatformChaCha20Poly1305Encrypt(
+        uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable c,
+        const uint8_t* _Nullable m,
+        size_t m_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]) {
+    HAPPrecondition(tag);
+    HAPPrecondition((c && m) || !m_len);
+    HAPPrecondition(a || !a_len);
+
+    ChaCha20 chacha;
+    Poly1305 poly;
+    Setup(&chacha, &poly, n, n_len, k);
+    Poly1305BlocksPadded(&poly, a, a_len);
+
+    // Encrypt and authenticate one ChaCha20 block at a time while it is hot in the cache.
+    uint32_t keyStream[16];
+    size_t o = 0;
+    for (; m_len - o >= 64; o += 64) {
+        ChaCha20Block(&chacha, keyStream);
+        XORKeyStream(&HAPNonnull(c)[o], &HAPNonnull(m)[o], keyStream, 64);
+        Poly1305Blocks(&poly, &HAPNonnull(c)[o], 4);
+    }
+    if (o < m_len) {
+        ChaCha20Block(&chacha, keyStream);
+        XORKeyStream(&HAPNonnull(c)[o], &HAPNonnull(m)[o], keyStream, m_len - o);
+        Poly1305BlocksPadded(&poly, &HAPNonnull(c)[o], m_len - o);
+    }
+    AuthenticateLengths(&poly, a_len, m_len);
+    Poly1305Finish(&poly, tag);
+
+    HAPRawBufferZero(&chacha, sizeof chacha);
+    HAPRawBufferZero(keyStream, sizeof keyStream);
+}
+
+HAP_RESULT_USE_CHECK
+int HAPPlatformChaCha20Poly1305Decrypt(
+        const uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable m,
+        const uint8_t* _Nullable c,
+        size_t c_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]) {
+    HAPPrecondition(tag);
+    HAPPrecondition((m && c) || !c_len);
+    HAPPrecondition(a || !a_len);
+
+    ChaCha20 chacha;
+    Poly1305 poly;
+    Setup(&chacha, &poly, n, n_len, k);
+    Poly1305BlocksPadded(&poly, a, a_len);
+
+    // The ciphertext is authenticated before it is overwritten, so that m may be the same buffer as c.
+    uint32_t keyStream[16];
+    size_t o = 0;
+    for (; c_len - o >= 64; o += 64) {
+        Poly1305Blocks(&poly, &HAPNonnull(c)[o], 4);
+        ChaCha20Block(&chacha, keyStream);
+        XORKeyStream(&HAPNonnull(m)[o], &HAPNonnull(c)[o], keyStream, 64);
+    }
+    if (o < c_len) {
+        Poly1305BlocksPadded(&poly, &HAPNonnull(c)[o], c_len - o);
+        ChaCha20Block(&chacha, keyStream);
+        XORKeyStream(&HAPNonnull(m)[o], &HAPNonnull(c)[o], keyStream, c_len - o);
+    }
+    AuthenticateLengths(&poly, a_len, c_len);
+    uint8_t expectedTag[kHAPPlatformChaCha20Poly1305_TagBytes];
+    Poly1305Finish(&poly, expectedTag);
+
+    HAPRawBufferZero(&chacha, sizeof chacha);
+    HAPRawBufferZero(keyStream, sizeof keyStream);
+
+    // Constant time comparison.
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof expectedTag; i++) {
+        diff |= (uint8_t)(expectedTag[i] ^ tag[i]);
+    }
+    if (diff) {
+        if (c_len) {
+            HAPRawBufferZero(HAPNonnull(m), c_len);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+#if CONFIG_HAP_CRYPTO_CHACHA20_POLY1305
+
+// The crypto PAL entry points are redirected here with -Wl,--wrap (see CMakeLists.txt).
+
+void __wrap_HAP_chacha20_poly1305_encrypt_aad(
+        uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable c,
+        const uint8_t* _Nullable m,
+        size_t m_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]);
+
+int __wrap_HAP_chacha20_poly1305_decrypt_aad(
+        const uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable m,
+        const uint8_t* _Nullable c,
+        size_t c_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]);
+
+void __wrap_HAP_chacha20_poly1305_encrypt_aad(
+        uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable c,
+        const uint8_t* _Nullable m,
+        size_t m_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]) {
+    HAPPlatformChaCha20Poly1305Encrypt(tag, c, m, m_len, a, a_len, n, n_len, k);
+}
+
+int __wrap_HAP_chacha20_poly1305_decrypt_aad(
+        const uint8_t tag[_Nonnull kHAPPlatformChaCha20Poly1305_TagBytes],
+        uint8_t* _Nullable m,
+        const uint8_t* _Nullable c,
+        size_t c_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[_Nonnull kHAPPlatformChaCha20Poly1305_KeyBytes]) {
+    return HAPPlatformChaCha20Poly1305Decrypt(tag, m, c, c_len, a, a_len, n, n_len, k);
+}
+
+#endif
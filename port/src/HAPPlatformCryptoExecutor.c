@@ -0,0 +1,209 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "HAPPlatform.h"
+#include "HAPPlatformCryptoExecutor+Init.h"
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "CryptoExecutor" };
+
+#if portNUM_PROCESSORS > 1
+#define kHAPPlatformCryptoExecutor_CoreID ((BaseType_t) CONFIG_HAP_CRYPTO_EXECUTOR_CORE_ID)
+#else
+#define kHAPPlatformCryptoExecutor_CoreID tskNO_AFFINITY
+#endif
+
+/**
+ * Maximum time to wait for the run loop to accept a job completion before the completion is dropped.
+ */
+#define kHAPPlatformCryptoExecutor_CompletionTimeout \
+    (pdMS_TO_TICKS(1000) ? pdMS_TO_TICKS(1000) : (TickType_t) 1)
+
+/**
+ * Queued job.
+ */
+typedef struct {
+    /**
+     * Job to run on the worker task. NULL requests the worker task to stop.
+     */
+    HAPPlatformCryptoExecutorJob _Nullable job;
+
+    /**
+     * Size of the job context.
+     */
+    uint8_t contextSize;
+
+    /**
+     * Completion and job context, in the layout passed to HAPPlatformRunLoopScheduleCallback.
+     *
+     * - Offset 0: Completion callback.
+     * - Offset 8: Job context.
+     */
+    HAP_ALIGNAS(8)
+    uint8_t bytes[8 + kHAPPlatformCryptoExecutor_MaxContextBytes];
+} HAPPlatformCryptoExecutorQueuedJob;
+HAP_STATIC_ASSERT(sizeof(HAPPlatformCryptoExecutorCompletion) <= 8, HAPPlatformCryptoExecutorCompletion);
+
+/**
+ * Invokes the completion of a job on the run loop.
+ */
+static void HandleJobCompleted(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize >= 8);
+    uint8_t* bytes = context;
+
+    HAPPlatformCryptoExecutorCompletion completion;
+    HAPRawBufferCopyBytes(&completion, &bytes[0], sizeof completion);
+    completion(contextSize > 8 ? &bytes[8] : NULL, contextSize - 8);
+}
+
+static void WorkerTaskMain(void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformCryptoExecutorRef cryptoExecutor = context;
+
+    for (;;) {
+        HAPPlatformCryptoExecutorQueuedJob queuedJob;
+        BaseType_t ok = xQueueReceive(cryptoExecutor->jobQueue, &queuedJob, portMAX_DELAY);
+        if (ok != pdTRUE) {
+            continue;
+        }
+        if (!queuedJob.job) {
+            break;
+        }
+
+        queuedJob.job(queuedJob.contextSize ? &queuedJob.bytes[8] : NULL, queuedJob.contextSize);
+
+        // Hand the result back to the run loop. Wait for space while the run loop is busy, but give up if the
+        // crypto executor is being released or the run loop does not drain its callbacks in time.
+        HAPError err;
+        TickType_t numWaitedTicks = 0;
+        while ((err = HAPPlatformRunLoopScheduleCallback(
+                        HandleJobCompleted, queuedJob.bytes, 8 + (size_t) queuedJob.contextSize)) != kHAPError_None) {
+            if (cryptoExecutor->isStopping || numWaitedTicks == kHAPPlatformCryptoExecutor_CompletionTimeout) {
+                break;
+            }
+            if (!numWaitedTicks) {
+                HAPLog(&logObject, "Cannot schedule job completion. Retrying.");
+            }
+            vTaskDelay(1);
+            numWaitedTicks++;
+        }
+        if (err) {
+            HAPLogError(&logObject, "Dropping job completion: run loop did not accept it.");
+            cryptoExecutor->numDroppedJobs++;
+            continue;
+        }
+        cryptoExecutor->numCompletedJobs++;
+    }
+
+    xSemaphoreGive(cryptoExecutor->stopSemaphore);
+    vTaskDelete(NULL);
+}
+
+void HAPPlatformCryptoExecutorCreate(
+        HAPPlatformCryptoExecutorRef cryptoExecutor,
+        const HAPPlatformCryptoExecutorOptions* options) {
+    HAPPrecondition(cryptoExecutor);
+    HAPPrecondition(options);
+
+    HAPRawBufferZero(cryptoExecutor, sizeof *cryptoExecutor);
+
+    uint32_t stackSize = options->stackSize ? options->stackSize : CONFIG_HAP_CRYPTO_EXECUTOR_STACK_SIZE;
+    UBaseType_t priority = options->priority ? options->priority : CONFIG_HAP_CRYPTO_EXECUTOR_PRIORITY;
+    size_t maxQueuedJobs = options->maxQueuedJobs ? options->maxQueuedJobs : CONFIG_HAP_CRYPTO_EXECUTOR_QUEUE_LENGTH;
+
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: queuedJob = %lu, maxQueuedJobs = %lu",
+            (unsigned long) sizeof(HAPPlatformCryptoExecutorQueuedJob),
+            (unsigned long) maxQueuedJobs);
+
+    cryptoExecutor->jobQueue = xQueueCreate(maxQueuedJobs, sizeof(HAPPlatformCryptoExecutorQueuedJob));
+    cryptoExecutor->stopSemaphore = xSemaphoreCreateBinary();
+    if (!cryptoExecutor->jobQueue || !cryptoExecutor->stopSemaphore) {
+        HAPLogError(&logObject, "Cannot allocate crypto executor job queue.");
+        HAPFatalError();
+    }
+
+    BaseType_t ok = xTaskCreatePinnedToCore(
+            WorkerTaskMain,
+            "hap_crypto",
+            stackSize,
+            cryptoExecutor,
+            priority,
+            &cryptoExecutor->task,
+            kHAPPlatformCryptoExecutor_CoreID);
+    if (ok != pdPASS) {
+        HAPLogError(&logObject, "Cannot create crypto executor task.");
+        HAPFatalError();
+    }
+}
+
+void HAPPlatformCryptoExecutorRelease(HAPPlatformCryptoExecutorRef cryptoExecutor) {
+    HAPPrecondition(cryptoExecutor);
+    HAPPrecondition(cryptoExecutor->task);
+
+    // Completions that the run loop does not accept right away are dropped from now on, as the run loop may have
+    // stopped already.
+    cryptoExecutor->isStopping = true;
+    static const HAPPlatformCryptoExecutorQueuedJob stopJob = { .job = NULL };
+    (void) xQueueSend(cryptoExecutor->jobQueue, &stopJob, portMAX_DELAY);
+    (void) xSemaphoreTake(cryptoExecutor->stopSemaphore, portMAX_DELAY);
+
+    vQueueDelete(cryptoExecutor->jobQueue);
+    vSemaphoreDelete(cryptoExecutor->stopSemaphore);
+    HAPRawBufferZero(cryptoExecutor, sizeof *cryptoExecutor);
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformCryptoExecutorSubmit(
+        HAPPlatformCryptoExecutorRef cryptoExecutor,
+        HAPPlatformCryptoExecutorJob job,
+        HAPPlatformCryptoExecutorCompletion completion,
+        const void* _Nullable context,
+        size_t contextSize) {
+    HAPPrecondition(cryptoExecutor);
+    HAPPrecondition(cryptoExecutor->jobQueue);
+    HAPPrecondition(job);
+    HAPPrecondition(completion);
+    HAPPrecondition(!contextSize || context);
+
+    if (contextSize > kHAPPlatformCryptoExecutor_MaxContextBytes) {
+        HAPLogError(&logObject, "Contexts larger than %lu bytes are not supported.",
+                (unsigned long) kHAPPlatformCryptoExecutor_MaxContextBytes);
+        return kHAPError_OutOfResources;
+    }
+
+    // Jobs are only submitted from the run loop, so a single staging buffer suffices.
+    static HAPPlatformCryptoExecutorQueuedJob queuedJob;
+    queuedJob.job = job;
+    queuedJob.contextSize = (uint8_t) contextSize;
+    HAPRawBufferZero(queuedJob.bytes, sizeof queuedJob.bytes);
+    HAPRawBufferCopyBytes(&queuedJob.bytes[0], &completion, sizeof completion);
+    if (contextSize) {
+        HAPRawBufferCopyBytes(&queuedJob.bytes[8], HAPNonnullVoid(context), contextSize);
+    }
+
+    if (xQueueSend(cryptoExecutor->jobQueue, &queuedJob, 0) != pdTRUE) {
+        HAPLog(&logObject, "Crypto executor job queue is full.");
+        return kHAPError_OutOfResources;
+    }
+    cryptoExecutor->numSubmittedJobs++;
+    return kHAPError_None;
+}
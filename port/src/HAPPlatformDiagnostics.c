@@ -0,0 +1,301 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "HAPPlatform.h"
+
+#include "HAPPlatformDiagnostics+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+// Header files added by Espressif
+#include <sdkconfig.h>
+#if CONFIG_HAP_DIAGNOSTICS
+#include <fcntl.h>
+#include <lwip/sockets.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+#if CONFIG_HAP_DIAGNOSTICS
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "Diagnostics" };
+
+static struct {
+    /**
+     * Whether diagnostics have been created.
+     */
+    bool isInitialized;
+
+    /**
+     * Key-value store whose statistics are sampled.
+     */
+    HAPPlatformKeyValueStoreRef _Nullable keyValueStore;
+
+    /**
+     * TCP stream manager whose statistics are sampled.
+     */
+    HAPPlatformTCPStreamManagerRef _Nullable tcpStreamManager;
+
+    /**
+     * Task that created diagnostics, i.e., the run loop task.
+     */
+    TaskHandle_t _Nullable mainTask;
+
+    /**
+     * Interval at which a snapshot is logged. 0 if disabled.
+     */
+    HAPTime reportInterval;
+
+    /**
+     * Timer to log the next snapshot. 0 if not registered.
+     */
+    HAPPlatformTimerRef reportTimer;
+
+    /**
+     * Last snapshot.
+     */
+    HAPPlatformDiagnosticsSnapshot snapshot;
+
+    /**
+     * Whether the last snapshot is valid.
+     */
+    bool hasSnapshot;
+} diagnostics;
+
+/**
+ * Samples the heap usage of a capability.
+ *
+ * @param[out] heap                 Heap usage.
+ * @param      caps                 Heap capabilities.
+ */
+static void SampleHeap(HAPPlatformDiagnosticsHeap* heap, uint32_t caps) {
+    HAPPrecondition(heap);
+
+    heap->freeBytes = (uint32_t) heap_caps_get_free_size(caps);
+    heap->minFreeBytes = (uint32_t) heap_caps_get_minimum_free_size(caps);
+    heap->largestFreeBlock = (uint32_t) heap_caps_get_largest_free_block(caps);
+}
+
+/**
+ * Gets the stack high-water mark of a task.
+ *
+ * - uxTaskGetStackHighWaterMark reports the current task for a NULL handle, so it must not be passed through.
+ *
+ * @param      task                 Task. NULL if not found.
+ *
+ * @return Stack high-water mark in bytes, or kHAPPlatformDiagnostics_UnknownStackHighWaterMark.
+ */
+HAP_RESULT_USE_CHECK
+static uint32_t GetStackHighWaterMark(TaskHandle_t _Nullable task) {
+    if (!task) {
+        return kHAPPlatformDiagnostics_UnknownStackHighWaterMark;
+    }
+    return (uint32_t) uxTaskGetStackHighWaterMark(task);
+}
+
+/**
+ * Counts the lwIP sockets in use.
+ *
+ * - lwIP does not export its socket table, so every descriptor in its range is probed instead.
+ *
+ * @param[out] numSocketsInUse      Number of sockets in use.
+ * @param[out] maxSockets           Maximum number of sockets.
+ */
+static void CountSockets(uint32_t* numSocketsInUse, uint32_t* maxSockets) {
+    HAPPrecondition(numSocketsInUse);
+    HAPPrecondition(maxSockets);
+
+    *numSocketsInUse = 0;
+    *maxSockets = 0;
+#ifdef LWIP_SOCKET_OFFSET
+    for (int fd = LWIP_SOCKET_OFFSET; fd < LWIP_SOCKET_OFFSET + CONFIG_LWIP_MAX_SOCKETS; fd++) {
+        if (fcntl(fd, F_GETFL, 0) != -1) {
+            (*numSocketsInUse)++;
+        }
+    }
+    *maxSockets = CONFIG_LWIP_MAX_SOCKETS;
+#endif
+}
+
+/**
+ * Takes a new snapshot.
+ *
+ * @param      now                  Current time.
+ */
+static void TakeSnapshot(HAPTime now) {
+    HAPPlatformDiagnosticsSnapshot* snapshot = &diagnostics.snapshot;
+    HAPRawBufferZero(snapshot, sizeof *snapshot);
+    snapshot->time = now;
+
+    SampleHeap(&snapshot->heap.internal, MALLOC_CAP_INTERNAL);
+    SampleHeap(&snapshot->heap.spiram, MALLOC_CAP_SPIRAM);
+
+    snapshot->stackHighWaterMarks.mainTask = GetStackHighWaterMark(diagnostics.mainTask);
+    snapshot->stackHighWaterMarks.timerTask = GetStackHighWaterMark(xTaskGetHandle("esp_timer"));
+    snapshot->stackHighWaterMarks.mdnsTask = GetStackHighWaterMark(xTaskGetHandle("mdns"));
+    snapshot->numTasks = (uint32_t) uxTaskGetNumberOfTasks();
+
+    CountSockets(&snapshot->sockets.numSocketsInUse, &snapshot->sockets.maxSockets);
+
+    HAPPlatformRunLoopStatistics runLoopStatistics;
+    HAPPlatformRunLoopGetStatistics(&runLoopStatistics);
+    snapshot->runLoop.numTimerWakeups = runLoopStatistics.numTimerWakeups;
+    snapshot->runLoop.numFileHandleWakeups = runLoopStatistics.numFileHandleWakeups;
+    snapshot->runLoop.numLoopbackWakeups = runLoopStatistics.numLoopbackWakeups;
+    snapshot->runLoop.maxFileHandleCallbackDuration = runLoopStatistics.fileHandleCallbackDuration.maxValue;
+    snapshot->runLoop.maxTimerCallbackDuration = runLoopStatistics.timerCallbackDuration.maxValue;
+    snapshot->runLoop.maxScheduledCallbackDuration = runLoopStatistics.scheduledCallbackDuration.maxValue;
+
+    if (diagnostics.tcpStreamManager) {
+        HAPPlatformTCPStreamManagerGetStatistics(
+                HAPNonnull(diagnostics.tcpStreamManager), &snapshot->tcpStreamManager);
+    }
+    if (diagnostics.keyValueStore) {
+        HAPPlatformKeyValueStoreGetStatistics(HAPNonnull(diagnostics.keyValueStore), &snapshot->keyValueStore);
+    }
+
+    diagnostics.hasSnapshot = true;
+}
+
+/**
+ * Logs a snapshot.
+ *
+ * @param      snapshot             Snapshot.
+ */
+static void LogSnapshot(const HAPPlatformDiagnosticsSnapshot* snapshot) {
+    HAPPrecondition(snapshot);
+
+    HAPLogInfo(
+            &logObject,
+            "Diagnostics: heap internal %lu free (min %lu, largest %lu) / spiram %lu free (min %lu). "
+            "stack free main %ld / esp_timer %ld / mdns %ld bytes, %lu tasks. sockets %lu / %lu. "
+            "tcp streams %lu (max %lu / %lu, accepted %lu, rejected %lu, evicted %lu). "
+            "kvs gets %lu (cache hits %lu), nvs reads %lu / writes %lu / commits %lu.",
+            (unsigned long) snapshot->heap.internal.freeBytes,
+            (unsigned long) snapshot->heap.internal.minFreeBytes,
+            (unsigned long) snapshot->heap.internal.largestFreeBlock,
+            (unsigned long) snapshot->heap.spiram.freeBytes,
+            (unsigned long) snapshot->heap.spiram.minFreeBytes,
+            (long) (int32_t) snapshot->stackHighWaterMarks.mainTask,
+            (long) (int32_t) snapshot->stackHighWaterMarks.timerTask,
+            (long) (int32_t) snapshot->stackHighWaterMarks.mdnsTask,
+            (unsigned long) snapshot->numTasks,
+            (unsigned long) snapshot->sockets.numSocketsInUse,
+            (unsigned long) snapshot->sockets.maxSockets,
+            (unsigned long) snapshot->tcpStreamManager.numTCPStreams,
+            (unsigned long) snapshot->tcpStreamManager.maxConcurrentTCPStreams,
+            (unsigned long) snapshot->tcpStreamManager.maxTCPStreams,
+            (unsigned long) snapshot->tcpStreamManager.numAcceptedTCPStreams,
+            (unsigned long) snapshot->tcpStreamManager.numRejectedTCPStreams,
+            (unsigned long) snapshot->tcpStreamManager.numEvictedTCPStreams,
+            (unsigned long) snapshot->keyValueStore.numGets,
+            (unsigned long) snapshot->keyValueStore.numCacheHits,
+            (unsigned long) snapshot->keyValueStore.numNVSReads,
+            (unsigned long) snapshot->keyValueStore.numNVSWrites,
+            (unsigned long) snapshot->keyValueStore.numNVSCommits);
+}
+
+static void ReportTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context HAP_UNUSED) {
+    HAPPrecondition(timer == diagnostics.reportTimer);
+    diagnostics.reportTimer = 0;
+
+    HAPPlatformDiagnosticsLogSnapshot();
+
+    HAPError err = HAPPlatformTimerRegister(
+            &diagnostics.reportTimer,
+            HAPPlatformClockGetCurrent() + diagnostics.reportInterval,
+            ReportTimerExpired,
+            NULL);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to schedule the next diagnostics report.");
+    }
+}
+
+void HAPPlatformDiagnosticsCreate(const HAPPlatformDiagnosticsOptions* options) {
+    HAPPrecondition(options);
+    HAPPrecondition(!diagnostics.isInitialized);
+
+    HAPRawBufferZero(&diagnostics, sizeof diagnostics);
+    diagnostics.keyValueStore = options->keyValueStore;
+    diagnostics.tcpStreamManager = options->tcpStreamManager;
+    diagnostics.mainTask = xTaskGetCurrentTaskHandle();
+    diagnostics.reportInterval = options->reportInterval ? options->reportInterval :
+                                                           (HAPTime) CONFIG_HAP_DIAGNOSTICS_REPORT_INTERVAL * HAPSecond;
+    diagnostics.isInitialized = true;
+
+    if (diagnostics.reportInterval) {
+        HAPError err = HAPPlatformTimerRegister(
+                &diagnostics.reportTimer,
+                HAPPlatformClockGetCurrent() + diagnostics.reportInterval,
+                ReportTimerExpired,
+                NULL);
+        if (err) {
+            HAPAssert(err == kHAPError_OutOfResources);
+            HAPLogError(&logObject, "Not enough resources to schedule the diagnostics report.");
+        }
+    }
+}
+
+void HAPPlatformDiagnosticsRelease(void) {
+    if (diagnostics.reportTimer) {
+        HAPPlatformTimerDeregister(diagnostics.reportTimer);
+        diagnostics.reportTimer = 0;
+    }
+    HAPRawBufferZero(&diagnostics, sizeof diagnostics);
+}
+
+void HAPPlatformDiagnosticsGetSnapshot(HAPPlatformDiagnosticsSnapshot* snapshot) {
+    HAPPrecondition(snapshot);
+    HAPPrecondition(diagnostics.isInitialized);
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+    if (!diagnostics.hasSnapshot || now - diagnostics.snapshot.time >= kHAPPlatformDiagnostics_MaxSnapshotAge) {
+        TakeSnapshot(now);
+    }
+    HAPRawBufferCopyBytes(snapshot, &diagnostics.snapshot, sizeof *snapshot);
+}
+
+void HAPPlatformDiagnosticsLogSnapshot(void) {
+    HAPPrecondition(diagnostics.isInitialized);
+
+    TakeSnapshot(HAPPlatformClockGetCurrent());
+    LogSnapshot(&diagnostics.snapshot);
+}
+
+#else
+
+void HAPPlatformDiagnosticsCreate(const HAPPlatformDiagnosticsOptions* options) {
+    HAPPrecondition(options);
+}
+
+void HAPPlatformDiagnosticsRelease(void) {
+}
+
+void HAPPlatformDiagnosticsGetSnapshot(HAPPlatformDiagnosticsSnapshot* snapshot) {
+    HAPPrecondition(snapshot);
+
+    HAPRawBufferZero(snapshot, sizeof *snapshot);
+}
+
+void HAPPlatformDiagnosticsLogSnapshot(void) {
+}
+
+#endif
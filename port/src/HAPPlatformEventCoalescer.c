@@ -0,0 +1,254 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformEventCoalescer+Init.h"
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "EventCoalescer" };
+
+void HAPPlatformEventCoalescerCreate(
+        HAPPlatformEventCoalescerRef eventCoalescer,
+        const HAPPlatformEventCoalescerOptions* options) {
+    HAPPrecondition(eventCoalescer);
+    HAPPrecondition(options);
+    HAPPrecondition(options->server);
+
+    HAPRawBufferZero(eventCoalescer, sizeof *eventCoalescer);
+    eventCoalescer->server = options->server;
+    eventCoalescer->window =
+            options->window ? options->window : (HAPTime) CONFIG_HAP_EVENT_COALESCER_WINDOW * HAPMillisecond;
+    eventCoalescer->exemptCharacteristics = options->exemptCharacteristics;
+
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: eventCoalescer = %lu, window = %llu ms",
+            (unsigned long) sizeof *eventCoalescer,
+            (unsigned long long) eventCoalescer->window);
+}
+
+void HAPPlatformEventCoalescerRelease(HAPPlatformEventCoalescerRef eventCoalescer) {
+    HAPPrecondition(eventCoalescer);
+    HAPPrecondition(eventCoalescer->server);
+
+    HAPLogInfo(
+            &logObject,
+            "Raised %lu events, coalesced %lu events.",
+            (unsigned long) eventCoalescer->numRaisedEvents,
+            (unsigned long) eventCoalescer->numCoalescedEvents);
+
+    if (eventCoalescer->timer) {
+        HAPPlatformTimerDeregister(eventCoalescer->timer);
+    }
+    HAPRawBufferZero(eventCoalescer, sizeof *eventCoalescer);
+}
+
+/**
+ * Checks whether events of a characteristic are exempt from coalescing.
+ *
+ * @param      eventCoalescer       Event coalescer.
+ * @param      characteristic       Characteristic.
+ *
+ * @return true                     If events of the characteristic are always raised immediately.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool IsExempt(HAPPlatformEventCoalescerRef eventCoalescer, const HAPCharacteristic* characteristic) {
+    HAPPrecondition(eventCoalescer);
+    HAPPrecondition(characteristic);
+
+    if (!eventCoalescer->exemptCharacteristics) {
+        return false;
+    }
+    for (const HAPCharacteristic* _Nullable const* exemptCharacteristic = eventCoalescer->exemptCharacteristics;
+         *exemptCharacteristic;
+         exemptCharacteristic++) {
+        if (*exemptCharacteristic == characteristic) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Raises the event of an entry on the accessory server.
+ *
+ * @param      eventCoalescer       Event coalescer.
+ * @param      entry                Entry.
+ * @param      now                  Current time.
+ */
+static void RaiseEntry(
+        HAPPlatformEventCoalescerRef eventCoalescer,
+        HAPPlatformEventCoalescerEntry* entry,
+        HAPTime now) {
+    HAPPrecondition(eventCoalescer);
+    HAPPrecondition(eventCoalescer->server);
+    HAPPrecondition(entry);
+    HAPPrecondition(entry->characteristic);
+    HAPPrecondition(entry->service);
+    HAPPrecondition(entry->accessory);
+
+    entry->isPending = false;
+    entry->lastRaiseTime = now;
+    eventCoalescer->numRaisedEvents++;
+    HAPAccessoryServerRaiseEvent(
+            HAPNonnull(eventCoalescer->server),
+            HAPNonnull(entry->characteristic),
+            HAPNonnull(entry->service),
+            HAPNonnull(entry->accessory));
+}
+
+static void HandleTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context);
+
+/**
+ * Schedules the timer for the earliest end of a coalescing window with a pending event.
+ *
+ * @param      eventCoalescer       Event coalescer.
+ */
+static void ScheduleTimer(HAPPlatformEventCoalescerRef eventCoalescer) {
+    HAPPrecondition(eventCoalescer);
+
+    HAPTime deadline = 0;
+    for (size_t i = 0; i < HAPArrayCount(eventCoalescer->entries); i++) {
+        const HAPPlatformEventCoalescerEntry* entry = &eventCoalescer->entries[i];
+        if (entry->isPending) {
+            HAPTime entryDeadline = entry->lastRaiseTime + eventCoalescer->window;
+            if (!deadline || entryDeadline < deadline) {
+                deadline = entryDeadline;
+            }
+        }
+    }
+
+    if (eventCoalescer->timer) {
+        if (deadline && eventCoalescer->timerDeadline == deadline) {
+            return;
+        }
+        HAPPlatformTimerDeregister(eventCoalescer->timer);
+        eventCoalescer->timer = 0;
+    }
+    if (!deadline) {
+        return;
+    }
+
+    HAPError err = HAPPlatformTimerRegister(&eventCoalescer->timer, deadline, HandleTimerExpired, eventCoalescer);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to schedule coalesced events. Raising them now.");
+        HAPPlatformEventCoalescerFlush(eventCoalescer);
+        return;
+    }
+    eventCoalescer->timerDeadline = deadline;
+}
+
+static void HandleTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformEventCoalescerRef eventCoalescer = context;
+    HAPPrecondition(timer == eventCoalescer->timer);
+    eventCoalescer->timer = 0;
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+    for (size_t i = 0; i < HAPArrayCount(eventCoalescer->entries); i++) {
+        HAPPlatformEventCoalescerEntry* entry = &eventCoalescer->entries[i];
+        if (entry->isPending && entry->lastRaiseTime + eventCoalescer->window <= now) {
+            RaiseEntry(eventCoalescer, entry, now);
+        }
+    }
+    ScheduleTimer(eventCoalescer);
+}
+
+void HAPPlatformEventCoalescerRaiseEvent(
+        HAPPlatformEventCoalescerRef eventCoalescer,
+        const HAPCharacteristic* characteristic,
+        const HAPService* service,
+        const HAPAccessory* accessory) {
+    HAPPrecondition(eventCoalescer);
+    HAPPrecondition(eventCoalescer->server);
+    HAPPrecondition(characteristic);
+    HAPPrecondition(service);
+    HAPPrecondition(accessory);
+
+    if (IsExempt(eventCoalescer, characteristic)) {
+        eventCoalescer->numRaisedEvents++;
+        HAPAccessoryServerRaiseEvent(HAPNonnull(eventCoalescer->server), characteristic, service, accessory);
+        return;
+    }
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+
+    // Find entry of the characteristic. Reuse the least recently raised idle entry otherwise.
+    HAPPlatformEventCoalescerEntry* entry = NULL;
+    HAPPlatformEventCoalescerEntry* idleEntry = NULL;
+    for (size_t i = 0; i < HAPArrayCount(eventCoalescer->entries); i++) {
+        HAPPlatformEventCoalescerEntry* e = &eventCoalescer->entries[i];
+        if (e->characteristic == characteristic && e->service == service && e->accessory == accessory) {
+            entry = e;
+            break;
+        }
+        if (!e->isPending && (!idleEntry || e->lastRaiseTime < idleEntry->lastRaiseTime)) {
+            idleEntry = e;
+        }
+    }
+
+    if (!entry) {
+        if (!idleEntry) {
+            HAPLog(&logObject, "Too many characteristics with pending events. Raising event immediately.");
+            eventCoalescer->numRaisedEvents++;
+            HAPAccessoryServerRaiseEvent(HAPNonnull(eventCoalescer->server), characteristic, service, accessory);
+            return;
+        }
+        entry = idleEntry;
+        entry->characteristic = characteristic;
+        entry->service = service;
+        entry->accessory = accessory;
+        entry->isPending = false;
+        RaiseEntry(eventCoalescer, entry, now);
+        return;
+    }
+
+    if (entry->isPending) {
+        // Merged into the event that is raised when the window ends.
+        eventCoalescer->numCoalescedEvents++;
+        return;
+    }
+    if (now >= entry->lastRaiseTime + eventCoalescer->window) {
+        RaiseEntry(eventCoalescer, entry, now);
+        return;
+    }
+
+    entry->isPending = true;
+    ScheduleTimer(eventCoalescer);
+}
+
+void HAPPlatformEventCoalescerFlush(HAPPlatformEventCoalescerRef eventCoalescer) {
+    HAPPrecondition(eventCoalescer);
+    HAPPrecondition(eventCoalescer->server);
+
+    if (eventCoalescer->timer) {
+        HAPPlatformTimerDeregister(eventCoalescer->timer);
+        eventCoalescer->timer = 0;
+    }
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+    for (size_t i = 0; i < HAPArrayCount(eventCoalescer->entries); i++) {
+        HAPPlatformEventCoalescerEntry* entry = &eventCoalescer->entries[i];
+        if (entry->isPending) {
+            RaiseEntry(eventCoalescer, entry, now);
+        }
+    }
+}
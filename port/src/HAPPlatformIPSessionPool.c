@@ -0,0 +1,411 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <esp_heap_caps.h>
+
+#include "HAPAccessoryServer+Internal.h"
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformIPSessionPool+Init.h"
+
+// The pool inspects the ADK-private HAPIPSessionDescriptor. See HAPPlatformIPSessionPool+Init.h.
+HAP_STATIC_ASSERT(HAP_COMPATIBILITY_VERSION == kHAPPlatform_ADKCompatibilityVersion, IPSessionPoolADKVersion);
+HAP_STATIC_ASSERT(sizeof(HAPIPSessionDescriptor) <= sizeof(HAPIPSessionDescriptorRef), IPSessionPoolDescriptorSize);
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "IPSessionPool" };
+
+/**
+ * Header of a buffer set.
+ *
+ * Followed by the event notification table, the inbound buffer and the outbound buffer.
+ */
+typedef struct HAPPlatformIPSessionPoolBufferSet {
+    /**
+     * Next buffer set on the free list.
+     */
+    struct HAPPlatformIPSessionPoolBufferSet* _Nullable nextFreeBufferSet;
+
+    /**
+     * Next allocated buffer set.
+     */
+    struct HAPPlatformIPSessionPoolBufferSet* _Nullable nextAllocatedBufferSet;
+} HAPPlatformIPSessionPoolBufferSet;
+
+/**
+ * Alignment of the regions within a buffer set.
+ */
+#define kHAPPlatformIPSessionPool_Alignment ((size_t) 8)
+
+/**
+ * Rounds a size up to the alignment of the regions within a buffer set.
+ */
+#define HAPPlatformIPSessionPoolAlign(numBytes) \
+    (((numBytes) + kHAPPlatformIPSessionPool_Alignment - 1) & ~(kHAPPlatformIPSessionPool_Alignment - 1))
+
+/**
+ * Buffer set regions.
+ */
+typedef struct {
+    HAPIPEventNotificationRef* eventNotifications;
+    uint8_t* inboundBuffer;
+    uint8_t* outboundBuffer;
+} HAPPlatformIPSessionPoolRegions;
+
+static void GetRegions(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        HAPPlatformIPSessionPoolBufferSet* bufferSet,
+        HAPPlatformIPSessionPoolRegions* regions) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(bufferSet);
+    HAPPrecondition(regions);
+
+    uint8_t* bytes = (uint8_t*) bufferSet;
+    size_t offset = HAPPlatformIPSessionPoolAlign(sizeof *bufferSet);
+    regions->eventNotifications = (HAPIPEventNotificationRef*) (void*) &bytes[offset];
+    offset += HAPPlatformIPSessionPoolAlign(ipSessionPool->numEventNotifications * sizeof(HAPIPEventNotificationRef));
+    regions->inboundBuffer = &bytes[offset];
+    offset += HAPPlatformIPSessionPoolAlign(ipSessionPool->inboundBufferSize);
+    regions->outboundBuffer = &bytes[offset];
+}
+
+/**
+ * Points the buffers of a session at a buffer set.
+ */
+static void MapRegions(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        HAPIPSession* session,
+        const HAPPlatformIPSessionPoolRegions* regions) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(session);
+    HAPPrecondition(regions);
+
+    session->inboundBuffer.bytes = regions->inboundBuffer;
+    session->inboundBuffer.numBytes = ipSessionPool->inboundBufferSize;
+    session->outboundBuffer.bytes = regions->outboundBuffer;
+    session->outboundBuffer.numBytes = ipSessionPool->outboundBufferSize;
+    session->eventNotifications = regions->eventNotifications;
+    session->numEventNotifications = ipSessionPool->numEventNotifications;
+}
+
+/**
+ * Returns the ADK state of a session.
+ */
+static const HAPIPSessionDescriptor* GetDescriptor(const HAPIPSession* session) {
+    HAPPrecondition(session);
+
+    return (const HAPIPSessionDescriptor*) &session->descriptor;
+}
+
+/**
+ * Allocates a new buffer set. It is freed when the pool is released.
+ */
+HAP_RESULT_USE_CHECK
+static HAPPlatformIPSessionPoolBufferSet* _Nullable AllocateBufferSet(HAPPlatformIPSessionPoolRef ipSessionPool) {
+    HAPPrecondition(ipSessionPool);
+
+    HAPPlatformIPSessionPoolStatistics* statistics = &ipSessionPool->statistics;
+    HAPPlatformIPSessionPoolBufferSet* bufferSet =
+            heap_caps_malloc(statistics->numBufferSetBytes, ipSessionPool->capabilities);
+    if (!bufferSet) {
+        HAPLogError(
+                &logObject,
+                "Allocating IP session buffers failed: out of memory (%lu bytes).",
+                (unsigned long) statistics->numBufferSetBytes);
+        return NULL;
+    }
+    bufferSet->nextFreeBufferSet = NULL;
+    bufferSet->nextAllocatedBufferSet = ipSessionPool->allocatedBufferSets;
+    ipSessionPool->allocatedBufferSets = bufferSet;
+    statistics->numAllocatedBufferSets++;
+    return bufferSet;
+}
+
+/**
+ * Gives every session that does not have one yet a buffer set of its own for the lifetime of the pool.
+ *
+ * - Buffer sets on the free list are not reused, as a session that was bound contrary to the documented ADK behavior
+ *   may still reference them.
+ *
+ * @return true                     If every session has a buffer set of its own.
+ * @return false                    If not enough memory is available.
+ */
+HAP_RESULT_USE_CHECK
+static bool MapFixedBufferSets(HAPPlatformIPSessionPoolRef ipSessionPool) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(ipSessionPool->isFixedMapping);
+
+    while (ipSessionPool->numFixedMappedSessions < ipSessionPool->numSessions) {
+        HAPPlatformIPSessionPoolBufferSet* bufferSet = AllocateBufferSet(ipSessionPool);
+        if (!bufferSet) {
+            return false;
+        }
+        HAPPlatformIPSessionPoolRegions regions;
+        GetRegions(ipSessionPool, bufferSet, &regions);
+        HAPRawBufferZero(
+                regions.eventNotifications,
+                ipSessionPool->numEventNotifications * sizeof regions.eventNotifications[0]);
+        MapRegions(ipSessionPool, &ipSessionPool->sessions[ipSessionPool->numFixedMappedSessions], &regions);
+        ipSessionPool->numFixedMappedSessions++;
+    }
+    return true;
+}
+
+/**
+ * Stops mapping buffer sets on demand after the ADK did not behave as documented in HAPPlatformIPSessionPool+Init.h.
+ */
+static void UseFixedMapping(HAPPlatformIPSessionPoolRef ipSessionPool) {
+    HAPPrecondition(ipSessionPool);
+
+    HAPLogError(&logObject, "Falling back to a buffer set per IP session.");
+    ipSessionPool->isFixedMapping = true;
+    ipSessionPool->numFixedMappedSessions = 0;
+    ipSessionPool->mappedBufferSet = NULL;
+}
+
+/**
+ * Verifies that the accessory server bound the session that the last acquired buffer set was mapped to, and that
+ * no two sessions that are in use share a buffer set.
+ *
+ * - Falls back to a buffer set per session if the ADK does not behave as documented in
+ *   HAPPlatformIPSessionPool+Init.h.
+ */
+static void CheckSessions(HAPPlatformIPSessionPoolRef ipSessionPool) {
+    HAPPrecondition(ipSessionPool);
+
+    if (ipSessionPool->isFixedMapping) {
+        return;
+    }
+
+    if (ipSessionPool->mappedBufferSet) {
+        HAPPlatformIPSessionPoolRegions regions;
+        GetRegions(ipSessionPool, ipSessionPool->mappedBufferSet, &regions);
+        const HAPIPSessionDescriptor* descriptor =
+                GetDescriptor(&ipSessionPool->sessions[ipSessionPool->mappedSessionIndex]);
+        if (!descriptor->server || descriptor->inboundBuffer.data != (char*) regions.inboundBuffer) {
+            HAPLogError(
+                    &logObject,
+                    "IP session [%lu] was not bound to the buffer set of its accepted TCP stream.",
+                    (unsigned long) ipSessionPool->mappedSessionIndex);
+            UseFixedMapping(ipSessionPool);
+            return;
+        }
+        ipSessionPool->mappedBufferSet = NULL;
+    }
+
+    for (size_t i = 0; i < ipSessionPool->numSessions; i++) {
+        const HAPIPSessionDescriptor* descriptor = GetDescriptor(&ipSessionPool->sessions[i]);
+        if (!descriptor->server) {
+            continue;
+        }
+        for (size_t j = i + 1; j < ipSessionPool->numSessions; j++) {
+            const HAPIPSessionDescriptor* otherDescriptor = GetDescriptor(&ipSessionPool->sessions[j]);
+            if (otherDescriptor->server && otherDescriptor->inboundBuffer.data == descriptor->inboundBuffer.data) {
+                HAPLogError(
+                        &logObject,
+                        "IP sessions [%lu] and [%lu] share a buffer set.",
+                        (unsigned long) i,
+                        (unsigned long) j);
+                UseFixedMapping(ipSessionPool);
+                return;
+            }
+        }
+    }
+}
+
+void HAPPlatformIPSessionPoolCreate(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        const HAPPlatformIPSessionPoolOptions* options) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(options);
+    HAPPrecondition(options->sessions);
+    HAPPrecondition(options->numSessions);
+    HAPPrecondition(options->inboundBufferSize);
+    HAPPrecondition(options->outboundBufferSize);
+
+    HAPRawBufferZero(ipSessionPool, sizeof *ipSessionPool);
+    ipSessionPool->sessions = options->sessions;
+    ipSessionPool->numSessions = options->numSessions;
+    ipSessionPool->inboundBufferSize = options->inboundBufferSize;
+    ipSessionPool->outboundBufferSize = options->outboundBufferSize;
+    ipSessionPool->numEventNotifications = options->numEventNotifications;
+    ipSessionPool->capabilities = options->capabilities ? options->capabilities : MALLOC_CAP_8BIT;
+    ipSessionPool->statistics.numBufferSetBytes =
+            HAPPlatformIPSessionPoolAlign(sizeof(HAPPlatformIPSessionPoolBufferSet)) +
+            HAPPlatformIPSessionPoolAlign(options->numEventNotifications * sizeof(HAPIPEventNotificationRef)) +
+            HAPPlatformIPSessionPoolAlign(options->inboundBufferSize) +
+            HAPPlatformIPSessionPoolAlign(options->outboundBufferSize);
+
+    HAPRawBufferZero(options->sessions, options->numSessions * sizeof options->sessions[0]);
+
+    // Sessions must reference valid buffers when the accessory server is created.
+    // Allocate the buffer set for the first TCP stream right away and point all sessions at it.
+    void* bufferSet;
+    HAPError err = HAPPlatformIPSessionPoolAcquireBuffers(ipSessionPool, &bufferSet);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPFatalError();
+    }
+    HAPPlatformIPSessionPoolRegions regions;
+    GetRegions(ipSessionPool, bufferSet, &regions);
+    for (size_t i = 0; i < ipSessionPool->numSessions; i++) {
+        MapRegions(ipSessionPool, &ipSessionPool->sessions[i], &regions);
+    }
+    HAPPlatformIPSessionPoolReleaseBuffers(ipSessionPool, bufferSet);
+    ipSessionPool->statistics.maxBufferSetsInUse = 0;
+
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: bufferSet = %lu (inbound %lu, outbound %lu, eventNotifications %lu), "
+            "maxBufferSets = %lu",
+            (unsigned long) ipSessionPool->statistics.numBufferSetBytes,
+            (unsigned long) ipSessionPool->inboundBufferSize,
+            (unsigned long) ipSessionPool->outboundBufferSize,
+            (unsigned long) ipSessionPool->numEventNotifications,
+            (unsigned long) ipSessionPool->numSessions);
+}
+
+void HAPPlatformIPSessionPoolRelease(HAPPlatformIPSessionPoolRef ipSessionPool) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(ipSessionPool->sessions);
+    HAPPrecondition(!ipSessionPool->statistics.numBufferSetsInUse);
+
+    HAPLogInfo(
+            &logObject,
+            "IP session buffers: peak %lu / %lu sessions (%lu bytes allocated).",
+            (unsigned long) ipSessionPool->statistics.maxBufferSetsInUse,
+            (unsigned long) ipSessionPool->numSessions,
+            (unsigned long) (ipSessionPool->statistics.numAllocatedBufferSets *
+                             ipSessionPool->statistics.numBufferSetBytes));
+
+    HAPPlatformIPSessionPoolBufferSet* bufferSet = ipSessionPool->allocatedBufferSets;
+    while (bufferSet) {
+        HAPPlatformIPSessionPoolBufferSet* nextBufferSet = bufferSet->nextAllocatedBufferSet;
+        heap_caps_free(bufferSet);
+        bufferSet = nextBufferSet;
+    }
+
+    HAPRawBufferZero(ipSessionPool->sessions, ipSessionPool->numSessions * sizeof ipSessionPool->sessions[0]);
+    HAPRawBufferZero(ipSessionPool, sizeof *ipSessionPool);
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformIPSessionPoolAcquireBuffers(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        void* _Nonnull* _Nonnull bufferSet_) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(ipSessionPool->sessions);
+    HAPPrecondition(bufferSet_);
+
+    CheckSessions(ipSessionPool);
+
+    HAPPlatformIPSessionPoolStatistics* statistics = &ipSessionPool->statistics;
+    if (statistics->numBufferSetsInUse == ipSessionPool->numSessions) {
+        HAPLog(&logObject, "All IP session buffers are in use.");
+        return kHAPError_OutOfResources;
+    }
+
+    if (ipSessionPool->isFixedMapping) {
+        // Every session keeps its own buffer set. The pool itself is handed out as a token.
+        if (!MapFixedBufferSets(ipSessionPool)) {
+            return kHAPError_OutOfResources;
+        }
+        statistics->numBufferSetsInUse++;
+        if (statistics->numBufferSetsInUse > statistics->maxBufferSetsInUse) {
+            statistics->maxBufferSetsInUse = statistics->numBufferSetsInUse;
+        }
+        *bufferSet_ = ipSessionPool;
+        return kHAPError_None;
+    }
+
+    // The accessory server binds an accepted TCP stream to the first session that is not in use.
+    size_t sessionIndex = 0;
+    while (sessionIndex < ipSessionPool->numSessions && GetDescriptor(&ipSessionPool->sessions[sessionIndex])->server) {
+        sessionIndex++;
+    }
+    if (sessionIndex == ipSessionPool->numSessions) {
+        HAPLog(&logObject, "No free IP session for the acquired buffers.");
+        return kHAPError_OutOfResources;
+    }
+
+    HAPPlatformIPSessionPoolBufferSet* bufferSet = ipSessionPool->freeBufferSets;
+    if (bufferSet) {
+        ipSessionPool->freeBufferSets = bufferSet->nextFreeBufferSet;
+    } else {
+        bufferSet = AllocateBufferSet(ipSessionPool);
+        if (!bufferSet) {
+            return kHAPError_OutOfResources;
+        }
+    }
+    bufferSet->nextFreeBufferSet = NULL;
+
+    statistics->numBufferSetsInUse++;
+    if (statistics->numBufferSetsInUse > statistics->maxBufferSetsInUse) {
+        statistics->maxBufferSetsInUse = statistics->numBufferSetsInUse;
+        HAPLogDebug(
+                &logObject,
+                "IP session buffers: new peak %lu / %lu sessions.",
+                (unsigned long) statistics->maxBufferSetsInUse,
+                (unsigned long) ipSessionPool->numSessions);
+    }
+
+    HAPPlatformIPSessionPoolRegions regions;
+    GetRegions(ipSessionPool, bufferSet, &regions);
+    HAPRawBufferZero(
+            regions.eventNotifications, ipSessionPool->numEventNotifications * sizeof regions.eventNotifications[0]);
+
+    MapRegions(ipSessionPool, &ipSessionPool->sessions[sessionIndex], &regions);
+    ipSessionPool->mappedBufferSet = bufferSet;
+    ipSessionPool->mappedSessionIndex = sessionIndex;
+
+    *bufferSet_ = bufferSet;
+    return kHAPError_None;
+}
+
+void HAPPlatformIPSessionPoolReleaseBuffers(HAPPlatformIPSessionPoolRef ipSessionPool, void* bufferSet_) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(ipSessionPool->sessions);
+    HAPPrecondition(bufferSet_);
+    HAPPrecondition(ipSessionPool->statistics.numBufferSetsInUse);
+
+    if (bufferSet_ == ipSessionPool) {
+        HAPAssert(ipSessionPool->isFixedMapping);
+        ipSessionPool->statistics.numBufferSetsInUse--;
+        return;
+    }
+
+    HAPPlatformIPSessionPoolBufferSet* bufferSet = bufferSet_;
+    if (bufferSet == ipSessionPool->mappedBufferSet) {
+        // The TCP stream was closed before another one was accepted. Its session may already be unbound.
+        ipSessionPool->mappedBufferSet = NULL;
+    }
+    bufferSet->nextFreeBufferSet = ipSessionPool->freeBufferSets;
+    ipSessionPool->freeBufferSets = bufferSet;
+    ipSessionPool->statistics.numBufferSetsInUse--;
+}
+
+void HAPPlatformIPSessionPoolGetStatistics(
+        HAPPlatformIPSessionPoolRef ipSessionPool,
+        HAPPlatformIPSessionPoolStatistics* statistics) {
+    HAPPrecondition(ipSessionPool);
+    HAPPrecondition(ipSessionPool->sessions);
+    HAPPrecondition(statistics);
+
+    *statistics = ipSessionPool->statistics;
+}
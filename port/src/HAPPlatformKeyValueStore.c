@@ -19,11 +19,14 @@
 // limitations under the License.
 
 #include "HAPPlatformKeyValueStore+Init.h"
+#include <stdio.h>
 #include <string.h>
 #include <nvs.h>
 #include <nvs_flash.h>
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "KeyValueStore" };
 
+static void BuildIndexes(HAPPlatformKeyValueStoreRef keyValueStore);
+
 void HAPPlatformKeyValueStoreCreate(
         HAPPlatformKeyValueStoreRef keyValueStore,
         const HAPPlatformKeyValueStoreOptions* options) {
@@ -48,16 +51,246 @@ void HAPPlatformKeyValueStoreCreate(
         ESP_ERROR_CHECK(err);
     }
 
+    HAPRawBufferZero(keyValueStore, sizeof *keyValueStore);
     keyValueStore->part_name = strdup(options->part_name);
     keyValueStore->namespace_prefix = strdup(options->namespace_prefix);
     keyValueStore->read_only = options->read_only;
 
+    // The key-value store may be accessed from tasks other than the run loop, e.g., from esp_timer callbacks.
+    // The lock is recursive because enumeration callbacks may access the key-value store.
+    keyValueStore->lock = xSemaphoreCreateRecursiveMutexStatic(&keyValueStore->lockStorage);
+    HAPAssert(keyValueStore->lock);
+
+    BuildIndexes(keyValueStore);
+
     HAPLog(&logObject, "keyValueStore %s Initialised", keyValueStore->part_name);
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: handles = %lu, items = %lu (%lu bytes each)",
+            (unsigned long) HAPArrayCount(keyValueStore->handles),
+            (unsigned long) HAPArrayCount(keyValueStore->items),
+            (unsigned long) sizeof keyValueStore->items[0].bytes);
+}
+
+static void Lock(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(keyValueStore->lock);
+
+    (void) xSemaphoreTakeRecursive(keyValueStore->lock, portMAX_DELAY);
+}
+
+static void Unlock(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(keyValueStore->lock);
+
+    (void) xSemaphoreGiveRecursive(keyValueStore->lock);
+}
+
+/**
+ * Formats the NVS namespace of a domain.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ * @param[out]  name_space      Namespace.
+ */
+static void GetNamespace(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        char name_space[NVS_KEY_NAME_MAX_SIZE]) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(keyValueStore->namespace_prefix);
+
+    snprintf(name_space, NVS_KEY_NAME_MAX_SIZE, "%s.%02X", keyValueStore->namespace_prefix, domain);
+}
+
+/**
+ * Formats the NVS key name of a key.
+ *
+ * @param       key             Key.
+ * @param[out]  keyname         Key name.
+ */
+static void GetKeyName(HAPPlatformKeyValueStoreKey key, char keyname[3]) {
+    static const char digits[] = "0123456789ABCDEF";
+    keyname[0] = digits[(key >> 4) & 0xF];
+    keyname[1] = digits[key & 0xF];
+    keyname[2] = '\0';
+}
+
+/**
+ * Parses a domain or key name that was formatted as two hex digits.
+ *
+ * @param       name            Name.
+ * @param[out]  value           Parsed value.
+ *
+ * @return true                 If the name is valid.
+ * @return false                Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool ParseHexName(const char* name, uint8_t* value) {
+    HAPPrecondition(name);
+    HAPPrecondition(value);
+
+    char* end;
+    long result = strtol(name, &end, 16);
+    if (end == name || *end != '\0' || result < 0 || result > UINT8_MAX) {
+        return false;
+    }
+    *value = (uint8_t) result;
+    return true;
+}
+
+/**
+ * Checks whether a domain is not covered by the key index, because all index slots were in use.
+ *
+ * - Queries of unindexed domains fall back to NVS. Queries of other domains are answered from the index.
+ *   A domain without an index slot that is not unindexed does not contain any keys.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ */
+static bool IsDomainUnindexed(HAPPlatformKeyValueStoreRef keyValueStore, HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    return keyValueStore->unindexedDomains[domain >> 3] & (1U << (domain & 7));
+}
+
+/**
+ * Finds the key index of a domain.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ *
+ * @return Key index if the domain is indexed and contains keys. NULL otherwise.
+ */
+static HAPPlatformKeyValueStoreDomainIndex* _Nullable FindIndex(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->indexes); i++) {
+        HAPPlatformKeyValueStoreDomainIndex* index = &keyValueStore->indexes[i];
+        if (index->active && index->domain == domain) {
+            return index;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Marks a key as present in the key index of its domain, allocating an index slot if necessary.
+ *
+ * - If no index slot is available, the domain becomes unindexed.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ * @param       key             Key.
+ */
+static void IndexKey(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    if (IsDomainUnindexed(keyValueStore, domain)) {
+        return;
+    }
+    HAPPlatformKeyValueStoreDomainIndex* index = FindIndex(keyValueStore, domain);
+    if (!index) {
+        for (size_t i = 0; i < HAPArrayCount(keyValueStore->indexes); i++) {
+            if (!keyValueStore->indexes[i].active) {
+                index = &keyValueStore->indexes[i];
+                break;
+            }
+        }
+        if (!index) {
+            HAPLog(&logObject, "No index slot available for domain %02X. Falling back to NVS.", domain);
+            keyValueStore->unindexedDomains[domain >> 3] |= (uint8_t)(1U << (domain & 7));
+            return;
+        }
+        HAPRawBufferZero(index, sizeof *index);
+        index->active = true;
+        index->domain = domain;
+    }
+    index->keys[key >> 3] |= (uint8_t)(1U << (key & 7));
+}
+
+/**
+ * Marks a key as not present in the key index of its domain.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ * @param       key             Key.
+ */
+static void UnindexKey(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    HAPPlatformKeyValueStoreDomainIndex* index = FindIndex(keyValueStore, domain);
+    if (index) {
+        index->keys[key >> 3] &= (uint8_t) ~(1U << (key & 7));
+    }
+}
+
+/**
+ * Checks whether a key of an indexed domain is present.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain. Must not be unindexed.
+ * @param       key             Key.
+ */
+static bool IsKeyIndexed(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(!IsDomainUnindexed(keyValueStore, domain));
+
+    HAPPlatformKeyValueStoreDomainIndex* index = FindIndex(keyValueStore, domain);
+    return index && (index->keys[key >> 3] & (1U << (key & 7)));
+}
+
+/**
+ * Builds the key indexes by iterating the namespaces of the key-value store once.
+ *
+ * @param       keyValueStore   Key-value store.
+ */
+static void BuildIndexes(HAPPlatformKeyValueStoreRef keyValueStore) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(keyValueStore->namespace_prefix);
+
+    size_t numPrefixBytes = strlen(keyValueStore->namespace_prefix);
+    size_t numKeys = 0;
+
+    nvs_iterator_t it = nvs_entry_find(keyValueStore->part_name, NULL, NVS_TYPE_BLOB);
+    while (it != NULL) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+
+        uint8_t domain;
+        uint8_t key;
+        if (strncmp(info.namespace_name, keyValueStore->namespace_prefix, numPrefixBytes) != 0 ||
+            info.namespace_name[numPrefixBytes] != '.' ||
+            !ParseHexName(&info.namespace_name[numPrefixBytes + 1], &domain) || !ParseHexName(info.key, &key)) {
+            continue;
+        }
+        IndexKey(keyValueStore, domain, key);
+        numKeys++;
+    }
+    nvs_release_iterator(it);
+
+    HAPLogDebug(&logObject, "Indexed %lu keys.", (unsigned long) numKeys);
 }
 
 /**
  * Gets the handle for accessing the key value store.
  *
+ * - Handles are kept open and reused. The least recently used handle is closed when all slots are in use.
+ *
+ * - Must be called with the key-value store locked. The handle must not be closed by the caller.
+ *
  * @param       keyValueStore   Key-value store.
  * @param       domain          Domain.
  * @param[out]  store_handle    Pointer to an allocated NVS storage handle
@@ -70,13 +303,126 @@ static esp_err_t HAPPlatformKeyValueStoreGetHandle(
 {
     HAPPrecondition(keyValueStore);
     HAPPrecondition(keyValueStore->namespace_prefix);
-    char name_space[15];
-    snprintf(name_space, sizeof(name_space), "%s.%02X", keyValueStore->namespace_prefix, domain);
-    return nvs_open_from_partition(keyValueStore->part_name, name_space, NVS_READWRITE, store_handle);
+    HAPPrecondition(store_handle);
+
+    keyValueStore->numAccesses++;
+
+    HAPPlatformKeyValueStoreHandle* handle = NULL;
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->handles); i++) {
+        HAPPlatformKeyValueStoreHandle* h = &keyValueStore->handles[i];
+        if (h->active && h->domain == domain) {
+            h->lastAccess = keyValueStore->numAccesses;
+            *store_handle = h->store_handle;
+            return ESP_OK;
+        }
+        if (!handle || !h->active || (handle->active && h->lastAccess < handle->lastAccess)) {
+            handle = h;
+        }
+    }
+    HAPAssert(handle);
+
+    if (handle->active) {
+        nvs_close(handle->store_handle);
+        handle->active = false;
+    }
+
+    char name_space[NVS_KEY_NAME_MAX_SIZE];
+    GetNamespace(keyValueStore, domain, name_space);
+    keyValueStore->statistics.numNVSOpens++;
+    esp_err_t err = nvs_open_from_partition(keyValueStore->part_name, name_space, NVS_READWRITE, store_handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    handle->active = true;
+    handle->domain = domain;
+    handle->lastAccess = keyValueStore->numAccesses;
+    handle->store_handle = *store_handle;
+    return ESP_OK;
+}
+
+void HAPPlatformKeyValueStoreGetStatistics(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreStatistics* statistics) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(statistics);
+
+    Lock(keyValueStore);
+    *statistics = keyValueStore->statistics;
+    Unlock(keyValueStore);
+}
+
+/**
+ * Finds the cached item of a key.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ * @param       key             Key.
+ *
+ * @return Cached item if the value of the key is cached. NULL otherwise.
+ */
+static HAPPlatformKeyValueStoreItem* _Nullable FindItem(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->items); i++) {
+        HAPPlatformKeyValueStoreItem* item = &keyValueStore->items[i];
+        if (item->active && item->domain == domain && item->key == key) {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Caches the value of a key, replacing the least recently used item if necessary.
+ *
+ * - Values that do not fit into an item are not cached, and a stale item of the key is dropped.
+ *
+ * @param       keyValueStore   Key-value store.
+ * @param       domain          Domain.
+ * @param       key             Key.
+ * @param       bytes           Value.
+ * @param       numBytes        Length of value.
+ */
+static void CacheItem(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* bytes,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(bytes);
+
+    HAPPlatformKeyValueStoreItem* item = FindItem(keyValueStore, domain, key);
+    if (numBytes > sizeof item->bytes) {
+        if (item) {
+            item->active = false;
+        }
+        return;
+    }
+    if (!item) {
+        for (size_t i = 0; i < HAPArrayCount(keyValueStore->items); i++) {
+            HAPPlatformKeyValueStoreItem* candidate = &keyValueStore->items[i];
+            if (!item || !candidate->active || (item->active && candidate->lastAccess < item->lastAccess)) {
+                item = candidate;
+            }
+        }
+        HAPAssert(item);
+    }
+
+    item->active = true;
+    item->domain = domain;
+    item->key = key;
+    item->lastAccess = keyValueStore->numAccesses;
+    item->numBytes = numBytes;
+    HAPRawBufferCopyBytes(item->bytes, bytes, numBytes);
 }
 
 HAP_RESULT_USE_CHECK
-HAPError HAPPlatformKeyValueStoreGet(
+static HAPError GetLocked(
         HAPPlatformKeyValueStoreRef keyValueStore,
         HAPPlatformKeyValueStoreDomain domain,
         HAPPlatformKeyValueStoreKey key,
@@ -85,10 +431,30 @@ HAPError HAPPlatformKeyValueStoreGet(
         size_t* _Nullable numBytes,
         bool* found) {
     HAPPrecondition(keyValueStore);
-    HAPPrecondition(!maxBytes || bytes);
-    HAPPrecondition((bytes == NULL) == (numBytes == NULL));
     HAPPrecondition(found);
 
+    keyValueStore->statistics.numGets++;
+    keyValueStore->numAccesses++;
+    HAPPlatformKeyValueStoreItem* item = FindItem(keyValueStore, domain, key);
+    if (item && (!bytes || item->numBytes <= maxBytes)) {
+        keyValueStore->statistics.numCacheHits++;
+        item->lastAccess = keyValueStore->numAccesses;
+        *found = true;
+        if (bytes) {
+            HAPRawBufferCopyBytes(bytes, item->bytes, item->numBytes);
+            *numBytes = item->numBytes;
+        }
+        return kHAPError_None;
+    }
+
+    if (!IsDomainUnindexed(keyValueStore, domain)) {
+        *found = IsKeyIndexed(keyValueStore, domain, key);
+        if (!*found || !bytes) {
+            keyValueStore->statistics.numIndexHits++;
+            return kHAPError_None;
+        }
+    }
+
     nvs_handle store_handle;
 
     esp_err_t err;
@@ -99,15 +465,14 @@ HAPError HAPPlatformKeyValueStoreGet(
         return kHAPError_Unknown;
     }
 
-    char keyname[15]; /* 15 is max key length for NVS */
-    snprintf(keyname, sizeof(keyname), "%02X", key);
+    char keyname[3];
+    GetKeyName(key, keyname);
 
     size_t num_bytes = maxBytes;
 
     *found = false;
+    keyValueStore->statistics.numNVSReads++;
     err = nvs_get_blob(store_handle, keyname, bytes, &num_bytes);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
     if (err != ESP_OK) {
         HAPLog(&logObject, "Error (%d). Key %02X not found in KeyStore", err, key);
         return kHAPError_None;
@@ -116,12 +481,35 @@ HAPError HAPPlatformKeyValueStoreGet(
     if(numBytes != NULL){
         *numBytes = num_bytes;
     }
+    if (bytes) {
+        CacheItem(keyValueStore, domain, key, HAPNonnullVoid(bytes), num_bytes);
+    }
 
     return kHAPError_None;
 }
 
 HAP_RESULT_USE_CHECK
-HAPError HAPPlatformKeyValueStoreSet(
+HAPError HAPPlatformKeyValueStoreGet(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        void* _Nullable const bytes,
+        size_t maxBytes,
+        size_t* _Nullable numBytes,
+        bool* found) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(!maxBytes || bytes);
+    HAPPrecondition((bytes == NULL) == (numBytes == NULL));
+    HAPPrecondition(found);
+
+    Lock(keyValueStore);
+    HAPError err = GetLocked(keyValueStore, domain, key, bytes, maxBytes, numBytes, found);
+    Unlock(keyValueStore);
+    return err;
+}
+
+HAP_RESULT_USE_CHECK
+static HAPError SetLocked(
         HAPPlatformKeyValueStoreRef keyValueStore,
         HAPPlatformKeyValueStoreDomain domain,
         HAPPlatformKeyValueStoreKey key,
@@ -130,8 +518,6 @@ HAPError HAPPlatformKeyValueStoreSet(
     HAPPrecondition(keyValueStore);
     HAPPrecondition(bytes);
 
-    HAPLogBufferDebug(&logObject, bytes, numBytes, "Write %02X.%02X", domain, key);
-
     nvs_handle store_handle;
     esp_err_t err;
     err = HAPPlatformKeyValueStoreGetHandle(keyValueStore, domain, &store_handle);
@@ -140,33 +526,70 @@ HAPError HAPPlatformKeyValueStoreSet(
         return kHAPError_Unknown;
     }
 
-    char keyname[15]; /* 15 is max key length for NVS */
-    snprintf(keyname, sizeof(keyname), "%02X", key);
+    char keyname[3];
+    GetKeyName(key, keyname);
+
+    // Skip writes that would not change the stored value.
+    HAPPlatformKeyValueStoreItem* item = FindItem(keyValueStore, domain, key);
+    if (item && item->numBytes == numBytes && HAPRawBufferAreEqual(item->bytes, bytes, numBytes)) {
+        HAPLogDebug(&logObject, "Value of %02X.%02X unchanged. Skipping write.", domain, key);
+        keyValueStore->statistics.numSkippedWrites++;
+        return kHAPError_None;
+    }
+
+    // Drop the cached value first, so that it cannot become stale if the write fails.
+    if (item) {
+        item->active = false;
+    }
+
+    keyValueStore->statistics.numNVSWrites++;
     err = nvs_set_blob(store_handle, keyname, (const void *) bytes, (size_t) numBytes);
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) setting NVS blob!", err);
-        nvs_close(store_handle);
         return kHAPError_Unknown;
     }
+    IndexKey(keyValueStore, domain, key);
 
+    keyValueStore->statistics.numNVSCommits++;
     err = nvs_commit(store_handle);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) committing to NVS!", err);
         return kHAPError_Unknown;
     }
 
+    CacheItem(keyValueStore, domain, key, bytes, numBytes);
     return kHAPError_None;
 }
 
 HAP_RESULT_USE_CHECK
-HAPError HAPPlatformKeyValueStoreRemove(
+HAPError HAPPlatformKeyValueStoreSet(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key,
+        const void* bytes,
+        size_t numBytes) {
+    HAPPrecondition(keyValueStore);
+    HAPPrecondition(bytes);
+
+    HAPLogBufferDebug(&logObject, bytes, numBytes, "Write %02X.%02X", domain, key);
+
+    Lock(keyValueStore);
+    HAPError err = SetLocked(keyValueStore, domain, key, bytes, numBytes);
+    Unlock(keyValueStore);
+    return err;
+}
+
+HAP_RESULT_USE_CHECK
+static HAPError RemoveLocked(
         HAPPlatformKeyValueStoreRef keyValueStore,
         HAPPlatformKeyValueStoreDomain domain,
         HAPPlatformKeyValueStoreKey key) {
     HAPPrecondition(keyValueStore);
 
+    if (!IsDomainUnindexed(keyValueStore, domain) && !IsKeyIndexed(keyValueStore, domain, key)) {
+        return kHAPError_None;
+    }
+
     nvs_handle store_handle;
     esp_err_t err;
     err = HAPPlatformKeyValueStoreGetHandle(keyValueStore, domain, &store_handle);
@@ -175,18 +598,23 @@ HAPError HAPPlatformKeyValueStoreRemove(
         return kHAPError_Unknown;
     }
 
-    char keyname[15]; /* 15 is max key length for NVS */
-    snprintf(keyname, sizeof(keyname), "%02X", key);
+    HAPPlatformKeyValueStoreItem* item = FindItem(keyValueStore, domain, key);
+    if (item) {
+        item->active = false;
+    }
+
+    char keyname[3];
+    GetKeyName(key, keyname);
+    keyValueStore->statistics.numNVSErases++;
     err = nvs_erase_key(store_handle, keyname);
     if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
         HAPLogError(&logObject, "Error (%d) erasing NVS key!", err);
-        nvs_close(store_handle);
         return kHAPError_Unknown;
     }
+    UnindexKey(keyValueStore, domain, key);
 
+    keyValueStore->statistics.numNVSCommits++;
     err = nvs_commit(store_handle);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) committing to NVS!", err);
         return kHAPError_Unknown;
@@ -195,6 +623,19 @@ HAPError HAPPlatformKeyValueStoreRemove(
     return kHAPError_None;
 }
 
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStoreRemove(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain,
+        HAPPlatformKeyValueStoreKey key) {
+    HAPPrecondition(keyValueStore);
+
+    Lock(keyValueStore);
+    HAPError err = RemoveLocked(keyValueStore, domain, key);
+    Unlock(keyValueStore);
+    return err;
+}
+
 HAP_RESULT_USE_CHECK
 HAPError HAPPlatformKeyValueStoreEnumerate(
         HAPPlatformKeyValueStoreRef keyValueStore,
@@ -205,30 +646,55 @@ HAPError HAPPlatformKeyValueStoreEnumerate(
     HAPPrecondition(callback);
 
     bool shouldContinue = true;
-    char name_space[15];
-    snprintf(name_space, sizeof(name_space), "%s.%02X", keyValueStore->namespace_prefix, domain);
+
+    Lock(keyValueStore);
+    if (!IsDomainUnindexed(keyValueStore, domain)) {
+        // The index is re-checked for every key, as the callback may modify the domain.
+        for (unsigned int key = 0; key <= UINT8_MAX && shouldContinue; key++) {
+            if (!IsKeyIndexed(keyValueStore, domain, (HAPPlatformKeyValueStoreKey) key)) {
+                continue;
+            }
+            HAPError err = callback(context, keyValueStore, domain, (HAPPlatformKeyValueStoreKey) key, &shouldContinue);
+            if (err) {
+                Unlock(keyValueStore);
+                return kHAPError_Unknown;
+            }
+        }
+        Unlock(keyValueStore);
+        return kHAPError_None;
+    }
+
+    char name_space[NVS_KEY_NAME_MAX_SIZE];
+    GetNamespace(keyValueStore, domain, name_space);
 
     nvs_iterator_t it = nvs_entry_find(keyValueStore->part_name, name_space, NVS_TYPE_BLOB);
     while (it != NULL && shouldContinue) {
         nvs_entry_info_t info;
         nvs_entry_info(it, &info);
         it = nvs_entry_next(it);
-        HAPError hap_err = callback(context, keyValueStore, domain, (HAPPlatformKeyValueStoreKey)atoi(info.key), &shouldContinue);
-            if (hap_err != kHAPError_None) {
-                return kHAPError_Unknown;
-            }
-    };
+        uint8_t key;
+        if (!ParseHexName(info.key, &key)) {
+            HAPLog(&logObject, "Skipping invalid key name %s in namespace %s.", info.key, name_space);
+            continue;
+        }
+        HAPError err = callback(context, keyValueStore, domain, (HAPPlatformKeyValueStoreKey) key, &shouldContinue);
+        if (err) {
+            nvs_release_iterator(it);
+            Unlock(keyValueStore);
+            return kHAPError_Unknown;
+        }
+    }
+    nvs_release_iterator(it);
+    Unlock(keyValueStore);
     return kHAPError_None;
 }
 
 HAP_RESULT_USE_CHECK
-HAPError HAPPlatformKeyValueStorePurgeDomain(
+static HAPError PurgeDomainLocked(
         HAPPlatformKeyValueStoreRef keyValueStore,
         HAPPlatformKeyValueStoreDomain domain) {
     HAPPrecondition(keyValueStore);
 
-    (void) domain;
-
     nvs_handle store_handle;
     esp_err_t err;
     err = HAPPlatformKeyValueStoreGetHandle(keyValueStore, domain, &store_handle);
@@ -237,19 +703,41 @@ HAPError HAPPlatformKeyValueStorePurgeDomain(
         return kHAPError_Unknown;
     }
 
+    for (size_t i = 0; i < HAPArrayCount(keyValueStore->items); i++) {
+        HAPPlatformKeyValueStoreItem* item = &keyValueStore->items[i];
+        if (item->active && item->domain == domain) {
+            item->active = false;
+        }
+    }
+
+    keyValueStore->statistics.numNVSErases++;
     err = nvs_erase_all(store_handle);
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) erasing NVS namespace!", err);
-        nvs_close(store_handle);
         return kHAPError_Unknown;
     }
+    HAPPlatformKeyValueStoreDomainIndex* index = FindIndex(keyValueStore, domain);
+    if (index) {
+        HAPRawBufferZero(index->keys, sizeof index->keys);
+    }
 
+    keyValueStore->statistics.numNVSCommits++;
     err = nvs_commit(store_handle);
-    nvs_close(store_handle);
-    /* Checking error code after nvs_close(), because the close has to be called in any case */
     if (err != ESP_OK) {
         HAPLogError(&logObject, "Error (%d) committing to NVS!", err);
         return kHAPError_Unknown;
     }
     return kHAPError_None;
 }
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformKeyValueStorePurgeDomain(
+        HAPPlatformKeyValueStoreRef keyValueStore,
+        HAPPlatformKeyValueStoreDomain domain) {
+    HAPPrecondition(keyValueStore);
+
+    Lock(keyValueStore);
+    HAPError err = PurgeDomainLocked(keyValueStore, domain);
+    Unlock(keyValueStore);
+    return err;
+}
@@ -31,6 +31,12 @@
 #include "HAP.h"
 #include "HAPPlatformLog+Init.h"
 
+#include <freertos/FreeRTOS.h>
+#if CONFIG_HAP_LOG_DEFERRED
+#include <freertos/ringbuf.h>
+#include <freertos/task.h>
+#endif
+
 #if _POSIX_C_SOURCE >= 200112L && ! _GNU_SOURCE
 #error "This file needs the GNU-specific version of 'strerror_r'."
 #endif
@@ -56,8 +62,57 @@ void HAPPlatformLogPOSIXError(
     HAPLogWithType(&logObject, type, "%s:%d:%s - %s @ %s:%d", message, errorNumber, errorString, function, file, line);
 }
 
-HAP_RESULT_USE_CHECK
-HAPPlatformLogEnabledTypes HAPPlatformLogGetEnabledTypes(const HAPLogObject* _Nonnull log HAP_UNUSED) {
+/**
+ * Number of log objects whose enabled types are cached.
+ */
+#define kHAPPlatformLog_NumCachedLogObjects ((size_t) 32)
+
+/**
+ * Rule that overrides the enabled log types of a subsystem and category.
+ */
+typedef struct {
+    const char* _Nullable subsystem;
+    const char* _Nullable category;
+    HAPPlatformLogEnabledTypes enabledTypes;
+    bool isActive;
+} LogRule;
+
+/**
+ * Enabled log types of a log object, valid while the generation matches.
+ */
+typedef struct {
+    const HAPLogObject* _Nullable log;
+    uint32_t generation;
+    HAPPlatformLogEnabledTypes enabledTypes;
+} LogCacheEntry;
+
+static struct {
+    portMUX_TYPE lock;
+    bool isInitialized;
+    uint32_t generation;
+    LogRule rules[CONFIG_HAP_LOG_MAX_CATEGORY_RULES];
+    LogCacheEntry cache[kHAPPlatformLog_NumCachedLogObjects];
+    char levels[sizeof CONFIG_HAP_LOG_CATEGORY_LEVELS];
+} logFilter = { .lock = portMUX_INITIALIZER_UNLOCKED };
+
+/**
+ * Locks the log filter.
+ *
+ * - A critical section, so the task holding the lock cannot be preempted by a task that waits for it on the same
+ *   core. It is only held for a cache lookup, or for a scan of the CONFIG_HAP_LOG_MAX_CATEGORY_RULES rules.
+ */
+static void LockLogFilter(void) {
+    portENTER_CRITICAL(&logFilter.lock);
+}
+
+static void UnlockLogFilter(void) {
+    portEXIT_CRITICAL(&logFilter.lock);
+}
+
+/**
+ * Gets the enabled log types that are configured by CONFIG_HAP_LOG_LEVEL.
+ */
+static HAPPlatformLogEnabledTypes GetDefaultEnabledTypes(void) {
     switch (HAP_LOG_LEVEL) {
         case 0: {
             return kHAPPlatformLogEnabledTypes_None;
@@ -77,154 +132,558 @@ HAPPlatformLogEnabledTypes HAPPlatformLogGetEnabledTypes(const HAPLogObject* _No
     }
 }
 
-void HAPPlatformLogCapture(
-        const HAPLogObject* _Nonnull log,
-        HAPLogType type,
-        const char* _Nonnull message,
-        const void* _Nullable bufferBytes,
-        size_t numBufferBytes) HAP_DIAGNOSE_ERROR(!bufferBytes && numBufferBytes, "empty buffer cannot have a length") {
+/**
+ * Sets a rule. Must be called with the log filter locked.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError SetRuleLocked(
+        const char* _Nullable subsystem,
+        const char* _Nullable category,
+        HAPPlatformLogEnabledTypes enabledTypes) {
+    LogRule* freeRule = NULL;
+    for (size_t i = 0; i < HAPArrayCount(logFilter.rules); i++) {
+        LogRule* rule = &logFilter.rules[i];
+        if (!rule->isActive) {
+            if (!freeRule) {
+                freeRule = rule;
+            }
+            continue;
+        }
+        if ((rule->subsystem == NULL) == (subsystem == NULL) && (rule->category == NULL) == (category == NULL) &&
+            (!subsystem || HAPStringAreEqual(HAPNonnull(rule->subsystem), HAPNonnull(subsystem))) &&
+            (!category || HAPStringAreEqual(HAPNonnull(rule->category), HAPNonnull(category)))) {
+            rule->enabledTypes = enabledTypes;
+            logFilter.generation++;
+            return kHAPError_None;
+        }
+    }
+    if (!freeRule) {
+        return kHAPError_OutOfResources;
+    }
+    freeRule->subsystem = subsystem;
+    freeRule->category = category;
+    freeRule->enabledTypes = enabledTypes;
+    freeRule->isActive = true;
+    logFilter.generation++;
+    return kHAPError_None;
+}
+
+/**
+ * Parses the rules of CONFIG_HAP_LOG_CATEGORY_LEVELS on first use. Must be called with the log filter locked.
+ *
+ * - Format: Whitespace separated "category=level" or "subsystem:category=level" entries,
+ *   where level is one of none, default, info or debug.
+ */
+static void InitializeLogFilterLocked(void) {
+    if (logFilter.isInitialized) {
+        return;
+    }
+    logFilter.isInitialized = true;
+
+    HAPRawBufferCopyBytes(logFilter.levels, CONFIG_HAP_LOG_CATEGORY_LEVELS, sizeof logFilter.levels);
+    char* _Nullable savePointer = NULL;
+    for (char* _Nullable entry = strtok_r(logFilter.levels, " \t", &savePointer); entry;
+         entry = strtok_r(NULL, " \t", &savePointer)) {
+        char* level = strchr(entry, '=');
+        if (!level) {
+            continue;
+        }
+        *level++ = '\0';
+        char* _Nullable subsystem = NULL;
+        char* category = entry;
+        char* separator = strrchr(entry, ':');
+        if (separator) {
+            *separator = '\0';
+            subsystem = entry;
+            category = separator + 1;
+        }
+
+        HAPPlatformLogEnabledTypes enabledTypes;
+        if (HAPStringAreEqual(level, "none")) {
+            enabledTypes = kHAPPlatformLogEnabledTypes_None;
+        } else if (HAPStringAreEqual(level, "default")) {
+            enabledTypes = kHAPPlatformLogEnabledTypes_Default;
+        } else if (HAPStringAreEqual(level, "info")) {
+            enabledTypes = kHAPPlatformLogEnabledTypes_Info;
+        } else if (HAPStringAreEqual(level, "debug")) {
+            enabledTypes = kHAPPlatformLogEnabledTypes_Debug;
+        } else {
+            continue;
+        }
+        (void) SetRuleLocked(subsystem, *category ? category : NULL, enabledTypes);
+    }
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformLogSetEnabledTypes(
+        const char* _Nullable subsystem,
+        const char* _Nullable category,
+        HAPPlatformLogEnabledTypes enabledTypes) {
+    LockLogFilter();
+    InitializeLogFilterLocked();
+    HAPError err = SetRuleLocked(subsystem, category, enabledTypes);
+    UnlockLogFilter();
+    return err;
+}
+
+void HAPPlatformLogResetEnabledTypes(void) {
+    LockLogFilter();
+    logFilter.isInitialized = true;
+    HAPRawBufferZero(logFilter.rules, sizeof logFilter.rules);
+    logFilter.generation++;
+    UnlockLogFilter();
+}
+
+HAP_RESULT_USE_CHECK
+HAPPlatformLogEnabledTypes HAPPlatformLogGetEnabledTypes(const HAPLogObject* _Nonnull log) {
     HAPPrecondition(log);
-    HAPPrecondition(message);
-    HAPPrecondition(!numBufferBytes || bufferBytes);
 
-    static volatile bool captureLock = 0;
-    while (__atomic_test_and_set(&captureLock, __ATOMIC_SEQ_CST))
-        ;
+    LockLogFilter();
+    InitializeLogFilterLocked();
 
-    // Format log message.
-    bool logHandled = false;
-
-    // Perform regular logging.
-    if (!logHandled) {
-        // Color.
-        switch (type) {
-            case kHAPLogType_Debug: {
-                fprintf(stderr, "\x1B[0m");
-            } break;
-            case kHAPLogType_Info: {
-                fprintf(stderr, "\x1B[32m");
-            } break;
-            case kHAPLogType_Default: {
-                fprintf(stderr, "\x1B[35m");
-            } break;
-            case kHAPLogType_Error: {
-                fprintf(stderr, "\x1B[31m");
-            } break;
-            case kHAPLogType_Fault: {
-                fprintf(stderr, "\x1B[1m\x1B[31m");
-            } break;
-        }
-
-// Time.
+    // Log objects are statically allocated, so their address identifies them.
+    LogCacheEntry* entry = &logFilter.cache[((uintptr_t) log / sizeof(void*)) % HAPArrayCount(logFilter.cache)];
+    if (entry->log == log && entry->generation == logFilter.generation) {
+        HAPPlatformLogEnabledTypes enabledTypes = entry->enabledTypes;
+        UnlockLogFilter();
+        return enabledTypes;
+    }
+
+    HAPPlatformLogEnabledTypes enabledTypes = GetDefaultEnabledTypes();
+    int bestScore = 0;
+    for (size_t i = 0; i < HAPArrayCount(logFilter.rules); i++) {
+        const LogRule* rule = &logFilter.rules[i];
+        if (!rule->isActive) {
+            continue;
+        }
+        if (rule->subsystem && (!log->subsystem || !HAPStringAreEqual(HAPNonnull(rule->subsystem), log->subsystem))) {
+            continue;
+        }
+        if (rule->category && (!log->category || !HAPStringAreEqual(HAPNonnull(rule->category), log->category))) {
+            continue;
+        }
+        int score = (rule->subsystem ? 1 : 0) + (rule->category ? 2 : 0);
+        if (score >= bestScore) {
+            bestScore = score;
+            enabledTypes = rule->enabledTypes;
+        }
+    }
+
+    entry->log = log;
+    entry->generation = logFilter.generation;
+    entry->enabledTypes = enabledTypes;
+    UnlockLogFilter();
+    return enabledTypes;
+}
+
+/**
+ * Maximum length of the prefix of a log record (color, time, type, subsystem and category).
+ */
+#define kHAPPlatformLog_MaxPrefixBytes ((size_t) 160)
+
+/**
+ * Maximum length of a formatted line of a buffer dump.
+ */
+#define kHAPPlatformLog_MaxBufferLineBytes ((size_t) 160)
+
+/**
+ * Appends bytes to a log record.
+ *
+ * - If the record is too small, the bytes are only counted.
+ *
+ * @param      bytes                Record buffer. NULL to only count the bytes.
+ * @param      maxBytes             Capacity of the record buffer.
+ * @param[in,out] numBytes          Length of the record.
+ * @param      string               Bytes to append.
+ * @param      numStringBytes       Number of bytes to append.
+ */
+static void Append(
+        char* _Nullable bytes,
+        size_t maxBytes,
+        size_t* numBytes,
+        const char* string,
+        size_t numStringBytes) {
+    HAPPrecondition(numBytes);
+    HAPPrecondition(string);
+
+    if (bytes && *numBytes + numStringBytes <= maxBytes) {
+        HAPRawBufferCopyBytes(&bytes[*numBytes], string, numStringBytes);
+    }
+    *numBytes += numStringBytes;
+}
+
+/**
+ * Formats the prefix of a log record: color, time, type, subsystem and category.
+ *
+ * @param[out] bytes                Buffer, at least kHAPPlatformLog_MaxPrefixBytes long.
+ * @param      log                  Log object.
+ * @param      type                 Log type.
+ *
+ * @return Length of the prefix.
+ */
+static size_t FormatPrefix(char* bytes, const HAPLogObject* log, HAPLogType type) {
+    HAPPrecondition(bytes);
+    HAPPrecondition(log);
+
+    const char* color = "";
+    const char* typeName = "";
+    switch (type) {
+        case kHAPLogType_Debug: {
+            color = "\x1B[0m";
+            typeName = "Debug";
+        } break;
+        case kHAPLogType_Info: {
+            color = "\x1B[32m";
+            typeName = "Info";
+        } break;
+        case kHAPLogType_Default: {
+            color = "\x1B[35m";
+            typeName = "Default";
+        } break;
+        case kHAPLogType_Error: {
+            color = "\x1B[31m";
+            typeName = "Error";
+        } break;
+        case kHAPLogType_Fault: {
+            color = "\x1B[1m\x1B[31m";
+            typeName = "Fault";
+        } break;
+    }
+
+    // Time.
+    char timeString[32] = "";
 #ifdef _WIN32
-        SYSTEMTIME now;
-        GetSystemTime(&now);
-        (void) fprintf(
-                stderr,
-                "%04d-%02d-%02d'T'%02d:%02d:%02d'Z'",
-                now.wYear,
-                now.wMonth,
-                now.wDay,
-                now.wHour,
-                now.wMinute,
-                now.wSecond);
+    SYSTEMTIME now;
+    GetSystemTime(&now);
+    (void) snprintf(
+            timeString,
+            sizeof timeString,
+            "%04d-%02d-%02d'T'%02d:%02d:%02d'Z'",
+            now.wYear,
+            now.wMonth,
+            now.wDay,
+            now.wHour,
+            now.wMinute,
+            now.wSecond);
 #else
-        struct timeval now;
-        int err = gettimeofday(&now, NULL);
-        if (!err) {
-            struct tm g;
-            struct tm* gmt = gmtime_r(&now.tv_sec, &g);
-            if (gmt) {
-                (void) fprintf(
-                        stderr,
-                        "%04d-%02d-%02d'T'%02d:%02d:%02d'Z'",
-                        1900 + gmt->tm_year,
-                        1 + gmt->tm_mon,
-                        gmt->tm_mday,
-                        gmt->tm_hour,
-                        gmt->tm_min,
-                        gmt->tm_sec);
-            }
+    struct timeval now;
+    int err = gettimeofday(&now, NULL);
+    if (!err) {
+        struct tm g;
+        struct tm* gmt = gmtime_r(&now.tv_sec, &g);
+        if (gmt) {
+            (void) snprintf(
+                    timeString,
+                    sizeof timeString,
+                    "%04d-%02d-%02d'T'%02d:%02d:%02d'Z'",
+                    1900 + gmt->tm_year,
+                    1 + gmt->tm_mon,
+                    gmt->tm_mday,
+                    gmt->tm_hour,
+                    gmt->tm_min,
+                    gmt->tm_sec);
         }
+    }
 #endif
-        (void) fprintf(stderr, "\t");
-
-        // Type.
-        switch (type) {
-            case kHAPLogType_Debug: {
-                (void) fprintf(stderr, "Debug");
-            } break;
-            case kHAPLogType_Info: {
-                (void) fprintf(stderr, "Info");
-            } break;
-            case kHAPLogType_Default: {
-                (void) fprintf(stderr, "Default");
-            } break;
-            case kHAPLogType_Error: {
-                (void) fprintf(stderr, "Error");
-            } break;
-            case kHAPLogType_Fault: {
-                (void) fprintf(stderr, "Fault");
-            } break;
-        }
-        (void) fprintf(stderr, "\t");
-
-        // Subsystem / Category.
-        if (log->subsystem) {
-            (void) fprintf(stderr, "[%s", log->subsystem);
-            if (log->category) {
-                (void) fprintf(stderr, ":%s", log->category);
-            }
-            (void) fprintf(stderr, "] ");
-        }
-
-        // Message.
-        (void) fprintf(stderr, "%s", message);
-        (void) fprintf(stderr, "\n");
-
-        // Buffer.
-        if (bufferBytes) {
-            size_t i, n;
-            const uint8_t* b = bufferBytes;
-            size_t length = numBufferBytes;
-            if (length == 0) {
-                (void) fprintf(stderr, "\n");
-            } else {
-                i = 0;
-                do {
-                    (void) fprintf(stderr, "    %04zx ", i);
-                    for (n = 0; n != 8 * 4; n++) {
-                        if (n % 4 == 0) {
-                            (void) fprintf(stderr, " ");
-                        }
-                        if ((n <= length) && (i < length - n)) {
-                            (void) fprintf(stderr, "%02x", b[i + n] & 0xff);
-                        } else {
-                            (void) fprintf(stderr, "  ");
-                        }
-                    };
-                    (void) fprintf(stderr, "    ");
-                    for (n = 0; n != 8 * 4; n++) {
-                        if (i != length) {
-                            if ((32 <= b[i]) && (b[i] < 127)) {
-                                (void) fprintf(stderr, "%c", b[i]);
-                            } else {
-                                (void) fprintf(stderr, ".");
-                            }
-                            i++;
-                        }
-                    }
-                    (void) fprintf(stderr, "\n");
-                } while (i != length);
-            }
+
+    // Subsystem / Category.
+    int numBytes;
+    if (log->subsystem && log->category) {
+        numBytes = snprintf(
+                bytes,
+                kHAPPlatformLog_MaxPrefixBytes,
+                "%s%s\t%s\t[%s:%s] ",
+                color,
+                timeString,
+                typeName,
+                log->subsystem,
+                log->category);
+    } else if (log->subsystem) {
+        numBytes = snprintf(
+                bytes,
+                kHAPPlatformLog_MaxPrefixBytes,
+                "%s%s\t%s\t[%s] ",
+                color,
+                timeString,
+                typeName,
+                log->subsystem);
+    } else {
+        numBytes = snprintf(
+                bytes, kHAPPlatformLog_MaxPrefixBytes, "%s%s\t%s\t", color, timeString, typeName);
+    }
+    if (numBytes < 0) {
+        bytes[0] = '\0';
+        return 0;
+    }
+    return HAPMin((size_t) numBytes, kHAPPlatformLog_MaxPrefixBytes - 1);
+}
+
+/**
+ * Formats one line of a buffer dump: offset, up to 32 bytes in hex, and their printable characters.
+ *
+ * @param[out] bytes                Buffer, at least kHAPPlatformLog_MaxBufferLineBytes long.
+ * @param      bufferBytes          Buffer being dumped.
+ * @param      numBufferBytes       Length of the buffer being dumped.
+ * @param[in,out] offset            Offset of the line. Advanced to the start of the next line.
+ *
+ * @return Length of the line.
+ */
+static size_t FormatBufferLine(char* bytes, const uint8_t* bufferBytes, size_t numBufferBytes, size_t* offset) {
+    HAPPrecondition(bytes);
+    HAPPrecondition(bufferBytes);
+    HAPPrecondition(offset);
+
+    static const char digits[] = "0123456789abcdef";
+    size_t i = *offset;
+    size_t numBytes = 0;
+    int n = snprintf(bytes, kHAPPlatformLog_MaxBufferLineBytes, "    %04zx ", i);
+    numBytes = n > 0 ? (size_t) n : 0;
+    for (size_t j = 0; j != 8 * 4; j++) {
+        if (j % 4 == 0) {
+            bytes[numBytes++] = ' ';
+        }
+        if ((j <= numBufferBytes) && (i < numBufferBytes - j)) {
+            bytes[numBytes++] = digits[(bufferBytes[i + j] >> 4) & 0xF];
+            bytes[numBytes++] = digits[bufferBytes[i + j] & 0xF];
+        } else {
+            bytes[numBytes++] = ' ';
+            bytes[numBytes++] = ' ';
         }
+    }
+    for (size_t j = 0; j != 4; j++) {
+        bytes[numBytes++] = ' ';
+    }
+    for (size_t j = 0; j != 8 * 4 && i != numBufferBytes; j++, i++) {
+        bytes[numBytes++] = (32 <= bufferBytes[i]) && (bufferBytes[i] < 127) ? (char) bufferBytes[i] : '.';
+    }
+    bytes[numBytes++] = '\n';
+    HAPAssert(numBytes <= kHAPPlatformLog_MaxBufferLineBytes);
+    *offset = i;
+    return numBytes;
+}
+
+/**
+ * Formats a complete log record.
+ *
+ * @param      bytes                Record buffer. NULL to only compute the length.
+ * @param      maxBytes             Capacity of the record buffer.
+ * @param      prefix               Formatted prefix.
+ * @param      numPrefixBytes       Length of the formatted prefix.
+ * @param      message              Log message.
+ * @param      bufferBytes          Buffer to dump. Optional.
+ * @param      numBufferBytes       Length of the buffer to dump.
+ *
+ * @return Length of the record.
+ */
+static size_t FormatRecord(
+        char* _Nullable bytes,
+        size_t maxBytes,
+        const char* prefix,
+        size_t numPrefixBytes,
+        const char* message,
+        const void* _Nullable bufferBytes,
+        size_t numBufferBytes) {
+    HAPPrecondition(prefix);
+    HAPPrecondition(message);
 
-        // Reset color.
-        fprintf(stderr, "\x1B[0m");
+    size_t numBytes = 0;
+    Append(bytes, maxBytes, &numBytes, prefix, numPrefixBytes);
+    Append(bytes, maxBytes, &numBytes, message, strlen(message));
+    Append(bytes, maxBytes, &numBytes, "\n", 1);
+    if (bufferBytes) {
+        if (numBufferBytes == 0) {
+            Append(bytes, maxBytes, &numBytes, "\n", 1);
+        } else {
+            size_t offset = 0;
+            do {
+                char line[kHAPPlatformLog_MaxBufferLineBytes];
+                size_t numLineBytes = FormatBufferLine(line, bufferBytes, numBufferBytes, &offset);
+                Append(bytes, maxBytes, &numBytes, line, numLineBytes);
+            } while (offset != numBufferBytes);
+        }
     }
+    Append(bytes, maxBytes, &numBytes, "\x1B[0m", 4);
+    return numBytes;
+}
+
+/**
+ * Writes a log record to stderr synchronously.
+ */
+static void WriteRecord(
+        const char* prefix,
+        size_t numPrefixBytes,
+        const char* message,
+        const void* _Nullable bufferBytes,
+        size_t numBufferBytes) {
+    HAPPrecondition(prefix);
+    HAPPrecondition(message);
+
+    // The record is written under the stderr lock, which the deferred logging task takes as well.
+    // It is a mutex with priority inheritance, so a high-priority task waiting for it cannot starve
+    // the low-priority logging task that holds it.
+    flockfile(stderr);
+
+    (void) fwrite(prefix, 1, numPrefixBytes, stderr);
+    (void) fputs(message, stderr);
+    (void) fputc('\n', stderr);
+    if (bufferBytes) {
+        if (numBufferBytes == 0) {
+            (void) fputc('\n', stderr);
+        } else {
+            size_t offset = 0;
+            do {
+                char line[kHAPPlatformLog_MaxBufferLineBytes];
+                size_t numLineBytes = FormatBufferLine(line, bufferBytes, numBufferBytes, &offset);
+                (void) fwrite(line, 1, numLineBytes, stderr);
+            } while (offset != numBufferBytes);
+        }
+    }
+    (void) fputs("\x1B[0m", stderr);
 
     // Finish log.
     (void) fflush(stderr);
 
-    __atomic_clear(&captureLock, __ATOMIC_SEQ_CST);
+    funlockfile(stderr);
+}
+
+#if CONFIG_HAP_LOG_DEFERRED
+/**
+ * Deferred logging state.
+ *
+ * Log records are formatted by the logging task directly into a ring buffer,
+ * and written to stderr by a low-priority task.
+ */
+static struct {
+    RingbufHandle_t _Nullable ringbuffer;
+    StaticRingbuffer_t ringbufferStorage;
+    uint8_t bytes[CONFIG_HAP_LOG_DEFERRED_BUFFER_SIZE];
+    volatile bool isInitialized;
+    volatile bool initializationLock;
+    uint32_t numDroppedRecords;
+} deferredLog;
+
+static void DeferredLogTask(void* _Nullable context HAP_UNUSED) {
+    uint32_t numReportedDroppedRecords = 0;
+    for (;;) {
+        size_t numBytes;
+        void* _Nullable bytes = xRingbufferReceive(deferredLog.ringbuffer, &numBytes, portMAX_DELAY);
+
+        // Same lock as WriteRecord, so that records written synchronously do not interleave with this one.
+        flockfile(stderr);
+        if (bytes) {
+            (void) fwrite(bytes, 1, numBytes, stderr);
+            vRingbufferReturnItem(deferredLog.ringbuffer, bytes);
+        }
+
+        uint32_t numDroppedRecords = __atomic_load_n(&deferredLog.numDroppedRecords, __ATOMIC_RELAXED);
+        if (numDroppedRecords != numReportedDroppedRecords) {
+            (void) fprintf(
+                    stderr,
+                    "\x1B[31m[%lu log messages dropped]\x1B[0m\n",
+                    (unsigned long) (numDroppedRecords - numReportedDroppedRecords));
+            numReportedDroppedRecords = numDroppedRecords;
+        }
+        (void) fflush(stderr);
+        funlockfile(stderr);
+    }
+}
+
+/**
+ * Initializes deferred logging on first use.
+ *
+ * @return true                     If deferred logging is available.
+ * @return false                    Otherwise. Records must be written synchronously.
+ */
+HAP_RESULT_USE_CHECK
+static bool EnsureDeferredLogInitialized(void) {
+    if (__atomic_load_n(&deferredLog.isInitialized, __ATOMIC_ACQUIRE)) {
+        return deferredLog.ringbuffer != NULL;
+    }
+    if (__atomic_test_and_set(&deferredLog.initializationLock, __ATOMIC_SEQ_CST)) {
+        // Another task is initializing deferred logging.
+        return false;
+    }
+    deferredLog.ringbuffer = xRingbufferCreateStatic(
+            sizeof deferredLog.bytes, RINGBUF_TYPE_NOSPLIT, deferredLog.bytes, &deferredLog.ringbufferStorage);
+    if (deferredLog.ringbuffer) {
+        BaseType_t ok = xTaskCreate(
+                DeferredLogTask,
+                "hap_log",
+                CONFIG_HAP_LOG_DEFERRED_TASK_STACK_SIZE,
+                NULL,
+                CONFIG_HAP_LOG_DEFERRED_TASK_PRIORITY,
+                NULL);
+        if (ok != pdPASS) {
+            vRingbufferDelete(deferredLog.ringbuffer);
+            deferredLog.ringbuffer = NULL;
+        }
+    }
+    __atomic_store_n(&deferredLog.isInitialized, true, __ATOMIC_RELEASE);
+    return deferredLog.ringbuffer != NULL;
+}
+
+/**
+ * Queues a log record for the logging task.
+ *
+ * - Never blocks. If the ring buffer is full, the record is dropped and counted.
+ *
+ * - Records that are larger than the largest item the ring buffer can ever hold are not queued.
+ *   They are written synchronously instead, so that large buffer dumps are not lost.
+ *
+ * @return true                     If the record was queued or dropped.
+ * @return false                    If deferred logging is not available or the record is too large.
+ */
+HAP_RESULT_USE_CHECK
+static bool QueueRecord(
+        const char* prefix,
+        size_t numPrefixBytes,
+        const char* message,
+        const void* _Nullable bufferBytes,
+        size_t numBufferBytes) {
+    HAPPrecondition(prefix);
+    HAPPrecondition(message);
+
+    if (!EnsureDeferredLogInitialized()) {
+        return false;
+    }
+
+    size_t numBytes = FormatRecord(NULL, 0, prefix, numPrefixBytes, message, bufferBytes, numBufferBytes);
+    if (numBytes > xRingbufferGetMaxItemSize(deferredLog.ringbuffer)) {
+        return false;
+    }
+    void* _Nullable bytes = NULL;
+    if (xRingbufferSendAcquire(deferredLog.ringbuffer, &bytes, numBytes, 0) != pdTRUE || !bytes) {
+        (void) __atomic_fetch_add(&deferredLog.numDroppedRecords, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    size_t numWrittenBytes = FormatRecord(bytes, numBytes, prefix, numPrefixBytes, message, bufferBytes, numBufferBytes);
+    HAPAssert(numWrittenBytes == numBytes);
+    (void) xRingbufferSendComplete(deferredLog.ringbuffer, bytes);
+    return true;
+}
+#endif
+
+void HAPPlatformLogCapture(
+        const HAPLogObject* _Nonnull log,
+        HAPLogType type,
+        const char* _Nonnull message,
+        const void* _Nullable bufferBytes,
+        size_t numBufferBytes) HAP_DIAGNOSE_ERROR(!bufferBytes && numBufferBytes, "empty buffer cannot have a length") {
+    HAPPrecondition(log);
+    HAPPrecondition(message);
+    HAPPrecondition(!numBufferBytes || bufferBytes);
+
+    // Format log message.
+    char prefix[kHAPPlatformLog_MaxPrefixBytes];
+    size_t numPrefixBytes = FormatPrefix(prefix, log, type);
+
+#if CONFIG_HAP_LOG_DEFERRED
+    // Faults usually precede an abort. They are written immediately so that they are not lost.
+    if (type != kHAPLogType_Fault &&
+        QueueRecord(prefix, numPrefixBytes, message, bufferBytes, numBufferBytes)) {
+        return;
+    }
+#endif
+
+    WriteRecord(prefix, numPrefixBytes, message, bufferBytes, numBufferBytes);
 }
@@ -21,6 +21,8 @@
 #include "HAP+Internal.h"
 #include "HAPPlatformMFiHWAuth+Init.h"
 #include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "driver/i2c.h"
 
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "MFiHWAuth" };
@@ -45,7 +47,29 @@ static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem,
 #define I2C_MASTER_RETRY_TIMES      500
 #define I2C_MASTER_TICKS_TIMES      2 * I2C_MASTER_RETRY_TIMES
 #define I2C_MASTER_MAX_RETRY        10
-#define I2C_MASTER_INTERNAL_TIMES   8 * I2C_MASTER_RETRY_TIMES
+#define I2C_MASTER_BUSY_TIMEOUT_MS  CONFIG_HAP_I2C_BUSY_TIMEOUT
+#define I2C_MASTER_MAX_BACKOFF_MS   32
+
+/**
+ * @brief Wait before retrying a transaction that the coprocessor NACKed
+ *
+ * The coprocessor NACKs its address while it is busy, e.g. while generating a signature. The wait doubles with
+ * every attempt and blocks the calling task instead of spinning, so that other tasks run meanwhile.
+ *
+ * @return false if the coprocessor has been busy for longer than I2C_MASTER_BUSY_TIMEOUT_MS
+ */
+static bool esp_mfi_i2c_backoff(uint32_t attempt, uint32_t *waited_ms)
+{
+    // 1, 2, 4, ... ms up to I2C_MASTER_MAX_BACKOFF_MS.
+    uint32_t wait_ms = attempt < 5 ? (uint32_t) 1 << attempt : I2C_MASTER_MAX_BACKOFF_MS;
+    if (*waited_ms >= I2C_MASTER_BUSY_TIMEOUT_MS)
+        return false;
+
+    TickType_t ticks = pdMS_TO_TICKS(wait_ms);
+    vTaskDelay(ticks ? ticks : 1);
+    *waited_ms += ticks ? wait_ms : portTICK_PERIOD_MS;
+    return true;
+}
 /**
  * @brief Initialize I2C information
  */
@@ -86,27 +110,32 @@ static int esp_mfi_i2c_write(uint8_t slvaddr, const uint8_t *buff, uint32_t len)
     if (!buff)
         return ESP_FAIL;
 
-    HAPLog(&logObject, "Writing to HW I2C");
+    HAPLogDebug(&logObject, "Writing to HW I2C");
 
     int ret = 0;
-    i2c_cmd_handle_t cmd = NULL;
+    uint32_t waited_ms = 0;
     i = 0;
 
-    do {
-        cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
+    // The command link is built once and replayed for every attempt.
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    if (!cmd)
+        return ESP_ERR_NO_MEM;
+    i2c_master_start(cmd);
+
+    // Send write address of the CP
+    i2c_master_write_byte(cmd, slvaddr, ACK_CHECK_EN);
+    // Send data out.
+    i2c_master_write(cmd, (uint8_t *)buff, len, ACK_CHECK_EN);
 
-        // Send write address of the CP
-        i2c_master_write_byte(cmd, slvaddr, ACK_CHECK_EN);
-        // Send data out.
-        i2c_master_write(cmd, (uint8_t *)buff, len, ACK_CHECK_EN);
+    i2c_master_stop(cmd);
 
-        i2c_master_stop(cmd);
+    do {
+        // The driver waits for the transaction interrupt, so the task blocks instead of polling.
         ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, I2C_MASTER_TICKS_TIMES / portTICK_RATE_MS);
         i ++;
-        i2c_cmd_link_delete(cmd);
-        ets_delay_us(I2C_MASTER_RETRY_TIMES);
-    } while(ret != ESP_OK && i < I2C_MASTER_MAX_RETRY);
+    } while (ret != ESP_OK && i < I2C_MASTER_MAX_RETRY && esp_mfi_i2c_backoff(i, &waited_ms));
+
+    i2c_cmd_link_delete(cmd);
 
     if (ret != ESP_OK) {
         HAPLogError(&logObject, "Write data to slave fail %d.", ret);
@@ -124,50 +153,59 @@ static int esp_mfi_i2c_read(uint8_t slvaddr, uint8_t regaddr, uint8_t *buff, uin
     if (!buff)
         return ESP_FAIL;
 
-    HAPLog(&logObject, "Reading from HW I2C");
+    HAPLogDebug(&logObject, "Reading from HW I2C");
 
     int ret = 0;
-    i2c_cmd_handle_t cmd = NULL;
+    uint32_t waited_ms = 0;
     i = 0;
 
+    // Both command links are built once and replayed for every attempt.
+    i2c_cmd_handle_t addr_cmd = i2c_cmd_link_create();
+    i2c_cmd_handle_t read_cmd = i2c_cmd_link_create();
+    if (!addr_cmd || !read_cmd) {
+        if (addr_cmd)
+            i2c_cmd_link_delete(addr_cmd);
+        if (read_cmd)
+            i2c_cmd_link_delete(read_cmd);
+        return ESP_ERR_NO_MEM;
+    }
+
+    i2c_master_start(addr_cmd);
+    // Send write address of the CP
+    i2c_master_write_byte(addr_cmd, slvaddr, ACK_CHECK_EN);
+    // Send register address to slave.
+    i2c_master_write_byte(addr_cmd, regaddr, ACK_CHECK_EN);
+    i2c_master_stop(addr_cmd);
+
+    i2c_master_start(read_cmd);
+    i2c_master_write_byte(read_cmd, slvaddr + 1, ACK_CHECK_EN);
+    if (len == 1)
+        i2c_master_read_byte(read_cmd, buff, NACK_VAL);
+    else {
+        i2c_master_read(read_cmd, buff, len - 1, ACK_VAL);
+        i2c_master_read_byte(read_cmd, buff + len - 1, NACK_VAL);
+    }
+    i2c_master_stop(read_cmd);
+
     do {
+        // The CP NACKs while it is busy. The driver waits for the transaction interrupt, and the backoff blocks
+        // the task, so nothing spins while the CP is busy.
         for (j = 0; j < I2C_MASTER_MAX_READ; j++) {
-            cmd = i2c_cmd_link_create();
-            i2c_master_start(cmd);
-
-            // Send write address of the CP
-            i2c_master_write_byte(cmd, slvaddr, ACK_CHECK_EN);
-            // Send register address to slave.
-            i2c_master_write_byte(cmd, regaddr, ACK_CHECK_EN);
-
-            i2c_master_stop(cmd);
-            ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, I2C_MASTER_TICKS_TIMES / portTICK_RATE_MS);
-            i2c_cmd_link_delete(cmd);
-            if (ret == ESP_OK) {
+            ret = i2c_master_cmd_begin(I2C_MASTER_NUM, addr_cmd, I2C_MASTER_TICKS_TIMES / portTICK_RATE_MS);
+            if (ret == ESP_OK || !esp_mfi_i2c_backoff(j, &waited_ms)) {
                 break;
-            } else {
-                ets_delay_us(I2C_MASTER_INTERNAL_TIMES);
             }
         }
-
-        ets_delay_us(I2C_MASTER_INTERNAL_TIMES);
-
-        cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
-
-        i2c_master_write_byte(cmd, slvaddr + 1, ACK_CHECK_EN);
-        if (len == 1)
-            i2c_master_read_byte(cmd, buff, NACK_VAL);
-        else {
-            i2c_master_read(cmd, buff, len - 1, ACK_VAL);
-            i2c_master_read_byte(cmd, buff + len - 1, NACK_VAL);
+        if (ret != ESP_OK) {
+            break;
         }
 
-        i2c_master_stop(cmd);
-        ret = i2c_master_cmd_begin(I2C_MASTER_NUM, cmd, I2C_MASTER_TICKS_TIMES / portTICK_RATE_MS);
+        ret = i2c_master_cmd_begin(I2C_MASTER_NUM, read_cmd, I2C_MASTER_TICKS_TIMES / portTICK_RATE_MS);
         i ++;
-        i2c_cmd_link_delete(cmd);
-    } while (ret != ESP_OK && i < I2C_MASTER_MAX_RETRY);
+    } while (ret != ESP_OK && i < I2C_MASTER_MAX_RETRY && esp_mfi_i2c_backoff(i, &waited_ms));
+
+    i2c_cmd_link_delete(addr_cmd);
+    i2c_cmd_link_delete(read_cmd);
 
     if (ret != ESP_OK) {
         HAPLogError(&logObject, "Read data from slave fail %d.", ret);
@@ -175,9 +213,74 @@ static int esp_mfi_i2c_read(uint8_t slvaddr, uint8_t regaddr, uint8_t *buff, uin
 
     return ret;
 }
+/**
+ * Returns whether a register of the coprocessor holds a value that never changes.
+ *
+ * - 0x00 - 0x04: Device version, firmware version, protocol versions and device ID.
+ * - 0x30 - 0x3A: Accessory certificate data length and accessory certificate data.
+ */
+HAP_RESULT_USE_CHECK
+static bool IsConstantRegister(uint8_t registerAddress) {
+    return registerAddress <= 0x04 || (registerAddress >= 0x30 && registerAddress <= 0x3A);
+}
+
+/**
+ * Looks up a cached register value.
+ *
+ * @return true if the first numBytes bytes of the register have been copied to bytes.
+ */
+HAP_RESULT_USE_CHECK
+static bool GetCachedRegister(
+        HAPPlatformMFiHWAuthRef mfiHWAuth,
+        uint8_t registerAddress,
+        void* bytes,
+        size_t numBytes) {
+    HAPPrecondition(mfiHWAuth);
+    HAPPrecondition(bytes);
+
+    for (size_t i = 0; i < mfiHWAuth->numCachedRegisters; i++) {
+        const HAPPlatformMFiHWAuthCachedRegister* cachedRegister = &mfiHWAuth->cachedRegisters[i];
+        if (cachedRegister->registerAddress == registerAddress && cachedRegister->numBytes >= numBytes) {
+            HAPRawBufferCopyBytes(bytes, &mfiHWAuth->cacheBytes[cachedRegister->offset], numBytes);
+            return true;
+        }
+    }
+    return false;
+}
+
+HAP_STATIC_ASSERT(kHAPPlatformMFiHWAuth_CacheSize <= UINT16_MAX, CacheSize_fits_cached_register_fields);
+
+/**
+ * Caches a register value if there is space left.
+ */
+static void CacheRegister(
+        HAPPlatformMFiHWAuthRef mfiHWAuth,
+        uint8_t registerAddress,
+        const void* bytes,
+        size_t numBytes) {
+    HAPPrecondition(mfiHWAuth);
+    HAPPrecondition(bytes);
+
+    if (mfiHWAuth->numCachedRegisters == HAPArrayCount(mfiHWAuth->cachedRegisters) ||
+        numBytes > sizeof mfiHWAuth->cacheBytes - mfiHWAuth->numCacheBytes) {
+        HAPLog(&logObject, "Register cache full. Not caching register 0x%02X.", registerAddress);
+        return;
+    }
+
+    HAPPlatformMFiHWAuthCachedRegister* cachedRegister = &mfiHWAuth->cachedRegisters[mfiHWAuth->numCachedRegisters];
+    cachedRegister->registerAddress = registerAddress;
+    cachedRegister->numBytes = (uint16_t) numBytes;
+    cachedRegister->offset = mfiHWAuth->numCacheBytes;
+    HAPRawBufferCopyBytes(&mfiHWAuth->cacheBytes[cachedRegister->offset], bytes, numBytes);
+    mfiHWAuth->numCacheBytes = (uint16_t)(mfiHWAuth->numCacheBytes + numBytes);
+    mfiHWAuth->numCachedRegisters++;
+}
+
 void HAPPlatformMFiHWAuthCreate(HAPPlatformMFiHWAuthRef mfiHWAuth) {
     HAPPrecondition(mfiHWAuth);
 
+    HAPRawBufferZero(mfiHWAuth, sizeof *mfiHWAuth);
+
     int ret = 0;
 
     ret = esp_mfi_i2c_init();
@@ -191,6 +294,8 @@ void HAPPlatformMFiHWAuthRelease(HAPPlatformMFiHWAuthRef mfiHWAuth) {
     HAPPrecondition(mfiHWAuth);
 
     mfiHWAuth->slaveAddr = 0;
+    mfiHWAuth->numCachedRegisters = 0;
+    mfiHWAuth->numCacheBytes = 0;
 }
 
 HAP_RESULT_USE_CHECK
@@ -245,9 +350,17 @@ HAPError HAPPlatformMFiHWAuthRead(
         return kHAPError_InvalidState;
     }
 
+    bool isConstant = IsConstantRegister(registerAddress);
+    if (isConstant && GetCachedRegister(mfiHWAuth, registerAddress, bytes, numBytes)) {
+        return kHAPError_None;
+    }
+
     if (esp_mfi_i2c_read(mfiHWAuth->slaveAddr, registerAddress, bytes, numBytes) != ESP_OK) {
         return kHAPError_Unknown;
     }
 
+    if (isConstant) {
+        CacheRegister(mfiHWAuth, registerAddress, bytes, numBytes);
+    }
     return kHAPError_None;
 }
@@ -0,0 +1,276 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <esp_system.h>
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformPersistedState+Init.h"
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "PersistedState" };
+
+/**
+ * Initialized persisted states, flushed before a software restart.
+ */
+static HAPPlatformPersistedStateRef _Nullable persistedStates;
+
+/**
+ * Whether the shutdown handler has been registered.
+ */
+static bool isShutdownHandlerRegistered;
+
+static void Lock(HAPPlatformPersistedStateRef persistedState) {
+    HAPPrecondition(persistedState);
+    HAPPrecondition(persistedState->lock);
+
+    (void) xSemaphoreTakeRecursive(persistedState->lock, portMAX_DELAY);
+}
+
+static void Unlock(HAPPlatformPersistedStateRef persistedState) {
+    HAPPrecondition(persistedState);
+    HAPPrecondition(persistedState->lock);
+
+    (void) xSemaphoreGiveRecursive(persistedState->lock);
+}
+
+/**
+ * Flushes all initialized persisted states before a software restart.
+ */
+static void HandleShutdown(void) {
+    for (HAPPlatformPersistedStateRef persistedState = persistedStates; persistedState;
+         persistedState = persistedState->nextPersistedState) {
+        (void) HAPPlatformPersistedStateFlush(persistedState);
+    }
+}
+
+static void HandleFlushCallback(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize == sizeof(HAPPlatformPersistedStateRef));
+    HAPPlatformPersistedStateRef persistedState = *(HAPPlatformPersistedStateRef*) context;
+
+    // The persisted state may have been released after the timer expired.
+    for (HAPPlatformPersistedStateRef p = persistedStates; p; p = p->nextPersistedState) {
+        if (p == persistedState) {
+            (void) HAPPlatformPersistedStateFlush(persistedState);
+            return;
+        }
+    }
+}
+
+static void HandleTimerExpired(void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformPersistedStateRef persistedState = context;
+
+    // Flush on the run loop, where the state is not modified concurrently by accessory request handlers.
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleFlushCallback, &persistedState, sizeof persistedState);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Scheduling flush of %02X.%02X failed.", persistedState->domain, persistedState->key);
+    }
+}
+
+/**
+ * (Re-)arms the flush timer of a persisted state.
+ *
+ * - Must be called with the persisted state locked.
+ *
+ * @param      persistedState       Persisted state.
+ * @param      now                  Current time in microseconds.
+ */
+static void ScheduleFlush(HAPPlatformPersistedStateRef persistedState, int64_t now) {
+    HAPPrecondition(persistedState);
+    HAPPrecondition(persistedState->timer);
+    HAPPrecondition(persistedState->isDirty);
+
+    int64_t deadline = now + (int64_t) persistedState->quietPeriod * 1000;
+    int64_t maxDeadline = persistedState->dirtyTime + (int64_t) persistedState->maxDelay * 1000;
+    if (deadline > maxDeadline) {
+        deadline = maxDeadline;
+    }
+
+    // ESP_ERR_INVALID_STATE if the timer is not running.
+    (void) esp_timer_stop(persistedState->timer);
+    esp_err_t err = esp_timer_start_once(persistedState->timer, (uint64_t)(deadline > now ? deadline - now : 0));
+    if (err != ESP_OK) {
+        HAPLogError(&logObject, "esp_timer_start_once failed: %d.", err);
+        HAPFatalError();
+    }
+}
+
+void HAPPlatformPersistedStateCreate(
+        HAPPlatformPersistedStateRef persistedState,
+        const HAPPlatformPersistedStateOptions* options) {
+    HAPPrecondition(persistedState);
+    HAPPrecondition(options);
+    HAPPrecondition(options->keyValueStore);
+    HAPPrecondition(options->bytes);
+    HAPPrecondition(options->flushedBytes);
+    HAPPrecondition(options->numBytes);
+
+    HAPRawBufferZero(persistedState, sizeof *persistedState);
+    persistedState->keyValueStore = options->keyValueStore;
+    persistedState->domain = options->domain;
+    persistedState->key = options->key;
+    persistedState->bytes = options->bytes;
+    persistedState->flushedBytes = options->flushedBytes;
+    persistedState->numBytes = options->numBytes;
+    persistedState->quietPeriod = options->quietPeriod ? options->quietPeriod :
+                                                         (HAPTime) CONFIG_HAP_PERSISTED_STATE_QUIET_PERIOD * HAPMillisecond;
+    persistedState->maxDelay =
+            options->maxDelay ? options->maxDelay : (HAPTime) CONFIG_HAP_PERSISTED_STATE_MAX_DELAY * HAPMillisecond;
+    HAPPrecondition(persistedState->maxDelay >= persistedState->quietPeriod);
+
+    persistedState->lock = xSemaphoreCreateRecursiveMutexStatic(&persistedState->lockStorage);
+    HAPAssert(persistedState->lock);
+
+    esp_err_t e = esp_timer_create(
+            &(const esp_timer_create_args_t) { .callback = HandleTimerExpired,
+                                               .arg = persistedState,
+                                               .dispatch_method = ESP_TIMER_TASK,
+                                               .name = "persisted_state" },
+            &persistedState->timer);
+    if (e != ESP_OK) {
+        HAPLogError(&logObject, "esp_timer_create failed: %d.", e);
+        HAPFatalError();
+    }
+
+    // Remember the stored state, so that writing it again can be skipped.
+    HAPError err;
+    bool found;
+    size_t numBytes;
+    err = HAPPlatformKeyValueStoreGet(
+            persistedState->keyValueStore,
+            persistedState->domain,
+            persistedState->key,
+            persistedState->flushedBytes,
+            persistedState->numBytes,
+            &numBytes,
+            &found);
+    if (err) {
+        HAPAssert(err == kHAPError_Unknown);
+        HAPLogError(&logObject, "Reading %02X.%02X failed.", persistedState->domain, persistedState->key);
+    }
+    persistedState->hasFlushedBytes = !err && found && numBytes == persistedState->numBytes;
+
+    persistedState->nextPersistedState = persistedStates;
+    persistedStates = persistedState;
+    if (!isShutdownHandlerRegistered) {
+        e = esp_register_shutdown_handler(HandleShutdown);
+        if (e != ESP_OK) {
+            HAPLogError(&logObject, "esp_register_shutdown_handler failed: %d.", e);
+        }
+        isShutdownHandlerRegistered = true;
+    }
+
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: persistedState = %lu, quiet period = %llu ms, maximum delay = %llu ms",
+            (unsigned long) sizeof *persistedState,
+            (unsigned long long) persistedState->quietPeriod,
+            (unsigned long long) persistedState->maxDelay);
+}
+
+void HAPPlatformPersistedStateRelease(HAPPlatformPersistedStateRef persistedState) {
+    HAPPrecondition(persistedState);
+    HAPPrecondition(persistedState->timer);
+
+    (void) HAPPlatformPersistedStateFlush(persistedState);
+
+    HAPLogInfo(
+            &logObject,
+            "%02X.%02X: %lu writes, %lu unchanged writes skipped.",
+            persistedState->domain,
+            persistedState->key,
+            (unsigned long) persistedState->numWrites,
+            (unsigned long) persistedState->numSkippedWrites);
+
+    for (HAPPlatformPersistedStateRef* p = &persistedStates; *p; p = &(*p)->nextPersistedState) {
+        if (*p == persistedState) {
+            *p = persistedState->nextPersistedState;
+            break;
+        }
+    }
+
+    (void) esp_timer_stop(persistedState->timer);
+    esp_timer_delete(persistedState->timer);
+
+    vSemaphoreDelete(persistedState->lock);
+    HAPRawBufferZero(persistedState, sizeof *persistedState);
+}
+
+void HAPPlatformPersistedStateMarkDirty(HAPPlatformPersistedStateRef persistedState) {
+    HAPPrecondition(persistedState);
+
+    Lock(persistedState);
+    int64_t now = esp_timer_get_time();
+    if (!persistedState->isDirty) {
+        persistedState->isDirty = true;
+        persistedState->dirtyTime = now;
+    }
+    ScheduleFlush(persistedState, now);
+    Unlock(persistedState);
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformPersistedStateFlush(HAPPlatformPersistedStateRef persistedState) {
+    HAPPrecondition(persistedState);
+    HAPPrecondition(persistedState->keyValueStore);
+    HAPPrecondition(persistedState->bytes);
+    HAPPrecondition(persistedState->flushedBytes);
+
+    Lock(persistedState);
+    if (!persistedState->isDirty) {
+        Unlock(persistedState);
+        return kHAPError_None;
+    }
+    (void) esp_timer_stop(persistedState->timer);
+    persistedState->isDirty = false;
+
+    if (persistedState->hasFlushedBytes &&
+        HAPRawBufferAreEqual(persistedState->flushedBytes, persistedState->bytes, persistedState->numBytes)) {
+        persistedState->numSkippedWrites++;
+        Unlock(persistedState);
+        return kHAPError_None;
+    }
+
+    // Copy the state first, so that the written value and the flushed copy match.
+    HAPRawBufferCopyBytes(persistedState->flushedBytes, persistedState->bytes, persistedState->numBytes);
+    HAPError err = HAPPlatformKeyValueStoreSet(
+            persistedState->keyValueStore,
+            persistedState->domain,
+            persistedState->key,
+            persistedState->flushedBytes,
+            persistedState->numBytes);
+    if (err) {
+        HAPAssert(err == kHAPError_Unknown);
+        HAPLogError(&logObject, "Writing %02X.%02X failed. Retrying later.", persistedState->domain, persistedState->key);
+        persistedState->hasFlushedBytes = false;
+        persistedState->isDirty = true;
+        int64_t now = esp_timer_get_time();
+        persistedState->dirtyTime = now;
+        ScheduleFlush(persistedState, now);
+        Unlock(persistedState);
+        return err;
+    }
+    persistedState->hasFlushedBytes = true;
+    persistedState->numWrites++;
+    HAPLogDebug(&logObject, "Flushed %02X.%02X.", persistedState->domain, persistedState->key);
+    Unlock(persistedState);
+    return kHAPError_None;
+}
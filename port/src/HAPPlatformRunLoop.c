@@ -29,6 +29,7 @@
 #include <sys/select.h>
 
 #include "HAPPlatform+Init.h"
+#include "HAPPlatformClock+Init.h"
 #include "HAPPlatformFileHandle.h"
 #include "HAPPlatformLog+Init.h"
 #include "HAPPlatformRunLoop+Init.h"
@@ -38,11 +39,147 @@
 #include <sys/types.h>
 #include <lwip/sockets.h>
 #include <sys/syslimits.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+#if CONFIG_HAP_RUN_LOOP_PM
+#include <esp_pm.h>
+#endif
 
 static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "RunLoop" };
 
 #define LOOPBACK_PORT   12321
 
+/**
+ * Alignment of scheduled callback slots and of the contexts passed to scheduled callbacks.
+ */
+#define kHAPPlatformRunLoop_CallbackSlotAlignment ((size_t) 8)
+
+/**
+ * Size of the in-memory ring holding callbacks scheduled through HAPPlatformRunLoopScheduleCallback.
+ */
+#define kHAPPlatformRunLoop_CallbackQueueSize \
+    ((size_t) CONFIG_HAP_RUN_LOOP_CALLBACK_QUEUE_SIZE & ~(kHAPPlatformRunLoop_CallbackSlotAlignment - 1))
+
+/**
+ * Maximum number of scheduled callbacks that are dispatched per run loop iteration.
+ */
+#define kHAPPlatformRunLoop_MaxCallbacksPerIteration ((size_t) CONFIG_HAP_RUN_LOOP_CALLBACK_BATCH_LIMIT)
+
+/**
+ * Interval, in microseconds, after which a wakeup datagram that could not be sent is sent again.
+ */
+#define kHAPPlatformRunLoop_WakeupRetryInterval ((uint64_t) 10 * 1000)
+
+/**
+ * Leeway of timers registered through HAPPlatformTimerRegister.
+ */
+#define kHAPPlatformRunLoop_DefaultTimerLeeway ((HAPTime) CONFIG_HAP_RUN_LOOP_TIMER_LEEWAY)
+
+/**
+ * Maximum number of concurrently registered file handles.
+ */
+#define kHAPPlatformRunLoop_MaxFileHandles ((size_t) CONFIG_HAP_RUN_LOOP_MAX_FILE_HANDLES)
+
+/**
+ * Maximum number of concurrently registered timers.
+ */
+#define kHAPPlatformRunLoop_MaxTimers ((size_t) CONFIG_HAP_RUN_LOOP_MAX_TIMERS)
+
+/**
+ * Fixed-size object pool.
+ *
+ * - Objects are handed out from a caller-provided array. Released objects are kept in a free list that is linked
+ *   through the first pointer-sized bytes of each free object.
+ *
+ * - Objects that have never been allocated are handed out in array order, so the pool needs no initialization.
+ */
+typedef struct {
+    /**
+     * Object storage.
+     */
+    void* storage;
+
+    /**
+     * Size of an object. Must be at least the size of a pointer.
+     */
+    size_t objectSize;
+
+    /**
+     * Number of objects in the storage.
+     */
+    size_t maxObjects;
+
+    /**
+     * Number of objects that have been handed out from the storage at least once.
+     */
+    size_t numTouchedObjects;
+
+    /**
+     * Free list of released objects.
+     */
+    void* _Nullable freeObjects;
+
+    /**
+     * Number of objects currently in use.
+     */
+    size_t numObjects;
+
+    /**
+     * Maximum number of objects that have been in use at the same time.
+     */
+    size_t maxUsedObjects;
+} HAPPlatformRunLoopPool;
+
+/**
+ * Allocates a zero-initialized object from a pool.
+ *
+ * @param      pool                 Pool.
+ *
+ * @return Object, if successful. NULL, if the pool is exhausted.
+ */
+HAP_RESULT_USE_CHECK
+static void* _Nullable PoolAllocate(HAPPlatformRunLoopPool* pool) {
+    HAPPrecondition(pool);
+    HAPPrecondition(pool->objectSize >= sizeof(void*));
+
+    void* object;
+    if (pool->freeObjects) {
+        object = pool->freeObjects;
+        HAPRawBufferCopyBytes(&pool->freeObjects, object, sizeof pool->freeObjects);
+    } else if (pool->numTouchedObjects < pool->maxObjects) {
+        object = (uint8_t*) pool->storage + pool->numTouchedObjects * pool->objectSize;
+        pool->numTouchedObjects++;
+    } else {
+        return NULL;
+    }
+    HAPRawBufferZero(object, pool->objectSize);
+
+    pool->numObjects++;
+    if (pool->numObjects > pool->maxUsedObjects) {
+        pool->maxUsedObjects = pool->numObjects;
+    }
+    return object;
+}
+
+/**
+ * Returns an object to its pool.
+ *
+ * @param      pool                 Pool.
+ * @param      object               Object that has been allocated from the pool.
+ */
+static void PoolFree(HAPPlatformRunLoopPool* pool, void* object) {
+    HAPPrecondition(pool);
+    HAPPrecondition(object);
+    HAPPrecondition((uint8_t*) object >= (uint8_t*) pool->storage);
+    HAPPrecondition((uint8_t*) object < (uint8_t*) pool->storage + pool->numTouchedObjects * pool->objectSize);
+    HAPPrecondition(!(((uint8_t*) object - (uint8_t*) pool->storage) % pool->objectSize));
+    HAPPrecondition(pool->numObjects);
+
+    HAPRawBufferCopyBytes(object, &pool->freeObjects, sizeof pool->freeObjects);
+    pool->freeObjects = object;
+    pool->numObjects--;
+}
+
 /**
  * Internal file handle type, representing the registration of a platform-specific file descriptor.
  */
@@ -73,19 +210,12 @@ struct HAPPlatformFileHandle {
     void* _Nullable context;
 
     /**
-     * Previous file handle in linked list.
-     */
-    HAPPlatformFileHandle* _Nullable prevFileHandle;
-
-    /**
-     * Next file handle in linked list.
-     */
-    HAPPlatformFileHandle* _Nullable nextFileHandle;
-
-    /**
-     * Flag indicating whether the platform-specific file descriptor is registered with an I/O multiplexer or not.
+     * Value of runLoop.numSelectIterations when the file handle was registered.
+     *
+     * - Events are only dispatched to file handles that were registered before the current `select` call, so that
+     *   a file handle registered for a reused file descriptor does not receive events meant for its predecessor.
      */
-    bool isAwaitingEvents;
+    uint32_t registrationIteration;
 };
 
 /**
@@ -102,6 +232,16 @@ struct HAPPlatformTimer {
      */
     HAPTime deadline;
 
+    /**
+     * Registration sequence number. Orders timers with the same deadline by order of registration.
+     */
+    uint64_t sequenceNumber;
+
+    /**
+     * Amount of time by which the timer may fire late, so that it can be coalesced with other timers.
+     */
+    HAPTime leeway;
+
     /**
      * Callback that is invoked when the timer expires.
      */
@@ -113,11 +253,58 @@ struct HAPPlatformTimer {
     void* _Nullable context;
 
     /**
-     * Next timer in linked list.
+     * Index of the timer in the timer heap.
      */
-    HAPPlatformTimer* _Nullable nextTimer;
+    size_t heapIndex;
 };
 
+/**
+ * Storage for file handles.
+ */
+static HAPPlatformFileHandle fileHandleStorage[kHAPPlatformRunLoop_MaxFileHandles];
+
+/**
+ * Storage for timers.
+ */
+static HAPPlatformTimer timerStorage[kHAPPlatformRunLoop_MaxTimers];
+
+/**
+ * Header of a scheduled callback slot in the scheduled callback ring.
+ *
+ * - The header is followed by the context, starting at the next aligned offset.
+ */
+typedef struct {
+    /**
+     * Callback to invoke. NULL if the remainder of the ring is unused and the next slot starts at offset 0.
+     */
+    HAPPlatformRunLoopCallback _Nullable callback;
+
+    /**
+     * Context size (up to UINT8_MAX).
+     */
+    uint8_t numContextBytes;
+} HAPPlatformRunLoopCallbackSlot;
+
+// The unused remainder at the end of the ring is a multiple of the slot alignment and is marked by a NULL callback.
+HAP_STATIC_ASSERT(
+        kHAPPlatformRunLoop_CallbackSlotAlignment >= sizeof(HAPPlatformRunLoopCallback),
+        CallbackSlotAlignmentFitsMarker);
+
+/**
+ * Returns the number of bytes occupied by a scheduled callback slot.
+ *
+ * @param      numContextBytes      Context size.
+ *
+ * @return Number of bytes occupied by the slot, including header, context and padding.
+ */
+HAP_RESULT_USE_CHECK
+static size_t GetCallbackSlotSize(size_t numContextBytes) {
+    size_t numHeaderBytes = (sizeof(HAPPlatformRunLoopCallbackSlot) + kHAPPlatformRunLoop_CallbackSlotAlignment - 1) &
+                            ~(kHAPPlatformRunLoop_CallbackSlotAlignment - 1);
+    return (numHeaderBytes + numContextBytes + kHAPPlatformRunLoop_CallbackSlotAlignment - 1) &
+           ~(kHAPPlatformRunLoop_CallbackSlotAlignment - 1);
+}
+
 /**
  * Run loop state.
  */
@@ -139,70 +326,281 @@ HAP_ENUM_BEGIN(uint8_t, HAPPlatformRunLoopState) { /**
 
 static struct {
     /**
-     * Sentinel node of a circular doubly-linked list of file handles
+     * Registered file handles, indexed by platform-specific file descriptor.
      */
-    HAPPlatformFileHandle fileHandleSentinel;
+    HAPPlatformFileHandle* _Nullable fileHandles[FD_SETSIZE];
 
     /**
-     * Pointer to sentinel node, representing a circular doubly-linked list of file handles
+     * Set of file descriptors with interest in reading. Updated whenever file handle interests change.
      */
-    HAPPlatformFileHandle* _Nullable fileHandles;
+    fd_set readFileDescriptors;
 
     /**
-     * File handle cursor, used to handle reentrant modifications of global file handle list during iteration.
+     * Set of file descriptors with interest in writing. Updated whenever file handle interests change.
      */
-    HAPPlatformFileHandle* _Nullable fileHandleCursor;
+    fd_set writeFileDescriptors;
 
     /**
-     * Start of linked list of timers, ordered by deadline.
+     * Set of file descriptors with interest in error conditions. Updated whenever file handle interests change.
      */
-    HAPPlatformTimer* _Nullable timers;
-    
+    fd_set errorFileDescriptors;
+
+    /**
+     * Highest file descriptor in any of the file descriptor sets, or -1 if all sets are empty.
+     */
+    int maxFileDescriptor;
+
+    /**
+     * Number of `select` calls so far.
+     */
+    uint32_t numSelectIterations;
+
+    /**
+     * Pool of file handles.
+     */
+    HAPPlatformRunLoopPool fileHandlePool;
+
     /**
-     * Loopback file descriptor to receive data.
+     * Pool of timers.
+     */
+    HAPPlatformRunLoopPool timerPool;
+
+    /**
+     * Binary min-heap of timers, ordered by deadline and registration sequence number.
+     */
+    HAPPlatformTimer* _Nullable timers[kHAPPlatformRunLoop_MaxTimers];
+
+    /**
+     * Number of timers in the timer heap.
+     */
+    size_t numTimers;
+
+    /**
+     * Sequence number of the next registered timer.
+     */
+    uint64_t nextTimerSequenceNumber;
+
+    /**
+     * Loopback file descriptor to receive wakeup datagrams.
      */
     volatile int loopbackFileDescriptor;
 
     /**
-     * Self-pipe byte buffer.
+     * Loopback file descriptor to send wakeup datagrams. Connected to the receiving loopback socket.
+     */
+    volatile int loopbackSendFileDescriptor;
+
+    /**
+     * Lock protecting the scheduled callback queue. May be taken from any task.
+     */
+    portMUX_TYPE scheduledCallbacksLock;
+
+    /**
+     * Ring of scheduled callbacks, filled by HAPPlatformRunLoopScheduleCallback.
+     *
+     * - Each callback occupies one aligned slot: a HAPPlatformRunLoopCallbackSlot header followed by the context.
+     *   Contexts are passed to the callbacks in place.
      *
-     * - Callbacks are serialized into the buffer as:
-     *   - 8-byte aligned callback pointer.
-     *   - Context size (up to UINT8_MAX).
-     *   - Context (unaligned). When invoking the callback, the context is first moved to be 8-byte aligned.
+     * - Slots never wrap around the end of the ring. If a slot does not fit, a header with a NULL callback marks
+     *   the remainder of the ring as unused and the slot is stored at offset 0.
+     *
+     * - The ring is rewound to offset 0 whenever it is empty, so the largest slot always fits into an empty ring.
      */
     HAP_ALIGNAS(8)
-    char loopbackBytes[sizeof(HAPPlatformRunLoopCallback) + 1 + UINT8_MAX];
+    uint8_t callbackBytes[kHAPPlatformRunLoop_CallbackQueueSize];
 
     /**
-     * Number of bytes in self-pipe byte buffer.
+     * Offset of the next slot to write.
      */
-    size_t numLoopbackBytes;
+    size_t callbackBytesHead;
+
+    /**
+     * Offset of the next slot to dispatch. Only advanced by the run loop. Reset to 0 while the ring is empty.
+     */
+    size_t callbackBytesTail;
+
+    /**
+     * Number of bytes in use in the scheduled callback ring, including unused space at the end of a lap.
+     */
+    size_t numCallbackBytes;
+
+    /**
+     * Whether a wakeup datagram has been sent since the run loop last started draining the scheduled callback ring.
+     *
+     * - Only the first callback scheduled after that wakes up the run loop.
+     */
+    bool isLoopbackWakeupPending;
+
+    /**
+     * Whether sending a wakeup datagram failed since the run loop last started draining the scheduled callback ring.
+     *
+     * - The run loop checks this on every select return and then drains the ring without a wakeup datagram.
+     * - Until then, wakeupRetryTimer sends the wakeup datagram again.
+     */
+    bool isLoopbackWakeupFailed;
+
+    /**
+     * Timer that sends the wakeup datagram again after sending it failed.
+     *
+     * - Runs on the esp_timer task, so it also unblocks a run loop that is already waiting in `select`.
+     */
+    esp_timer_handle_t _Nullable wakeupRetryTimer;
 
     /**
      * File handle for self-pipe.
      */
     HAPPlatformFileHandleRef loopbackFileHandle;
 
+#if CONFIG_HAP_RUN_LOOP_PM
+    /**
+     * Power management lock that is held while the run loop dispatches callbacks.
+     */
+    esp_pm_lock_handle_t _Nullable pmLock;
+#endif
+
+    /**
+     * Time, in microseconds, spent waiting in `select`, i.e. with the chip allowed to sleep.
+     */
+    int64_t idleTime;
+
+    /**
+     * Time, in microseconds, spent dispatching callbacks.
+     */
+    int64_t activeTime;
+
+    /**
+     * Number of times the run loop woke up from `select`.
+     */
+    uint32_t numWakeups;
+
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+    /**
+     * Dispatch statistics.
+     */
+    HAPPlatformRunLoopStatistics statistics;
+#endif
+
+    /**
+     * Number of callbacks in the scheduled callback ring.
+     */
+    size_t numCallbacks;
+
     /**
      * Current run loop state.
      */
     HAPPlatformRunLoopState state;
-} runLoop = { .fileHandleSentinel = { .fileDescriptor = -1,
-                                      .interests = { .isReadyForReading = false,
-                                                     .isReadyForWriting = false,
-                                                     .hasErrorConditionPending = false },
-                                      .callback = NULL,
-                                      .context = NULL,
-                                      .prevFileHandle = &runLoop.fileHandleSentinel,
-                                      .nextFileHandle = &runLoop.fileHandleSentinel,
-                                      .isAwaitingEvents = false },
-              .fileHandles = &runLoop.fileHandleSentinel,
-              .fileHandleCursor = &runLoop.fileHandleSentinel,
-
-              .timers = NULL,
-
-              .loopbackFileDescriptor = -1 };
+} runLoop = { .maxFileDescriptor = -1,
+              .fileHandlePool = { .storage = fileHandleStorage,
+                                  .objectSize = sizeof fileHandleStorage[0],
+                                  .maxObjects = HAPArrayCount(fileHandleStorage) },
+              .timerPool = { .storage = timerStorage,
+                             .objectSize = sizeof timerStorage[0],
+                             .maxObjects = HAPArrayCount(timerStorage) },
+
+              .numTimers = 0,
+              .nextTimerSequenceNumber = 0,
+
+              .loopbackFileDescriptor = -1,
+              .loopbackSendFileDescriptor = -1,
+              .scheduledCallbacksLock = portMUX_INITIALIZER_UNLOCKED };
+
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+/**
+ * Adds a sample to a histogram.
+ *
+ * @param      histogram            Histogram.
+ * @param      value                Sample.
+ */
+static void RecordHistogramSample(HAPPlatformRunLoopHistogram* histogram, int64_t value) {
+    HAPPrecondition(histogram);
+
+    uint32_t sample = value <= 0 ? 0 : value >= UINT32_MAX ? UINT32_MAX : (uint32_t) value;
+    size_t bucket = sample ? (size_t)(32 - __builtin_clz(sample)) : 0;
+    if (bucket >= HAPArrayCount(histogram->buckets)) {
+        bucket = HAPArrayCount(histogram->buckets) - 1;
+    }
+    histogram->buckets[bucket]++;
+    histogram->numSamples++;
+    histogram->sum += sample;
+    if (sample > histogram->maxValue) {
+        histogram->maxValue = sample;
+    }
+}
+#endif
+
+HAP_RESULT_USE_CHECK
+uint32_t HAPPlatformRunLoopHistogramGetPercentile(const HAPPlatformRunLoopHistogram* histogram, unsigned int percentile) {
+    HAPPrecondition(histogram);
+    HAPPrecondition(percentile <= 100);
+
+    uint64_t threshold = ((uint64_t) histogram->numSamples * percentile + 99) / 100;
+    uint64_t numSamples = 0;
+    for (size_t i = 0; i < HAPArrayCount(histogram->buckets); i++) {
+        numSamples += histogram->buckets[i];
+        if (numSamples && numSamples >= threshold) {
+            uint32_t upperBound = i ? (i < 32 ? (uint32_t)((1ull << i) - 1) : UINT32_MAX) : 0;
+            return upperBound < histogram->maxValue ? upperBound : histogram->maxValue;
+        }
+    }
+    return histogram->maxValue;
+}
+
+void HAPPlatformRunLoopGetStatistics(HAPPlatformRunLoopStatistics* statistics) {
+    HAPPrecondition(statistics);
+
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+    *statistics = runLoop.statistics;
+#else
+    HAPRawBufferZero(statistics, sizeof *statistics);
+#endif
+}
+
+void HAPPlatformRunLoopResetStatistics(void) {
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+    HAPRawBufferZero(&runLoop.statistics, sizeof runLoop.statistics);
+#endif
+}
+
+/**
+ * Updates the file descriptor sets for a file handle.
+ *
+ * @param      fileDescriptor       Platform-specific file descriptor.
+ * @param      interests            Set of file handle events on which the callback shall be invoked.
+ */
+static void UpdateFileDescriptorSets(int fileDescriptor, HAPPlatformFileHandleEvent interests) {
+    HAPPrecondition(fileDescriptor >= 0);
+    HAPPrecondition(fileDescriptor < FD_SETSIZE);
+
+    if (interests.isReadyForReading) {
+        FD_SET(fileDescriptor, &runLoop.readFileDescriptors);
+    } else {
+        FD_CLR(fileDescriptor, &runLoop.readFileDescriptors);
+    }
+    if (interests.isReadyForWriting) {
+        FD_SET(fileDescriptor, &runLoop.writeFileDescriptors);
+    } else {
+        FD_CLR(fileDescriptor, &runLoop.writeFileDescriptors);
+    }
+    if (interests.hasErrorConditionPending) {
+        FD_SET(fileDescriptor, &runLoop.errorFileDescriptors);
+    } else {
+        FD_CLR(fileDescriptor, &runLoop.errorFileDescriptors);
+    }
+
+    bool hasInterests = interests.isReadyForReading || interests.isReadyForWriting ||
+                        interests.hasErrorConditionPending;
+    if (hasInterests && fileDescriptor > runLoop.maxFileDescriptor) {
+        runLoop.maxFileDescriptor = fileDescriptor;
+    } else if (!hasInterests && fileDescriptor == runLoop.maxFileDescriptor) {
+        // Find next lower file descriptor that is in any of the sets.
+        do {
+            runLoop.maxFileDescriptor--;
+        } while (runLoop.maxFileDescriptor >= 0 &&
+                 !FD_ISSET(runLoop.maxFileDescriptor, &runLoop.readFileDescriptors) &&
+                 !FD_ISSET(runLoop.maxFileDescriptor, &runLoop.writeFileDescriptors) &&
+                 !FD_ISSET(runLoop.maxFileDescriptor, &runLoop.errorFileDescriptors));
+    }
+}
 
 HAP_RESULT_USE_CHECK
 HAPError HAPPlatformFileHandleRegister(
@@ -212,11 +610,16 @@ HAPError HAPPlatformFileHandleRegister(
         HAPPlatformFileHandleCallback callback,
         void* _Nullable context) {
     HAPPrecondition(fileHandle_);
+    HAPPrecondition(fileDescriptor >= 0);
+    HAPPrecondition(fileDescriptor < FD_SETSIZE);
+    HAPPrecondition(!runLoop.fileHandles[fileDescriptor]);
 
     // Prepare fileHandle.
-    HAPPlatformFileHandle* fileHandle = calloc(1, sizeof(HAPPlatformFileHandle));
+    HAPPlatformFileHandle* fileHandle = PoolAllocate(&runLoop.fileHandlePool);
     if (!fileHandle) {
-        HAPLog(&logObject, "Cannot allocate more file handles.");
+        HAPLog(&logObject,
+               "Cannot allocate more file handles (%lu in use).",
+               (unsigned long) runLoop.fileHandlePool.numObjects);
         *fileHandle_ = 0;
         return kHAPError_OutOfResources;
     }
@@ -224,11 +627,9 @@ HAPError HAPPlatformFileHandleRegister(
     fileHandle->interests = interests;
     fileHandle->callback = callback;
     fileHandle->context = context;
-    fileHandle->prevFileHandle = runLoop.fileHandles->prevFileHandle;
-    fileHandle->nextFileHandle = runLoop.fileHandles;
-    fileHandle->isAwaitingEvents = false;
-    runLoop.fileHandles->prevFileHandle->nextFileHandle = fileHandle;
-    runLoop.fileHandles->prevFileHandle = fileHandle;
+    fileHandle->registrationIteration = runLoop.numSelectIterations;
+    runLoop.fileHandles[fileDescriptor] = fileHandle;
+    UpdateFileDescriptorSets(fileDescriptor, interests);
 
     *fileHandle_ = (HAPPlatformFileHandleRef) fileHandle;
     return kHAPError_None;
@@ -241,7 +642,13 @@ void HAPPlatformFileHandleUpdateInterests(
         void* _Nullable context) {
     HAPPrecondition(fileHandle_);
     HAPPlatformFileHandle* fileHandle = (HAPPlatformFileHandle * _Nonnull) fileHandle_;
+    HAPPrecondition(runLoop.fileHandles[fileHandle->fileDescriptor] == fileHandle);
 
+    if (fileHandle->interests.isReadyForReading != interests.isReadyForReading ||
+        fileHandle->interests.isReadyForWriting != interests.isReadyForWriting ||
+        fileHandle->interests.hasErrorConditionPending != interests.hasErrorConditionPending) {
+        UpdateFileDescriptorSets(fileHandle->fileDescriptor, interests);
+    }
     fileHandle->interests = interests;
     fileHandle->callback = callback;
     fileHandle->context = context;
@@ -250,16 +657,15 @@ void HAPPlatformFileHandleUpdateInterests(
 void HAPPlatformFileHandleDeregister(HAPPlatformFileHandleRef fileHandle_) {
     HAPPrecondition(fileHandle_);
     HAPPlatformFileHandle* fileHandle = (HAPPlatformFileHandle * _Nonnull) fileHandle_;
+    HAPPrecondition(fileHandle->fileDescriptor >= 0);
+    HAPPrecondition(fileHandle->fileDescriptor < FD_SETSIZE);
+    HAPPrecondition(runLoop.fileHandles[fileHandle->fileDescriptor] == fileHandle);
 
-    HAPPrecondition(fileHandle->prevFileHandle);
-    HAPPrecondition(fileHandle->nextFileHandle);
-
-    if (fileHandle == runLoop.fileHandleCursor) {
-        runLoop.fileHandleCursor = fileHandle->nextFileHandle;
-    }
-
-    fileHandle->prevFileHandle->nextFileHandle = fileHandle->nextFileHandle;
-    fileHandle->nextFileHandle->prevFileHandle = fileHandle->prevFileHandle;
+    UpdateFileDescriptorSets(
+            fileHandle->fileDescriptor,
+            (HAPPlatformFileHandleEvent) {
+                    .isReadyForReading = false, .isReadyForWriting = false, .hasErrorConditionPending = false });
+    runLoop.fileHandles[fileHandle->fileDescriptor] = NULL;
 
     fileHandle->fileDescriptor = -1;
     fileHandle->interests.isReadyForReading = false;
@@ -267,50 +673,190 @@ void HAPPlatformFileHandleDeregister(HAPPlatformFileHandleRef fileHandle_) {
     fileHandle->interests.hasErrorConditionPending = false;
     fileHandle->callback = NULL;
     fileHandle->context = NULL;
-    fileHandle->nextFileHandle = NULL;
-    fileHandle->prevFileHandle = NULL;
-    fileHandle->isAwaitingEvents = false;
-    HAPPlatformFreeSafe(fileHandle);
+    PoolFree(&runLoop.fileHandlePool, fileHandle);
 }
 
 static void ProcessSelectedFileHandles(
         fd_set* readFileDescriptors,
         fd_set* writeFileDescriptors,
-        fd_set* errorFileDescriptors) {
+        fd_set* errorFileDescriptors,
+        int maxFileDescriptor) {
     HAPPrecondition(readFileDescriptors);
     HAPPrecondition(writeFileDescriptors);
     HAPPrecondition(errorFileDescriptors);
+    HAPPrecondition(maxFileDescriptor < FD_SETSIZE);
+
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+    bool hasFileHandleEvents = false;
+#endif
+
+    // Only file descriptors that `select` reported ready are looked up.
+    // File handles are looked up again for every file descriptor to handle reentrant registrations and removals.
+    for (int fileDescriptor = 0; fileDescriptor <= maxFileDescriptor; fileDescriptor++) {
+        bool isReadyForReading = FD_ISSET(fileDescriptor, readFileDescriptors);
+        bool isReadyForWriting = FD_ISSET(fileDescriptor, writeFileDescriptors);
+        bool hasErrorConditionPending = FD_ISSET(fileDescriptor, errorFileDescriptors);
+        if (!isReadyForReading && !isReadyForWriting && !hasErrorConditionPending) {
+            continue;
+        }
+
+        HAPPlatformFileHandle* _Nullable fileHandle = runLoop.fileHandles[fileDescriptor];
+        if (!fileHandle || fileHandle->registrationIteration == runLoop.numSelectIterations ||
+            !fileHandle->callback) {
+            continue;
+        }
 
-    runLoop.fileHandleCursor = runLoop.fileHandles->nextFileHandle;
-    while (runLoop.fileHandleCursor != runLoop.fileHandles) {
-        HAPPlatformFileHandle* fileHandle = runLoop.fileHandleCursor;
-        runLoop.fileHandleCursor = fileHandle->nextFileHandle;
-
-        if (fileHandle->isAwaitingEvents) {
-            HAPAssert(fileHandle->fileDescriptor != -1);
-            fileHandle->isAwaitingEvents = false;
-            if (fileHandle->callback) {
-                HAPPlatformFileHandleEvent fileHandleEvents;
-                fileHandleEvents.isReadyForReading = fileHandle->interests.isReadyForReading &&
-                                                     FD_ISSET(fileHandle->fileDescriptor, readFileDescriptors);
-                fileHandleEvents.isReadyForWriting = fileHandle->interests.isReadyForWriting &&
-                                                     FD_ISSET(fileHandle->fileDescriptor, writeFileDescriptors);
-                fileHandleEvents.hasErrorConditionPending = fileHandle->interests.hasErrorConditionPending &&
-                                                            FD_ISSET(fileHandle->fileDescriptor, errorFileDescriptors);
-
-                if (fileHandleEvents.isReadyForReading || fileHandleEvents.isReadyForWriting ||
-                    fileHandleEvents.hasErrorConditionPending) {
-                    fileHandle->callback((HAPPlatformFileHandleRef) fileHandle, fileHandleEvents, fileHandle->context);
-                }
+        HAPPlatformFileHandleEvent fileHandleEvents;
+        fileHandleEvents.isReadyForReading = fileHandle->interests.isReadyForReading && isReadyForReading;
+        fileHandleEvents.isReadyForWriting = fileHandle->interests.isReadyForWriting && isReadyForWriting;
+        fileHandleEvents.hasErrorConditionPending =
+                fileHandle->interests.hasErrorConditionPending && hasErrorConditionPending;
+
+        if (fileHandleEvents.isReadyForReading || fileHandleEvents.isReadyForWriting ||
+            fileHandleEvents.hasErrorConditionPending) {
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+            bool isLoopback = (HAPPlatformFileHandleRef) fileHandle == runLoop.loopbackFileHandle;
+            if (!isLoopback && !hasFileHandleEvents) {
+                runLoop.statistics.numFileHandleWakeups++;
+            }
+            hasFileHandleEvents = hasFileHandleEvents || !isLoopback;
+            int64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
+            fileHandle->callback((HAPPlatformFileHandleRef) fileHandle, fileHandleEvents, fileHandle->context);
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+            if (!isLoopback) {
+                RecordHistogramSample(
+                        &runLoop.statistics.fileHandleCallbackDuration, HAPPlatformClockGetCurrentMicroseconds() - startTime);
             }
+#endif
         }
     }
 }
 
+/**
+ * Returns whether a timer expires before another timer.
+ *
+ * - Timers with the same deadline expire in order of registration.
+ *
+ * @param      timer                Timer.
+ * @param      otherTimer           Other timer.
+ *
+ * @return true                     If timer expires before the other timer.
+ * @return false                    Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static bool IsTimerEarlier(const HAPPlatformTimer* timer, const HAPPlatformTimer* otherTimer) {
+    HAPPrecondition(timer);
+    HAPPrecondition(otherTimer);
+
+    if (timer->deadline != otherTimer->deadline) {
+        return timer->deadline < otherTimer->deadline;
+    }
+    return timer->sequenceNumber < otherTimer->sequenceNumber;
+}
+
+/**
+ * Stores a timer at a given position in the timer heap.
+ *
+ * @param      timer                Timer.
+ * @param      heapIndex            Position in the timer heap.
+ */
+static void PlaceTimer(HAPPlatformTimer* timer, size_t heapIndex) {
+    HAPPrecondition(timer);
+    HAPPrecondition(heapIndex < runLoop.numTimers);
+
+    runLoop.timers[heapIndex] = timer;
+    timer->heapIndex = heapIndex;
+}
+
+/**
+ * Moves a timer towards the root of the timer heap until the heap order is restored.
+ *
+ * @param      heapIndex            Position of the timer in the timer heap.
+ */
+static void SiftTimerUp(size_t heapIndex) {
+    HAPPrecondition(heapIndex < runLoop.numTimers);
+
+    HAPPlatformTimer* timer = runLoop.timers[heapIndex];
+    while (heapIndex) {
+        size_t parentIndex = (heapIndex - 1) / 2;
+        HAPPlatformTimer* parentTimer = runLoop.timers[parentIndex];
+        if (!IsTimerEarlier(timer, parentTimer)) {
+            break;
+        }
+        PlaceTimer(parentTimer, heapIndex);
+        heapIndex = parentIndex;
+    }
+    PlaceTimer(timer, heapIndex);
+}
+
+/**
+ * Moves a timer towards the leaves of the timer heap until the heap order is restored.
+ *
+ * @param      heapIndex            Position of the timer in the timer heap.
+ */
+static void SiftTimerDown(size_t heapIndex) {
+    HAPPrecondition(heapIndex < runLoop.numTimers);
+
+    HAPPlatformTimer* timer = runLoop.timers[heapIndex];
+    for (;;) {
+        size_t childIndex = 2 * heapIndex + 1;
+        if (childIndex >= runLoop.numTimers) {
+            break;
+        }
+        if (childIndex + 1 < runLoop.numTimers &&
+            IsTimerEarlier(runLoop.timers[childIndex + 1], runLoop.timers[childIndex])) {
+            childIndex++;
+        }
+        HAPPlatformTimer* childTimer = runLoop.timers[childIndex];
+        if (!IsTimerEarlier(childTimer, timer)) {
+            break;
+        }
+        PlaceTimer(childTimer, heapIndex);
+        heapIndex = childIndex;
+    }
+    PlaceTimer(timer, heapIndex);
+}
+
+/**
+ * Removes a timer from the timer heap.
+ *
+ * @param      timer                Timer.
+ */
+static void RemoveTimer(HAPPlatformTimer* timer) {
+    HAPPrecondition(timer);
+    HAPPrecondition(timer->heapIndex < runLoop.numTimers);
+    HAPPrecondition(runLoop.timers[timer->heapIndex] == timer);
+
+    size_t heapIndex = timer->heapIndex;
+    runLoop.numTimers--;
+    if (heapIndex == runLoop.numTimers) {
+        return;
+    }
+
+    // Fill the gap with the last timer and restore heap order.
+    PlaceTimer(runLoop.timers[runLoop.numTimers], heapIndex);
+    if (heapIndex && IsTimerEarlier(runLoop.timers[heapIndex], runLoop.timers[(heapIndex - 1) / 2])) {
+        SiftTimerUp(heapIndex);
+    } else {
+        SiftTimerDown(heapIndex);
+    }
+}
+
 HAP_RESULT_USE_CHECK
 HAPError HAPPlatformTimerRegister(
+        HAPPlatformTimerRef* timer,
+        HAPTime deadline,
+        HAPPlatformTimerCallback callback,
+        void* _Nullable context) {
+    return HAPPlatformTimerRegisterWithLeeway(timer, deadline, kHAPPlatformRunLoop_DefaultTimerLeeway, callback, context);
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformTimerRegisterWithLeeway(
         HAPPlatformTimerRef* timer_,
         HAPTime deadline,
+        HAPTime leeway,
         HAPPlatformTimerCallback callback,
         void* _Nullable context) {
     HAPPrecondition(timer_);
@@ -318,30 +864,22 @@ HAPError HAPPlatformTimerRegister(
     HAPPrecondition(callback);
 
     // Prepare timer.
-    *newTimer = calloc(1, sizeof(HAPPlatformTimer));
+    *newTimer = PoolAllocate(&runLoop.timerPool);
     if (!*newTimer) {
-        HAPLog(&logObject, "Cannot allocate more timers.");
+        HAPLog(&logObject, "Cannot allocate more timers (%lu in use).", (unsigned long) runLoop.numTimers);
         return kHAPError_OutOfResources;
     }
+    HAPAssert(runLoop.numTimers < HAPArrayCount(runLoop.timers));
     (*newTimer)->deadline = deadline ? deadline : 1;
+    (*newTimer)->sequenceNumber = runLoop.nextTimerSequenceNumber++;
+    (*newTimer)->leeway = leeway;
     (*newTimer)->callback = callback;
     (*newTimer)->context = context;
 
     // Insert timer.
-    for (HAPPlatformTimer* _Nullable* nextTimer = &runLoop.timers;; nextTimer = &(*nextTimer)->nextTimer) {
-        if (!*nextTimer) {
-            (*newTimer)->nextTimer = NULL;
-            *nextTimer = *newTimer;
-            break;
-        }
-        if ((*nextTimer)->deadline > deadline) {
-            // Search condition must be '>' and not '>=' to ensure that timers fire in ascending order of their
-            // deadlines and that timers registered with the same deadline fire in order of registration.
-            (*newTimer)->nextTimer = *nextTimer;
-            *nextTimer = *newTimer;
-            break;
-        }
-    }
+    runLoop.numTimers++;
+    PlaceTimer(HAPNonnull(*newTimer), runLoop.numTimers - 1);
+    SiftTimerUp(runLoop.numTimers - 1);
 
     return kHAPError_None;
 }
@@ -350,17 +888,59 @@ void HAPPlatformTimerDeregister(HAPPlatformTimerRef timer_) {
     HAPPrecondition(timer_);
     HAPPlatformTimer* timer = (HAPPlatformTimer*) timer_;
 
-    // Find and remove timer.
-    for (HAPPlatformTimer* _Nullable* nextTimer = &runLoop.timers; *nextTimer; nextTimer = &(*nextTimer)->nextTimer) {
-        if (*nextTimer == timer) {
-            *nextTimer = timer->nextTimer;
-            HAPPlatformFreeSafe(timer);
-            return;
-        }
+    // Check that timer is registered.
+    if (timer->heapIndex >= runLoop.numTimers || runLoop.timers[timer->heapIndex] != timer) {
+        HAPFatalError();
     }
 
-    // Timer not found.
-    HAPFatalError();
+    // Remove timer.
+    RemoveTimer(timer);
+    PoolFree(&runLoop.timerPool, timer);
+}
+
+/**
+ * Finds the earliest time by which a timer in a subtree of the timer heap must fire, taking leeway into account.
+ *
+ * - Subtrees whose root deadline is not earlier than the current result are skipped, as all their timers
+ *   may fire at the current result without exceeding their leeway.
+ *
+ * @param      heapIndex            Root of the subtree in the timer heap.
+ * @param[in,out] wakeTime          Earliest time by which a timer must fire.
+ */
+static void FindTimerWakeTime(size_t heapIndex, HAPTime* wakeTime) {
+    HAPPrecondition(wakeTime);
+
+    if (heapIndex >= runLoop.numTimers) {
+        return;
+    }
+    const HAPPlatformTimer* timer = runLoop.timers[heapIndex];
+    if (timer->deadline >= *wakeTime) {
+        return;
+    }
+    HAPTime latestFireTime = timer->leeway < *wakeTime - timer->deadline ? timer->deadline + timer->leeway : *wakeTime;
+    if (latestFireTime < *wakeTime) {
+        *wakeTime = latestFireTime;
+    }
+    FindTimerWakeTime(2 * heapIndex + 1, wakeTime);
+    FindTimerWakeTime(2 * heapIndex + 2, wakeTime);
+}
+
+/**
+ * Returns the time at which the run loop needs to wake up to process timers.
+ *
+ * - Timers are coalesced: once the run loop wakes up all timers with a deadline before that time fire together.
+ *
+ * @return Wake time, or 0 if no timers are registered.
+ */
+HAP_RESULT_USE_CHECK
+static HAPTime GetTimerWakeTime(void) {
+    if (!runLoop.numTimers) {
+        return 0;
+    }
+    HAPTime wakeTime = UINT64_MAX;
+    FindTimerWakeTime(0, &wakeTime);
+    HAPAssert(wakeTime >= runLoop.timers[0]->deadline);
+    return wakeTime;
 }
 
 static void ProcessExpiredTimers(void) {
@@ -368,20 +948,36 @@ static void ProcessExpiredTimers(void) {
     HAPTime now = HAPPlatformClockGetCurrent();
 
     // Enumerate timers.
-    while (runLoop.timers) {
-        if (runLoop.timers->deadline > now) {
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+    bool hasExpiredTimers = false;
+#endif
+    while (runLoop.numTimers) {
+        if (runLoop.timers[0]->deadline > now) {
             break;
         }
 
-        // Update head, so that reentrant add / removes do not interfere.
-        HAPPlatformTimer* expiredTimer = runLoop.timers;
-        runLoop.timers = runLoop.timers->nextTimer;
+        // Remove timer before invoking the callback, so that reentrant add / removes do not interfere.
+        HAPPlatformTimer* expiredTimer = runLoop.timers[0];
+        RemoveTimer(expiredTimer);
+
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+        if (!hasExpiredTimers) {
+            runLoop.statistics.numTimerWakeups++;
+            hasExpiredTimers = true;
+        }
+        RecordHistogramSample(&runLoop.statistics.timerLateness, (int64_t)(now - expiredTimer->deadline));
+        int64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
 
         // Invoke callback.
         expiredTimer->callback((HAPPlatformTimerRef) expiredTimer, expiredTimer->context);
 
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+        RecordHistogramSample(&runLoop.statistics.timerCallbackDuration, HAPPlatformClockGetCurrentMicroseconds() - startTime);
+#endif
+
         // Free memory.
-        HAPPlatformFreeSafe(expiredTimer);
+        PoolFree(&runLoop.timerPool, expiredTimer);
     }
 }
 
@@ -399,74 +995,175 @@ void CloseLoopback(int fileDescriptor)
     }
 }
 
-static void HandleLoopbackFileHandleCallback(
-    HAPPlatformFileHandleRef fileHandle,
-    HAPPlatformFileHandleEvent fileHandleEvents,
-    void *_Nullable context HAP_UNUSED)
-{
-    HAPAssert(fileHandle);
-    HAPAssert(fileHandle == runLoop.loopbackFileHandle);
-    HAPAssert(fileHandleEvents.isReadyForReading);
-
-    HAPAssert(runLoop.numLoopbackBytes < sizeof runLoop.loopbackBytes);
-    
+/**
+ * Sends a wakeup datagram to the run loop.
+ *
+ * - Must only be called after setting runLoop.isLoopbackWakeupPending.
+ * - On failure, sets runLoop.isLoopbackWakeupFailed and arms runLoop.wakeupRetryTimer to send it again.
+ */
+static void WakeUpRunLoop(void) {
+    const uint8_t wakeupByte = 0;
     ssize_t n;
     do {
-        n = recvfrom(runLoop.loopbackFileDescriptor,
-                &runLoop.loopbackBytes[runLoop.numLoopbackBytes],
-                sizeof runLoop.loopbackBytes - runLoop.numLoopbackBytes, 0, NULL, NULL);
+        n = send(runLoop.loopbackSendFileDescriptor, &wakeupByte, sizeof wakeupByte, 0);
     } while (n == -1 && errno == EINTR);
-    if (n == -1 && errno == EAGAIN) {
-        return;
-    }
-
-    if (n < 0) {
+    if (n == -1) {
         int _errno = errno;
-        HAPAssert(n == -1);
         HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "Loopback read failed.", _errno, __func__, HAP_FILE, __LINE__);
-        HAPFatalError();
+            "Loopback client socket failed to send data (log, call 'send').",
+            _errno, __func__, HAP_FILE, __LINE__);
+
+        // Callbacks stay queued. Send the wakeup again shortly, in case the run loop is already waiting in select.
+        portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+        runLoop.isLoopbackWakeupPending = false;
+        runLoop.isLoopbackWakeupFailed = true;
+        portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+
+        // ESP_ERR_INVALID_STATE if the timer is already running.
+        esp_err_t e =
+                esp_timer_start_once(HAPNonnull(runLoop.wakeupRetryTimer), kHAPPlatformRunLoop_WakeupRetryInterval);
+        if (e != ESP_OK && e != ESP_ERR_INVALID_STATE) {
+            HAPLogError(&logObject, "esp_timer_start_once failed: %d.", (int) e);
+        }
     }
-    if (n == 0) {
-        HAPLogError(&logObject, "Loopback socket read returned no data.");
-        HAPFatalError();
+}
+
+/**
+ * Sends the wakeup datagram again if sending it failed and the run loop has not drained the ring since.
+ *
+ * - Runs on the esp_timer task.
+ */
+static void HandleWakeupRetryTimerExpired(void* _Nullable arg HAP_UNUSED) {
+    bool needsWakeup = false;
+    portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+    if (runLoop.isLoopbackWakeupFailed && !runLoop.isLoopbackWakeupPending) {
+        runLoop.isLoopbackWakeupPending = true;
+        needsWakeup = true;
+    }
+    portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+    if (needsWakeup) {
+        WakeUpRunLoop();
     }
+}
 
-    HAPAssert((size_t) n <= sizeof runLoop.loopbackBytes - runLoop.numLoopbackBytes);
-    runLoop.numLoopbackBytes += (size_t) n;
-    for (;;) {
-        if (runLoop.numLoopbackBytes < sizeof (HAPPlatformRunLoopCallback) + 1) {
-            break;
-        }
-        size_t contextSize = (size_t) runLoop.loopbackBytes[sizeof (HAPPlatformRunLoopCallback)];
-        if (runLoop.numLoopbackBytes < sizeof (HAPPlatformRunLoopCallback) + 1 + contextSize) {
+/**
+ * Dispatches a batch of callbacks from the scheduled callback ring.
+ */
+static void ProcessScheduledCallbacks(void) {
+    // Snapshot the batch of scheduled callbacks to dispatch.
+    // Callbacks that are scheduled while dispatching send a new wakeup and are dispatched on the next iteration.
+    portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+    size_t numPendingBytes = runLoop.numCallbackBytes;
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+    size_t numPendingCallbacks = runLoop.numCallbacks;
+#endif
+    runLoop.isLoopbackWakeupPending = false;
+    runLoop.isLoopbackWakeupFailed = false;
+    portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+    if (numPendingCallbacks) {
+        runLoop.statistics.numLoopbackWakeups++;
+        RecordHistogramSample(&runLoop.statistics.loopbackQueueDepth, (int64_t) numPendingCallbacks);
+    }
+#endif
+
+    // Issue memory barrier to ensure visibility of data referenced by callback context.
+    __sync_synchronize();
+
+    size_t numDispatchedCallbacks = 0;
+    while (numPendingBytes) {
+        if (numDispatchedCallbacks == kHAPPlatformRunLoop_MaxCallbacksPerIteration) {
+            // Let timers and other file handles run. Make sure the run loop wakes up again for the remainder.
+            bool needsWakeup = false;
+            portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+            if (!runLoop.isLoopbackWakeupPending) {
+                runLoop.isLoopbackWakeupPending = true;
+                needsWakeup = true;
+            }
+            portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+            if (needsWakeup) {
+                WakeUpRunLoop();
+            }
             break;
         }
 
-        HAPPlatformRunLoopCallback callback;
-        HAPRawBufferCopyBytes(
-            &callback,
-            &runLoop.loopbackBytes[0],
-            sizeof (HAPPlatformRunLoopCallback));
-        HAPRawBufferCopyBytes(
-            &runLoop.loopbackBytes[0],
-            &runLoop.loopbackBytes[sizeof (HAPPlatformRunLoopCallback) + 1],
-            runLoop.numLoopbackBytes - (sizeof (HAPPlatformRunLoopCallback) + 1));
-        runLoop.numLoopbackBytes -= (sizeof (HAPPlatformRunLoopCallback) + 1);
+        size_t tail = runLoop.callbackBytesTail;
+        HAPAssert(!(tail % kHAPPlatformRunLoop_CallbackSlotAlignment));
+        HAPAssert(tail < sizeof runLoop.callbackBytes);
+        const HAPPlatformRunLoopCallbackSlot* slot = (const HAPPlatformRunLoopCallbackSlot*) &runLoop.callbackBytes[tail];
+
+        size_t numSlotBytes;
+        if (!slot->callback) {
+            // Remainder of the ring is unused. Continue at offset 0.
+            numSlotBytes = sizeof runLoop.callbackBytes - tail;
+        } else {
+            HAPPlatformRunLoopCallback callback = slot->callback;
+            size_t contextSize = slot->numContextBytes;
+            numSlotBytes = GetCallbackSlotSize(contextSize);
+            HAPAssert(numSlotBytes <= sizeof runLoop.callbackBytes - tail);
+
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+            int64_t startTime = HAPPlatformClockGetCurrentMicroseconds();
+#endif
+            // The slot stays allocated while the callback runs, so the context may be passed in place.
+            callback(
+                contextSize ? &runLoop.callbackBytes[tail + GetCallbackSlotSize(0)] : NULL,
+                contextSize);
+            numDispatchedCallbacks++;
+#if CONFIG_HAP_RUN_LOOP_STATISTICS
+            RecordHistogramSample(&runLoop.statistics.scheduledCallbackDuration, HAPPlatformClockGetCurrentMicroseconds() - startTime);
+#endif
+        }
 
-        // Issue memory barrier to ensure visibility of data referenced by callback context.
-        __sync_synchronize();
+        HAPAssert(numSlotBytes <= numPendingBytes);
+        numPendingBytes -= numSlotBytes;
+        portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+        if (slot->callback) {
+            HAPAssert(runLoop.numCallbacks);
+            runLoop.numCallbacks--;
+        }
+        runLoop.numCallbackBytes -= numSlotBytes;
+        if (!runLoop.numCallbackBytes) {
+            // Rewind the empty ring, so that the next slot does not have to skip the end of the ring.
+            runLoop.callbackBytesHead = 0;
+            runLoop.callbackBytesTail = 0;
+        } else {
+            runLoop.callbackBytesTail = (tail + numSlotBytes) % sizeof runLoop.callbackBytes;
+        }
+        portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+    }
+}
 
-        callback(
-            contextSize ? &runLoop.loopbackBytes[0] : NULL,
-            contextSize);
+static void HandleLoopbackFileHandleCallback(
+    HAPPlatformFileHandleRef fileHandle,
+    HAPPlatformFileHandleEvent fileHandleEvents,
+    void *_Nullable context HAP_UNUSED)
+{
+    HAPAssert(fileHandle);
+    HAPAssert(fileHandle == runLoop.loopbackFileHandle);
+    HAPAssert(fileHandleEvents.isReadyForReading);
 
-        HAPRawBufferCopyBytes(
-            &runLoop.loopbackBytes[0],
-            &runLoop.loopbackBytes[contextSize],
-            runLoop.numLoopbackBytes - contextSize);
-        runLoop.numLoopbackBytes -= contextSize;
+    // Consume wakeup datagrams. Their content is irrelevant, the callbacks are in the scheduled callback ring.
+    for (;;) {
+        uint8_t wakeupBytes[16];
+        ssize_t n;
+        do {
+            n = recvfrom(runLoop.loopbackFileDescriptor, wakeupBytes, sizeof wakeupBytes, 0, NULL, NULL);
+        } while (n == -1 && errno == EINTR);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n < 0) {
+            int _errno = errno;
+            HAPAssert(n == -1);
+            HAPPlatformLogPOSIXError(kHAPLogType_Error,
+                "Loopback read failed.", _errno, __func__, HAP_FILE, __LINE__);
+            HAPFatalError();
+        }
     }
+
+    ProcessScheduledCallbacks();
 }
 
 void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
@@ -477,6 +1174,16 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
     HAPLogDebug(&logObject, "Storage configuration: runLoop = %lu", (unsigned long) sizeof runLoop);
     HAPLogDebug(&logObject, "Storage configuration: fileHandle = %lu", (unsigned long) sizeof(HAPPlatformFileHandle));
     HAPLogDebug(&logObject, "Storage configuration: timer = %lu", (unsigned long) sizeof(HAPPlatformTimer));
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: fileHandlePool = %lu / %lu",
+            (unsigned long) runLoop.fileHandlePool.numObjects,
+            (unsigned long) runLoop.fileHandlePool.maxObjects);
+    HAPLogDebug(
+            &logObject,
+            "Storage configuration: timerPool = %lu / %lu",
+            (unsigned long) runLoop.timerPool.numObjects,
+            (unsigned long) runLoop.timerPool.maxObjects);
 
     // Open loop back
 
@@ -513,6 +1220,34 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
 
     runLoop.loopbackFileDescriptor = fileDescriptor;
 
+    // Open persistent send side of loop back. It is shared by all tasks scheduling callbacks.
+    HAPPrecondition(runLoop.loopbackSendFileDescriptor == -1);
+    fileDescriptor = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fileDescriptor < 0) {
+        int _errno = errno;
+        HAPPlatformLogPOSIXError(kHAPLogType_Error,
+            "Loopback client socket failed (log, call 'socket').",
+            _errno, __func__, HAP_FILE, __LINE__);
+        HAPFatalError();
+    }
+    e = fcntl(fileDescriptor, F_SETFL, O_NONBLOCK);
+    if (e == -1) {
+        HAPPlatformLogPOSIXError(kHAPLogType_Error,
+            "System call 'fcntl' to set loopback send file descriptor flags to 'non-blocking' failed.",
+            errno, __func__, HAP_FILE, __LINE__);
+        HAPFatalError();
+    }
+    if (connect(fileDescriptor, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int _errno = errno;
+        CloseLoopback(fileDescriptor);
+        HAPPlatformLogPOSIXError(kHAPLogType_Error,
+            "Loopback client socket connect failed (log, call 'connect').",
+            _errno, __func__, HAP_FILE, __LINE__);
+        HAPFatalError();
+    }
+
+    runLoop.loopbackSendFileDescriptor = fileDescriptor;
+
     err = HAPPlatformFileHandleRegister(&runLoop.loopbackFileHandle,
         runLoop.loopbackFileDescriptor,
         (HAPPlatformFileHandleEvent) {
@@ -528,6 +1263,26 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
     }
     HAPAssert(runLoop.loopbackFileHandle);
 
+    HAPPrecondition(!runLoop.wakeupRetryTimer);
+    esp_err_t timerErr = esp_timer_create(
+            &(const esp_timer_create_args_t) { .callback = HandleWakeupRetryTimerExpired,
+                                               .dispatch_method = ESP_TIMER_TASK,
+                                               .name = "hap_run_loop_wakeup" },
+            &runLoop.wakeupRetryTimer);
+    if (timerErr != ESP_OK) {
+        HAPLogError(&logObject, "esp_timer_create failed: %d.", (int) timerErr);
+        HAPFatalError();
+    }
+
+#if CONFIG_HAP_RUN_LOOP_PM
+    HAPPrecondition(!runLoop.pmLock);
+    esp_err_t pmErr = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "hap_run_loop", &runLoop.pmLock);
+    if (pmErr != ESP_OK) {
+        HAPLogError(&logObject, "esp_pm_lock_create failed: %d.", (int) pmErr);
+        HAPFatalError();
+    }
+#endif
+
     runLoop.state = kHAPPlatformRunLoopState_Idle;
     
     // Issue memory barrier to ensure visibility of write to runLoop.selfPipeFileDescriptor1 on other threads.
@@ -535,76 +1290,154 @@ void HAPPlatformRunLoopCreate(const HAPPlatformRunLoopOptions* options) {
 }
 
 void HAPPlatformRunLoopRelease(void) {
+    HAPLogDebug(
+            &logObject,
+            "File handle pool high-water mark: %lu / %lu.",
+            (unsigned long) runLoop.fileHandlePool.maxUsedObjects,
+            (unsigned long) runLoop.fileHandlePool.maxObjects);
+    HAPLogDebug(
+            &logObject,
+            "Timer pool high-water mark: %lu / %lu.",
+            (unsigned long) runLoop.timerPool.maxUsedObjects,
+            (unsigned long) runLoop.timerPool.maxObjects);
+
+    if (runLoop.wakeupRetryTimer) {
+        // ESP_ERR_INVALID_STATE if the timer is not running.
+        (void) esp_timer_stop(runLoop.wakeupRetryTimer);
+        esp_timer_delete(runLoop.wakeupRetryTimer);
+        runLoop.wakeupRetryTimer = NULL;
+    }
+
+    CloseLoopback(runLoop.loopbackSendFileDescriptor);
     CloseLoopback(runLoop.loopbackFileDescriptor);
 
+    runLoop.loopbackSendFileDescriptor = -1;
     runLoop.loopbackFileDescriptor = -1;
 
+    portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+    runLoop.callbackBytesHead = 0;
+    runLoop.callbackBytesTail = 0;
+    runLoop.numCallbackBytes = 0;
+    runLoop.numCallbacks = 0;
+    runLoop.isLoopbackWakeupPending = false;
+    runLoop.isLoopbackWakeupFailed = false;
+    portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+
     if (runLoop.loopbackFileHandle) {
         HAPPlatformFileHandleDeregister(runLoop.loopbackFileHandle);
         runLoop.loopbackFileHandle = 0;
     }
 
+#if CONFIG_HAP_RUN_LOOP_PM
+    if (runLoop.pmLock) {
+        esp_pm_lock_delete(runLoop.pmLock);
+        runLoop.pmLock = NULL;
+    }
+#endif
+
     runLoop.state = kHAPPlatformRunLoopState_Idle;
 
     // Issue memory barrier to ensure visibility of write to runLoop.loopbackFileDescriptor1 on other threads.
     __sync_synchronize();
 }
 
+/**
+ * Logs the power statistics of the run loop, if the reporting interval elapsed.
+ *
+ * @param      now                  Current time, in microseconds.
+ */
+static void ReportPowerStatistics(int64_t now) {
+#if CONFIG_HAP_RUN_LOOP_PM_REPORT_INTERVAL
+    static int64_t lastReportTime;
+    if (now - lastReportTime < (int64_t) CONFIG_HAP_RUN_LOOP_PM_REPORT_INTERVAL * 1000 * 1000) {
+        return;
+    }
+    lastReportTime = now;
+
+    HAPPlatformRunLoopPowerStatistics statistics;
+    HAPPlatformRunLoopGetPowerStatistics(&statistics);
+    int64_t totalTime = statistics.idleTime + statistics.activeTime;
+    HAPLogInfo(
+            &logObject,
+            "Power: idle %llu ms, active %llu ms (%u.%u%% idle), %lu wakeups.",
+            (unsigned long long) (statistics.idleTime / 1000),
+            (unsigned long long) (statistics.activeTime / 1000),
+            (unsigned int) (totalTime ? statistics.idleTime * 100 / totalTime : 0),
+            (unsigned int) (totalTime ? statistics.idleTime * 1000 / totalTime % 10 : 0),
+            (unsigned long) statistics.numWakeups);
+#else
+    (void) now;
+#endif
+}
+
+/**
+ * Logs a summary of the dispatch statistics of the run loop, if the reporting interval elapsed.
+ *
+ * @param      now                  Current time, in microseconds.
+ */
+static void ReportStatistics(int64_t now) {
+#if CONFIG_HAP_RUN_LOOP_STATISTICS && CONFIG_HAP_RUN_LOOP_STATISTICS_REPORT_INTERVAL
+    static int64_t lastReportTime;
+    if (now - lastReportTime < (int64_t) CONFIG_HAP_RUN_LOOP_STATISTICS_REPORT_INTERVAL * 1000 * 1000) {
+        return;
+    }
+    lastReportTime = now;
+
+    const HAPPlatformRunLoopStatistics* statistics = &runLoop.statistics;
+    HAPLogInfo(
+            &logObject,
+            "Statistics: wakeups timer %lu / fd %lu / loopback %lu. "
+            "fd callbacks %lu (p99 %lu us, max %lu us). "
+            "timers %lu (p99 %lu us, max %lu us, lateness p99 %lu ms, max %lu ms). "
+            "scheduled callbacks max %lu us, queue depth p99 %lu, max %lu.",
+            (unsigned long) statistics->numTimerWakeups,
+            (unsigned long) statistics->numFileHandleWakeups,
+            (unsigned long) statistics->numLoopbackWakeups,
+            (unsigned long) statistics->fileHandleCallbackDuration.numSamples,
+            (unsigned long) HAPPlatformRunLoopHistogramGetPercentile(&statistics->fileHandleCallbackDuration, 99),
+            (unsigned long) statistics->fileHandleCallbackDuration.maxValue,
+            (unsigned long) statistics->timerCallbackDuration.numSamples,
+            (unsigned long) HAPPlatformRunLoopHistogramGetPercentile(&statistics->timerCallbackDuration, 99),
+            (unsigned long) statistics->timerCallbackDuration.maxValue,
+            (unsigned long) HAPPlatformRunLoopHistogramGetPercentile(&statistics->timerLateness, 99),
+            (unsigned long) statistics->timerLateness.maxValue,
+            (unsigned long) statistics->scheduledCallbackDuration.maxValue,
+            (unsigned long) HAPPlatformRunLoopHistogramGetPercentile(&statistics->loopbackQueueDepth, 99),
+            (unsigned long) statistics->loopbackQueueDepth.maxValue);
+#else
+    (void) now;
+#endif
+}
+
+void HAPPlatformRunLoopGetPowerStatistics(HAPPlatformRunLoopPowerStatistics* statistics) {
+    HAPPrecondition(statistics);
+
+    statistics->idleTime = runLoop.idleTime;
+    statistics->activeTime = runLoop.activeTime;
+    statistics->numWakeups = runLoop.numWakeups;
+}
+
 void HAPPlatformRunLoopRun(void) {
     HAPPrecondition(runLoop.state == kHAPPlatformRunLoopState_Idle);
 
     HAPLogInfo(&logObject, "Entering run loop.");
     runLoop.state = kHAPPlatformRunLoopState_Running;
+#if CONFIG_HAP_RUN_LOOP_PM
+    HAPAssert(runLoop.pmLock);
+    esp_pm_lock_acquire(runLoop.pmLock);
+#endif
+    int64_t activeStartTime = HAPPlatformClockGetCurrentMicroseconds();
     do {
-        fd_set readFileDescriptors;
-        fd_set writeFileDescriptors;
-        fd_set errorFileDescriptors;
-
-        FD_ZERO(&readFileDescriptors);
-        FD_ZERO(&writeFileDescriptors);
-        FD_ZERO(&errorFileDescriptors);
-
-        int maxFileDescriptor = -1;
-
-        HAPPlatformFileHandle* fileHandle = runLoop.fileHandles->nextFileHandle;
-        while (fileHandle != runLoop.fileHandles) {
-            fileHandle->isAwaitingEvents = false;
-            if (fileHandle->fileDescriptor != -1) {
-                if (fileHandle->interests.isReadyForReading) {
-                    HAPAssert(fileHandle->fileDescriptor >= 0);
-                    HAPAssert(fileHandle->fileDescriptor < FD_SETSIZE);
-                    FD_SET(fileHandle->fileDescriptor, &readFileDescriptors);
-                    if (fileHandle->fileDescriptor > maxFileDescriptor) {
-                        maxFileDescriptor = fileHandle->fileDescriptor;
-                    }
-                    fileHandle->isAwaitingEvents = true;
-                }
-                if (fileHandle->interests.isReadyForWriting) {
-                    HAPAssert(fileHandle->fileDescriptor >= 0);
-                    HAPAssert(fileHandle->fileDescriptor < FD_SETSIZE);
-                    FD_SET(fileHandle->fileDescriptor, &writeFileDescriptors);
-                    if (fileHandle->fileDescriptor > maxFileDescriptor) {
-                        maxFileDescriptor = fileHandle->fileDescriptor;
-                    }
-                    fileHandle->isAwaitingEvents = true;
-                }
-                if (fileHandle->interests.hasErrorConditionPending) {
-                    HAPAssert(fileHandle->fileDescriptor >= 0);
-                    HAPAssert(fileHandle->fileDescriptor < FD_SETSIZE);
-                    FD_SET(fileHandle->fileDescriptor, &errorFileDescriptors);
-                    if (fileHandle->fileDescriptor > maxFileDescriptor) {
-                        maxFileDescriptor = fileHandle->fileDescriptor;
-                    }
-                    fileHandle->isAwaitingEvents = true;
-                }
-            }
-            fileHandle = fileHandle->nextFileHandle;
-        }
+        // Copy the cached file descriptor sets, as `select` overwrites them with the ready file descriptors.
+        fd_set readFileDescriptors = runLoop.readFileDescriptors;
+        fd_set writeFileDescriptors = runLoop.writeFileDescriptors;
+        fd_set errorFileDescriptors = runLoop.errorFileDescriptors;
+        int maxFileDescriptor = runLoop.maxFileDescriptor;
 
         struct timeval timeoutValue;
         struct timeval* timeout = NULL;
 
-        HAPTime nextDeadline = runLoop.timers ? runLoop.timers->deadline : 0;
+        HAPTime nextDeadline = GetTimerWakeTime();
         if (nextDeadline) {
             HAPTime now = HAPPlatformClockGetCurrent();
             HAPTime delta;
@@ -619,11 +1452,34 @@ void HAPPlatformRunLoopRun(void) {
             timeout->tv_usec = (suseconds_t)((delta % 1000) * 1000);
         }
 
+        // Do not block if a wakeup datagram for queued callbacks could not be sent from the run loop itself.
+        portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+        bool isLoopbackWakeupFailed = runLoop.isLoopbackWakeupFailed;
+        portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+        if (isLoopbackWakeupFailed) {
+            timeout = &timeoutValue;
+            timeout->tv_sec = 0;
+            timeout->tv_usec = 0;
+        }
+
         HAPAssert(maxFileDescriptor >= -1);
         HAPAssert(maxFileDescriptor < FD_SETSIZE);
 
+        // Allow the chip to sleep until the next timer or until a file descriptor becomes ready.
+        int64_t idleStartTime = HAPPlatformClockGetCurrentMicroseconds();
+        runLoop.activeTime += idleStartTime - activeStartTime;
+#if CONFIG_HAP_RUN_LOOP_PM
+        esp_pm_lock_release(runLoop.pmLock);
+#endif
+        runLoop.numSelectIterations++;
         int e = select(
                 maxFileDescriptor + 1, &readFileDescriptors, &writeFileDescriptors, &errorFileDescriptors, timeout);
+#if CONFIG_HAP_RUN_LOOP_PM
+        esp_pm_lock_acquire(runLoop.pmLock);
+#endif
+        activeStartTime = HAPPlatformClockGetCurrentMicroseconds();
+        runLoop.idleTime += activeStartTime - idleStartTime;
+        runLoop.numWakeups++;
         if (e == -1 && errno == EINTR) {
             continue;
         }
@@ -637,8 +1493,24 @@ void HAPPlatformRunLoopRun(void) {
 
         ProcessExpiredTimers();
 
-        ProcessSelectedFileHandles(&readFileDescriptors, &writeFileDescriptors, &errorFileDescriptors);
+        ProcessSelectedFileHandles(
+                &readFileDescriptors, &writeFileDescriptors, &errorFileDescriptors, maxFileDescriptor);
+
+        // Dispatch callbacks whose wakeup datagram could not be sent.
+        portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+        isLoopbackWakeupFailed = runLoop.isLoopbackWakeupFailed;
+        portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+        if (isLoopbackWakeupFailed) {
+            ProcessScheduledCallbacks();
+        }
+
+        ReportPowerStatistics(activeStartTime);
+        ReportStatistics(activeStartTime);
     } while (runLoop.state == kHAPPlatformRunLoopState_Running);
+    runLoop.activeTime += HAPPlatformClockGetCurrentMicroseconds() - activeStartTime;
+#if CONFIG_HAP_RUN_LOOP_PM
+    esp_pm_lock_release(runLoop.pmLock);
+#endif
 
     HAPLogInfo(&logObject, "Exiting run loop.");
     HAPAssert(runLoop.state == kHAPPlatformRunLoopState_Stopping);
@@ -667,53 +1539,50 @@ HAPError HAPPlatformRunLoopScheduleCallback(
         return kHAPError_OutOfResources;
     }
 
-    // Serialize event context.
-    // Format: Callback pointer followed by 1 byte context size and context data.
-    // Context is copied to offset 0 when invoking the callback to ensure proper alignment.
-    uint8_t bytes[sizeof callback + 1 + UINT8_MAX];
-    size_t numBytes = 0;
-    HAPRawBufferCopyBytes(&bytes[numBytes], &callback, sizeof callback);
-    numBytes += sizeof callback;
-    bytes[numBytes] = (uint8_t) contextSize;
-    numBytes++;
-    if (context) {
-        HAPRawBufferCopyBytes(&bytes[numBytes], context, contextSize);
-        numBytes += contextSize;
+    // Serialize event context into the scheduled callback ring.
+    // Format: Aligned slot header with callback pointer and context size, followed by aligned context data.
+    size_t numSlotBytes = GetCallbackSlotSize(contextSize);
+    bool needsWakeup = false;
+    portENTER_CRITICAL(&runLoop.scheduledCallbacksLock);
+    if (!runLoop.numCallbackBytes) {
+        // The run loop only reads the tail while slots are pending, so the empty ring may be rewound here.
+        runLoop.callbackBytesHead = 0;
+        runLoop.callbackBytesTail = 0;
     }
-    HAPAssert(numBytes <= sizeof bytes);
-
-    int fileDescriptor = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (fileDescriptor < 0) {
-        int _errno = errno;
-        HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "Loopback client socket failed (log, call 'bind').",
-            _errno, __func__, HAP_FILE, __LINE__);
-        HAPFatalError();
+    size_t head = runLoop.callbackBytesHead;
+    size_t numSkippedBytes = 0;
+    if (numSlotBytes > sizeof runLoop.callbackBytes - head) {
+        // Slot does not fit at the end of the ring. Mark the remainder as unused and continue at offset 0.
+        numSkippedBytes = sizeof runLoop.callbackBytes - head;
     }
-
-    int e = fcntl(fileDescriptor, F_SETFL, O_NONBLOCK);
-    if (e == -1) {
-        HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "System call 'fcntl' to set loopback send file descriptor flags to 'non-blocking' failed.",
-            errno, __func__, HAP_FILE, __LINE__);
-        HAPFatalError();
+    if (numSkippedBytes + numSlotBytes > sizeof runLoop.callbackBytes - runLoop.numCallbackBytes) {
+        portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+        HAPLogError(&logObject, "Cannot schedule more callbacks (queue full).");
+        return kHAPError_OutOfResources;
     }
-    
-    struct sockaddr_in to_addr;
-    to_addr.sin_family = AF_INET;
-    to_addr.sin_port = htons(LOOPBACK_PORT);
-    inet_aton("127.0.0.1", &to_addr.sin_addr);
-    ssize_t n;
-    do {
-        n = sendto(fileDescriptor, bytes, numBytes, 0, (struct sockaddr *)&to_addr, sizeof(to_addr));
-    } while (n == -1 && errno == EINTR);
-    close(fileDescriptor);
-    if (n == -1) {
-        int _errno = errno;
-        HAPPlatformLogPOSIXError(kHAPLogType_Error,
-            "Loopback client socket failed to send data (log, call 'sendto').",
-            _errno, __func__, HAP_FILE, __LINE__);
-        return kHAPError_Unknown;
+    if (numSkippedBytes) {
+        HAPAssert(numSkippedBytes >= sizeof(HAPPlatformRunLoopCallback));
+        ((HAPPlatformRunLoopCallbackSlot*) &runLoop.callbackBytes[head])->callback = NULL;
+        head = 0;
+    }
+    HAPPlatformRunLoopCallbackSlot* slot = (HAPPlatformRunLoopCallbackSlot*) &runLoop.callbackBytes[head];
+    slot->callback = callback;
+    slot->numContextBytes = (uint8_t) contextSize;
+    if (contextSize) {
+        HAPRawBufferCopyBytes(
+                &runLoop.callbackBytes[head + GetCallbackSlotSize(0)], HAPNonnullVoid(context), contextSize);
+    }
+    runLoop.callbackBytesHead = (head + numSlotBytes) % sizeof runLoop.callbackBytes;
+    runLoop.numCallbackBytes += numSkippedBytes + numSlotBytes;
+    runLoop.numCallbacks++;
+    if (!runLoop.isLoopbackWakeupPending) {
+        runLoop.isLoopbackWakeupPending = true;
+        needsWakeup = true;
+    }
+    portEXIT_CRITICAL(&runLoop.scheduledCallbacksLock);
+
+    if (needsWakeup) {
+        WakeUpRunLoop();
     }
 
     return kHAPError_None;
@@ -0,0 +1,325 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+//
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformSRPEphemeralCache+Init.h"
+
+static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem, .category = "SRPEphemeralCache" };
+
+#if CONFIG_HAP_CRYPTO_SRP_EPHEMERAL_CACHE
+#include "HAPAccessoryServer+Internal.h"
+
+// The redirected HAP_srp_public_key replaces b in the ADK-private Pair Setup state.
+// See HAPPlatformSRPEphemeralCache+Init.h.
+HAP_STATIC_ASSERT(HAP_COMPATIBILITY_VERSION == kHAPPlatform_ADKCompatibilityVersion, SRPEphemeralCacheADKVersion);
+HAP_STATIC_ASSERT(sizeof(HAPAccessoryServer) <= sizeof(HAPAccessoryServerRef), SRPEphemeralCacheServerSize);
+HAP_STATIC_ASSERT(
+        sizeof(((HAPAccessoryServer*) NULL)->pairSetup.b) == SRP_SECRET_KEY_BYTES, SRPEphemeralCachePairSetupB);
+
+// HAP_srp_public_key is redirected to the cache (see CMakeLists.txt). The crypto PAL implementation is still
+// available as __real_HAP_srp_public_key.
+void __real_HAP_srp_public_key(
+        uint8_t pub_b[_Nonnull SRP_PUBLIC_KEY_BYTES],
+        const uint8_t priv_b[_Nonnull SRP_SECRET_KEY_BYTES],
+        const uint8_t v[_Nonnull SRP_VERIFIER_BYTES]);
+#define SRPPublicKey __real_HAP_srp_public_key
+#else
+#define SRPPublicKey HAP_srp_public_key
+#endif
+
+/**
+ * SRP ephemeral cache that HAP_srp_public_key is redirected to.
+ */
+static HAPPlatformSRPEphemeralCacheRef _Nullable activeSRPEphemeralCache;
+
+/**
+ * Context of a key pair computation.
+ */
+typedef struct {
+    HAPPlatformSRPEphemeralCacheRef srpEphemeralCache;
+    uint32_t generation;
+} ComputeKeyPairContext;
+
+/**
+ * Computes the pending key pair. Runs on the crypto executor.
+ *
+ * The run loop does not touch the pending key pair while a computation is running.
+ */
+static void ComputeKeyPair(void* _Nullable context_, size_t contextSize) {
+    HAPPrecondition(context_);
+    HAPPrecondition(contextSize == sizeof(ComputeKeyPairContext));
+    ComputeKeyPairContext* context = context_;
+    HAPPlatformSRPEphemeralKeyPair* keyPair = &context->srpEphemeralCache->pendingKeyPair;
+
+    SRPPublicKey(keyPair->B, keyPair->b, keyPair->verifier);
+}
+
+static void HandleKeyPairComputed(void* _Nullable context_, size_t contextSize) {
+    HAPPrecondition(context_);
+    HAPPrecondition(contextSize == sizeof(ComputeKeyPairContext));
+    ComputeKeyPairContext* context = context_;
+    HAPPlatformSRPEphemeralCacheRef srpEphemeralCache = context->srpEphemeralCache;
+    if (!srpEphemeralCache->cryptoExecutor) {
+        HAPLogDebug(&logObject, "Dropping SRP key pair of a released cache.");
+        return;
+    }
+    HAPPrecondition(srpEphemeralCache->isComputing);
+
+    srpEphemeralCache->isComputing = false;
+    srpEphemeralCache->statistics.numComputedKeyPairs++;
+    if (context->generation != srpEphemeralCache->generation) {
+        HAPLogDebug(&logObject, "Dropping SRP key pair that was discarded while it was computed.");
+    } else {
+        srpEphemeralCache->keyPair = srpEphemeralCache->pendingKeyPair;
+        srpEphemeralCache->isKeyPairAvailable = true;
+        HAPLogDebug(&logObject, "SRP key pair is ready.");
+    }
+    HAPRawBufferZero(&srpEphemeralCache->pendingKeyPair, sizeof srpEphemeralCache->pendingKeyPair);
+
+    if (srpEphemeralCache->isRefillPending) {
+        srpEphemeralCache->isRefillPending = false;
+        uint8_t verifier[SRP_VERIFIER_BYTES];
+        HAPRawBufferCopyBytes(verifier, srpEphemeralCache->refillVerifier, sizeof verifier);
+        HAPError err = HAPPlatformSRPEphemeralCacheRefill(srpEphemeralCache, verifier);
+        if (err) {
+            HAPAssert(err == kHAPError_OutOfResources);
+        }
+    }
+}
+
+static void HandleRefillTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformSRPEphemeralCacheRef srpEphemeralCache = context;
+    HAPPrecondition(timer == srpEphemeralCache->refillTimer);
+    srpEphemeralCache->refillTimer = 0;
+
+    uint8_t verifier[SRP_VERIFIER_BYTES];
+    HAPRawBufferCopyBytes(verifier, srpEphemeralCache->refillVerifier, sizeof verifier);
+    HAPError err = HAPPlatformSRPEphemeralCacheRefill(srpEphemeralCache, verifier);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+    }
+}
+
+/**
+ * Schedules computing a key pair for a verifier after kHAPPlatformSRPEphemeralCache_RefillDelay.
+ *
+ * @param      srpEphemeralCache    SRP ephemeral cache.
+ * @param      verifier             SRP verifier of the current setup code.
+ */
+static void ScheduleRefill(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        const uint8_t verifier[_Nonnull SRP_VERIFIER_BYTES]) {
+    HAPPrecondition(srpEphemeralCache);
+    HAPPrecondition(verifier);
+
+    if (srpEphemeralCache->refillTimer) {
+        HAPPlatformTimerDeregister(srpEphemeralCache->refillTimer);
+        srpEphemeralCache->refillTimer = 0;
+    }
+    srpEphemeralCache->isRefillPending = false;
+    HAPRawBufferCopyBytes(srpEphemeralCache->refillVerifier, verifier, sizeof srpEphemeralCache->refillVerifier);
+
+    HAPError err = HAPPlatformTimerRegister(
+            &srpEphemeralCache->refillTimer,
+            HAPPlatformClockGetCurrent() + kHAPPlatformSRPEphemeralCache_RefillDelay,
+            HandleRefillTimerExpired,
+            srpEphemeralCache);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLog(&logObject, "Not enough resources to schedule SRP key pair precomputation.");
+    }
+}
+
+void HAPPlatformSRPEphemeralCacheCreate(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        const HAPPlatformSRPEphemeralCacheOptions* options) {
+    HAPPrecondition(srpEphemeralCache);
+    HAPPrecondition(options);
+    HAPPrecondition(options->cryptoExecutor);
+    HAPPrecondition(options->server);
+
+    HAPPrecondition(!activeSRPEphemeralCache);
+
+    HAPRawBufferZero(srpEphemeralCache, sizeof *srpEphemeralCache);
+    srpEphemeralCache->cryptoExecutor = options->cryptoExecutor;
+    srpEphemeralCache->server = options->server;
+    activeSRPEphemeralCache = srpEphemeralCache;
+}
+
+void HAPPlatformSRPEphemeralCacheRelease(HAPPlatformSRPEphemeralCacheRef srpEphemeralCache) {
+    HAPPrecondition(srpEphemeralCache);
+    HAPPrecondition(srpEphemeralCache->cryptoExecutor);
+    HAPPrecondition(srpEphemeralCache == activeSRPEphemeralCache);
+
+    HAPLogInfo(
+            &logObject,
+            "SRP key pairs: %lu hits, %lu misses, %lu computed.",
+            (unsigned long) srpEphemeralCache->statistics.numHits,
+            (unsigned long) srpEphemeralCache->statistics.numMisses,
+            (unsigned long) srpEphemeralCache->statistics.numComputedKeyPairs);
+
+    if (srpEphemeralCache->refillTimer) {
+        HAPPlatformTimerDeregister(srpEphemeralCache->refillTimer);
+    }
+    HAPRawBufferZero(srpEphemeralCache, sizeof *srpEphemeralCache);
+    activeSRPEphemeralCache = NULL;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformSRPEphemeralCacheRefill(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        const uint8_t verifier[_Nonnull SRP_VERIFIER_BYTES]) {
+    HAPPrecondition(srpEphemeralCache);
+    HAPPrecondition(srpEphemeralCache->cryptoExecutor);
+    HAPPrecondition(verifier);
+
+    if (srpEphemeralCache->isKeyPairAvailable) {
+        if (HAPRawBufferAreEqual(srpEphemeralCache->keyPair.verifier, verifier, SRP_VERIFIER_BYTES)) {
+            return kHAPError_None;
+        }
+        HAPPlatformSRPEphemeralCacheDiscard(srpEphemeralCache);
+    }
+    if (srpEphemeralCache->isComputing) {
+        // The pending key pair is owned by the crypto executor until the computation completes.
+        // A computation for another verifier is dropped then, and the computation for this verifier is started.
+        if (!HAPRawBufferAreEqual(srpEphemeralCache->pendingKeyPair.verifier, verifier, SRP_VERIFIER_BYTES)) {
+            srpEphemeralCache->generation++;
+            HAPRawBufferCopyBytes(
+                    srpEphemeralCache->refillVerifier, verifier, sizeof srpEphemeralCache->refillVerifier);
+            srpEphemeralCache->isRefillPending = true;
+        } else {
+            srpEphemeralCache->isRefillPending = false;
+        }
+        return kHAPError_None;
+    }
+
+    HAPPlatformSRPEphemeralKeyPair* keyPair = &srpEphemeralCache->pendingKeyPair;
+    HAPRawBufferCopyBytes(keyPair->verifier, verifier, sizeof keyPair->verifier);
+    HAPPlatformRandomNumberFill(keyPair->b, sizeof keyPair->b);
+
+    ComputeKeyPairContext context = { .srpEphemeralCache = srpEphemeralCache,
+                                      .generation = srpEphemeralCache->generation };
+    HAPError err = HAPPlatformCryptoExecutorSubmit(
+            HAPNonnull(srpEphemeralCache->cryptoExecutor),
+            ComputeKeyPair,
+            HandleKeyPairComputed,
+            &context,
+            sizeof context);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLog(&logObject, "Cannot precompute SRP key pair: crypto executor is busy.");
+        HAPRawBufferZero(keyPair, sizeof *keyPair);
+        return err;
+    }
+    srpEphemeralCache->isComputing = true;
+    return kHAPError_None;
+}
+
+HAP_RESULT_USE_CHECK
+bool HAPPlatformSRPEphemeralCacheTake(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        const uint8_t verifier[_Nonnull SRP_VERIFIER_BYTES],
+        uint8_t b[_Nonnull SRP_SECRET_KEY_BYTES],
+        uint8_t B[_Nonnull SRP_PUBLIC_KEY_BYTES]) {
+    HAPPrecondition(srpEphemeralCache);
+    HAPPrecondition(srpEphemeralCache->cryptoExecutor);
+    HAPPrecondition(verifier);
+    HAPPrecondition(b);
+    HAPPrecondition(B);
+
+    HAPPlatformSRPEphemeralKeyPair* keyPair = &srpEphemeralCache->keyPair;
+    if (!srpEphemeralCache->isKeyPairAvailable ||
+        !HAPRawBufferAreEqual(keyPair->verifier, verifier, sizeof keyPair->verifier)) {
+        srpEphemeralCache->statistics.numMisses++;
+        return false;
+    }
+
+    // Key pairs are single use.
+    HAPRawBufferCopyBytes(b, keyPair->b, sizeof keyPair->b);
+    HAPRawBufferCopyBytes(B, keyPair->B, sizeof keyPair->B);
+    HAPRawBufferZero(keyPair, sizeof *keyPair);
+    srpEphemeralCache->isKeyPairAvailable = false;
+    srpEphemeralCache->statistics.numHits++;
+    return true;
+}
+
+void HAPPlatformSRPEphemeralCacheDiscard(HAPPlatformSRPEphemeralCacheRef srpEphemeralCache) {
+    HAPPrecondition(srpEphemeralCache);
+    HAPPrecondition(srpEphemeralCache->cryptoExecutor);
+
+    if (srpEphemeralCache->refillTimer) {
+        HAPPlatformTimerDeregister(srpEphemeralCache->refillTimer);
+        srpEphemeralCache->refillTimer = 0;
+    }
+    HAPRawBufferZero(&srpEphemeralCache->keyPair, sizeof srpEphemeralCache->keyPair);
+    srpEphemeralCache->isKeyPairAvailable = false;
+    srpEphemeralCache->isRefillPending = false;
+    srpEphemeralCache->generation++;
+}
+
+void HAPPlatformSRPEphemeralCacheGetStatistics(
+        HAPPlatformSRPEphemeralCacheRef srpEphemeralCache,
+        HAPPlatformSRPEphemeralCacheStatistics* statistics) {
+    HAPPrecondition(srpEphemeralCache);
+    HAPPrecondition(srpEphemeralCache->cryptoExecutor);
+    HAPPrecondition(statistics);
+
+    *statistics = srpEphemeralCache->statistics;
+}
+
+#if CONFIG_HAP_CRYPTO_SRP_EPHEMERAL_CACHE
+
+void __wrap_HAP_srp_public_key(
+        uint8_t pub_b[_Nonnull SRP_PUBLIC_KEY_BYTES],
+        const uint8_t priv_b[_Nonnull SRP_SECRET_KEY_BYTES],
+        const uint8_t v[_Nonnull SRP_VERIFIER_BYTES]);
+
+void __wrap_HAP_srp_public_key(
+        uint8_t pub_b[_Nonnull SRP_PUBLIC_KEY_BYTES],
+        const uint8_t priv_b[_Nonnull SRP_SECRET_KEY_BYTES],
+        const uint8_t v[_Nonnull SRP_VERIFIER_BYTES]) {
+    HAPPrecondition(pub_b);
+    HAPPrecondition(priv_b);
+    HAPPrecondition(v);
+
+    HAPPlatformSRPEphemeralCacheRef _Nullable srpEphemeralCache = activeSRPEphemeralCache;
+    if (!srpEphemeralCache) {
+        __real_HAP_srp_public_key(pub_b, priv_b, v);
+        return;
+    }
+
+    // Pair Setup passes the b that it just generated into its own state (see HAPPlatformSRPEphemeralCache+Init.h).
+    // The crypto PAL declares priv_b const, so b is replaced through the Pair Setup state of the accessory server
+    // instead of casting priv_b. Calls with any other buffer are not served from the cache.
+    HAPAccessoryServer* server = (HAPAccessoryServer*) HAPNonnull(srpEphemeralCache->server);
+    if (priv_b != server->pairSetup.b) {
+        HAPLog(&logObject, "HAP_srp_public_key called outside of Pair Setup. Not using SRP ephemeral cache.");
+        __real_HAP_srp_public_key(pub_b, priv_b, v);
+        return;
+    }
+    if (!HAPPlatformSRPEphemeralCacheTake(HAPNonnull(srpEphemeralCache), v, server->pairSetup.b, pub_b)) {
+        HAPLogDebug(&logObject, "No precomputed SRP key pair available.");
+        __real_HAP_srp_public_key(pub_b, priv_b, v);
+    }
+    ScheduleRefill(HAPNonnull(srpEphemeralCache), v);
+}
+
+#endif
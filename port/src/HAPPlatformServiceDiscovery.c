@@ -21,6 +21,7 @@
 #include <unistd.h>
 
 #include <string.h>
+#include <esp_netif.h>
 #include <mdns.h>
 #include "HAPPlatform+Init.h"
 #include "HAPPlatformServiceDiscovery+Init.h"
@@ -29,6 +30,320 @@ static const HAPLogObject logObject = { .subsystem = kHAPPlatform_LogSubsystem,
 
 static HAPPlatformServiceDiscoveryRef hapService;
 
+/**
+ * Scratch array that is handed to the mdns component when all TXT records are replaced.
+ */
+static mdns_txt_item_t txtItems[kHAPPlatformServiceDiscovery_MaxTXTRecords];
+
+/**
+ * Splits a protocol such as "_hap._tcp" into the service type and protocol expected by the mdns component.
+ * The protocol is only parsed again when it differs from the previous registration.
+ */
+static void SetProtocol(HAPPlatformServiceDiscoveryRef serviceDiscovery, const char* protocol) {
+    HAPPrecondition(serviceDiscovery);
+    HAPPrecondition(protocol);
+
+    if (HAPStringAreEqual(serviceDiscovery->protocol, protocol)) {
+        return;
+    }
+
+    size_t numProtocolBytes = HAPStringGetNumBytes(protocol);
+    HAPPrecondition(numProtocolBytes < sizeof serviceDiscovery->protocol);
+    const char* separator = strchr(protocol, '.');
+    HAPPrecondition(separator);
+    size_t numServTypeBytes = (size_t)(separator - protocol);
+    size_t numProtoBytes = strcspn(&separator[1], ".");
+    HAPPrecondition(numServTypeBytes < sizeof serviceDiscovery->serv_type);
+    HAPPrecondition(numProtoBytes < sizeof serviceDiscovery->proto);
+
+    HAPRawBufferCopyBytes(serviceDiscovery->serv_type, protocol, numServTypeBytes);
+    serviceDiscovery->serv_type[numServTypeBytes] = '\0';
+    HAPRawBufferCopyBytes(serviceDiscovery->proto, &separator[1], numProtoBytes);
+    serviceDiscovery->proto[numProtoBytes] = '\0';
+    HAPRawBufferCopyBytes(serviceDiscovery->protocol, protocol, numProtocolBytes + 1);
+}
+
+static void LogTXTRecords(const HAPPlatformServiceDiscoveryTXTRecord* txtRecords, size_t numTXTRecords) {
+    HAPPrecondition(txtRecords);
+
+    for (size_t i = 0; i < numTXTRecords; i++) {
+        HAPPrecondition(!txtRecords[i].value.numBytes || txtRecords[i].value.bytes);
+        HAPPrecondition(txtRecords[i].value.numBytes <= UINT8_MAX);
+        if (txtRecords[i].value.bytes) {
+            HAPLogBufferDebug(&logObject, txtRecords[i].value.bytes, txtRecords[i].value.numBytes,
+                    "txtRecord[%lu]: \"%s\"", (unsigned long) i, txtRecords[i].key);
+        } else {
+            HAPLogDebug(&logObject, "txtRecord[%lu]: \"%s\"", (unsigned long) i, txtRecords[i].key);
+        }
+    }
+}
+
+/**
+ * Copies TXT records into a table, NUL-terminating each value.
+ *
+ * @return true                     If all TXT records fit into the table.
+ * @return false                    Otherwise. The table contents are undefined in that case.
+ */
+HAP_RESULT_USE_CHECK
+static bool BuildTXTRecordTable(
+        HAPPlatformServiceDiscoveryTXTRecordTable* table,
+        const HAPPlatformServiceDiscoveryTXTRecord* txtRecords,
+        size_t numTXTRecords) {
+    HAPPrecondition(table);
+    HAPPrecondition(txtRecords);
+
+    table->numRecords = 0;
+    size_t numValueBytes = 0;
+    for (size_t i = 0; i < numTXTRecords; i++) {
+        size_t numKeyBytes = HAPStringGetNumBytes(txtRecords[i].key);
+        size_t numBytes = txtRecords[i].value.numBytes;
+        if (i >= HAPArrayCount(table->records) || numKeyBytes > kHAPPlatformServiceDiscovery_MaxTXTRecordKeyLength ||
+            numBytes + 1 > sizeof table->values - numValueBytes ||
+            (numBytes && memchr(txtRecords[i].value.bytes, '\0', numBytes))) {
+            return false;
+        }
+
+        HAPPlatformServiceDiscoveryTXTRecordEntry* record = &table->records[i];
+        HAPRawBufferCopyBytes(record->key, txtRecords[i].key, numKeyBytes + 1);
+        record->valueOffset = (uint16_t) numValueBytes;
+        record->numValueBytes = (uint16_t) numBytes;
+        if (numBytes) {
+            HAPRawBufferCopyBytes(&table->values[numValueBytes], txtRecords[i].value.bytes, numBytes);
+        }
+        table->values[numValueBytes + numBytes] = '\0';
+        numValueBytes += numBytes + 1;
+        table->numRecords++;
+    }
+    return true;
+}
+
+static const HAPPlatformServiceDiscoveryTXTRecordEntry* _Nullable FindTXTRecord(
+        const HAPPlatformServiceDiscoveryTXTRecordTable* table,
+        const char* key) {
+    HAPPrecondition(table);
+    HAPPrecondition(key);
+
+    for (size_t i = 0; i < table->numRecords; i++) {
+        if (HAPStringAreEqual(table->records[i].key, key)) {
+            return &table->records[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Fills the scratch mdns TXT item array from a table.
+ */
+static void FillTXTItems(const HAPPlatformServiceDiscoveryTXTRecordTable* table) {
+    HAPPrecondition(table);
+
+    for (size_t i = 0; i < table->numRecords; i++) {
+        txtItems[i].key = (char*) table->records[i].key;
+        txtItems[i].value = (char*) &table->values[table->records[i].valueOffset];
+    }
+}
+
+/**
+ * Fills the scratch mdns TXT item array directly from the TXT records of the caller.
+ * Used when the TXT records do not fit into a table.
+ */
+static void FillTXTItemsFromRecords(const HAPPlatformServiceDiscoveryTXTRecord* txtRecords, size_t numTXTRecords) {
+    HAPPrecondition(txtRecords);
+    HAPPrecondition(numTXTRecords <= HAPArrayCount(txtItems));
+
+    for (size_t i = 0; i < numTXTRecords; i++) {
+        txtItems[i].key = (char*) txtRecords[i].key;
+        txtItems[i].value = txtRecords[i].value.bytes ? (char*) txtRecords[i].value.bytes : "";
+    }
+}
+
+/**
+ * Replaces all published TXT records with the contents of the table at the given index, or with the TXT records of
+ * the caller if they did not fit into that table.
+ */
+static void ReplaceTXTRecords(
+        HAPPlatformServiceDiscoveryRef serviceDiscovery,
+        uint8_t tableIndex,
+        bool isTableValid,
+        const HAPPlatformServiceDiscoveryTXTRecord* txtRecords,
+        size_t numTXTRecords) {
+    HAPPrecondition(serviceDiscovery);
+    HAPPrecondition(tableIndex < HAPArrayCount(serviceDiscovery->txtRecordTables));
+    HAPPrecondition(txtRecords);
+
+    if (isTableValid) {
+        FillTXTItems(&serviceDiscovery->txtRecordTables[tableIndex]);
+    } else {
+        HAPLogInfo(&logObject, "TXT records do not fit into the published table. Replacing all TXT records.");
+        FillTXTItemsFromRecords(txtRecords, numTXTRecords);
+    }
+    esp_err_t err = mdns_service_txt_set(
+            serviceDiscovery->serv_type, serviceDiscovery->proto, txtItems, (uint8_t) numTXTRecords);
+    if (err != ESP_OK) {
+        HAPLogError(&logObject, "mdns_service_txt_set failed: %d.", err);
+    }
+    serviceDiscovery->publishedTXTRecordTable = tableIndex;
+    serviceDiscovery->isPublishedTXTRecordTableValid = isTableValid && err == ESP_OK;
+}
+
+/**
+ * Announces the registered service again by republishing its TXT records, or by probing the host name and all
+ * services again if the TXT records are not tracked.
+ */
+static void AnnounceService(HAPPlatformServiceDiscoveryRef serviceDiscovery) {
+    HAPPrecondition(serviceDiscovery);
+    HAPPrecondition(serviceDiscovery->isRegistered);
+
+    esp_err_t err;
+    if (serviceDiscovery->isPublishedTXTRecordTableValid) {
+        const HAPPlatformServiceDiscoveryTXTRecordTable* published =
+                &serviceDiscovery->txtRecordTables[serviceDiscovery->publishedTXTRecordTable];
+        FillTXTItems(published);
+        err = mdns_service_txt_set(
+                serviceDiscovery->serv_type, serviceDiscovery->proto, txtItems, (uint8_t) published->numRecords);
+    } else {
+        err = mdns_hostname_set(serviceDiscovery->hostName);
+    }
+    if (err != ESP_OK) {
+        HAPLogError(&logObject, "Announcing service failed: %d.", err);
+    }
+}
+
+static void CancelReannounceTimer(HAPPlatformServiceDiscoveryRef serviceDiscovery) {
+    HAPPrecondition(serviceDiscovery);
+
+    if (serviceDiscovery->reannounceTimer) {
+        HAPPlatformTimerDeregister(serviceDiscovery->reannounceTimer);
+        serviceDiscovery->reannounceTimer = 0;
+    }
+    serviceDiscovery->numReannouncementsRemaining = 0;
+}
+
+static void HandleReannounceTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context);
+
+/**
+ * Schedules the next re-announcement of the burst, doubling the interval.
+ */
+static void ScheduleReannouncement(HAPPlatformServiceDiscoveryRef serviceDiscovery) {
+    HAPPrecondition(serviceDiscovery);
+    HAPPrecondition(!serviceDiscovery->reannounceTimer);
+
+    if (!serviceDiscovery->numReannouncementsRemaining) {
+        return;
+    }
+    HAPError err = HAPPlatformTimerRegister(
+            &serviceDiscovery->reannounceTimer,
+            HAPPlatformClockGetCurrent() + serviceDiscovery->reannounceInterval,
+            HandleReannounceTimerExpired,
+            serviceDiscovery);
+    if (err) {
+        HAPAssert(err == kHAPError_OutOfResources);
+        HAPLogError(&logObject, "Not enough resources to schedule re-announcement.");
+        serviceDiscovery->numReannouncementsRemaining = 0;
+        return;
+    }
+    serviceDiscovery->numReannouncementsRemaining--;
+    serviceDiscovery->reannounceInterval *= 2;
+}
+
+static void HandleReannounceTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformServiceDiscoveryRef serviceDiscovery = context;
+    HAPPrecondition(timer == serviceDiscovery->reannounceTimer);
+    serviceDiscovery->reannounceTimer = 0;
+
+    HAPLogDebug(&logObject, "Re-announcing \"%s\".", serviceDiscovery->protocol);
+    AnnounceService(serviceDiscovery);
+    ScheduleReannouncement(serviceDiscovery);
+}
+
+typedef struct {
+    HAPPlatformServiceDiscoveryRef serviceDiscovery;
+    HAPTime time;
+    bool ipChanged;
+} IPAcquiredEvent;
+
+/**
+ * Records the first controller response after the station acquired an IP address.
+ */
+static void HandleFirstResponse(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPTime time, void* _Nullable context) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(context);
+    HAPPlatformServiceDiscoveryRef serviceDiscovery = context;
+    HAPPrecondition(tcpStreamManager == serviceDiscovery->tcpStreamManager);
+
+    HAPPlatformServiceDiscoveryRediscoveryStatistics* statistics = &serviceDiscovery->rediscoveryStatistics;
+    HAPTime timeToFirstResponse = time - serviceDiscovery->ipAcquisitionTime;
+    statistics->numMeasurements++;
+    statistics->lastTimeToFirstResponse = timeToFirstResponse;
+    statistics->maxTimeToFirstResponse = HAPMax(statistics->maxTimeToFirstResponse, timeToFirstResponse);
+    HAPLogInfo(
+            &logObject,
+            "First controller response %llu ms after acquiring an IP address (max %llu ms).",
+            (unsigned long long) timeToFirstResponse,
+            (unsigned long long) statistics->maxTimeToFirstResponse);
+}
+
+/**
+ * Starts a re-announcement burst on the run loop after the station acquired an IP address.
+ */
+static void HandleIPAcquired(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize == sizeof(IPAcquiredEvent));
+    const IPAcquiredEvent* event = context;
+    HAPPlatformServiceDiscoveryRef serviceDiscovery = event->serviceDiscovery;
+
+    if (!serviceDiscovery->ipEventHandler) {
+        return;
+    }
+
+    if (serviceDiscovery->tcpStreamManager) {
+        serviceDiscovery->rediscoveryStatistics.numIPAcquisitions++;
+        serviceDiscovery->ipAcquisitionTime = event->time;
+        HAPPlatformTCPStreamManagerObserveNextWrite(
+                HAPNonnull(serviceDiscovery->tcpStreamManager), HandleFirstResponse, serviceDiscovery);
+    }
+
+    if (!serviceDiscovery->isRegistered) {
+        return;
+    }
+
+    CancelReannounceTimer(serviceDiscovery);
+    if (event->ipChanged) {
+        // The mdns component probes the host name and all services again when the host name is set.
+        HAPLogInfo(&logObject, "IP address changed. Probing \"%s\" again.", serviceDiscovery->protocol);
+        esp_err_t err = mdns_hostname_set(serviceDiscovery->hostName);
+        if (err != ESP_OK) {
+            HAPLogError(&logObject, "mdns_hostname_set failed: %d.", err);
+        }
+    } else {
+        HAPLogInfo(&logObject, "IP address unchanged. Announcing \"%s\" again.", serviceDiscovery->protocol);
+        AnnounceService(serviceDiscovery);
+    }
+    serviceDiscovery->numReannouncementsRemaining = CONFIG_HAP_SERVICE_DISCOVERY_REANNOUNCE_COUNT;
+    serviceDiscovery->reannounceInterval = (HAPTime) CONFIG_HAP_SERVICE_DISCOVERY_REANNOUNCE_INTERVAL * HAPMillisecond;
+    ScheduleReannouncement(serviceDiscovery);
+}
+
+/**
+ * Handles IP_EVENT_STA_GOT_IP on the default event loop task.
+ */
+static void HandleIPEvent(void* _Nullable arg, esp_event_base_t eventBase, int32_t eventID, void* _Nullable eventData) {
+    HAPPrecondition(arg);
+    HAPPrecondition(eventBase == IP_EVENT);
+    HAPPrecondition(eventID == IP_EVENT_STA_GOT_IP);
+    HAPPrecondition(eventData);
+    const ip_event_got_ip_t* gotIP = eventData;
+
+    IPAcquiredEvent event = { .serviceDiscovery = arg,
+                              .time = HAPPlatformClockGetCurrent(),
+                              .ipChanged = gotIP->ip_changed };
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleIPAcquired, &event, sizeof event);
+    if (err) {
+        HAPLogError(&logObject, "Failed to schedule re-announcement after acquiring an IP address.");
+    }
+}
+
 void HAPPlatformServiceDiscoveryRegister(
         HAPPlatformServiceDiscoveryRef serviceDiscovery,
         const char* name,
@@ -40,36 +355,30 @@ void HAPPlatformServiceDiscoveryRegister(
     HAPPrecondition(name);
     HAPPrecondition(protocol);
     HAPPrecondition(txtRecords);
+    HAPPrecondition(numTXTRecords <= kHAPPlatformServiceDiscovery_MaxTXTRecords);
+
+    SetProtocol(serviceDiscovery, protocol);
 
-    char tmp_proto[64] = {0};
-    strncpy(tmp_proto, protocol, sizeof(tmp_proto));
-    char *serv_type = strtok(tmp_proto, ".");
-    char *proto = strtok(NULL, ".");
-    strcpy(serviceDiscovery->serv_type, serv_type);
-    strcpy(serviceDiscovery->proto, proto);
-    
     HAPLogDebug(&logObject, "name: \"%s\"", name);
     HAPLogDebug(&logObject, "protocol: \"%s\"", protocol);
     HAPLogDebug(&logObject, "port: %u", port);
-    
-    mdns_txt_item_t *txtRecords_copy = malloc(sizeof(mdns_txt_item_t) * numTXTRecords);
-    if (txtRecords_copy) {
-        for (size_t i = 0; i < numTXTRecords; i++) {
-            HAPPrecondition(!txtRecords[i].value.numBytes || txtRecords[i].value.bytes);
-            HAPPrecondition(txtRecords[i].value.numBytes <= UINT8_MAX);
-            if (txtRecords[i].value.bytes) {
-                HAPLogBufferDebug(&logObject, txtRecords[i].value.bytes, txtRecords[i].value.numBytes,
-                        "txtRecord[%lu]: \"%s\"", (unsigned long) i, txtRecords[i].key);
-            } else {
-                HAPLogDebug(&logObject, "txtRecord[%lu]: \"%s\"", (unsigned long) i, txtRecords[i].key);
-            }
-            txtRecords_copy[i].key = (char *)txtRecords[i].key;
-            txtRecords_copy[i].value = (char *)txtRecords[i].value.bytes;
-        }
-        esp_err_t err = mdns_service_add(name, serv_type, proto, port, txtRecords_copy, numTXTRecords);
-         HAPLogDebug(&logObject, "Error: \"%d\"", err);
-        free(txtRecords_copy);
+    LogTXTRecords(txtRecords, numTXTRecords);
+
+    HAPPlatformServiceDiscoveryTXTRecordTable* table = &serviceDiscovery->txtRecordTables[0];
+    bool isTableValid = BuildTXTRecordTable(table, txtRecords, numTXTRecords);
+    if (isTableValid) {
+        FillTXTItems(table);
+    } else {
+        FillTXTItemsFromRecords(txtRecords, numTXTRecords);
     }
+    esp_err_t err = mdns_service_add(
+            name, serviceDiscovery->serv_type, serviceDiscovery->proto, port, txtItems, numTXTRecords);
+    if (err != ESP_OK) {
+        HAPLogError(&logObject, "mdns_service_add failed: %d.", err);
+    }
+    serviceDiscovery->publishedTXTRecordTable = 0;
+    serviceDiscovery->isPublishedTXTRecordTableValid = isTableValid && err == ESP_OK;
+    serviceDiscovery->isRegistered = true;
     hapService = serviceDiscovery;
 }
 
@@ -79,42 +388,116 @@ void HAPPlatformServiceDiscoveryUpdateTXTRecords(
         size_t numTXTRecords) {
     HAPPrecondition(serviceDiscovery);
     HAPPrecondition(txtRecords);
+    HAPPrecondition(numTXTRecords <= kHAPPlatformServiceDiscovery_MaxTXTRecords);
+
+    LogTXTRecords(txtRecords, numTXTRecords);
+
+    uint8_t tableIndex = serviceDiscovery->publishedTXTRecordTable ^ 1;
+    const HAPPlatformServiceDiscoveryTXTRecordTable* published =
+            &serviceDiscovery->txtRecordTables[serviceDiscovery->publishedTXTRecordTable];
+    HAPPlatformServiceDiscoveryTXTRecordTable* table = &serviceDiscovery->txtRecordTables[tableIndex];
+    bool isTableValid = BuildTXTRecordTable(table, txtRecords, numTXTRecords);
+    if (!isTableValid || !serviceDiscovery->isPublishedTXTRecordTableValid) {
+        ReplaceTXTRecords(serviceDiscovery, tableIndex, isTableValid, txtRecords, numTXTRecords);
+        return;
+    }
 
-    mdns_txt_item_t *txtRecords_copy = malloc(sizeof(mdns_txt_item_t) * numTXTRecords);
-    if (txtRecords_copy) {
-        for (size_t i = 0; i < numTXTRecords; i++) {
-            HAPPrecondition(!txtRecords[i].value.numBytes || txtRecords[i].value.bytes);
-            HAPPrecondition(txtRecords[i].value.numBytes <= UINT8_MAX);
-            if (txtRecords[i].value.bytes) {
-                HAPLogBufferDebug(&logObject, txtRecords[i].value.bytes, txtRecords[i].value.numBytes,
-                        "txtRecord[%lu]: \"%s\"", (unsigned long) i, txtRecords[i].key);
-            } else {
-                HAPLogDebug(&logObject, "txtRecord[%lu]: \"%s\"", (unsigned long) i, txtRecords[i].key);
-            }
-            txtRecords_copy[i].key = (char *) txtRecords[i].key;
-            txtRecords_copy[i].value = (char *) txtRecords[i].value.bytes;
+    // Push changed and added keys individually.
+    size_t numChanges = 0;
+    for (size_t i = 0; i < table->numRecords; i++) {
+        const HAPPlatformServiceDiscoveryTXTRecordEntry* record = &table->records[i];
+        const HAPPlatformServiceDiscoveryTXTRecordEntry* publishedRecord = FindTXTRecord(published, record->key);
+        const char* value = &table->values[record->valueOffset];
+        if (publishedRecord && publishedRecord->numValueBytes == record->numValueBytes &&
+            HAPRawBufferAreEqual(&published->values[publishedRecord->valueOffset], value, record->numValueBytes)) {
+            continue;
         }
-        mdns_service_txt_set(serviceDiscovery->serv_type, serviceDiscovery->proto, txtRecords_copy, numTXTRecords);
-        free(txtRecords_copy);
+        HAPLogDebug(&logObject, "Updating TXT record \"%s\".", record->key);
+        esp_err_t err =
+                mdns_service_txt_item_set(serviceDiscovery->serv_type, serviceDiscovery->proto, record->key, value);
+        if (err != ESP_OK) {
+            HAPLogError(&logObject, "mdns_service_txt_item_set failed: %d.", err);
+            ReplaceTXTRecords(serviceDiscovery, tableIndex, isTableValid, txtRecords, numTXTRecords);
+            return;
+        }
+        numChanges++;
+    }
+
+    // Remove keys that are no longer present.
+    for (size_t i = 0; i < published->numRecords; i++) {
+        const HAPPlatformServiceDiscoveryTXTRecordEntry* publishedRecord = &published->records[i];
+        if (FindTXTRecord(table, publishedRecord->key)) {
+            continue;
+        }
+        HAPLogDebug(&logObject, "Removing TXT record \"%s\".", publishedRecord->key);
+        esp_err_t err = mdns_service_txt_item_remove(
+                serviceDiscovery->serv_type, serviceDiscovery->proto, publishedRecord->key);
+        if (err != ESP_OK) {
+            HAPLogError(&logObject, "mdns_service_txt_item_remove failed: %d.", err);
+            ReplaceTXTRecords(serviceDiscovery, tableIndex, isTableValid, txtRecords, numTXTRecords);
+            return;
+        }
+        numChanges++;
+    }
+
+    if (!numChanges) {
+        HAPLogDebug(&logObject, "TXT records unchanged. Skipping update.");
     }
+    serviceDiscovery->publishedTXTRecordTable = tableIndex;
 }
 
 void HAPPlatformServiceDiscoveryStop(HAPPlatformServiceDiscoveryRef serviceDiscovery) {
     HAPPrecondition(serviceDiscovery);
+    CancelReannounceTimer(serviceDiscovery);
     mdns_service_remove(serviceDiscovery->serv_type, serviceDiscovery->proto);
+    serviceDiscovery->isPublishedTXTRecordTableValid = false;
+    serviceDiscovery->isRegistered = false;
 }
 
 void HAPPlatformServiceDiscoveryCreate(
-    HAPPlatformServiceDiscoveryRef serviceDiscovery,
-    const HAPPlatformServiceDiscoveryOptions *options)
-{
+        HAPPlatformServiceDiscoveryRef serviceDiscovery,
+        const HAPPlatformServiceDiscoveryOptions* options) {
     HAPPrecondition(serviceDiscovery);
+    HAPPrecondition(options);
+
+    HAPRawBufferZero(serviceDiscovery, sizeof *serviceDiscovery);
+
+    const char* hostName = options->hostName ? options->hostName : "MyHost";
+    size_t numHostNameBytes = HAPStringGetNumBytes(hostName);
+    HAPPrecondition(numHostNameBytes < sizeof serviceDiscovery->hostName);
+    HAPRawBufferCopyBytes(serviceDiscovery->hostName, hostName, numHostNameBytes + 1);
+    serviceDiscovery->tcpStreamManager = options->tcpStreamManager;
 
     mdns_init();
+    mdns_hostname_set(serviceDiscovery->hostName);
 
-    if (options->hostName) {
-        mdns_hostname_set(options->hostName);
-    } else {
-        mdns_hostname_set("MyHost");
+    esp_err_t err = esp_event_handler_instance_register(
+            IP_EVENT, IP_EVENT_STA_GOT_IP, HandleIPEvent, serviceDiscovery, &serviceDiscovery->ipEventHandler);
+    if (err != ESP_OK) {
+        HAPLogError(&logObject, "Failed to register IP event handler: %d. Reconnects are not announced.", err);
+        serviceDiscovery->ipEventHandler = NULL;
     }
 }
+
+void HAPPlatformServiceDiscoveryRelease(HAPPlatformServiceDiscoveryRef serviceDiscovery) {
+    HAPPrecondition(serviceDiscovery);
+
+    if (serviceDiscovery->ipEventHandler) {
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, serviceDiscovery->ipEventHandler);
+        serviceDiscovery->ipEventHandler = NULL;
+    }
+    CancelReannounceTimer(serviceDiscovery);
+    if (serviceDiscovery->tcpStreamManager) {
+        HAPPlatformTCPStreamManagerObserveNextWrite(HAPNonnull(serviceDiscovery->tcpStreamManager), NULL, NULL);
+        serviceDiscovery->tcpStreamManager = NULL;
+    }
+}
+
+void HAPPlatformServiceDiscoveryGetRediscoveryStatistics(
+        HAPPlatformServiceDiscoveryRef serviceDiscovery,
+        HAPPlatformServiceDiscoveryRediscoveryStatistics* statistics) {
+    HAPPrecondition(serviceDiscovery);
+    HAPPrecondition(statistics);
+
+    *statistics = serviceDiscovery->rediscoveryStatistics;
+}
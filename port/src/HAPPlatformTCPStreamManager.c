@@ -29,6 +29,7 @@
 #include <esp_event.h>
 
 #include "HAPPlatform+Init.h"
+#include "HAPPlatformIPSessionPool+Init.h"
 #include "HAPPlatformLog+Init.h"
 #include "HAPPlatformTCPStreamManager+Init.h"
 
@@ -66,6 +67,10 @@ static void InitializeTCPStream(HAPPlatformTCPStream* tcpStream) {
     tcpStream->interests.hasSpaceAvailable = false;
     tcpStream->callback = NULL;
     tcpStream->context = NULL;
+    tcpStream->lastActivityTime = 0;
+    tcpStream->isEvicted = false;
+    tcpStream->ipSessionBuffers = NULL;
+    tcpStream->nextFreeTCPStream = NULL;
 }
 
 HAP_RESULT_USE_CHECK
@@ -130,6 +135,232 @@ static HAPError SetNodelay(int fileDescriptor) {
     return kHAPError_None;
 }
 
+/**
+ * Enables TCP keepalive on a socket.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      fileDescriptor       Socket file descriptor.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_Unknown        If an error occurred while configuring keepalive.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError SetKeepAlive(HAPPlatformTCPStreamManagerRef tcpStreamManager, int fileDescriptor) {
+    HAPPrecondition(tcpStreamManager);
+
+    const struct {
+        int level;
+        int name;
+        int value;
+        const char* description;
+    } options[] = {
+        { SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE" },
+        { IPPROTO_TCP, TCP_KEEPIDLE, (int) tcpStreamManager->keepAlive.idleTime, "TCP_KEEPIDLE" },
+        { IPPROTO_TCP, TCP_KEEPINTVL, (int) tcpStreamManager->keepAlive.interval, "TCP_KEEPINTVL" },
+        { IPPROTO_TCP, TCP_KEEPCNT, (int) tcpStreamManager->keepAlive.count, "TCP_KEEPCNT" },
+    };
+    for (size_t i = 0; i < HAPArrayCount(options); i++) {
+        int v = options[i].value;
+        HAPLogBufferDebug(
+                &logObject,
+                &v,
+                sizeof v,
+                "setsockopt(%d, %d, %s, <buffer>);",
+                fileDescriptor,
+                options[i].level,
+                options[i].description);
+        int e = setsockopt(fileDescriptor, options[i].level, options[i].name, &v, sizeof v);
+        if (e != 0) {
+            int _errno = errno;
+            HAPAssert(e == -1);
+            HAPPlatformLogPOSIXError(
+                    kHAPLogType_Error,
+                    "System call 'setsockopt' to configure TCP keepalive failed.",
+                    _errno,
+                    __func__,
+                    HAP_FILE,
+                    __LINE__);
+            return kHAPError_Unknown;
+        }
+    }
+    return kHAPError_None;
+}
+
+static void HandleTCPStreamListenerFileHandleCallback(
+        HAPPlatformFileHandleRef fileHandle,
+        HAPPlatformFileHandleEvent fileHandleEvents,
+        void* _Nullable context);
+
+/**
+ * Suspends or resumes monitoring the TCP stream listener socket for new connections.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ * @param      isAcceptSuspended    Whether monitoring for new connections should be suspended.
+ */
+static void SetAcceptSuspended(HAPPlatformTCPStreamManagerRef tcpStreamManager, bool isAcceptSuspended) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreamListener.tcpStreamManager == tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->tcpStreamListener.fileHandle);
+
+    if (tcpStreamManager->isAcceptSuspended == isAcceptSuspended) {
+        return;
+    }
+    HAPLogInfo(
+            &logObject,
+            "%s accepting new TCP streams on TCP stream listener socket.",
+            isAcceptSuspended ? "Suspending" : "Resuming");
+    HAPPlatformFileHandleUpdateInterests(
+            tcpStreamManager->tcpStreamListener.fileHandle,
+            (HAPPlatformFileHandleEvent) { .isReadyForReading = !isAcceptSuspended,
+                                           .isReadyForWriting = false,
+                                           .hasErrorConditionPending = false },
+            HandleTCPStreamListenerFileHandleCallback,
+            &tcpStreamManager->tcpStreamListener);
+    tcpStreamManager->isAcceptSuspended = isAcceptSuspended;
+}
+
+/**
+ * Cancels a pending eviction retry.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ */
+static void CancelEvictionTimer(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
+    HAPPrecondition(tcpStreamManager);
+
+    if (tcpStreamManager->evictionTimer) {
+        HAPPlatformTimerDeregister(tcpStreamManager->evictionTimer);
+        tcpStreamManager->evictionTimer = 0;
+    }
+    tcpStreamManager->isEvictionRetryPending = false;
+}
+
+static void HandleEvictionTimerExpired(HAPPlatformTimerRef timer, void* _Nullable context) {
+    HAPPrecondition(context);
+    HAPPlatformTCPStreamManagerRef tcpStreamManager = context;
+    HAPPrecondition(timer == tcpStreamManager->evictionTimer);
+    tcpStreamManager->evictionTimer = 0;
+
+    // Listen again. If a connection is still pending, eviction is retried from the listener callback.
+    if (tcpStreamManager->tcpStreamListener.tcpStreamManager) {
+        SetAcceptSuspended(tcpStreamManager, false);
+    }
+}
+
+/**
+ * Shuts down the least recently active TCP stream to make room for a pending connection.
+ *
+ * - The TCP stream is not closed. Its owner observes the shutdown as end of stream and closes it regularly,
+ *   which makes the slot available again.
+ *
+ * - If every TCP stream was active too recently, accepting is suspended until the least recently active one becomes
+ *   eligible for eviction. If no timer is available for that, accepting stays suspended until the next TCP stream
+ *   activity or until a TCP stream is closed.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ */
+static void EvictIdleTCPStream(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(tcpStreamManager->numTCPStreams == tcpStreamManager->maxTCPStreams);
+    HAPPrecondition(tcpStreamManager->evictionIdleTime);
+
+    HAPPlatformTCPStream* leastRecentlyActiveTCPStream = NULL;
+    for (size_t i = 0; i < tcpStreamManager->maxTCPStreams; i++) {
+        HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+        if (tcpStream->fileDescriptor == -1) {
+            continue;
+        }
+        if (tcpStream->isEvicted) {
+            // Wait for the evicted TCP stream to be closed.
+            SetAcceptSuspended(tcpStreamManager, true);
+            return;
+        }
+        if (!leastRecentlyActiveTCPStream ||
+            tcpStream->lastActivityTime < leastRecentlyActiveTCPStream->lastActivityTime) {
+            leastRecentlyActiveTCPStream = tcpStream;
+        }
+    }
+    HAPAssert(leastRecentlyActiveTCPStream);
+    HAPPlatformTCPStream* tcpStream = leastRecentlyActiveTCPStream;
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+    HAPTime idleTime = now - tcpStream->lastActivityTime;
+    if (idleTime < tcpStreamManager->evictionIdleTime) {
+        SetAcceptSuspended(tcpStreamManager, true);
+        if (!tcpStreamManager->evictionTimer) {
+            HAPError err = HAPPlatformTimerRegister(
+                    &tcpStreamManager->evictionTimer,
+                    tcpStream->lastActivityTime + tcpStreamManager->evictionIdleTime,
+                    HandleEvictionTimerExpired,
+                    tcpStreamManager);
+            if (err) {
+                HAPAssert(err == kHAPError_OutOfResources);
+                HAPLogError(
+                        &logObject,
+                        "Not enough resources to schedule TCP stream eviction. Retrying on TCP stream activity.");
+                tcpStreamManager->isEvictionRetryPending = true;
+            }
+        }
+        return;
+    }
+
+    HAPLogInfo(
+            &logObject,
+            "Evicting TCP stream %d: inactive for %llu ms.",
+            tcpStream->fileDescriptor,
+            (unsigned long long) idleTime);
+    HAPLogDebug(&logObject, "shutdown(%d, SHUT_RDWR);", tcpStream->fileDescriptor);
+    int e = shutdown(tcpStream->fileDescriptor, SHUT_RDWR);
+    if (e != 0) {
+        int _errno = errno;
+        HAPAssert(e == -1);
+        HAPPlatformLogPOSIXError(
+                kHAPLogType_Debug,
+                "System call 'shutdown' on TCP stream socket failed.",
+                _errno,
+                __func__,
+                HAP_FILE,
+                __LINE__);
+    }
+    tcpStream->isEvicted = true;
+    tcpStreamManager->numEvictedTCPStreams++;
+    SetAcceptSuspended(tcpStreamManager, true);
+}
+
+/**
+ * Records activity on a TCP stream.
+ *
+ * - If scheduling an eviction failed, accepting is resumed, so that the pending connection retries the eviction.
+ *
+ * @param      tcpStreamManager     TCP stream manager.
+ */
+static void HandleTCPStreamActivity(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
+    HAPPrecondition(tcpStreamManager);
+
+    if (!tcpStreamManager->isEvictionRetryPending) {
+        return;
+    }
+    tcpStreamManager->isEvictionRetryPending = false;
+    if (tcpStreamManager->tcpStreamListener.tcpStreamManager) {
+        SetAcceptSuspended(tcpStreamManager, false);
+    }
+}
+
+/**
+ * Invokes the pending write callback after data has been written to a TCP stream.
+ */
+static void HandleWritten(HAPPlatformTCPStreamManagerRef tcpStreamManager, HAPTime now) {
+    HAPPrecondition(tcpStreamManager);
+
+    HAPPlatformTCPStreamManagerWriteCallback _Nullable callback = tcpStreamManager->writeCallback;
+    if (!callback) {
+        return;
+    }
+    void* _Nullable context = tcpStreamManager->writeCallbackContext;
+    tcpStreamManager->writeCallback = NULL;
+    tcpStreamManager->writeCallbackContext = NULL;
+    callback(tcpStreamManager, now, context);
+}
+
 void HAPPlatformTCPStreamManagerCreate(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
         const HAPPlatformTCPStreamManagerOptions* options) {
@@ -142,24 +373,57 @@ void HAPPlatformTCPStreamManagerCreate(
 
     tcpStreamManager->numTCPStreams = 0;
     tcpStreamManager->maxTCPStreams = options->maxConcurrentTCPStreams;
+    tcpStreamManager->ipSessionPool = options->ipSessionPool;
+
+    tcpStreamManager->keepAlive.idleTime =
+            options->keepAlive.idleTime ? options->keepAlive.idleTime : CONFIG_HAP_TCP_STREAM_KEEPALIVE_IDLE;
+    tcpStreamManager->keepAlive.interval =
+            options->keepAlive.interval ? options->keepAlive.interval : CONFIG_HAP_TCP_STREAM_KEEPALIVE_INTERVAL;
+    tcpStreamManager->keepAlive.count =
+            options->keepAlive.count ? options->keepAlive.count : CONFIG_HAP_TCP_STREAM_KEEPALIVE_COUNT;
+    tcpStreamManager->evictionIdleTime = options->evictionIdleTime ?
+                                                 options->evictionIdleTime :
+                                                 (HAPTime) CONFIG_HAP_TCP_STREAM_EVICTION_IDLE_TIME * HAPSecond;
 
     HAPLogDebug(&logObject, "Storage configuration: tcpStreamManager = %lu", (unsigned long) sizeof *tcpStreamManager);
     HAPLogDebug(
             &logObject, "Storage configuration: maxTCPStreams = %lu", (unsigned long) tcpStreamManager->maxTCPStreams);
     HAPLogDebug(
             &logObject,
-            "Storage configuration: tcpStreams = %lu",
-            (unsigned long) tcpStreamManager->maxTCPStreams * sizeof(HAPPlatformTCPStream));
+            "Storage configuration: tcpStreams = %lu (%s)",
+            (unsigned long) tcpStreamManager->maxTCPStreams * sizeof(HAPPlatformTCPStream),
+            options->arena ? "arena" : "heap");
+    HAPLogDebug(
+            &logObject,
+            "Keepalive configuration: idle = %lu s, interval = %lu s, count = %lu",
+            (unsigned long) tcpStreamManager->keepAlive.idleTime,
+            (unsigned long) tcpStreamManager->keepAlive.interval,
+            (unsigned long) tcpStreamManager->keepAlive.count);
+    HAPLogDebug(
+            &logObject,
+            "Eviction configuration: evictionIdleTime = %llu ms",
+            (unsigned long long) tcpStreamManager->evictionIdleTime);
 
     InitializeTCPStreamListener(&tcpStreamManager->tcpStreamListener);
 
-    tcpStreamManager->tcpStreams = malloc(tcpStreamManager->maxTCPStreams * sizeof(HAPPlatformTCPStream));
+    size_t numTCPStreamBytes = tcpStreamManager->maxTCPStreams * sizeof(HAPPlatformTCPStream);
+    if (options->arena) {
+        tcpStreamManager->arena = options->arena;
+        tcpStreamManager->tcpStreams = HAPPlatformArenaAllocate(HAPNonnull(options->arena), numTCPStreamBytes);
+    } else {
+        tcpStreamManager->tcpStreams = malloc(numTCPStreamBytes);
+    }
     if (!tcpStreamManager->tcpStreams) {
         HAPLogError(&logObject, "Allocating new TCP stream failed: out of memory.");
         HAPFatalError();
     }
-    for (size_t i = 0; i < tcpStreamManager->maxTCPStreams; i++) {
-        InitializeTCPStream(&tcpStreamManager->tcpStreams[i]);
+
+    // Thread all TCP streams onto the free list, lowest index first.
+    for (size_t i = tcpStreamManager->maxTCPStreams; i-- > 0;) {
+        HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+        InitializeTCPStream(tcpStream);
+        tcpStream->nextFreeTCPStream = tcpStreamManager->freeTCPStreams;
+        tcpStreamManager->freeTCPStreams = tcpStream;
     }
 }
 
@@ -167,8 +431,45 @@ void HAPPlatformTCPStreamManagerRelease(HAPPlatformTCPStreamManagerRef tcpStream
     HAPPrecondition(tcpStreamManager);
     HAPPrecondition(tcpStreamManager->tcpStreams);
 
-    HAPPlatformFreeSafe(tcpStreamManager->tcpStreams);
+    CancelEvictionTimer(tcpStreamManager);
+
+    tcpStreamManager->writeCallback = NULL;
+    tcpStreamManager->writeCallbackContext = NULL;
+
+    if (tcpStreamManager->arena) {
+        // Arena storage is released together with the arena.
+        tcpStreamManager->arena = NULL;
+    } else {
+        HAPPlatformFreeSafe(tcpStreamManager->tcpStreams);
+    }
     tcpStreamManager->tcpStreams = NULL;
+    tcpStreamManager->freeTCPStreams = NULL;
+}
+
+void HAPPlatformTCPStreamManagerObserveNextWrite(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerWriteCallback _Nullable callback,
+        void* _Nullable context) {
+    HAPPrecondition(tcpStreamManager);
+
+    tcpStreamManager->writeCallback = callback;
+    tcpStreamManager->writeCallbackContext = callback ? context : NULL;
+}
+
+void HAPPlatformTCPStreamManagerGetStatistics(
+        HAPPlatformTCPStreamManagerRef tcpStreamManager,
+        HAPPlatformTCPStreamManagerStatistics* statistics) {
+    HAPPrecondition(tcpStreamManager);
+    HAPPrecondition(statistics);
+
+    *statistics = (HAPPlatformTCPStreamManagerStatistics) {
+        .numTCPStreams = tcpStreamManager->numTCPStreams,
+        .maxTCPStreams = tcpStreamManager->maxTCPStreams,
+        .maxConcurrentTCPStreams = tcpStreamManager->maxConcurrentTCPStreams,
+        .numAcceptedTCPStreams = tcpStreamManager->numAcceptedTCPStreams,
+        .numRejectedTCPStreams = tcpStreamManager->numRejectedTCPStreams,
+        .numEvictedTCPStreams = tcpStreamManager->numEvictedTCPStreams
+    };
 }
 
 HAP_RESULT_USE_CHECK
@@ -179,11 +480,6 @@ bool HAPPlatformTCPStreamManagerIsListenerOpen(HAPPlatformTCPStreamManagerRef tc
     return tcpStreamManager->tcpStreamListener.tcpStreamManager != NULL;
 }
 
-static void HandleTCPStreamListenerFileHandleCallback(
-        HAPPlatformFileHandleRef fileHandle,
-        HAPPlatformFileHandleEvent fileHandleEvents,
-        void* _Nullable context);
-
 void HAPPlatformTCPStreamManagerOpenListener(
         HAPPlatformTCPStreamManagerRef tcpStreamManager,
         HAPPlatformTCPStreamListenerCallback callback,
@@ -310,6 +606,7 @@ void HAPPlatformTCPStreamManagerOpenListener(
     tcpStreamManager->tcpStreamListener.fileHandle = fileHandle;
     tcpStreamManager->tcpStreamListener.callback = callback;
     tcpStreamManager->tcpStreamListener.context = context;
+    tcpStreamManager->isAcceptSuspended = false;
 }
 
 void HAPPlatformTCPStreamManagerCloseListener(HAPPlatformTCPStreamManagerRef tcpStreamManager) {
@@ -322,6 +619,7 @@ void HAPPlatformTCPStreamManagerCloseListener(HAPPlatformTCPStreamManagerRef tcp
 
     int e;
 
+    CancelEvictionTimer(tcpStreamManager);
     HAPPlatformFileHandleDeregister(tcpStreamManager->tcpStreamListener.fileHandle);
 
     HAPLogDebug(&logObject, "shutdown(%d, SHUT_RDWR);", tcpStreamManager->tcpStreamListener.fileDescriptor);
@@ -353,6 +651,7 @@ void HAPPlatformTCPStreamManagerCloseListener(HAPPlatformTCPStreamManagerRef tcp
     }
 
     InitializeTCPStreamListener(&tcpStreamManager->tcpStreamListener);
+    tcpStreamManager->isAcceptSuspended = false;
 }
 
 static void HandleTCPStreamFileHandleCallback(
@@ -381,14 +680,9 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
 
     HAPAssert(tcpStreamManager->numTCPStreams < tcpStreamManager->maxTCPStreams);
 
-    // Find free TCP stream.
-    size_t i = 0;
-    while ((i < tcpStreamManager->maxTCPStreams) && (tcpStreamManager->tcpStreams[i].fileDescriptor != -1)) {
-        i++;
-    }
-    HAPAssert(i < tcpStreamManager->maxTCPStreams);
-
-    HAPPlatformTCPStream* tcpStream = &tcpStreamManager->tcpStreams[i];
+    // Take free TCP stream. It is only removed from the free list once the connection has been accepted.
+    HAPPlatformTCPStream* tcpStream = tcpStreamManager->freeTCPStreams;
+    HAPAssert(tcpStream);
 
     HAPAssert(!tcpStream->tcpStreamManager);
     HAPAssert(tcpStream->fileDescriptor == -1);
@@ -414,6 +708,23 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
         return kHAPError_Busy;
     }
 
+    // Map session buffers.
+    void* _Nullable ipSessionBuffers = NULL;
+    if (tcpStreamManager->ipSessionPool) {
+        void* bufferSet;
+        err = HAPPlatformIPSessionPoolAcquireBuffers(HAPNonnull(tcpStreamManager->ipSessionPool), &bufferSet);
+        if (err) {
+            HAPAssert(err == kHAPError_OutOfResources);
+            HAPLog(&logObject, "Rejecting TCP stream: no IP session buffers available.");
+            tcpStreamManager->numRejectedTCPStreams++;
+            HAPLogDebug(&logObject, "close(%d);", fileDescriptor);
+            (void) close(fileDescriptor);
+            *tcpStream_ = (HAPPlatformTCPStreamRef) NULL;
+            return kHAPError_OutOfResources;
+        }
+        ipSessionBuffers = bufferSet;
+    }
+
     // Configure socket.
     int e = SetNonblocking(fileDescriptor);
     if (e != 0) {
@@ -425,6 +736,13 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
         HAPLogError(&logObject, "Failed to disable Nagle's algorithm for TCP stream socket.");
         HAPFatalError();
     }
+    if (tcpStreamManager->keepAlive.idleTime) {
+        err = SetKeepAlive(tcpStreamManager, fileDescriptor);
+        if (err) {
+            HAPAssert(err == kHAPError_Unknown);
+            HAPLog(&logObject, "Failed to enable keepalive for TCP stream socket. Continuing without keepalive.");
+        }
+    }
 
     HAPPlatformFileHandleRef fileHandle;
     err = HAPPlatformFileHandleRegister(
@@ -440,9 +758,14 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
     }
     HAPAssert(fileHandle);
 
+    tcpStreamManager->freeTCPStreams = tcpStream->nextFreeTCPStream;
+    tcpStream->nextFreeTCPStream = NULL;
+
     tcpStream->tcpStreamManager = tcpStreamManager;
     tcpStream->fileDescriptor = fileDescriptor;
     tcpStream->fileHandle = fileHandle;
+    tcpStream->lastActivityTime = HAPPlatformClockGetCurrent();
+    tcpStream->ipSessionBuffers = ipSessionBuffers;
     HAPAssert(!tcpStream->interests.hasBytesAvailable);
     HAPAssert(!tcpStream->interests.hasSpaceAvailable);
     HAPAssert(!tcpStream->callback);
@@ -451,15 +774,17 @@ HAPError HAPPlatformTCPStreamManagerAcceptTCPStream(
     *tcpStream_ = (HAPPlatformTCPStreamRef) tcpStream;
 
     tcpStreamManager->numTCPStreams++;
+    tcpStreamManager->numAcceptedTCPStreams++;
+    tcpStreamManager->maxConcurrentTCPStreams =
+            HAPMax(tcpStreamManager->maxConcurrentTCPStreams, tcpStreamManager->numTCPStreams);
 
     if (tcpStreamManager->maxTCPStreams - tcpStreamManager->numTCPStreams == 0) {
-        HAPLogInfo(&logObject, "Suspending accepting new TCP streams on TCP stream listener socket.");
-        HAPPlatformFileHandleUpdateInterests(
-                tcpStreamManager->tcpStreamListener.fileHandle,
-                (HAPPlatformFileHandleEvent) {
-                        .isReadyForReading = false, .isReadyForWriting = false, .hasErrorConditionPending = false },
-                HandleTCPStreamListenerFileHandleCallback,
-                &tcpStreamManager->tcpStreamListener);
+        if (tcpStreamManager->evictionIdleTime) {
+            // Keep listening. The next pending connection triggers eviction of an idle TCP stream.
+            HAPLogInfo(&logObject, "All TCP streams in use. Idle TCP streams are evicted for new connections.");
+        } else {
+            SetAcceptSuspended(tcpStreamManager, true);
+        }
     }
 
     return kHAPError_None;
@@ -536,7 +861,15 @@ void HAPPlatformTCPStreamClose(HAPPlatformTCPStreamManagerRef tcpStreamManager,
                 __LINE__);
     }
 
+    if (tcpStream->ipSessionBuffers) {
+        HAPAssert(tcpStreamManager->ipSessionPool);
+        HAPPlatformIPSessionPoolReleaseBuffers(
+                HAPNonnull(tcpStreamManager->ipSessionPool), HAPNonnullVoid(tcpStream->ipSessionBuffers));
+    }
+
     InitializeTCPStream(tcpStream);
+    tcpStream->nextFreeTCPStream = tcpStreamManager->freeTCPStreams;
+    tcpStreamManager->freeTCPStreams = tcpStream;
 
     HAPAssert(tcpStreamManager->numTCPStreams <= tcpStreamManager->maxTCPStreams);
 
@@ -548,13 +881,8 @@ void HAPPlatformTCPStreamClose(HAPPlatformTCPStreamManagerRef tcpStreamManager,
         HAPAssert(tcpStreamManager->tcpStreamListener.tcpStreamManager == tcpStreamManager);
         HAPAssert(tcpStreamManager->tcpStreamListener.fileHandle);
         if (tcpStreamManager->maxTCPStreams - tcpStreamManager->numTCPStreams == 1) {
-            HAPLogInfo(&logObject, "Resuming accepting new TCP streams on TCP stream listener socket.");
-            HAPPlatformFileHandleUpdateInterests(
-                    tcpStreamManager->tcpStreamListener.fileHandle,
-                    (HAPPlatformFileHandleEvent) {
-                            .isReadyForReading = true, .isReadyForWriting = false, .hasErrorConditionPending = false },
-                    HandleTCPStreamListenerFileHandleCallback,
-                    &tcpStreamManager->tcpStreamListener);
+            CancelEvictionTimer(tcpStreamManager);
+            SetAcceptSuspended(tcpStreamManager, false);
         }
     } else {
         HAPAssert(!tcpStreamManager->tcpStreamListener.tcpStreamManager);
@@ -636,6 +964,10 @@ HAPError HAPPlatformTCPStreamRead(
 
     HAPAssert(n >= 0);
     HAPAssert((size_t) n <= maxBytes);
+    if (n) {
+        tcpStream->lastActivityTime = HAPPlatformClockGetCurrent();
+        HandleTCPStreamActivity(tcpStreamManager);
+    }
     *numBytes = (size_t) n;
     return kHAPError_None;
 }
@@ -683,6 +1015,11 @@ HAPError HAPPlatformTCPStreamWrite(
 
     HAPAssert(n >= 0);
     HAPAssert((size_t) n <= maxBytes);
+    if (n) {
+        tcpStream->lastActivityTime = HAPPlatformClockGetCurrent();
+        HandleTCPStreamActivity(tcpStreamManager);
+        HandleWritten(tcpStreamManager, tcpStream->lastActivityTime);
+    }
     *numBytes = (size_t) n;
     return kHAPError_None;
 }
@@ -703,6 +1040,13 @@ static void HandleTCPStreamListenerFileHandleCallback(
 
     HAPAssert(fileHandleEvents.isReadyForReading);
 
+    HAPPlatformTCPStreamManagerRef tcpStreamManager = listener->tcpStreamManager;
+    if (tcpStreamManager->numTCPStreams == tcpStreamManager->maxTCPStreams) {
+        // A connection is pending but all TCP streams are in use.
+        EvictIdleTCPStream(tcpStreamManager);
+        return;
+    }
+
     listener->callback(listener->tcpStreamManager, listener->context);
 }
 
@@ -0,0 +1,929 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Simulated HomeKit controller.
+//
+// The controller speaks HAP over IP to the accessory server on the loopback interface:
+//
+//   1. Pair-verify with the long-term keys of a pairing that was provisioned into the key-value store.
+//
+//   2. Characteristic reads, writes and event subscriptions as HTTP requests that are encrypted with the session keys
+//      derived from the pair-verify shared secret.
+//
+// ChaCha20-Poly1305 is computed with OpenSSL directly instead of the crypto PAL. When the accessory links against the
+// ChaCha20-Poly1305 kernel of the port, the controller therefore cross-checks it against an independent implementation.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <esp_timer.h>
+#include <openssl/evp.h>
+
+#include "Controller.h"
+
+static const HAPLogObject logObject = { .subsystem = "com.apple.mfi.HomeKit.Bench", .category = "Controller" };
+
+/**
+ * Maximum number of samples per measurement of one controller.
+ */
+#define kController_MaxSamples ((size_t) 1 << 20)
+
+/**
+ * Time after which a blocking socket operation fails, in seconds.
+ */
+#define kController_SocketTimeout ((time_t) 10)
+
+/**
+ * Size of the inbound and outbound buffers in bytes.
+ */
+#define kConnection_BufferSize ((size_t) 4096)
+
+/**
+ * Maximum number of plaintext bytes per encrypted frame.
+ */
+#define kConnection_MaxFrameBytes ((size_t) 1024)
+
+/**
+ * Number of ChaCha20-Poly1305 nonce bytes. Shorter nonces are padded with leading zeros.
+ */
+#define kChaCha20Poly1305_NonceBytes ((size_t) 12)
+
+/**
+ * TLV types of pair-verify.
+ */
+/**@{*/
+#define kTLVType_Identifier ((uint8_t) 0x01)
+#define kTLVType_PublicKey  ((uint8_t) 0x03)
+#define kTLVType_EncryptedData ((uint8_t) 0x05)
+#define kTLVType_State      ((uint8_t) 0x06)
+#define kTLVType_Error      ((uint8_t) 0x07)
+#define kTLVType_Signature  ((uint8_t) 0x0A)
+/**@}*/
+
+/**
+ * Connection to the accessory server.
+ */
+typedef struct {
+    int fileDescriptor;
+
+    /** Whether pair-verify completed and traffic is encrypted. */
+    bool isSecured;
+    uint8_t writeKey[CHACHA20_POLY1305_KEY_BYTES];
+    uint8_t readKey[CHACHA20_POLY1305_KEY_BYTES];
+    uint64_t writeNonce;
+    uint64_t readNonce;
+
+    /** Bytes received from the socket that have not been decrypted yet. */
+    uint8_t inboundBytes[kConnection_BufferSize];
+    size_t numInboundBytes;
+
+    /** Plaintext bytes that have not been parsed yet. */
+    uint8_t plaintextBytes[kConnection_BufferSize];
+    size_t numPlaintextBytes;
+
+    /** Number of event notifications that were received. */
+    size_t numEvents;
+} Connection;
+
+/**
+ * HTTP response.
+ */
+typedef struct {
+    unsigned int status;
+    uint8_t body[kConnection_BufferSize];
+    size_t numBodyBytes;
+} Response;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * TLV8 writer.
+ */
+typedef struct {
+    uint8_t* bytes;
+    size_t maxBytes;
+    size_t numBytes;
+} TLVWriter;
+
+HAP_RESULT_USE_CHECK
+static HAPError TLVAppend(TLVWriter* writer, uint8_t type, const void* value, size_t numValueBytes) {
+    HAPPrecondition(writer);
+    HAPPrecondition(value || !numValueBytes);
+
+    const uint8_t* valueBytes = value;
+    do {
+        size_t numFragmentBytes = HAPMin(numValueBytes, (size_t) UINT8_MAX);
+        if (writer->maxBytes - writer->numBytes < 2 + numFragmentBytes) {
+            return kHAPError_OutOfResources;
+        }
+        writer->bytes[writer->numBytes++] = type;
+        writer->bytes[writer->numBytes++] = (uint8_t) numFragmentBytes;
+        if (numFragmentBytes) {
+            HAPRawBufferCopyBytes(&writer->bytes[writer->numBytes], valueBytes, numFragmentBytes);
+        }
+        writer->numBytes += numFragmentBytes;
+        valueBytes += numFragmentBytes;
+        numValueBytes -= numFragmentBytes;
+    } while (numValueBytes);
+    return kHAPError_None;
+}
+
+/**
+ * Finds a TLV item and concatenates its fragments.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_InvalidData    If the TLV item is missing, malformed or larger than maxValueBytes.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError TLVFind(
+        const uint8_t* bytes,
+        size_t numBytes,
+        uint8_t type,
+        uint8_t* value,
+        size_t maxValueBytes,
+        size_t* numValueBytes) {
+    HAPPrecondition(bytes);
+    HAPPrecondition(value);
+    HAPPrecondition(numValueBytes);
+
+    bool found = false;
+    *numValueBytes = 0;
+    for (size_t i = 0; i < numBytes;) {
+        if (numBytes - i < 2 || numBytes - i - 2 < bytes[i + 1]) {
+            return kHAPError_InvalidData;
+        }
+        uint8_t itemType = bytes[i];
+        size_t numItemBytes = bytes[i + 1];
+        if (itemType == type) {
+            if (maxValueBytes - *numValueBytes < numItemBytes) {
+                return kHAPError_InvalidData;
+            }
+            HAPRawBufferCopyBytes(&value[*numValueBytes], &bytes[i + 2], numItemBytes);
+            *numValueBytes += numItemBytes;
+            found = true;
+        } else if (found) {
+            break;
+        }
+        i += 2 + numItemBytes;
+    }
+    return found ? kHAPError_None : kHAPError_InvalidData;
+}
+
+/**
+ * Checks the State of a pair-verify response and that it does not carry an Error.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError TLVCheckState(const uint8_t* bytes, size_t numBytes, uint8_t expectedState) {
+    HAPPrecondition(bytes);
+
+    HAPError err;
+
+    uint8_t value[1];
+    size_t numValueBytes;
+    if (!TLVFind(bytes, numBytes, kTLVType_Error, value, sizeof value, &numValueBytes)) {
+        HAPLogError(&logObject, "Pair-verify M%u: Error %u.", expectedState, numValueBytes ? value[0] : 0);
+        return kHAPError_InvalidData;
+    }
+    err = TLVFind(bytes, numBytes, kTLVType_State, value, sizeof value, &numValueBytes);
+    if (err || numValueBytes != 1 || value[0] != expectedState) {
+        HAPLogError(&logObject, "Pair-verify M%u: Unexpected state.", expectedState);
+        return kHAPError_InvalidData;
+    }
+    return kHAPError_None;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+HAP_RESULT_USE_CHECK
+static HAPError ConnectionOpen(Connection* connection, HAPNetworkPort port) {
+    HAPPrecondition(connection);
+
+    HAPRawBufferZero(connection, sizeof *connection);
+    connection->fileDescriptor = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection->fileDescriptor < 0) {
+        HAPLogError(&logObject, "socket failed: %d.", errno);
+        return kHAPError_Unknown;
+    }
+
+    int on = 1;
+    (void) setsockopt(connection->fileDescriptor, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    struct timeval timeout = { .tv_sec = kController_SocketTimeout };
+    (void) setsockopt(connection->fileDescriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    (void) setsockopt(connection->fileDescriptor, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+    struct sockaddr_in address = { .sin_family = AF_INET,
+                                   .sin_port = htons(port),
+                                   .sin_addr = { .s_addr = htonl(INADDR_LOOPBACK) } };
+    if (connect(connection->fileDescriptor, (const struct sockaddr*) &address, sizeof address)) {
+        HAPLogError(&logObject, "connect failed: %d.", errno);
+        close(connection->fileDescriptor);
+        connection->fileDescriptor = -1;
+        return kHAPError_Unknown;
+    }
+    return kHAPError_None;
+}
+
+static void ConnectionClose(Connection* connection) {
+    HAPPrecondition(connection);
+
+    if (connection->fileDescriptor >= 0) {
+        close(connection->fileDescriptor);
+        connection->fileDescriptor = -1;
+    }
+    HAPRawBufferZero(connection->writeKey, sizeof connection->writeKey);
+    HAPRawBufferZero(connection->readKey, sizeof connection->readKey);
+}
+
+/**
+ * Sets up a ChaCha20-Poly1305 context and feeds the additional authenticated data.
+ */
+HAP_RESULT_USE_CHECK
+static bool ChaCha20Poly1305Init(
+        EVP_CIPHER_CTX* ctx,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[CHACHA20_POLY1305_KEY_BYTES],
+        int enc) {
+    HAPPrecondition(ctx);
+    HAPPrecondition(n);
+    HAPPrecondition(n_len <= kChaCha20Poly1305_NonceBytes);
+    HAPPrecondition(k);
+
+    uint8_t nonce[kChaCha20Poly1305_NonceBytes] = { 0 };
+    HAPRawBufferCopyBytes(&nonce[sizeof nonce - n_len], n, n_len);
+    int outl;
+    return EVP_CipherInit_ex(ctx, EVP_chacha20_poly1305(), NULL, k, nonce, enc) == 1 &&
+           (!a_len || EVP_CipherUpdate(ctx, NULL, &outl, a, (int) a_len) == 1);
+}
+
+/**
+ * Encrypts with ChaCha20-Poly1305. Same signature as HAP_chacha20_poly1305_encrypt_aad.
+ */
+static void ChaCha20Poly1305Encrypt(
+        uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+        uint8_t* c,
+        const uint8_t* m,
+        size_t m_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]) {
+    HAPPrecondition(tag);
+    HAPPrecondition(c);
+    HAPPrecondition(m);
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    HAPAssert(ctx);
+    int outl;
+    bool ok = ChaCha20Poly1305Init(ctx, a, a_len, n, n_len, k, 1) &&
+              EVP_CipherUpdate(ctx, c, &outl, m, (int) m_len) == 1 && EVP_CipherFinal_ex(ctx, c, &outl) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, CHACHA20_POLY1305_TAG_BYTES, tag) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    HAPAssert(ok);
+}
+
+/**
+ * Decrypts with ChaCha20-Poly1305. Same signature as HAP_chacha20_poly1305_decrypt_aad.
+ *
+ * @return 0                            If the tag is valid.
+ * @return -1                           Otherwise.
+ */
+HAP_RESULT_USE_CHECK
+static int ChaCha20Poly1305Decrypt(
+        const uint8_t tag[CHACHA20_POLY1305_TAG_BYTES],
+        uint8_t* m,
+        const uint8_t* c,
+        size_t c_len,
+        const uint8_t* _Nullable a,
+        size_t a_len,
+        const uint8_t* n,
+        size_t n_len,
+        const uint8_t k[CHACHA20_POLY1305_KEY_BYTES]) {
+    HAPPrecondition(tag);
+    HAPPrecondition(m);
+    HAPPrecondition(c);
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    HAPAssert(ctx);
+    int outl;
+    bool ok = ChaCha20Poly1305Init(ctx, a, a_len, n, n_len, k, 0) &&
+              EVP_CipherUpdate(ctx, m, &outl, c, (int) c_len) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, CHACHA20_POLY1305_TAG_BYTES, (void*) tag) == 1 &&
+              EVP_CipherFinal_ex(ctx, m, &outl) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok ? 0 : -1;
+}
+
+HAP_RESULT_USE_CHECK
+static HAPError SendAll(int fileDescriptor, const uint8_t* bytes, size_t numBytes) {
+    while (numBytes) {
+        ssize_t n = send(fileDescriptor, bytes, numBytes, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            HAPLogError(&logObject, "send failed: %d.", errno);
+            return kHAPError_Unknown;
+        }
+        bytes += n;
+        numBytes -= (size_t) n;
+    }
+    return kHAPError_None;
+}
+
+/**
+ * Sends bytes, encrypting them into frames once the connection is secured.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ConnectionSend(Connection* connection, const uint8_t* bytes, size_t numBytes) {
+    HAPPrecondition(connection);
+    HAPPrecondition(bytes);
+
+    if (!connection->isSecured) {
+        return SendAll(connection->fileDescriptor, bytes, numBytes);
+    }
+
+    uint8_t frames[kConnection_BufferSize + 4 * (2 + CHACHA20_POLY1305_TAG_BYTES)];
+    size_t numFrameBytes = 0;
+    while (numBytes) {
+        size_t numChunkBytes = HAPMin(numBytes, kConnection_MaxFrameBytes);
+        if (sizeof frames - numFrameBytes < 2 + numChunkBytes + CHACHA20_POLY1305_TAG_BYTES) {
+            return kHAPError_OutOfResources;
+        }
+        uint8_t* frame = &frames[numFrameBytes];
+        frame[0] = (uint8_t)(numChunkBytes & 0xFF);
+        frame[1] = (uint8_t)(numChunkBytes >> 8);
+        uint8_t nonce[] = { HAPExpandLittleUInt64(connection->writeNonce) };
+        ChaCha20Poly1305Encrypt(
+                &frame[2 + numChunkBytes],
+                &frame[2],
+                bytes,
+                numChunkBytes,
+                frame,
+                2,
+                nonce,
+                sizeof nonce,
+                connection->writeKey);
+        connection->writeNonce++;
+        numFrameBytes += 2 + numChunkBytes + CHACHA20_POLY1305_TAG_BYTES;
+        bytes += numChunkBytes;
+        numBytes -= numChunkBytes;
+    }
+    return SendAll(connection->fileDescriptor, frames, numFrameBytes);
+}
+
+/**
+ * Receives bytes and appends the plaintext that is complete to the plaintext buffer.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ConnectionFill(Connection* connection) {
+    HAPPrecondition(connection);
+
+    if (connection->numInboundBytes == sizeof connection->inboundBytes) {
+        return kHAPError_OutOfResources;
+    }
+    ssize_t n;
+    do {
+        n = recv(connection->fileDescriptor,
+                 &connection->inboundBytes[connection->numInboundBytes],
+                 sizeof connection->inboundBytes - connection->numInboundBytes,
+                 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        HAPLogError(&logObject, "recv failed: %s.", n ? strerror(errno) : "Connection closed");
+        return kHAPError_Unknown;
+    }
+    connection->numInboundBytes += (size_t) n;
+
+    size_t numConsumedBytes = 0;
+    for (;;) {
+        const uint8_t* frame = &connection->inboundBytes[numConsumedBytes];
+        size_t numFrameBytes = connection->numInboundBytes - numConsumedBytes;
+        size_t numChunkBytes;
+        if (!connection->isSecured) {
+            numChunkBytes = numFrameBytes;
+        } else {
+            if (numFrameBytes < 2) {
+                break;
+            }
+            numChunkBytes = (size_t) frame[0] | (size_t) frame[1] << 8;
+            if (numChunkBytes > kConnection_MaxFrameBytes) {
+                HAPLogError(&logObject, "Frame too long: %lu bytes.", (unsigned long) numChunkBytes);
+                return kHAPError_InvalidData;
+            }
+            if (numFrameBytes < 2 + numChunkBytes + CHACHA20_POLY1305_TAG_BYTES) {
+                break;
+            }
+        }
+        if (!numChunkBytes) {
+            break;
+        }
+        if (sizeof connection->plaintextBytes - connection->numPlaintextBytes < numChunkBytes) {
+            return kHAPError_OutOfResources;
+        }
+        uint8_t* plaintext = &connection->plaintextBytes[connection->numPlaintextBytes];
+        if (!connection->isSecured) {
+            HAPRawBufferCopyBytes(plaintext, frame, numChunkBytes);
+            numConsumedBytes += numChunkBytes;
+        } else {
+            uint8_t nonce[] = { HAPExpandLittleUInt64(connection->readNonce) };
+            int e = ChaCha20Poly1305Decrypt(
+                    &frame[2 + numChunkBytes],
+                    plaintext,
+                    &frame[2],
+                    numChunkBytes,
+                    frame,
+                    2,
+                    nonce,
+                    sizeof nonce,
+                    connection->readKey);
+            if (e) {
+                HAPLogError(&logObject, "Frame authentication failed.");
+                return kHAPError_InvalidData;
+            }
+            connection->readNonce++;
+            numConsumedBytes += 2 + numChunkBytes + CHACHA20_POLY1305_TAG_BYTES;
+        }
+        connection->numPlaintextBytes += numChunkBytes;
+    }
+    connection->numInboundBytes -= numConsumedBytes;
+    memmove(connection->inboundBytes, &connection->inboundBytes[numConsumedBytes], connection->numInboundBytes);
+    return kHAPError_None;
+}
+
+/**
+ * Parses an HTTP message from the plaintext buffer.
+ *
+ * - found is set if a complete message was parsed and consumed, and cleared if more bytes are needed.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_InvalidData    If the message is malformed.
+ * @return kHAPError_OutOfResources If the message does not fit into the buffers.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ConnectionParseMessage(Connection* connection, Response* response, bool* isEvent, bool* found) {
+    HAPPrecondition(connection);
+    HAPPrecondition(response);
+    HAPPrecondition(isEvent);
+    HAPPrecondition(found);
+
+    *found = false;
+    const char* bytes = (const char*) connection->plaintextBytes;
+    size_t numBytes = connection->numPlaintextBytes;
+    const char* end = memmem(bytes, numBytes, "\r\n\r\n", 4);
+    if (!end) {
+        return numBytes == sizeof connection->plaintextBytes ? kHAPError_OutOfResources : kHAPError_None;
+    }
+    size_t numHeaderBytes = (size_t)(end - bytes) + 4;
+
+    char header[kConnection_BufferSize + 1];
+    HAPRawBufferCopyBytes(header, bytes, numHeaderBytes);
+    header[numHeaderBytes] = '\0';
+    unsigned int status;
+    if (sscanf(header, "HTTP/1.1 %u", &status) == 1) {
+        *isEvent = false;
+    } else if (sscanf(header, "EVENT/1.0 %u", &status) == 1) {
+        *isEvent = true;
+    } else {
+        HAPLogError(&logObject, "Malformed HTTP message.");
+        return kHAPError_InvalidData;
+    }
+
+    size_t numBodyBytes = 0;
+    for (char* line = strstr(header, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        static const char contentLength[] = "Content-Length:";
+        if (!strncasecmp(&line[2], contentLength, sizeof contentLength - 1)) {
+            numBodyBytes = strtoul(&line[2 + sizeof contentLength - 1], NULL, 10);
+        }
+    }
+    if (numBodyBytes > sizeof response->body) {
+        HAPLogError(&logObject, "HTTP body too long: %lu bytes.", (unsigned long) numBodyBytes);
+        return kHAPError_OutOfResources;
+    }
+    if (numBytes - numHeaderBytes < numBodyBytes) {
+        return kHAPError_None;
+    }
+
+    response->status = status;
+    HAPRawBufferCopyBytes(response->body, &bytes[numHeaderBytes], numBodyBytes);
+    response->numBodyBytes = numBodyBytes;
+    connection->numPlaintextBytes -= numHeaderBytes + numBodyBytes;
+    memmove(connection->plaintextBytes,
+            &connection->plaintextBytes[numHeaderBytes + numBodyBytes],
+            connection->numPlaintextBytes);
+    *found = true;
+    return kHAPError_None;
+}
+
+/**
+ * Sends an HTTP request and receives its response. Event notifications received meanwhile are counted.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError ConnectionExchange(
+        Connection* connection,
+        const char* method,
+        const char* path,
+        const char* _Nullable contentType,
+        const void* _Nullable body,
+        size_t numBodyBytes,
+        Response* response) {
+    HAPPrecondition(connection);
+    HAPPrecondition(method);
+    HAPPrecondition(path);
+    HAPPrecondition(body || !numBodyBytes);
+    HAPPrecondition(response);
+
+    HAPError err;
+
+    uint8_t request[kConnection_BufferSize];
+    int n;
+    if (contentType) {
+        n = snprintf(
+                (char*) request,
+                sizeof request,
+                "%s %s HTTP/1.1\r\nHost: bench.local\r\nContent-Type: %s\r\nContent-Length: %lu\r\n\r\n",
+                method,
+                path,
+                contentType,
+                (unsigned long) numBodyBytes);
+    } else {
+        n = snprintf((char*) request, sizeof request, "%s %s HTTP/1.1\r\nHost: bench.local\r\n\r\n", method, path);
+    }
+    if (n < 0 || sizeof request - (size_t) n < numBodyBytes) {
+        return kHAPError_OutOfResources;
+    }
+    if (numBodyBytes) {
+        HAPRawBufferCopyBytes(&request[n], HAPNonnullVoid(body), numBodyBytes);
+    }
+    err = ConnectionSend(connection, request, (size_t) n + numBodyBytes);
+    if (err) {
+        return err;
+    }
+
+    for (;;) {
+        bool isEvent;
+        bool found;
+        err = ConnectionParseMessage(connection, response, &isEvent, &found);
+        if (err) {
+            return err;
+        }
+        if (!found) {
+            err = ConnectionFill(connection);
+            if (err) {
+                return err;
+            }
+        } else if (isEvent) {
+            connection->numEvents++;
+        } else {
+            return kHAPError_None;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+HAP_RESULT_USE_CHECK
+static HAPError PairVerify(Connection* connection, const ControllerOptions* options) {
+    HAPPrecondition(connection);
+    HAPPrecondition(options);
+
+    HAPError err;
+    Response response;
+    static const char contentType[] = "application/pairing+tlv8";
+
+    // M1.
+    uint8_t secretKey[X25519_SCALAR_BYTES];
+    HAPPlatformRandomNumberFill(secretKey, sizeof secretKey);
+    uint8_t publicKey[X25519_BYTES];
+    HAP_X25519_scalarmult_base(publicKey, secretKey);
+
+    uint8_t m1[64];
+    TLVWriter writer = { .bytes = m1, .maxBytes = sizeof m1 };
+    uint8_t state = 1;
+    err = TLVAppend(&writer, kTLVType_State, &state, sizeof state);
+    HAPAssert(!err);
+    err = TLVAppend(&writer, kTLVType_PublicKey, publicKey, sizeof publicKey);
+    HAPAssert(!err);
+    err = ConnectionExchange(connection, "POST", "/pair-verify", contentType, m1, writer.numBytes, &response);
+    if (err) {
+        return err;
+    }
+
+    // M2.
+    if (response.status != 200) {
+        HAPLogError(&logObject, "Pair-verify M2: HTTP status %u.", response.status);
+        return kHAPError_InvalidData;
+    }
+    err = TLVCheckState(response.body, response.numBodyBytes, 2);
+    if (err) {
+        return err;
+    }
+    uint8_t accessoryPublicKey[X25519_BYTES];
+    size_t numBytes;
+    err = TLVFind(
+            response.body,
+            response.numBodyBytes,
+            kTLVType_PublicKey,
+            accessoryPublicKey,
+            sizeof accessoryPublicKey,
+            &numBytes);
+    if (err || numBytes != sizeof accessoryPublicKey) {
+        HAPLogError(&logObject, "Pair-verify M2: Invalid public key.");
+        return kHAPError_InvalidData;
+    }
+    uint8_t encryptedData[256];
+    err = TLVFind(
+            response.body, response.numBodyBytes, kTLVType_EncryptedData, encryptedData, sizeof encryptedData, &numBytes);
+    if (err || numBytes < CHACHA20_POLY1305_TAG_BYTES) {
+        HAPLogError(&logObject, "Pair-verify M2: Invalid encrypted data.");
+        return kHAPError_InvalidData;
+    }
+
+    uint8_t sharedSecret[X25519_BYTES];
+    HAP_X25519_scalarmult(sharedSecret, secretKey, accessoryPublicKey);
+    HAPRawBufferZero(secretKey, sizeof secretKey);
+
+    static const char encryptSalt[] = "Pair-Verify-Encrypt-Salt";
+    static const char encryptInfo[] = "Pair-Verify-Encrypt-Info";
+    uint8_t sessionKey[CHACHA20_POLY1305_KEY_BYTES];
+    HAP_hkdf_sha512(
+            sessionKey,
+            sizeof sessionKey,
+            sharedSecret,
+            sizeof sharedSecret,
+            (const uint8_t*) encryptSalt,
+            sizeof encryptSalt - 1,
+            (const uint8_t*) encryptInfo,
+            sizeof encryptInfo - 1);
+
+    // The sub-TLV carries the identifier and signature of the accessory. Decrypting it authenticates the shared secret.
+    uint8_t subTLV[sizeof encryptedData];
+    size_t numSubTLVBytes = numBytes - CHACHA20_POLY1305_TAG_BYTES;
+    if (ChaCha20Poly1305Decrypt(
+                &encryptedData[numSubTLVBytes],
+                subTLV,
+                encryptedData,
+                numSubTLVBytes,
+                NULL,
+                0,
+                (const uint8_t*) "PV-Msg02",
+                8,
+                sessionKey)) {
+        HAPLogError(&logObject, "Pair-verify M2: Decryption failed.");
+        return kHAPError_InvalidData;
+    }
+
+    // M3.
+    size_t numIdentifierBytes = HAPStringGetNumBytes(options->identifier);
+    HAPPrecondition(numIdentifierBytes <= kControllerIdentifier_MaxBytes);
+    uint8_t info[X25519_BYTES + kControllerIdentifier_MaxBytes + X25519_BYTES];
+    HAPRawBufferCopyBytes(&info[0], publicKey, sizeof publicKey);
+    HAPRawBufferCopyBytes(&info[sizeof publicKey], options->identifier, numIdentifierBytes);
+    HAPRawBufferCopyBytes(
+            &info[sizeof publicKey + numIdentifierBytes], accessoryPublicKey, sizeof accessoryPublicKey);
+    uint8_t signature[ED25519_BYTES];
+    HAP_ed25519_sign(
+            signature,
+            info,
+            sizeof publicKey + numIdentifierBytes + sizeof accessoryPublicKey,
+            options->ltsk,
+            options->ltpk);
+
+    writer = (TLVWriter) { .bytes = subTLV, .maxBytes = sizeof subTLV - CHACHA20_POLY1305_TAG_BYTES };
+    err = TLVAppend(&writer, kTLVType_Identifier, options->identifier, numIdentifierBytes);
+    HAPAssert(!err);
+    err = TLVAppend(&writer, kTLVType_Signature, signature, sizeof signature);
+    HAPAssert(!err);
+    ChaCha20Poly1305Encrypt(
+            &encryptedData[writer.numBytes],
+            encryptedData,
+            subTLV,
+            writer.numBytes,
+            NULL,
+            0,
+            (const uint8_t*) "PV-Msg03",
+            8,
+            sessionKey);
+    HAPRawBufferZero(sessionKey, sizeof sessionKey);
+
+    uint8_t m3[sizeof encryptedData + 8];
+    size_t numEncryptedDataBytes = writer.numBytes + CHACHA20_POLY1305_TAG_BYTES;
+    writer = (TLVWriter) { .bytes = m3, .maxBytes = sizeof m3 };
+    state = 3;
+    err = TLVAppend(&writer, kTLVType_State, &state, sizeof state);
+    HAPAssert(!err);
+    err = TLVAppend(&writer, kTLVType_EncryptedData, encryptedData, numEncryptedDataBytes);
+    HAPAssert(!err);
+    err = ConnectionExchange(connection, "POST", "/pair-verify", contentType, m3, writer.numBytes, &response);
+    if (err) {
+        return err;
+    }
+
+    // M4.
+    if (response.status != 200) {
+        HAPLogError(&logObject, "Pair-verify M4: HTTP status %u.", response.status);
+        return kHAPError_InvalidData;
+    }
+    err = TLVCheckState(response.body, response.numBodyBytes, 4);
+    if (err) {
+        return err;
+    }
+
+    // Session keys.
+    static const char controlSalt[] = "Control-Salt";
+    static const char writeInfo[] = "Control-Write-Encryption-Key";
+    static const char readInfo[] = "Control-Read-Encryption-Key";
+    HAP_hkdf_sha512(
+            connection->writeKey,
+            sizeof connection->writeKey,
+            sharedSecret,
+            sizeof sharedSecret,
+            (const uint8_t*) controlSalt,
+            sizeof controlSalt - 1,
+            (const uint8_t*) writeInfo,
+            sizeof writeInfo - 1);
+    HAP_hkdf_sha512(
+            connection->readKey,
+            sizeof connection->readKey,
+            sharedSecret,
+            sizeof sharedSecret,
+            (const uint8_t*) controlSalt,
+            sizeof controlSalt - 1,
+            (const uint8_t*) readInfo,
+            sizeof readInfo - 1);
+    HAPRawBufferZero(sharedSecret, sizeof sharedSecret);
+    connection->isSecured = true;
+    return kHAPError_None;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+HAP_RESULT_USE_CHECK
+static HAPError PutCharacteristic(
+        Connection* connection,
+        const ControllerOptions* options,
+        const char* property,
+        bool value,
+        Response* response) {
+    char body[128];
+    HAPError err = HAPStringWithFormat(
+            body,
+            sizeof body,
+            "{\"characteristics\":[{\"aid\":%llu,\"iid\":%llu,\"%s\":%s}]}",
+            (unsigned long long) options->aid,
+            (unsigned long long) options->iid,
+            property,
+            value ? "true" : "false");
+    HAPAssert(!err);
+    err = ConnectionExchange(
+            connection, "PUT", "/characteristics", "application/hap+json", body, HAPStringGetNumBytes(body), response);
+    if (err) {
+        return err;
+    }
+    if (response->status != 204) {
+        HAPLogError(&logObject, "PUT /characteristics: HTTP status %u.", response->status);
+        return kHAPError_InvalidData;
+    }
+    return kHAPError_None;
+}
+
+/**
+ * Runs one session: pair-verify, an optional subscription and the characteristic requests.
+ */
+HAP_RESULT_USE_CHECK
+static HAPError RunSession(
+        Connection* connection,
+        const ControllerOptions* options,
+        ControllerResult* result,
+        unsigned int* writeCredit,
+        bool* value) {
+    HAPPrecondition(connection);
+    HAPPrecondition(options);
+    HAPPrecondition(result);
+    HAPPrecondition(writeCredit);
+    HAPPrecondition(value);
+
+    HAPError err;
+    Response response;
+
+    int64_t startTime = esp_timer_get_time();
+    err = ConnectionOpen(connection, options->port);
+    if (err) {
+        return err;
+    }
+    err = PairVerify(connection, options);
+    if (err) {
+        return err;
+    }
+    MeasurementRecord(&result->pairVerify, startTime);
+
+    if (options->subscribe) {
+        startTime = esp_timer_get_time();
+        err = PutCharacteristic(connection, options, "ev", true, &response);
+        if (err) {
+            return err;
+        }
+        MeasurementRecord(&result->subscribe, startTime);
+    }
+
+    char readPath[64];
+    err = HAPStringWithFormat(
+            readPath,
+            sizeof readPath,
+            "/characteristics?id=%llu.%llu",
+            (unsigned long long) options->aid,
+            (unsigned long long) options->iid);
+    HAPAssert(!err);
+
+    for (size_t i = 0; i < options->numRequests; i++) {
+        // Spread the writes evenly over the requests.
+        *writeCredit += options->writePercentage;
+        startTime = esp_timer_get_time();
+        if (*writeCredit >= 100) {
+            *writeCredit -= 100;
+            *value = !*value;
+            err = PutCharacteristic(connection, options, "value", *value, &response);
+            if (err) {
+                return err;
+            }
+            MeasurementRecord(&result->write, startTime);
+        } else {
+            err = ConnectionExchange(connection, "GET", readPath, NULL, NULL, 0, &response);
+            if (err) {
+                return err;
+            }
+            if (response.status != 200) {
+                HAPLogError(&logObject, "GET %s: HTTP status %u.", readPath, response.status);
+                return kHAPError_InvalidData;
+            }
+            MeasurementRecord(&result->read, startTime);
+        }
+    }
+    return kHAPError_None;
+}
+
+void ControllerResultCreate(ControllerResult* result, const ControllerOptions* options) {
+    HAPPrecondition(result);
+    HAPPrecondition(options);
+
+    HAPRawBufferZero(result, sizeof *result);
+    size_t numRequests = HAPMin(options->numSessions * options->numRequests, kController_MaxSamples);
+    MeasurementCreate(&result->pairVerify, "Pair-verify", options->numSessions);
+    MeasurementCreate(&result->read, "Characteristic read", numRequests);
+    MeasurementCreate(&result->write, "Characteristic write", numRequests);
+    MeasurementCreate(&result->subscribe, "Event subscription", options->subscribe ? options->numSessions : 0);
+}
+
+void ControllerResultRelease(ControllerResult* result) {
+    HAPPrecondition(result);
+
+    MeasurementRelease(&result->pairVerify);
+    MeasurementRelease(&result->read);
+    MeasurementRelease(&result->write);
+    MeasurementRelease(&result->subscribe);
+}
+
+void ControllerRun(const ControllerOptions* options, ControllerResult* result) {
+    HAPPrecondition(options);
+    HAPPrecondition(options->identifier);
+    HAPPrecondition(options->writePercentage <= 100);
+    HAPPrecondition(result);
+
+    Connection* connection = malloc(sizeof *connection);
+    if (!connection) {
+        HAPLogError(&logObject, "Cannot allocate connection.");
+        HAPFatalError();
+    }
+
+    unsigned int writeCredit = 0;
+    bool value = false;
+    for (size_t i = 0; i < options->numSessions; i++) {
+        HAPError err = RunSession(connection, options, result, &writeCredit, &value);
+        if (err) {
+            HAPLogError(&logObject, "Controller %s: Session %lu failed.", options->identifier, (unsigned long) i);
+            result->numErrors++;
+        }
+        result->numEvents += connection->numEvents;
+        ConnectionClose(connection);
+    }
+    free(connection);
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAPPlatform.h"
+#include "HAPCrypto.h"
+
+#include "Measurement.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**
+ * Maximum number of bytes of a controller pairing identifier.
+ */
+#define kControllerIdentifier_MaxBytes ((size_t) 36)
+
+/**
+ * Options of a simulated controller.
+ */
+typedef struct {
+    /**
+     * Port of the accessory server on the loopback interface.
+     */
+    HAPNetworkPort port;
+
+    /**
+     * Pairing identifier of the controller. Must be paired with the accessory.
+     */
+    const char* identifier;
+
+    /**
+     * Long-term secret key of the controller.
+     */
+    uint8_t ltsk[ED25519_SECRET_KEY_BYTES];
+
+    /**
+     * Long-term public key of the controller.
+     */
+    uint8_t ltpk[ED25519_PUBLIC_KEY_BYTES];
+
+    /**
+     * Number of sessions that are opened one after the other, each starting with a pair-verify.
+     */
+    size_t numSessions;
+
+    /**
+     * Number of characteristic reads and writes per session.
+     */
+    size_t numRequests;
+
+    /**
+     * Percentage of requests that are writes (0-100).
+     */
+    unsigned int writePercentage;
+
+    /**
+     * Whether each session subscribes to events of the characteristic before sending requests.
+     */
+    bool subscribe;
+
+    /**
+     * Accessory instance ID of the characteristic.
+     */
+    uint64_t aid;
+
+    /**
+     * Instance ID of the characteristic. Must be a writable Bool characteristic that supports event notifications.
+     */
+    uint64_t iid;
+} ControllerOptions;
+
+/**
+ * Results of a simulated controller.
+ */
+typedef struct {
+    /** Duration of pair-verify, from connecting until M4 was received. */
+    Measurement pairVerify;
+
+    /** Duration of characteristic reads. */
+    Measurement read;
+
+    /** Duration of characteristic writes. */
+    Measurement write;
+
+    /** Duration of event subscriptions. */
+    Measurement subscribe;
+
+    /** Number of event notifications that were received. */
+    size_t numEvents;
+
+    /** Number of sessions that were aborted because of an error. */
+    size_t numErrors;
+} ControllerResult;
+
+/**
+ * Initializes the results of a simulated controller.
+ *
+ * @param[out] result               Results.
+ * @param      options              Options of the controller.
+ */
+void ControllerResultCreate(ControllerResult* result, const ControllerOptions* options);
+
+/**
+ * Releases the results of a simulated controller.
+ *
+ * @param      result               Results.
+ */
+void ControllerResultRelease(ControllerResult* result);
+
+/**
+ * Runs a simulated controller. Blocks until all sessions have completed.
+ *
+ * - Must not be called from the run loop thread.
+ *
+ * - The signature of the accessory in pair-verify M2 is not verified, as the controllers are provisioned directly
+ *   into the key-value store and never learn the long-term public key of the accessory.
+ *
+ * @param      options              Options of the controller.
+ * @param      result               Results. Must have been initialized with ControllerResultCreate.
+ */
+void ControllerRun(const ControllerOptions* options, ControllerResult* result);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,96 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+#include <stdlib.h>
+
+#include <esp_timer.h>
+
+#include "Measurement.h"
+
+void MeasurementCreate(Measurement* measurement, const char* name, size_t maxSamples) {
+    HAPPrecondition(measurement);
+    HAPPrecondition(name);
+
+    HAPRawBufferZero(measurement, sizeof *measurement);
+    measurement->name = name;
+    if (maxSamples) {
+        measurement->samples = calloc(maxSamples, sizeof measurement->samples[0]);
+        if (!measurement->samples) {
+            HAPLogError(&kHAPLog_Default, "Cannot allocate %lu samples.", (unsigned long) maxSamples);
+            HAPFatalError();
+        }
+    }
+    measurement->maxSamples = maxSamples;
+}
+
+void MeasurementRelease(Measurement* measurement) {
+    HAPPrecondition(measurement);
+
+    free(measurement->samples);
+    HAPRawBufferZero(measurement, sizeof *measurement);
+}
+
+void MeasurementRecord(Measurement* measurement, int64_t startTime) {
+    HAPPrecondition(measurement);
+
+    int64_t duration = esp_timer_get_time() - startTime;
+    if (measurement->numSamples < measurement->maxSamples) {
+        measurement->samples[measurement->numSamples++] = (uint32_t) HAPMin(duration, (int64_t) UINT32_MAX);
+    }
+}
+
+void MeasurementMerge(Measurement* measurement, const Measurement* other) {
+    HAPPrecondition(measurement);
+    HAPPrecondition(other);
+
+    size_t numSamples = HAPMin(other->numSamples, measurement->maxSamples - measurement->numSamples);
+    if (numSamples) {
+        HAPRawBufferCopyBytes(
+                &measurement->samples[measurement->numSamples],
+                HAPNonnull(other->samples),
+                numSamples * sizeof other->samples[0]);
+        measurement->numSamples += numSamples;
+    }
+}
+
+static int CompareSamples(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+void MeasurementReport(Measurement* measurement, int64_t duration) {
+    HAPPrecondition(measurement);
+
+    if (!measurement->numSamples) {
+        HAPLogInfo(&kHAPLog_Default, "  %-28s n = %6lu", measurement->name, 0UL);
+        return;
+    }
+    qsort(HAPNonnull(measurement->samples), measurement->numSamples, sizeof measurement->samples[0], CompareSamples);
+    size_t n = measurement->numSamples;
+    const uint32_t* samples = HAPNonnull(measurement->samples);
+    char throughput[32] = "";
+    if (duration > 0) {
+        HAPError err = HAPStringWithFormat(
+                throughput, sizeof throughput, "  %8.1f op/s", (double) n * 1000000.0 / (double) duration);
+        HAPAssert(!err);
+    }
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  %-28s n = %6lu  p50 = %6lu us  p90 = %6lu us  p99 = %6lu us  max = %6lu us%s",
+            measurement->name,
+            (unsigned long) n,
+            (unsigned long) samples[n * 50 / 100],
+            (unsigned long) samples[n * 90 / 100],
+            (unsigned long) samples[n * 99 / 100],
+            (unsigned long) samples[n - 1],
+            throughput);
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAPPlatform.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**
+ * Latency samples of one operation, in microseconds.
+ */
+typedef struct {
+    const char* name;
+    size_t numSamples;
+    size_t maxSamples;
+    uint32_t* _Nullable samples;
+} Measurement;
+
+/**
+ * Initializes a measurement. Samples beyond maxSamples are dropped.
+ *
+ * @param[out] measurement          Measurement.
+ * @param      name                 Name of the operation.
+ * @param      maxSamples           Maximum number of samples.
+ */
+void MeasurementCreate(Measurement* measurement, const char* name, size_t maxSamples);
+
+/**
+ * Releases a measurement.
+ *
+ * @param      measurement          Measurement.
+ */
+void MeasurementRelease(Measurement* measurement);
+
+/**
+ * Records the time since startTime as a sample.
+ *
+ * @param      measurement          Measurement.
+ * @param      startTime            esp_timer_get_time at the start of the operation.
+ */
+void MeasurementRecord(Measurement* measurement, int64_t startTime);
+
+/**
+ * Appends the samples of another measurement.
+ *
+ * @param      measurement          Measurement.
+ * @param      other                Measurement whose samples are appended.
+ */
+void MeasurementMerge(Measurement* measurement, const Measurement* other);
+
+/**
+ * Logs the latency percentiles of a measurement and, if a duration is given, its throughput.
+ *
+ * - The samples are sorted.
+ *
+ * @param      measurement          Measurement.
+ * @param      duration             Wall time in microseconds over which the samples were taken. 0 to omit throughput.
+ */
+void MeasurementReport(Measurement* measurement, int64_t duration);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
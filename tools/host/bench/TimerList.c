@@ -0,0 +1,100 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+#include <stdlib.h>
+
+#include "TimerList.h"
+
+/**
+ * Timer in the sorted list.
+ */
+typedef struct ListTimer ListTimer;
+
+struct ListTimer {
+    /**
+     * Deadline at which the timer expires.
+     */
+    HAPTime deadline;
+
+    /**
+     * Callback that is invoked when the timer expires.
+     */
+    HAPPlatformTimerCallback callback;
+
+    /**
+     * The context parameter given to the TimerListRegister function.
+     */
+    void* _Nullable context;
+
+    /**
+     * Next timer in linked list.
+     */
+    ListTimer* _Nullable nextTimer;
+};
+
+/**
+ * Pending timers, in ascending order of their deadlines.
+ */
+static ListTimer* _Nullable timers;
+
+HAP_RESULT_USE_CHECK
+HAPError TimerListRegister(
+        HAPPlatformTimerRef* timer_,
+        HAPTime deadline,
+        HAPPlatformTimerCallback callback,
+        void* _Nullable context) {
+    HAPPrecondition(timer_);
+    ListTimer* _Nullable* newTimer = (ListTimer * _Nullable*) timer_;
+    HAPPrecondition(callback);
+
+    // Prepare timer.
+    *newTimer = calloc(1, sizeof(ListTimer));
+    if (!*newTimer) {
+        HAPLog(&kHAPLog_Default, "Cannot allocate more timers.");
+        return kHAPError_OutOfResources;
+    }
+    (*newTimer)->deadline = deadline ? deadline : 1;
+    (*newTimer)->callback = callback;
+    (*newTimer)->context = context;
+
+    // Insert timer.
+    for (ListTimer* _Nullable* nextTimer = &timers;; nextTimer = &(*nextTimer)->nextTimer) {
+        if (!*nextTimer) {
+            (*newTimer)->nextTimer = NULL;
+            *nextTimer = *newTimer;
+            break;
+        }
+        if ((*nextTimer)->deadline > deadline) {
+            (*newTimer)->nextTimer = *nextTimer;
+            *nextTimer = *newTimer;
+            break;
+        }
+    }
+
+    return kHAPError_None;
+}
+
+void TimerListDeregister(HAPPlatformTimerRef timer_) {
+    HAPPrecondition(timer_);
+    ListTimer* timer = (ListTimer*) timer_;
+
+    // Find and remove timer.
+    for (ListTimer* _Nullable* nextTimer = &timers; *nextTimer; nextTimer = &(*nextTimer)->nextTimer) {
+        if (*nextTimer == timer) {
+            *nextTimer = timer->nextTimer;
+            free(timer);
+            return;
+        }
+    }
+
+    // Timer not found.
+    HAPFatalError();
+}
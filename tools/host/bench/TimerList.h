@@ -0,0 +1,68 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+#ifndef TIMER_LIST_H
+#define TIMER_LIST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "HAPPlatform.h"
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull begin
+#endif
+
+/**@file
+ * Timers kept in a sorted linked list, as the run loop kept them before the timer heap.
+ *
+ * - Baseline for the timer benchmark. Each timer is allocated with calloc, and registration and deregistration
+ *   walk the list, so both are O(n) in the number of pending timers.
+ *
+ * - Timers never fire. The list only exists to be compared with HAPPlatformTimerRegister and
+ *   HAPPlatformTimerDeregister under the same load.
+ */
+
+/**
+ * Registers a timer in the sorted list.
+ *
+ * @param[out] timer                Non-zero timer object, if successful.
+ * @param      deadline             Deadline after which the timer expires.
+ * @param      callback             Function to call when the timer expires.
+ * @param      context              Context that is passed to the callback.
+ *
+ * @return kHAPError_None           If successful.
+ * @return kHAPError_OutOfResources If the timer could not be allocated.
+ */
+HAP_RESULT_USE_CHECK
+HAPError TimerListRegister(
+        HAPPlatformTimerRef* timer,
+        HAPTime deadline,
+        HAPPlatformTimerCallback callback,
+        void* _Nullable context);
+
+/**
+ * Deregisters a timer from the sorted list.
+ *
+ * @param      timer                Timer.
+ */
+void TimerListDeregister(HAPPlatformTimerRef timer);
+
+#if __has_feature(nullability)
+#pragma clang assume_nonnull end
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,860 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// End-to-end benchmark of the port on a POSIX host.
+//
+// The Lightbulb accessory runs on the port's run loop, TCP stream manager, key-value store and service discovery,
+// with the ESP-IDF services replaced by the shims in ../shims. Simulated controllers load the accessory server over
+// the loopback interface:
+//
+//   1. Timers. Timers are registered and deregistered while other timers are pending, before the server starts.
+//
+//   2. Scheduled callbacks. Callbacks are scheduled from another thread, as the ESP-IDF event handlers do.
+//
+//   3. Controllers. Every controller runs on its own thread. Each session pair-verifies with a pairing that was
+//      provisioned into the key-value store, optionally subscribes to the On characteristic, and reads and writes it.
+//      Writes by one controller raise events for the others.
+//
+// Throughput and latency percentiles are reported per operation, followed by the run loop, key-value store and
+// IP session pool statistics collected during the controller phase.
+
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#include "App.h"
+#include "DB.h"
+
+#include "HAP.h"
+#include "HAP+Internal.h"
+#include "HAPCrypto.h"
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformAccessorySetup+Init.h"
+#include "HAPPlatformDiagnostics+Init.h"
+#include "HAPPlatformArena+Init.h"
+#include "HAPPlatformIPSessionPool+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformKeyValueStore+SDKDomains.h"
+#include "HAPPlatformMFiTokenAuth+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+#include "HAPPlatformServiceDiscovery+Init.h"
+#include "HAPPlatformTCPStreamManager+Init.h"
+
+#include "Controller.h"
+#include "Measurement.h"
+#include "TimerList.h"
+
+/**
+ * Functions provided by App.c that are not declared in App.h.
+ */
+extern void AppInitialize(
+        HAPAccessoryServerOptions* hapAccessoryServerOptions,
+        HAPPlatform* hapPlatform,
+        HAPAccessoryServerCallbacks* hapAccessoryServerCallbacks);
+extern void AppDeinitialize();
+
+/**
+ * Number of concurrent TCP streams and IP sessions, as on the device.
+ */
+#define kIPNumSessions kHAPIPSessionStorage_MinimumNumElements
+
+/**
+ * Size of the arena backing the TCP streams.
+ */
+#define kIPArenaSize (kIPNumSessions * sizeof(HAPPlatformTCPStream) + sizeof(uint64_t))
+
+/**
+ * Name of the partition holding the accessory setup information.
+ */
+#define kFactoryPartitionName "fctry"
+
+/**
+ * Number of timers that are pending while timers are registered and deregistered.
+ */
+#define kBenchmarkNumBackgroundTimers ((size_t) 64)
+
+/**
+ * Number of timer registrations.
+ */
+#define kBenchmarkNumTimers ((size_t) 10000)
+
+/**
+ * Number of callbacks scheduled from another thread.
+ */
+#define kBenchmarkNumScheduledCallbacks ((size_t) 1000)
+
+/**
+ * Accessory instance ID and instance ID of the Light Bulb On characteristic.
+ */
+/**@{*/
+#define kBenchmarkAID ((uint64_t) 1)
+#define kBenchmarkIID ((uint64_t) 0x33)
+/**@}*/
+
+/**
+ * Serialized pairing, laid out like the pairings stored by the accessory server.
+ */
+typedef struct {
+    uint8_t identifier[kControllerIdentifier_MaxBytes];
+    uint8_t numIdentifierBytes;
+    uint8_t publicKey[ED25519_PUBLIC_KEY_BYTES];
+    uint8_t permissions;
+} BenchmarkPairing;
+
+/**
+ * Benchmark configuration.
+ */
+static struct {
+    size_t numControllers;
+    size_t numSessions;
+    size_t numRequests;
+    unsigned int writePercentage;
+    bool subscribe;
+    HAPNetworkPort port;
+} configuration = {
+    .numControllers = 8, .numSessions = 4, .numRequests = 250, .writePercentage = 20, .subscribe = true
+};
+
+/**
+ * Simulated controllers and their pairings.
+ */
+static struct {
+    ControllerOptions* options;
+    ControllerResult* results;
+    char (*identifiers)[kControllerIdentifier_MaxBytes + 1];
+    size_t numPairings;
+    int64_t duration;
+} controllers;
+
+static HAPIPSession ipSessions[kIPNumSessions];
+
+/**
+ * Global platform objects.
+ */
+static struct {
+    HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformKeyValueStore factoryKeyValueStore;
+    HAPAccessoryServerOptions hapAccessoryServerOptions;
+    HAPPlatform hapPlatform;
+    HAPAccessoryServerCallbacks hapAccessoryServerCallbacks;
+
+    HAPPlatformArena ipArena;
+    HAPPlatformIPSessionPool ipSessionPool;
+    HAPPlatformTCPStreamManager tcpStreamManager;
+
+    HAPPlatformMFiTokenAuth mfiTokenAuth;
+} platform;
+
+static HAPAccessoryServerRef accessoryServer;
+
+/**
+ * Orchestrator thread. Started once the accessory server is running.
+ */
+static struct {
+    pthread_t thread;
+    bool isStarted;
+    bool isStopping;
+    HAPNetworkPort port;
+} orchestrator;
+
+/**
+ * Latency of callbacks scheduled from another thread. Recorded on the run loop.
+ */
+static struct {
+    Measurement latency;
+    size_t numCompleted;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+} scheduledCallbacks = { .mutex = PTHREAD_MUTEX_INITIALIZER, .condition = PTHREAD_COND_INITIALIZER };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Writes the accessory setup information from tools/accessory_setup into the factory partition, as
+ * accessory_setup.bin does on the device.
+ */
+static void ProvisionAccessorySetup(void) {
+    static const HAPPlatformKeyValueStoreKey keys[] = { kSDKKeyValueStoreKey_Provisioning_SetupInfo,
+                                                        kSDKKeyValueStoreKey_Provisioning_SetupID };
+
+    esp_err_t err = nvs_flash_init_partition(kFactoryPartitionName);
+    ESP_ERROR_CHECK(err);
+    char nameSpace[NVS_KEY_NAME_MAX_SIZE];
+    snprintf(nameSpace, sizeof nameSpace, "hap.%02X", kSDKKeyValueStoreDomain_Provisioning);
+    nvs_handle_t handle;
+    err = nvs_open_from_partition(kFactoryPartitionName, nameSpace, NVS_READWRITE, &handle);
+    ESP_ERROR_CHECK(err);
+
+    for (size_t i = 0; i < HAPArrayCount(keys); i++) {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        snprintf(key, sizeof key, "%02X", keys[i]);
+        char path[PATH_MAX];
+        snprintf(path, sizeof path, "%s/%02X.%s", HOST_ACCESSORY_SETUP_DIR, kSDKKeyValueStoreDomain_Provisioning, key);
+        FILE* file = fopen(path, "rb");
+        if (!file) {
+            HAPLogError(&kHAPLog_Default, "Cannot open %s.", path);
+            HAPFatalError();
+        }
+        uint8_t bytes[1024];
+        size_t numBytes = fread(bytes, 1, sizeof bytes, file);
+        fclose(file);
+        err = nvs_set_blob(handle, key, bytes, numBytes);
+        ESP_ERROR_CHECK(err);
+    }
+    err = nvs_commit(handle);
+    ESP_ERROR_CHECK(err);
+    nvs_close(handle);
+}
+
+/**
+ * Replaces the pairings of the accessory with the pairings of the simulated controllers.
+ *
+ * - Controllers share pairings if there are more controllers than the accessory supports.
+ */
+static void ProvisionPairings(void) {
+    HAPError err;
+
+    controllers.numPairings = HAPMin(configuration.numControllers, (size_t) kHAPPairingStorage_MinElements);
+    err = HAPPlatformKeyValueStorePurgeDomain(&platform.keyValueStore, kHAPKeyValueStoreDomain_Pairings);
+    if (err) {
+        HAPAssert(err == kHAPError_Unknown);
+        HAPFatalError();
+    }
+
+    for (size_t i = 0; i < controllers.numPairings; i++) {
+        size_t numIdentifierBytes;
+        err = HAPStringWithFormat(
+                controllers.identifiers[i], sizeof controllers.identifiers[i], "BENCH-CONTROLLER-%04lu", (unsigned long) i);
+        HAPAssert(!err);
+        numIdentifierBytes = HAPStringGetNumBytes(controllers.identifiers[i]);
+
+        ControllerOptions* options = &controllers.options[i];
+        HAPPlatformRandomNumberFill(options->ltsk, sizeof options->ltsk);
+        HAP_ed25519_public_key(options->ltpk, options->ltsk);
+
+        BenchmarkPairing pairing;
+        HAPRawBufferZero(&pairing, sizeof pairing);
+        HAPRawBufferCopyBytes(pairing.identifier, controllers.identifiers[i], numIdentifierBytes);
+        pairing.numIdentifierBytes = (uint8_t) numIdentifierBytes;
+        HAPRawBufferCopyBytes(pairing.publicKey, options->ltpk, sizeof pairing.publicKey);
+        pairing.permissions = i == 0 ? 0x01 : 0x00;
+        err = HAPPlatformKeyValueStoreSet(
+                &platform.keyValueStore,
+                kHAPKeyValueStoreDomain_Pairings,
+                (HAPPlatformKeyValueStoreKey) i,
+                &pairing,
+                sizeof pairing);
+        if (err) {
+            HAPAssert(err == kHAPError_Unknown);
+            HAPFatalError();
+        }
+    }
+}
+
+/**
+ * Initializes the options and results of the simulated controllers.
+ */
+static void CreateControllers(void) {
+    controllers.options = calloc(configuration.numControllers, sizeof controllers.options[0]);
+    controllers.results = calloc(configuration.numControllers, sizeof controllers.results[0]);
+    controllers.identifiers = calloc(configuration.numControllers, sizeof controllers.identifiers[0]);
+    if (!controllers.options || !controllers.results || !controllers.identifiers) {
+        HAPLogError(&kHAPLog_Default, "Cannot allocate %lu controllers.", (unsigned long) configuration.numControllers);
+        HAPFatalError();
+    }
+
+    ProvisionPairings();
+    for (size_t i = 0; i < configuration.numControllers; i++) {
+        ControllerOptions* options = &controllers.options[i];
+        if (i >= controllers.numPairings) {
+            *options = controllers.options[i % controllers.numPairings];
+        }
+        options->identifier = controllers.identifiers[i % controllers.numPairings];
+        options->numSessions = configuration.numSessions;
+        options->numRequests = configuration.numRequests;
+        options->writePercentage = configuration.writePercentage;
+        options->subscribe = configuration.subscribe;
+        options->aid = kBenchmarkAID;
+        options->iid = kBenchmarkIID;
+        ControllerResultCreate(&controllers.results[i], options);
+    }
+}
+
+static void ReleaseControllers(void) {
+    for (size_t i = 0; i < configuration.numControllers; i++) {
+        ControllerResultRelease(&controllers.results[i]);
+    }
+    free(controllers.options);
+    free(controllers.results);
+    free(controllers.identifiers);
+    HAPRawBufferZero(&controllers, sizeof controllers);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void HandleTimerExpired(HAPPlatformTimerRef timer HAP_UNUSED, void* _Nullable context HAP_UNUSED) {
+}
+
+/**
+ * Timer implementation under test.
+ */
+typedef struct {
+    const char* name;
+    HAPError (*registerTimer)(
+            HAPPlatformTimerRef* timer,
+            HAPTime deadline,
+            HAPPlatformTimerCallback callback,
+            void* _Nullable context);
+    void (*deregisterTimer)(HAPPlatformTimerRef timer);
+} TimerImplementation;
+
+/**
+ * Measures timer registration and deregistration of one implementation while other timers are pending.
+ */
+static void BenchmarkTimerImplementation(const TimerImplementation* implementation) {
+    HAPPrecondition(implementation);
+
+    HAPError err;
+
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "Timers, %s (%lu pending):",
+            implementation->name,
+            (unsigned long) kBenchmarkNumBackgroundTimers);
+
+    HAPTime now = HAPPlatformClockGetCurrent();
+    HAPPlatformTimerRef backgroundTimers[kBenchmarkNumBackgroundTimers];
+    for (size_t i = 0; i < HAPArrayCount(backgroundTimers); i++) {
+        err = implementation->registerTimer(
+                &backgroundTimers[i], now + HAPMinute + (HAPTime) i * HAPSecond, HandleTimerExpired, NULL);
+        if (err) {
+            HAPLogError(&kHAPLog_Default, "Cannot register background timer.");
+            HAPFatalError();
+        }
+    }
+
+    Measurement registration;
+    Measurement deregistration;
+    MeasurementCreate(&registration, "Register", kBenchmarkNumTimers);
+    MeasurementCreate(&deregistration, "Deregister", kBenchmarkNumTimers);
+    for (size_t i = 0; i < kBenchmarkNumTimers; i++) {
+        // Deadlines are spread among the pending timers, like session and coalescing timeouts.
+        HAPTime deadline = now + HAPMinute + (HAPTime)(i % (kBenchmarkNumBackgroundTimers + 1)) * HAPSecond;
+        HAPPlatformTimerRef timer;
+        int64_t startTime = esp_timer_get_time();
+        err = implementation->registerTimer(&timer, deadline, HandleTimerExpired, NULL);
+        MeasurementRecord(&registration, startTime);
+        if (err) {
+            HAPLogError(&kHAPLog_Default, "Cannot register timer.");
+            HAPFatalError();
+        }
+        startTime = esp_timer_get_time();
+        implementation->deregisterTimer(timer);
+        MeasurementRecord(&deregistration, startTime);
+    }
+    MeasurementReport(&registration, 0);
+    MeasurementReport(&deregistration, 0);
+    MeasurementRelease(&registration);
+    MeasurementRelease(&deregistration);
+
+    for (size_t i = 0; i < HAPArrayCount(backgroundTimers); i++) {
+        implementation->deregisterTimer(backgroundTimers[i]);
+    }
+}
+
+/**
+ * Measures timer registration and deregistration of the run loop timer heap, and of the sorted list that it
+ * replaced under the same load.
+ *
+ * - Must be called on the run loop before it runs, so that no timer expires.
+ */
+static void BenchmarkTimers(void) {
+    BenchmarkTimerImplementation(&(const TimerImplementation) { .name = "heap",
+                                                                .registerTimer = HAPPlatformTimerRegister,
+                                                                .deregisterTimer = HAPPlatformTimerDeregister });
+    BenchmarkTimerImplementation(&(const TimerImplementation) { .name = "sorted list",
+                                                                .registerTimer = TimerListRegister,
+                                                                .deregisterTimer = TimerListDeregister });
+}
+
+static void HandleScheduledCallback(void* _Nullable context, size_t contextSize) {
+    HAPPrecondition(context);
+    HAPPrecondition(contextSize == sizeof(int64_t));
+    const int64_t* startTime = context;
+
+    MeasurementRecord(&scheduledCallbacks.latency, *startTime);
+
+    pthread_mutex_lock(&scheduledCallbacks.mutex);
+    scheduledCallbacks.numCompleted++;
+    pthread_cond_signal(&scheduledCallbacks.condition);
+    pthread_mutex_unlock(&scheduledCallbacks.mutex);
+}
+
+/**
+ * Measures the time from scheduling a callback on another thread until it runs on the run loop.
+ */
+static void BenchmarkScheduledCallbacks(void) {
+    MeasurementCreate(&scheduledCallbacks.latency, "Scheduled callback latency", kBenchmarkNumScheduledCallbacks);
+
+    size_t numScheduled = 0;
+    for (size_t i = 0; i < kBenchmarkNumScheduledCallbacks; i++) {
+        int64_t startTime = esp_timer_get_time();
+        HAPError err = HAPPlatformRunLoopScheduleCallback(HandleScheduledCallback, &startTime, sizeof startTime);
+        if (err) {
+            HAPLogError(&kHAPLog_Default, "Failed to schedule callback.");
+        } else {
+            numScheduled++;
+        }
+        usleep(100);
+    }
+
+    pthread_mutex_lock(&scheduledCallbacks.mutex);
+    while (scheduledCallbacks.numCompleted < numScheduled) {
+        pthread_cond_wait(&scheduledCallbacks.condition, &scheduledCallbacks.mutex);
+    }
+    pthread_mutex_unlock(&scheduledCallbacks.mutex);
+
+    HAPLogInfo(&kHAPLog_Default, "Scheduled callbacks:");
+    MeasurementReport(&scheduledCallbacks.latency, 0);
+    MeasurementRelease(&scheduledCallbacks.latency);
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void* ControllerThreadMain(void* _Nullable context) {
+    HAPPrecondition(context);
+    size_t i = (size_t)((ControllerOptions*) context - controllers.options);
+
+    ControllerRun(&controllers.options[i], &controllers.results[i]);
+    return NULL;
+}
+
+static void ReportHistogram(const char* name, const HAPPlatformRunLoopHistogram* histogram, const char* unit) {
+    HAPPrecondition(name);
+    HAPPrecondition(histogram);
+    HAPPrecondition(unit);
+
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  %-28s n = %6lu  p50 < %6lu %s  p90 < %6lu %s  p99 < %6lu %s  max = %6lu %s",
+            name,
+            (unsigned long) histogram->numSamples,
+            (unsigned long) HAPPlatformRunLoopHistogramGetPercentile(histogram, 50),
+            unit,
+            (unsigned long) HAPPlatformRunLoopHistogramGetPercentile(histogram, 90),
+            unit,
+            (unsigned long) HAPPlatformRunLoopHistogramGetPercentile(histogram, 99),
+            unit,
+            (unsigned long) histogram->maxValue,
+            unit);
+}
+
+/**
+ * Reports the results of the controller phase and stops the accessory server.
+ */
+static void HandleControllersCompleted(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "Controllers (%lu controllers, %lu sessions each, %lu requests per session, %u%% writes%s):",
+            (unsigned long) configuration.numControllers,
+            (unsigned long) configuration.numSessions,
+            (unsigned long) configuration.numRequests,
+            configuration.writePercentage,
+            configuration.subscribe ? ", subscribed" : "");
+
+    size_t numSamples = configuration.numControllers * configuration.numSessions * configuration.numRequests;
+    Measurement pairVerify, read, write, subscribe;
+    MeasurementCreate(&pairVerify, "Pair-verify", configuration.numControllers * configuration.numSessions);
+    MeasurementCreate(&read, "Characteristic read", numSamples);
+    MeasurementCreate(&write, "Characteristic write", numSamples);
+    MeasurementCreate(&subscribe, "Event subscription", configuration.numControllers * configuration.numSessions);
+    size_t numEvents = 0;
+    size_t numErrors = 0;
+    for (size_t i = 0; i < configuration.numControllers; i++) {
+        const ControllerResult* result = &controllers.results[i];
+        MeasurementMerge(&pairVerify, &result->pairVerify);
+        MeasurementMerge(&read, &result->read);
+        MeasurementMerge(&write, &result->write);
+        MeasurementMerge(&subscribe, &result->subscribe);
+        numEvents += result->numEvents;
+        numErrors += result->numErrors;
+    }
+    MeasurementReport(&pairVerify, controllers.duration);
+    MeasurementReport(&subscribe, controllers.duration);
+    MeasurementReport(&read, controllers.duration);
+    MeasurementReport(&write, controllers.duration);
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  %-28s n = %6lu  %8.1f events/s",
+            "Events received",
+            (unsigned long) numEvents,
+            controllers.duration > 0 ? (double) numEvents * 1000000.0 / (double) controllers.duration : 0.0);
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "  Duration: %lu ms. Failed sessions: %lu.",
+            (unsigned long) (controllers.duration / 1000),
+            (unsigned long) numErrors);
+    MeasurementRelease(&pairVerify);
+    MeasurementRelease(&read);
+    MeasurementRelease(&write);
+    MeasurementRelease(&subscribe);
+
+    HAPPlatformRunLoopStatistics runLoopStatistics;
+    HAPPlatformRunLoopGetStatistics(&runLoopStatistics);
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "Run loop (%lu timer, %lu file handle, %lu loopback wakeups):",
+            (unsigned long) runLoopStatistics.numTimerWakeups,
+            (unsigned long) runLoopStatistics.numFileHandleWakeups,
+            (unsigned long) runLoopStatistics.numLoopbackWakeups);
+    ReportHistogram("File handle callback", &runLoopStatistics.fileHandleCallbackDuration, "us");
+    ReportHistogram("Timer callback", &runLoopStatistics.timerCallbackDuration, "us");
+    ReportHistogram("Scheduled callback", &runLoopStatistics.scheduledCallbackDuration, "us");
+    ReportHistogram("Timer lateness", &runLoopStatistics.timerLateness, "ms");
+    ReportHistogram("Loopback queue depth", &runLoopStatistics.loopbackQueueDepth, "  ");
+
+    HAPPlatformKeyValueStoreStatistics keyValueStoreStatistics;
+    HAPPlatformKeyValueStoreGetStatistics(&platform.keyValueStore, &keyValueStoreStatistics);
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "Key-value store: %lu gets (%lu cached, %lu indexed), %lu NVS reads, %lu NVS writes (%lu skipped), "
+            "%lu NVS erases, %lu NVS commits, %lu NVS opens.",
+            (unsigned long) keyValueStoreStatistics.numGets,
+            (unsigned long) keyValueStoreStatistics.numCacheHits,
+            (unsigned long) keyValueStoreStatistics.numIndexHits,
+            (unsigned long) keyValueStoreStatistics.numNVSReads,
+            (unsigned long) keyValueStoreStatistics.numNVSWrites,
+            (unsigned long) keyValueStoreStatistics.numSkippedWrites,
+            (unsigned long) keyValueStoreStatistics.numNVSErases,
+            (unsigned long) keyValueStoreStatistics.numNVSCommits,
+            (unsigned long) keyValueStoreStatistics.numNVSOpens);
+
+    HAPPlatformIPSessionPoolStatistics ipSessionPoolStatistics;
+    HAPPlatformIPSessionPoolGetStatistics(&platform.ipSessionPool, &ipSessionPoolStatistics);
+    HAPLogInfo(
+            &kHAPLog_Default,
+            "IP session pool: %lu of %lu buffer sets in use at most, %lu allocated, %lu bytes each.",
+            (unsigned long) ipSessionPoolStatistics.maxBufferSetsInUse,
+            (unsigned long) kIPNumSessions,
+            (unsigned long) ipSessionPoolStatistics.numAllocatedBufferSets,
+            (unsigned long) ipSessionPoolStatistics.numBufferSetBytes);
+
+    // Heap and stack samples are not available on the host, but the TCP stream counters are.
+    HAPPlatformDiagnosticsLogSnapshot();
+
+    orchestrator.isStopping = true;
+    HAPAccessoryServerStop(&accessoryServer);
+}
+
+static void HandleControllersStarting(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    HAPPlatformRunLoopResetStatistics();
+}
+
+/**
+ * Runs the benchmarks that need a running accessory server, then schedules the report.
+ */
+static void* OrchestratorThreadMain(void* _Nullable context HAP_UNUSED) {
+    HAPError err;
+
+    BenchmarkScheduledCallbacks();
+
+    // Statistics are reset on the run loop before the first controller connects.
+    err = HAPPlatformRunLoopScheduleCallback(HandleControllersStarting, NULL, 0);
+    HAPAssert(!err);
+    usleep(10 * 1000);
+
+    pthread_t* threads = calloc(configuration.numControllers, sizeof threads[0]);
+    if (!threads) {
+        HAPLogError(&kHAPLog_Default, "Cannot allocate controller threads.");
+        HAPFatalError();
+    }
+    int64_t startTime = esp_timer_get_time();
+    for (size_t i = 0; i < configuration.numControllers; i++) {
+        controllers.options[i].port = orchestrator.port;
+        int e = pthread_create(&threads[i], NULL, ControllerThreadMain, &controllers.options[i]);
+        if (e) {
+            HAPLogError(&kHAPLog_Default, "pthread_create failed: %d.", e);
+            HAPFatalError();
+        }
+    }
+    for (size_t i = 0; i < configuration.numControllers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    controllers.duration = esp_timer_get_time() - startTime;
+    free(threads);
+
+    err = HAPPlatformRunLoopScheduleCallback(HandleControllersCompleted, NULL, 0);
+    HAPAssert(!err);
+    return NULL;
+}
+
+static void HandleUpdatedState(HAPAccessoryServerRef* _Nonnull server, void* _Nullable context) {
+    AccessoryServerHandleUpdatedState(server, context);
+
+    switch (HAPAccessoryServerGetState(server)) {
+        case kHAPAccessoryServerState_Running: {
+            if (orchestrator.isStarted) {
+                return;
+            }
+            orchestrator.port = HAPPlatformTCPStreamManagerGetListenerPort(&platform.tcpStreamManager);
+            HAPLogInfo(&kHAPLog_Default, "Accessory server listening on port %u.", orchestrator.port);
+            int e = pthread_create(&orchestrator.thread, NULL, OrchestratorThreadMain, NULL);
+            if (e) {
+                HAPLogError(&kHAPLog_Default, "pthread_create failed: %d.", e);
+                HAPFatalError();
+            }
+            orchestrator.isStarted = true;
+            return;
+        }
+        case kHAPAccessoryServerState_Idle: {
+            if (orchestrator.isStopping) {
+                HAPPlatformRunLoopStop();
+            }
+            return;
+        }
+        case kHAPAccessoryServerState_Stopping: {
+            return;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Initialize global platform objects.
+ */
+static void InitializePlatform(void) {
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    // Key-value store.
+    HAPPlatformKeyValueStoreCreate(&platform.keyValueStore, &(const HAPPlatformKeyValueStoreOptions) {
+        .part_name = "nvs",
+        .namespace_prefix = "hap",
+        .read_only = false
+    });
+    platform.hapPlatform.keyValueStore = &platform.keyValueStore;
+
+    ProvisionAccessorySetup();
+    HAPPlatformKeyValueStoreCreate(&platform.factoryKeyValueStore, &(const HAPPlatformKeyValueStoreOptions) {
+        .part_name = kFactoryPartitionName,
+        .namespace_prefix = "hap",
+        .read_only = true
+    });
+
+    // Accessory setup manager. Depends on key-value store.
+    static HAPPlatformAccessorySetup accessorySetup;
+    HAPPlatformAccessorySetupCreate(
+            &accessorySetup, &(const HAPPlatformAccessorySetupOptions) { .keyValueStore = &platform.factoryKeyValueStore });
+    platform.hapPlatform.accessorySetup = &accessorySetup;
+
+    // IP storage arena. Backs the TCP streams.
+    HAPPlatformArenaCreate(&platform.ipArena, &(const HAPPlatformArenaOptions) { .numBytes = kIPArenaSize });
+
+    // IP session pool. One buffer set is allocated now, the others on demand when TCP streams are accepted.
+    HAPPlatformIPSessionPoolCreate(&platform.ipSessionPool, &(const HAPPlatformIPSessionPoolOptions) {
+        .sessions = ipSessions,
+        .numSessions = HAPArrayCount(ipSessions),
+        .inboundBufferSize = kHAPIPSession_MinimumInboundBufferSize,
+        .outboundBufferSize = kHAPIPSession_MinimumOutboundBufferSize,
+        .numEventNotifications = kAttributeCount
+    });
+
+    // TCP stream manager. Depends on IP storage arena and IP session pool.
+    HAPPlatformTCPStreamManagerCreate(&platform.tcpStreamManager, &(const HAPPlatformTCPStreamManagerOptions) {
+        .port = configuration.port,
+        .maxConcurrentTCPStreams = kIPNumSessions,
+        .arena = &platform.ipArena,
+        .ipSessionPool = &platform.ipSessionPool
+    });
+    platform.hapPlatform.ip.tcpStreamManager = &platform.tcpStreamManager;
+
+    // Service discovery.
+    static HAPPlatformServiceDiscovery serviceDiscovery;
+    HAPPlatformServiceDiscoveryCreate(&serviceDiscovery, &(const HAPPlatformServiceDiscoveryOptions) {
+        .hostName = NULL, /* Register services on all available network interfaces. */
+        .tcpStreamManager = &platform.tcpStreamManager
+    });
+    platform.hapPlatform.ip.serviceDiscovery = &serviceDiscovery;
+
+    // Software Token provider. Depends on key-value store.
+    HAPPlatformMFiTokenAuthCreate(
+            &platform.mfiTokenAuth,
+            &(const HAPPlatformMFiTokenAuthOptions) { .keyValueStore = &platform.keyValueStore });
+
+    // Run loop.
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &platform.keyValueStore });
+
+    // Diagnostics. Depends on run loop.
+    HAPPlatformDiagnosticsCreate(&(const HAPPlatformDiagnosticsOptions) {
+        .keyValueStore = &platform.keyValueStore,
+        .tcpStreamManager = &platform.tcpStreamManager
+    });
+
+    platform.hapAccessoryServerOptions.maxPairings = kHAPPairingStorage_MinElements;
+
+    platform.hapPlatform.authentication.mfiTokenAuth =
+            HAPPlatformMFiTokenAuthIsProvisioned(&platform.mfiTokenAuth) ? &platform.mfiTokenAuth : NULL;
+
+    platform.hapAccessoryServerCallbacks.handleUpdatedState = HandleUpdatedState;
+}
+
+/**
+ * Deinitialize global platform objects.
+ */
+static void DeinitializePlatform(void) {
+    HAPPlatformDiagnosticsRelease();
+    HAPPlatformServiceDiscoveryRelease(HAPNonnull(platform.hapPlatform.ip.serviceDiscovery));
+    HAPPlatformTCPStreamManagerRelease(&platform.tcpStreamManager);
+    HAPPlatformIPSessionPoolRelease(&platform.ipSessionPool);
+    HAPPlatformArenaRelease(&platform.ipArena);
+
+    AppDeinitialize();
+
+    HAPPlatformRunLoopRelease();
+}
+
+static void InitializeIP(void) {
+    // Prepare accessory server storage.
+    // Session buffers and event notifications are provided by the IP session pool.
+    static HAPIPReadContextRef ipReadContexts[kAttributeCount];
+    static HAPIPWriteContextRef ipWriteContexts[kAttributeCount];
+    static uint8_t ipScratchBuffer[kHAPIPSession_MinimumScratchBufferSize];
+    static HAPIPAccessoryServerStorage ipAccessoryServerStorage = {
+        .sessions = ipSessions,
+        .numSessions = HAPArrayCount(ipSessions),
+        .readContexts = ipReadContexts,
+        .numReadContexts = HAPArrayCount(ipReadContexts),
+        .writeContexts = ipWriteContexts,
+        .numWriteContexts = HAPArrayCount(ipWriteContexts),
+        .scratchBuffer = { .bytes = ipScratchBuffer, .numBytes = sizeof ipScratchBuffer }
+    };
+
+    platform.hapAccessoryServerOptions.ip.transport = &kHAPAccessoryServerTransport_IP;
+    platform.hapAccessoryServerOptions.ip.accessoryServerStorage = &ipAccessoryServerStorage;
+}
+
+static void PrintUsage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [-c controllers] [-s sessions] [-n requests] [-w write percentage] [-e] [-p port]\n"
+            "  -c  Number of concurrent controllers (default %lu).\n"
+            "  -s  Number of sessions per controller, each starting with a pair-verify (default %lu).\n"
+            "  -n  Number of characteristic reads and writes per session (default %lu).\n"
+            "  -w  Percentage of requests that are writes (default %u).\n"
+            "  -e  Do not subscribe to events.\n"
+            "  -p  Port of the accessory server (default: ephemeral).\n",
+            name,
+            (unsigned long) configuration.numControllers,
+            (unsigned long) configuration.numSessions,
+            (unsigned long) configuration.numRequests,
+            configuration.writePercentage);
+}
+
+int main(int argc, char* argv[]) {
+    HAPAssert(HAPGetCompatibilityVersion() == HAP_COMPATIBILITY_VERSION);
+
+    int option;
+    while ((option = getopt(argc, argv, "c:s:n:w:ep:h")) != -1) {
+        switch (option) {
+            case 'c': {
+                configuration.numControllers = strtoul(optarg, NULL, 0);
+                break;
+            }
+            case 's': {
+                configuration.numSessions = strtoul(optarg, NULL, 0);
+                break;
+            }
+            case 'n': {
+                configuration.numRequests = strtoul(optarg, NULL, 0);
+                break;
+            }
+            case 'w': {
+                configuration.writePercentage = (unsigned int) strtoul(optarg, NULL, 0);
+                break;
+            }
+            case 'e': {
+                configuration.subscribe = false;
+                break;
+            }
+            case 'p': {
+                configuration.port = (HAPNetworkPort) strtoul(optarg, NULL, 0);
+                break;
+            }
+            default: {
+                PrintUsage(argv[0]);
+                return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+            }
+        }
+    }
+    if (!configuration.numControllers || !configuration.numSessions || configuration.writePercentage > 100) {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (configuration.numControllers > kIPNumSessions) {
+        HAPLog(&kHAPLog_Default,
+               "%lu controllers exceed the %lu IP sessions. Controllers will wait for sessions to close.",
+               (unsigned long) configuration.numControllers,
+               (unsigned long) kIPNumSessions);
+    }
+
+    // Initialize global platform objects.
+    InitializePlatform();
+    InitializeIP();
+    CreateControllers();
+
+    BenchmarkTimers();
+
+    AppInitialize(&platform.hapAccessoryServerOptions, &platform.hapPlatform, &platform.hapAccessoryServerCallbacks);
+
+    // Initialize accessory server.
+    HAPAccessoryServerCreate(
+            &accessoryServer,
+            &platform.hapAccessoryServerOptions,
+            &platform.hapPlatform,
+            &platform.hapAccessoryServerCallbacks,
+            /* context: */ NULL);
+
+    // Create app object.
+    AppCreate(&accessoryServer, &platform.keyValueStore);
+
+    // Start accessory server for App. The host network is up, so the IP address is acquired right away.
+    AppAccessoryServerStart();
+    ip_event_got_ip_t gotIP = { .ip_changed = true };
+    ESP_ERROR_CHECK(esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &gotIP, sizeof gotIP, portMAX_DELAY));
+
+    // Run main loop until the benchmark completes.
+    HAPPlatformRunLoopRun();
+
+    if (orchestrator.isStarted) {
+        pthread_join(orchestrator.thread, NULL);
+    }
+
+    // Cleanup.
+    AppRelease();
+
+    HAPAccessoryServerRelease(&accessoryServer);
+
+    ReleaseControllers();
+    DeinitializePlatform();
+
+    HAPLogInfo(&kHAPLog_Default, "Benchmark done.");
+    return EXIT_SUCCESS;
+}
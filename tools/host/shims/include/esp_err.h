@@ -0,0 +1,52 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the ESP-IDF error codes.
+
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int esp_err_t;
+
+#define ESP_OK ((esp_err_t) 0)
+#define ESP_FAIL ((esp_err_t) -1)
+
+#define ESP_ERR_NO_MEM ((esp_err_t) 0x101)
+#define ESP_ERR_INVALID_ARG ((esp_err_t) 0x102)
+#define ESP_ERR_INVALID_STATE ((esp_err_t) 0x103)
+#define ESP_ERR_INVALID_SIZE ((esp_err_t) 0x104)
+#define ESP_ERR_NOT_FOUND ((esp_err_t) 0x105)
+#define ESP_ERR_NOT_SUPPORTED ((esp_err_t) 0x106)
+
+/**
+ * Aborts if an ESP-IDF call failed.
+ */
+#define ESP_ERROR_CHECK(x) \
+    do { \
+        esp_err_t err_rc_ = (x); \
+        if (err_rc_ != ESP_OK) { \
+            fprintf(stderr, "ESP_ERROR_CHECK failed: %d at %s:%d (%s).\n", err_rc_, __FILE__, __LINE__, #x); \
+            abort(); \
+        } \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,69 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the default event loop.
+//
+// - Handlers are called synchronously by esp_event_post, on the thread that posts the event.
+//   On the target, they run on the event loop task, so they may not assume to run on the run loop either way.
+
+#ifndef ESP_EVENT_H
+#define ESP_EVENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef const char* esp_event_base_t;
+
+typedef void* esp_event_handler_instance_t;
+
+typedef void (*esp_event_handler_t)(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id,
+        void* event_data);
+
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
+
+#define ESP_EVENT_ANY_ID ((int32_t) -1)
+
+esp_err_t esp_event_loop_create_default(void);
+
+esp_err_t esp_event_handler_instance_register(
+        esp_event_base_t event_base,
+        int32_t event_id,
+        esp_event_handler_t event_handler,
+        void* event_handler_arg,
+        esp_event_handler_instance_t* instance);
+
+esp_err_t esp_event_handler_instance_unregister(
+        esp_event_base_t event_base,
+        int32_t event_id,
+        esp_event_handler_instance_t instance);
+
+/**
+ * Posts an event. The event data is passed to the handlers as is. The timeout is ignored.
+ */
+esp_err_t esp_event_post(
+        esp_event_base_t event_base,
+        int32_t event_id,
+        void* event_data,
+        size_t event_data_size,
+        uint32_t ticks_to_wait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the ESP-IDF capability-based heap allocator. The host has a single heap, so capabilities are ignored.
+
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+static inline void* heap_caps_malloc(size_t size, uint32_t caps) {
+    (void) caps;
+    return malloc(size);
+}
+
+static inline void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+    (void) caps;
+    return calloc(n, size);
+}
+
+static inline void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+// The host heap does not report its usage, so the diagnostics read 0.
+
+static inline size_t heap_caps_get_free_size(uint32_t caps) {
+    (void) caps;
+    return 0;
+}
+
+static inline size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    (void) caps;
+    return 0;
+}
+
+static inline size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    (void) caps;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of esp_system.
+
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*shutdown_handler_t)(void);
+
+/**
+ * Fills a buffer with random bytes from getrandom(2).
+ */
+void esp_fill_random(void* buf, size_t len);
+
+uint32_t esp_random(void);
+
+/**
+ * Registers a handler that is called on exit(3), which stands in for esp_restart.
+ */
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the FreeRTOS task queries used by the diagnostics. Host threads are not FreeRTOS tasks,
+// so no task is found and the diagnostics report the stack high-water marks as unknown.
+
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include <stddef.h>
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* TaskHandle_t;
+
+static inline TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return NULL;
+}
+
+static inline TaskHandle_t xTaskGetHandle(const char* name) {
+    (void) name;
+    return NULL;
+}
+
+static inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    (void) task;
+    return 0;
+}
+
+static inline UBaseType_t uxTaskGetNumberOfTasks(void) {
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
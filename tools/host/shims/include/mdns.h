@@ -0,0 +1,62 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the mdns component API used by the port.
+//
+// - With Avahi, the service is published through the Avahi daemon, so it can be browsed with avahi-browse and
+//   found by real controllers on the local network. The host name of the machine is used, as the host name is
+//   owned by the daemon.
+// - Without Avahi, the calls only validate their arguments.
+
+#ifndef MDNS_H
+#define MDNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char* key;
+    const char* value;
+} mdns_txt_item_t;
+
+esp_err_t mdns_init(void);
+
+void mdns_free(void);
+
+esp_err_t mdns_hostname_set(const char* hostname);
+
+esp_err_t mdns_service_add(
+        const char* instance_name,
+        const char* service_type,
+        const char* proto,
+        uint16_t port,
+        mdns_txt_item_t txt[],
+        size_t num_items);
+
+esp_err_t mdns_service_remove(const char* service_type, const char* proto);
+
+esp_err_t mdns_service_txt_set(const char* service_type, const char* proto, mdns_txt_item_t txt[], uint8_t num_items);
+
+esp_err_t mdns_service_txt_item_set(const char* service_type, const char* proto, const char* key, const char* value);
+
+esp_err_t mdns_service_txt_item_remove(const char* service_type, const char* proto, const char* key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
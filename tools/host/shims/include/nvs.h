@@ -0,0 +1,112 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the NVS API used by the port, backed by files.
+//
+// - Every partition is a directory below $HAP_HOST_NVS_DIR (default: ".nvs" in the working directory).
+// - Every namespace is a directory in its partition, and every blob is a file in its namespace directory.
+//   So "nvs/hap.40/10" holds key 10 of namespace hap.40 of partition nvs.
+// - Blobs are written to a temporary file and renamed, so an interrupted benchmark never leaves a torn blob.
+//   nvs_commit is a no-op, as the blobs are already durable once nvs_set_blob returns.
+// - Iterators take a snapshot of the matching keys, so entries may be added or erased while iterating.
+
+#ifndef NVS_H
+#define NVS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_READ_ONLY (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_NAME (ESP_ERR_NVS_BASE + 0x06)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_KEY_TOO_LONG (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+#define ESP_ERR_NVS_PART_NOT_FOUND (ESP_ERR_NVS_BASE + 0x0f)
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+#define NVS_NS_NAME_MAX_SIZE NVS_KEY_NAME_MAX_SIZE
+
+/**
+ * Maximum length of a blob, like on the target with the default page size.
+ */
+#define NVS_HOST_MAX_BLOB_SIZE ((size_t) 508000)
+
+typedef uint32_t nvs_handle_t;
+typedef nvs_handle_t nvs_handle;
+
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+typedef nvs_open_mode_t nvs_open_mode;
+
+typedef enum { NVS_TYPE_BLOB = 0x42, NVS_TYPE_ANY = 0xff } nvs_type_t;
+
+typedef struct {
+    char namespace_name[NVS_NS_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+} nvs_entry_info_t;
+
+typedef struct nvs_opaque_iterator_t* nvs_iterator_t;
+
+esp_err_t nvs_open_from_partition(
+        const char* part_name,
+        const char* name,
+        nvs_open_mode_t open_mode,
+        nvs_handle_t* out_handle);
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle);
+
+void nvs_close(nvs_handle_t handle);
+
+/**
+ * Reads a blob. If out_value is NULL, only the length is returned.
+ */
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length);
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length);
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key);
+
+esp_err_t nvs_erase_all(nvs_handle_t handle);
+
+esp_err_t nvs_commit(nvs_handle_t handle);
+
+/**
+ * Finds the blobs of a partition, optionally restricted to a namespace. Returns NULL if there are none.
+ */
+nvs_iterator_t nvs_entry_find(const char* part_name, const char* namespace_name, nvs_type_t type);
+
+/**
+ * Advances an iterator. Returns NULL and releases the iterator after the last entry.
+ */
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator);
+
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t* out_info);
+
+void nvs_release_iterator(nvs_iterator_t iterator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
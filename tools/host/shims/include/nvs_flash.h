@@ -0,0 +1,38 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the NVS partition management. Partitions are created on first use.
+
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+
+#include "nvs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t nvs_flash_init(void);
+
+esp_err_t nvs_flash_init_partition(const char* partition_label);
+
+/**
+ * Erases the default partition.
+ */
+esp_err_t nvs_flash_erase(void);
+
+esp_err_t nvs_flash_erase_partition(const char* part_name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
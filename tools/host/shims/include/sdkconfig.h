@@ -0,0 +1,92 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Configuration of the host build.
+//
+// Mirrors the defaults of port/Kconfig.projbuild, so that the host build measures what is flashed by default.
+// Options that need hardware are disabled. The run loop power management is off, as there is no esp_pm on the host.
+// The log level, the run loop statistics and the scheduled callback queue size may be overridden on the compiler
+// command line.
+
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#define CONFIG_IDF_TARGET "host"
+
+// Key-value store.
+#define CONFIG_HAP_KVS_MAX_OPEN_HANDLES 4
+#define CONFIG_HAP_KVS_READ_CACHE_SIZE 8
+#define CONFIG_HAP_KVS_MAX_INDEXED_DOMAINS 8
+
+// Run loop.
+#define CONFIG_HAP_RUN_LOOP_MAX_FILE_HANDLES 24
+#define CONFIG_HAP_RUN_LOOP_MAX_TIMERS 48
+#ifndef CONFIG_HAP_RUN_LOOP_CALLBACK_QUEUE_SIZE
+#define CONFIG_HAP_RUN_LOOP_CALLBACK_QUEUE_SIZE 2048
+#endif
+#define CONFIG_HAP_RUN_LOOP_CALLBACK_BATCH_LIMIT 32
+#define CONFIG_HAP_RUN_LOOP_TIMER_LEEWAY 0
+#define CONFIG_HAP_RUN_LOOP_PM 0
+#define CONFIG_HAP_RUN_LOOP_PM_REPORT_INTERVAL 0
+#ifndef CONFIG_HAP_RUN_LOOP_STATISTICS
+#define CONFIG_HAP_RUN_LOOP_STATISTICS 1
+#endif
+#define CONFIG_HAP_RUN_LOOP_STATISTICS_REPORT_INTERVAL 0
+
+// TCP stream manager.
+#define CONFIG_HAP_TCP_STREAM_KEEPALIVE_IDLE 60
+#define CONFIG_HAP_TCP_STREAM_KEEPALIVE_INTERVAL 10
+#define CONFIG_HAP_TCP_STREAM_KEEPALIVE_COUNT 3
+#define CONFIG_HAP_TCP_STREAM_EVICTION_IDLE_TIME 30
+
+// Service discovery.
+#define CONFIG_HAP_SERVICE_DISCOVERY_MAX_TXT_RECORDS 12
+#define CONFIG_HAP_SERVICE_DISCOVERY_TXT_BUFFER_SIZE 256
+#define CONFIG_HAP_SERVICE_DISCOVERY_REANNOUNCE_COUNT 3
+#define CONFIG_HAP_SERVICE_DISCOVERY_REANNOUNCE_INTERVAL 1000
+
+// Events and persisted state.
+#define CONFIG_HAP_EVENT_COALESCER_WINDOW 100
+#define CONFIG_HAP_EVENT_COALESCER_MAX_CHARACTERISTICS 16
+#define CONFIG_HAP_PERSISTED_STATE_QUIET_PERIOD 2000
+#define CONFIG_HAP_PERSISTED_STATE_MAX_DELAY 10000
+
+// Crypto.
+#ifndef CONFIG_HAP_CRYPTO_CHACHA20_POLY1305
+#define CONFIG_HAP_CRYPTO_CHACHA20_POLY1305 1
+#endif
+
+// BLE. There is no NimBLE on the host, so the BLE peripheral manager only does its bookkeeping.
+#define CONFIG_HAP_BLE_ATT_MTU 527
+#define CONFIG_HAP_BLE_DATA_LENGTH_EXTENSION 1
+#define CONFIG_HAP_BLE_ACTIVE_CONNECTION_INTERVAL 15
+#define CONFIG_HAP_BLE_IDLE_CONNECTION_INTERVAL 300
+#define CONFIG_HAP_BLE_IDLE_TIMEOUT 2000
+#define CONFIG_HAP_BLE_FAST_ADVERTISING_INTERVAL 20
+#define CONFIG_HAP_BLE_FAST_ADVERTISING_DURATION 30000
+#define CONFIG_HAP_BLE_BATCHING_WINDOW 100
+
+// Diagnostics. The snapshot is logged once in the benchmark report instead.
+#ifndef CONFIG_HAP_DIAGNOSTICS
+#define CONFIG_HAP_DIAGNOSTICS 1
+#endif
+#define CONFIG_HAP_DIAGNOSTICS_REPORT_INTERVAL 0
+
+// Logging.
+#ifndef CONFIG_HAP_LOG_LEVEL
+#define CONFIG_HAP_LOG_LEVEL 1
+#endif
+#define CONFIG_HAP_LOG_CATEGORY_LEVELS ""
+#define CONFIG_HAP_LOG_MAX_CATEGORY_RULES 8
+#define CONFIG_HAP_LOG_COMPILE_ALLOWLIST ""
+#define CONFIG_HAP_LOG_DEFERRED 0
+
+#endif
@@ -0,0 +1,71 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Apple Authentication Coprocessor provider of the host build.
+//
+// The host has no I2C bus, so port/src/HAPPlatformMFiHWAuth.c is replaced by a provider without a coprocessor.
+// The accessory server then uses software authentication, like accessories built without CONFIG_HAP_MFI_HW_AUTH.
+
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformMFiHWAuth+Init.h"
+
+void HAPPlatformMFiHWAuthCreate(HAPPlatformMFiHWAuthRef mfiHWAuth) {
+    HAPPrecondition(mfiHWAuth);
+
+    HAPRawBufferZero(mfiHWAuth, sizeof *mfiHWAuth);
+}
+
+void HAPPlatformMFiHWAuthRelease(HAPPlatformMFiHWAuthRef mfiHWAuth) {
+    HAPPrecondition(mfiHWAuth);
+}
+
+HAP_RESULT_USE_CHECK
+bool HAPPlatformMFiHWAuthIsPoweredOn(HAPPlatformMFiHWAuthRef mfiHWAuth) {
+    HAPPrecondition(mfiHWAuth);
+
+    return mfiHWAuth->poweredOn;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformMFiHWAuthPowerOn(HAPPlatformMFiHWAuthRef mfiHWAuth) {
+    HAPPrecondition(mfiHWAuth);
+
+    mfiHWAuth->poweredOn = true;
+    return kHAPError_None;
+}
+
+void HAPPlatformMFiHWAuthPowerOff(HAPPlatformMFiHWAuthRef mfiHWAuth) {
+    HAPPrecondition(mfiHWAuth);
+
+    mfiHWAuth->poweredOn = false;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformMFiHWAuthWrite(HAPPlatformMFiHWAuthRef mfiHWAuth, const void* bytes, size_t numBytes) {
+    HAPPrecondition(mfiHWAuth);
+    HAPPrecondition(bytes);
+    HAPPrecondition(numBytes >= 1 && numBytes <= 128);
+
+    return HAPPlatformMFiHWAuthIsPoweredOn(mfiHWAuth) ? kHAPError_Unknown : kHAPError_InvalidState;
+}
+
+HAP_RESULT_USE_CHECK
+HAPError HAPPlatformMFiHWAuthRead(
+        HAPPlatformMFiHWAuthRef mfiHWAuth,
+        uint8_t registerAddress HAP_UNUSED,
+        void* bytes,
+        size_t numBytes) {
+    HAPPrecondition(mfiHWAuth);
+    HAPPrecondition(bytes);
+    HAPPrecondition(numBytes >= 1 && numBytes <= 128);
+
+    return HAPPlatformMFiHWAuthIsPoweredOn(mfiHWAuth) ? kHAPError_Unknown : kHAPError_InvalidState;
+}
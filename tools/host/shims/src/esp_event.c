@@ -0,0 +1,113 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the default event loop. See esp_event.h.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_netif.h"
+
+ESP_EVENT_DEFINE_BASE(IP_EVENT);
+
+/**
+ * Maximum number of registered event handlers.
+ */
+#define kEventHandlers_Max ((size_t) 16)
+
+typedef struct {
+    bool isRegistered;
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void* arg;
+} EventHandler;
+
+static struct {
+    // Recursive, so that handlers may register and unregister handlers.
+    pthread_mutex_t mutex;
+    EventHandler handlers[kEventHandlers_Max];
+} eventLoop = { .mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP };
+
+esp_err_t esp_event_loop_create_default(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(
+        esp_event_base_t event_base,
+        int32_t event_id,
+        esp_event_handler_t event_handler,
+        void* event_handler_arg,
+        esp_event_handler_instance_t* instance) {
+    if (!event_base || !event_handler) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&eventLoop.mutex);
+    for (size_t i = 0; i < kEventHandlers_Max; i++) {
+        EventHandler* h = &eventLoop.handlers[i];
+        if (!h->isRegistered) {
+            *h = (EventHandler) {
+                .isRegistered = true, .base = event_base, .id = event_id, .handler = event_handler, .arg = event_handler_arg
+            };
+            if (instance) {
+                *instance = h;
+            }
+            pthread_mutex_unlock(&eventLoop.mutex);
+            return ESP_OK;
+        }
+    }
+    pthread_mutex_unlock(&eventLoop.mutex);
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_handler_instance_unregister(
+        esp_event_base_t event_base,
+        int32_t event_id,
+        esp_event_handler_instance_t instance) {
+    EventHandler* h = instance;
+    if (!h || h < &eventLoop.handlers[0] || h >= &eventLoop.handlers[kEventHandlers_Max]) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&eventLoop.mutex);
+    if (!h->isRegistered || h->base != event_base || h->id != event_id) {
+        pthread_mutex_unlock(&eventLoop.mutex);
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(h, 0, sizeof *h);
+    pthread_mutex_unlock(&eventLoop.mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(
+        esp_event_base_t event_base,
+        int32_t event_id,
+        void* event_data,
+        size_t event_data_size,
+        uint32_t ticks_to_wait) {
+    (void) event_data_size;
+    (void) ticks_to_wait;
+
+    pthread_mutex_lock(&eventLoop.mutex);
+    for (size_t i = 0; i < kEventHandlers_Max; i++) {
+        EventHandler h = eventLoop.handlers[i];
+        if (h.isRegistered && h.base == event_base && (h.id == event_id || h.id == ESP_EVENT_ANY_ID)) {
+            h.handler(h.arg, event_base, event_id, event_data);
+        }
+    }
+    pthread_mutex_unlock(&eventLoop.mutex);
+    return ESP_OK;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of esp_system. See esp_system.h.
+
+#include <stdlib.h>
+#include <sys/random.h>
+
+#include "esp_system.h"
+
+void esp_fill_random(void* buf, size_t len) {
+    uint8_t* bytes = buf;
+    while (len) {
+        ssize_t n = getrandom(bytes, len, 0);
+        if (n <= 0) {
+            continue;
+        }
+        bytes += n;
+        len -= (size_t) n;
+    }
+}
+
+uint32_t esp_random(void) {
+    uint32_t value;
+    esp_fill_random(&value, sizeof value);
+    return value;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle) {
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return atexit(handle) ? ESP_ERR_NO_MEM : ESP_OK;
+}
@@ -0,0 +1,229 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of esp_timer. See esp_timer.h.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_timer.h"
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+
+    /**
+     * Expiry time in microseconds. Only valid while the timer is armed.
+     */
+    int64_t deadline;
+
+    /**
+     * Period in microseconds. 0 for one-shot timers.
+     */
+    uint64_t period;
+
+    bool isArmed;
+
+    /**
+     * Next armed timer, sorted by deadline.
+     */
+    struct esp_timer* next;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    pthread_once_t once;
+    bool isThreadStarted;
+    struct esp_timer* armedTimers;
+} timers = { .mutex = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT };
+
+static int64_t GetMonotonicTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * CLOCK_MONOTONIC time at which the process started in microseconds.
+ */
+static int64_t startTime;
+
+static void InitializeTimers(void) {
+    startTime = GetMonotonicTime();
+
+    // The timer thread waits for deadlines on the same clock.
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timers.condition, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+__attribute__((constructor)) static void InitializeTimersAtStartup(void) {
+    pthread_once(&timers.once, InitializeTimers);
+}
+
+int64_t esp_timer_get_time(void) {
+    pthread_once(&timers.once, InitializeTimers);
+    return GetMonotonicTime() - startTime;
+}
+
+/**
+ * Removes a timer from the armed timers. The mutex must be held.
+ */
+static void Disarm(struct esp_timer* timer) {
+    for (struct esp_timer** t = &timers.armedTimers; *t; t = &(*t)->next) {
+        if (*t == timer) {
+            *t = timer->next;
+            break;
+        }
+    }
+    timer->next = NULL;
+    timer->isArmed = false;
+}
+
+/**
+ * Inserts a timer into the armed timers. The mutex must be held.
+ */
+static void Arm(struct esp_timer* timer, int64_t deadline) {
+    timer->deadline = deadline;
+    timer->isArmed = true;
+    struct esp_timer** t = &timers.armedTimers;
+    while (*t && (*t)->deadline <= deadline) {
+        t = &(*t)->next;
+    }
+    timer->next = *t;
+    *t = timer;
+    pthread_cond_signal(&timers.condition);
+}
+
+static void* TimerThreadMain(void* context) {
+    (void) context;
+
+    pthread_mutex_lock(&timers.mutex);
+    for (;;) {
+        struct esp_timer* timer = timers.armedTimers;
+        if (!timer) {
+            pthread_cond_wait(&timers.condition, &timers.mutex);
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+        if (timer->deadline > now) {
+            int64_t deadline = startTime + timer->deadline;
+            struct timespec timeout = { .tv_sec = deadline / 1000000, .tv_nsec = (deadline % 1000000) * 1000 };
+            (void) pthread_cond_timedwait(&timers.condition, &timers.mutex, &timeout);
+            continue;
+        }
+
+        Disarm(timer);
+        if (timer->period) {
+            Arm(timer, timer->deadline + (int64_t) timer->period);
+        }
+        esp_timer_cb_t callback = timer->callback;
+        void* arg = timer->arg;
+
+        // Like the esp_timer task, callbacks may start, stop and delete timers, including their own.
+        pthread_mutex_unlock(&timers.mutex);
+        callback(arg);
+        pthread_mutex_lock(&timers.mutex);
+    }
+    return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* create_args, esp_timer_handle_t* out_handle) {
+    if (!create_args || !create_args->callback || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    struct esp_timer* timer = calloc(1, sizeof *timer);
+    if (!timer) {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+
+    pthread_once(&timers.once, InitializeTimers);
+    pthread_mutex_lock(&timers.mutex);
+    if (!timers.isThreadStarted) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int e = pthread_create(&thread, &attr, TimerThreadMain, NULL);
+        pthread_attr_destroy(&attr);
+        if (e) {
+            pthread_mutex_unlock(&timers.mutex);
+            free(timer);
+            return ESP_ERR_NO_MEM;
+        }
+        timers.isThreadStarted = true;
+    }
+    pthread_mutex_unlock(&timers.mutex);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t Start(esp_timer_handle_t timer, uint64_t timeout, uint64_t period) {
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&timers.mutex);
+    if (timer->isArmed) {
+        pthread_mutex_unlock(&timers.mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->period = period;
+    Arm(timer, esp_timer_get_time() + (int64_t) timeout);
+    pthread_mutex_unlock(&timers.mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return Start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    if (!period) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return Start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&timers.mutex);
+    if (!timer->isArmed) {
+        pthread_mutex_unlock(&timers.mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    Disarm(timer);
+    pthread_mutex_unlock(&timers.mutex);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (!timer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pthread_mutex_lock(&timers.mutex);
+    if (timer->isArmed) {
+        pthread_mutex_unlock(&timers.mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    pthread_mutex_unlock(&timers.mutex);
+    free(timer);
+    return ESP_OK;
+}
@@ -0,0 +1,387 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the mdns component, backed by the Avahi daemon. See mdns.h.
+//
+// - The port publishes a single service, so a single entry group is kept.
+// - Avahi runs its own thread. All calls into Avahi take the lock of the threaded poll, except those made from the
+//   Avahi callbacks, which run with the lock held.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <avahi-client/client.h>
+#include <avahi-client/publish.h>
+#include <avahi-common/alternative.h>
+#include <avahi-common/error.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/strlst.h>
+#include <avahi-common/thread-watch.h>
+
+#include "mdns.h"
+
+/**
+ * Maximum number of TXT records. Matches the default of CONFIG_HAP_SERVICE_DISCOVERY_MAX_TXT_RECORDS with headroom.
+ */
+#define kMDNSMaxTXTItems ((size_t) 16)
+
+/**
+ * Maximum length of a TXT record key.
+ */
+#define kMDNSMaxTXTKeyBytes ((size_t) 15)
+
+/**
+ * Maximum length of a TXT record value. DNS limits a TXT string including key and separator to 255 bytes.
+ */
+#define kMDNSMaxTXTValueBytes ((size_t) 255)
+
+typedef struct {
+    char key[kMDNSMaxTXTKeyBytes + 1];
+    char value[kMDNSMaxTXTValueBytes + 1];
+} TXTItem;
+
+static struct {
+    AvahiThreadedPoll* poll;
+    AvahiClient* client;
+    AvahiEntryGroup* group;
+
+    /**
+     * Whether a service has been added.
+     */
+    bool hasService;
+
+    /**
+     * Whether the service is part of the entry group, so that only the TXT records need to be updated.
+     */
+    bool isServicePublished;
+
+    char* name;
+    char type[64];
+    uint16_t port;
+    size_t numTXTItems;
+    TXTItem txtItems[kMDNSMaxTXTItems];
+} mdns;
+
+static void LogError(const char* operation, int error) {
+    fprintf(stderr, "mdns (Avahi): %s failed: %s.\n", operation, avahi_strerror(error));
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static void Publish(AvahiClient* client);
+
+static void HandleEntryGroupStateChange(AvahiEntryGroup* group, AvahiEntryGroupState state, void* userdata) {
+    (void) userdata;
+
+    if (state == AVAHI_ENTRY_GROUP_COLLISION) {
+        // Another service has the same name. Pick the next alternative name, like the mdns component does.
+        char* name = avahi_alternative_service_name(mdns.name);
+        fprintf(stderr, "mdns (Avahi): Service name collision. Renaming \"%s\" to \"%s\".\n", mdns.name, name);
+        avahi_free(mdns.name);
+        mdns.name = name;
+        avahi_entry_group_reset(group);
+        mdns.isServicePublished = false;
+        Publish(avahi_entry_group_get_client(group));
+    } else if (state == AVAHI_ENTRY_GROUP_FAILURE) {
+        LogError("Entry group", avahi_client_errno(avahi_entry_group_get_client(group)));
+    }
+}
+
+static AvahiStringList* CopyTXTItems(void) {
+    AvahiStringList* list = NULL;
+    for (size_t i = mdns.numTXTItems; i > 0; i--) {
+        // Avahi prepends, so the records are added in reverse to keep their order.
+        const TXTItem* item = &mdns.txtItems[i - 1];
+        list = avahi_string_list_add_pair(list, item->key, item->value);
+    }
+    return list;
+}
+
+/**
+ * Publishes the service, or updates its TXT records if it is published already. The poll lock must be held.
+ */
+static void Publish(AvahiClient* client) {
+    if (!mdns.hasService || avahi_client_get_state(client) != AVAHI_CLIENT_S_RUNNING) {
+        // Published once the daemon is running.
+        return;
+    }
+    if (!mdns.group) {
+        mdns.group = avahi_entry_group_new(client, HandleEntryGroupStateChange, NULL);
+        if (!mdns.group) {
+            LogError("avahi_entry_group_new", avahi_client_errno(client));
+            return;
+        }
+    }
+
+    AvahiStringList* txt = CopyTXTItems();
+    int e;
+    if (mdns.isServicePublished) {
+        e = avahi_entry_group_update_service_txt_strlst(
+                mdns.group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, mdns.name, mdns.type, NULL, txt);
+        if (e < 0) {
+            LogError("avahi_entry_group_update_service_txt_strlst", e);
+        }
+    } else {
+        e = avahi_entry_group_add_service_strlst(
+                mdns.group, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, mdns.name, mdns.type, NULL, NULL, mdns.port, txt);
+        if (e < 0) {
+            LogError("avahi_entry_group_add_service_strlst", e);
+        } else {
+            e = avahi_entry_group_commit(mdns.group);
+            if (e < 0) {
+                LogError("avahi_entry_group_commit", e);
+            }
+            mdns.isServicePublished = e >= 0;
+        }
+    }
+    avahi_string_list_free(txt);
+}
+
+static void HandleClientStateChange(AvahiClient* client, AvahiClientState state, void* userdata) {
+    (void) userdata;
+
+    switch (state) {
+        case AVAHI_CLIENT_S_RUNNING: {
+            Publish(client);
+            break;
+        }
+        case AVAHI_CLIENT_S_COLLISION:
+        case AVAHI_CLIENT_S_REGISTERING: {
+            // The host name changed. The service is published again once the daemon is running.
+            if (mdns.group) {
+                avahi_entry_group_reset(mdns.group);
+            }
+            mdns.isServicePublished = false;
+            break;
+        }
+        case AVAHI_CLIENT_FAILURE: {
+            LogError("Client", avahi_client_errno(client));
+            break;
+        }
+        case AVAHI_CLIENT_CONNECTING: {
+            fprintf(stderr, "mdns (Avahi): Waiting for the Avahi daemon.\n");
+            break;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static bool IsService(const char* service_type, const char* proto) {
+    char type[sizeof mdns.type];
+    int n = snprintf(type, sizeof type, "%s.%s", service_type, proto);
+    return mdns.hasService && n > 0 && (size_t) n < sizeof type && !strcmp(type, mdns.type);
+}
+
+static esp_err_t SetTXTItem(const char* key, const char* value) {
+    if (!key || !value) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (strlen(key) > kMDNSMaxTXTKeyBytes || strlen(key) + 1 + strlen(value) > kMDNSMaxTXTValueBytes) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t i;
+    for (i = 0; i < mdns.numTXTItems; i++) {
+        if (!strcmp(mdns.txtItems[i].key, key)) {
+            break;
+        }
+    }
+    if (i == mdns.numTXTItems) {
+        if (mdns.numTXTItems == kMDNSMaxTXTItems) {
+            return ESP_ERR_NO_MEM;
+        }
+        mdns.numTXTItems++;
+    }
+    strcpy(mdns.txtItems[i].key, key);
+    strcpy(mdns.txtItems[i].value, value);
+    return ESP_OK;
+}
+
+static esp_err_t SetTXTItems(mdns_txt_item_t txt[], size_t num_items) {
+    if (num_items && !txt) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    mdns.numTXTItems = 0;
+    for (size_t i = 0; i < num_items; i++) {
+        esp_err_t err = SetTXTItem(txt[i].key, txt[i].value);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t mdns_init(void) {
+    if (mdns.poll) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    mdns.poll = avahi_threaded_poll_new();
+    if (!mdns.poll) {
+        return ESP_ERR_NO_MEM;
+    }
+    int error;
+    mdns.client = avahi_client_new(
+            avahi_threaded_poll_get(mdns.poll), AVAHI_CLIENT_NO_FAIL, HandleClientStateChange, NULL, &error);
+    if (!mdns.client) {
+        LogError("avahi_client_new", error);
+        avahi_threaded_poll_free(mdns.poll);
+        mdns.poll = NULL;
+        return ESP_FAIL;
+    }
+    if (avahi_threaded_poll_start(mdns.poll) < 0) {
+        avahi_client_free(mdns.client);
+        avahi_threaded_poll_free(mdns.poll);
+        mdns.client = NULL;
+        mdns.poll = NULL;
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void mdns_free(void) {
+    if (!mdns.poll) {
+        return;
+    }
+    avahi_threaded_poll_stop(mdns.poll);
+    // Freeing the client also frees its entry groups.
+    avahi_client_free(mdns.client);
+    avahi_threaded_poll_free(mdns.poll);
+    avahi_free(mdns.name);
+    memset(&mdns, 0, sizeof mdns);
+}
+
+esp_err_t mdns_hostname_set(const char* hostname) {
+    if (!hostname) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // The host name is owned by the Avahi daemon. Announcing again is left to the daemon as well.
+    return mdns.poll ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t mdns_service_add(
+        const char* instance_name,
+        const char* service_type,
+        const char* proto,
+        uint16_t port,
+        mdns_txt_item_t txt[],
+        size_t num_items) {
+    if (!instance_name || !service_type || !proto) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mdns.poll) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    char type[sizeof mdns.type];
+    int n = snprintf(type, sizeof type, "%s.%s", service_type, proto);
+    if (n <= 0 || (size_t) n >= sizeof type) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    avahi_threaded_poll_lock(mdns.poll);
+    esp_err_t err = mdns.hasService ? ESP_ERR_INVALID_STATE : SetTXTItems(txt, num_items);
+    if (err == ESP_OK) {
+        strcpy(mdns.type, type);
+        avahi_free(mdns.name);
+        mdns.name = avahi_strdup(instance_name);
+        mdns.port = port;
+        mdns.hasService = true;
+        mdns.isServicePublished = false;
+        Publish(mdns.client);
+    }
+    avahi_threaded_poll_unlock(mdns.poll);
+    return err;
+}
+
+esp_err_t mdns_service_remove(const char* service_type, const char* proto) {
+    if (!service_type || !proto) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mdns.poll) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    avahi_threaded_poll_lock(mdns.poll);
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (IsService(service_type, proto)) {
+        if (mdns.group) {
+            avahi_entry_group_reset(mdns.group);
+        }
+        mdns.hasService = false;
+        mdns.isServicePublished = false;
+        mdns.numTXTItems = 0;
+        err = ESP_OK;
+    }
+    avahi_threaded_poll_unlock(mdns.poll);
+    return err;
+}
+
+esp_err_t mdns_service_txt_set(const char* service_type, const char* proto, mdns_txt_item_t txt[], uint8_t num_items) {
+    if (!service_type || !proto) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mdns.poll) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    avahi_threaded_poll_lock(mdns.poll);
+    esp_err_t err = IsService(service_type, proto) ? SetTXTItems(txt, num_items) : ESP_ERR_NOT_FOUND;
+    if (err == ESP_OK) {
+        Publish(mdns.client);
+    }
+    avahi_threaded_poll_unlock(mdns.poll);
+    return err;
+}
+
+esp_err_t mdns_service_txt_item_set(const char* service_type, const char* proto, const char* key, const char* value) {
+    if (!service_type || !proto) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mdns.poll) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    avahi_threaded_poll_lock(mdns.poll);
+    esp_err_t err = IsService(service_type, proto) ? SetTXTItem(key, value) : ESP_ERR_NOT_FOUND;
+    if (err == ESP_OK) {
+        Publish(mdns.client);
+    }
+    avahi_threaded_poll_unlock(mdns.poll);
+    return err;
+}
+
+esp_err_t mdns_service_txt_item_remove(const char* service_type, const char* proto, const char* key) {
+    if (!service_type || !proto || !key) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mdns.poll) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    avahi_threaded_poll_lock(mdns.poll);
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    if (IsService(service_type, proto)) {
+        for (size_t i = 0; i < mdns.numTXTItems; i++) {
+            if (!strcmp(mdns.txtItems[i].key, key)) {
+                memmove(&mdns.txtItems[i], &mdns.txtItems[i + 1], (mdns.numTXTItems - i - 1) * sizeof mdns.txtItems[0]);
+                mdns.numTXTItems--;
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    if (err == ESP_OK) {
+        Publish(mdns.client);
+    }
+    avahi_threaded_poll_unlock(mdns.poll);
+    return err;
+}
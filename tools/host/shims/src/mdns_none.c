@@ -0,0 +1,81 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of the mdns component without Avahi. See mdns.h.
+//
+// - The service is not published. Controllers, including the benchmark, connect to the TCP port directly.
+
+#include <stdbool.h>
+
+#include "mdns.h"
+
+static bool isInitialized;
+
+esp_err_t mdns_init(void) {
+    if (isInitialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    isInitialized = true;
+    return ESP_OK;
+}
+
+void mdns_free(void) {
+    isInitialized = false;
+}
+
+esp_err_t mdns_hostname_set(const char* hostname) {
+    if (!hostname) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return isInitialized ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t mdns_service_add(
+        const char* instance_name,
+        const char* service_type,
+        const char* proto,
+        uint16_t port,
+        mdns_txt_item_t txt[],
+        size_t num_items) {
+    (void) port;
+    if (!instance_name || !service_type || !proto || (num_items && !txt)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return isInitialized ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t mdns_service_remove(const char* service_type, const char* proto) {
+    if (!service_type || !proto) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return isInitialized ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t mdns_service_txt_set(const char* service_type, const char* proto, mdns_txt_item_t txt[], uint8_t num_items) {
+    if (!service_type || !proto || (num_items && !txt)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return isInitialized ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t mdns_service_txt_item_set(const char* service_type, const char* proto, const char* key, const char* value) {
+    if (!service_type || !proto || !key || !value) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return isInitialized ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t mdns_service_txt_item_remove(const char* service_type, const char* proto, const char* key) {
+    if (!service_type || !proto || !key) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return isInitialized ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
@@ -0,0 +1,540 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Host shim of NVS, backed by files. See nvs.h.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+/**
+ * Environment variable holding the directory of the partitions.
+ */
+#define kNVSRootEnvironmentVariable "HAP_HOST_NVS_DIR"
+
+/**
+ * Default directory of the partitions, relative to the working directory.
+ */
+#define kNVSDefaultRoot ".nvs"
+
+/**
+ * Partition used by nvs_open and nvs_flash_init.
+ */
+#define kNVSDefaultPartition "nvs"
+
+/**
+ * Maximum number of open handles. The key-value stores keep at most CONFIG_HAP_KVS_MAX_OPEN_HANDLES open each.
+ */
+#define kNVSMaxHandles ((size_t) 32)
+
+/**
+ * Maximum number of initialized partitions.
+ */
+#define kNVSMaxPartitions ((size_t) 4)
+
+typedef struct {
+    bool isOpen;
+    bool isReadOnly;
+    char partition[NVS_KEY_NAME_MAX_SIZE];
+    char namespace_name[NVS_NS_NAME_MAX_SIZE];
+} Handle;
+
+static struct {
+    pthread_mutex_t mutex;
+    char partitions[kNVSMaxPartitions][NVS_KEY_NAME_MAX_SIZE];
+    Handle handles[kNVSMaxHandles];
+} nvs = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+struct nvs_opaque_iterator_t {
+    size_t numEntries;
+    size_t index;
+    nvs_entry_info_t entries[];
+};
+
+//----------------------------------------------------------------------------------------------------------------------
+
+static const char* GetRoot(void) {
+    const char* root = getenv(kNVSRootEnvironmentVariable);
+    return root && root[0] ? root : kNVSDefaultRoot;
+}
+
+/**
+ * Checks that a partition, namespace or key name is non-empty, fits NVS and is a plain file name.
+ */
+static bool IsValidName(const char* name) {
+    if (!name || !name[0] || name[0] == '.') {
+        return false;
+    }
+    size_t n = strlen(name);
+    return n < NVS_KEY_NAME_MAX_SIZE && !strchr(name, '/');
+}
+
+static esp_err_t MakeDirectory(const char* path) {
+    if (mkdir(path, 0755) && errno != EEXIST) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Formats the path of a partition, namespace or key. Trailing components may be NULL.
+ */
+static esp_err_t GetPath(
+        char path[PATH_MAX],
+        const char* partition,
+        const char* namespace_name,
+        const char* key) {
+    int n;
+    if (key) {
+        n = snprintf(path, PATH_MAX, "%s/%s/%s/%s", GetRoot(), partition, namespace_name, key);
+    } else if (namespace_name) {
+        n = snprintf(path, PATH_MAX, "%s/%s/%s", GetRoot(), partition, namespace_name);
+    } else {
+        n = snprintf(path, PATH_MAX, "%s/%s", GetRoot(), partition);
+    }
+    return n > 0 && n < PATH_MAX ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static bool IsPartitionInitialized(const char* partition) {
+    for (size_t i = 0; i < kNVSMaxPartitions; i++) {
+        if (!strcmp(nvs.partitions[i], partition)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Removes all blobs of a namespace directory, or all namespaces of a partition directory if isPartition is set.
+ */
+static esp_err_t RemoveEntries(const char* path, bool isPartition) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return errno == ENOENT ? ESP_OK : ESP_FAIL;
+    }
+    esp_err_t err = ESP_OK;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+            continue;
+        }
+        char entryPath[PATH_MAX];
+        int n = snprintf(entryPath, sizeof entryPath, "%s/%s", path, entry->d_name);
+        if (n <= 0 || n >= PATH_MAX) {
+            err = ESP_ERR_INVALID_SIZE;
+            continue;
+        }
+        if (isPartition) {
+            esp_err_t e = RemoveEntries(entryPath, false);
+            if (e != ESP_OK || rmdir(entryPath)) {
+                err = ESP_FAIL;
+            }
+        } else if (unlink(entryPath)) {
+            err = ESP_FAIL;
+        }
+    }
+    closedir(dir);
+    return err;
+}
+
+static Handle* GetHandle(nvs_handle_t handle) {
+    if (!handle || handle > kNVSMaxHandles || !nvs.handles[handle - 1].isOpen) {
+        return NULL;
+    }
+    return &nvs.handles[handle - 1];
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+esp_err_t nvs_flash_init_partition(const char* partition_label) {
+    if (!IsValidName(partition_label)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&nvs.mutex);
+    esp_err_t err = MakeDirectory(GetRoot());
+    char path[PATH_MAX];
+    if (err == ESP_OK) {
+        err = GetPath(path, partition_label, NULL, NULL);
+    }
+    if (err == ESP_OK) {
+        err = MakeDirectory(path);
+    }
+    if (err == ESP_OK && !IsPartitionInitialized(partition_label)) {
+        err = ESP_ERR_NO_MEM;
+        for (size_t i = 0; i < kNVSMaxPartitions; i++) {
+            if (!nvs.partitions[i][0]) {
+                strcpy(nvs.partitions[i], partition_label);
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nvs.mutex);
+    return err;
+}
+
+esp_err_t nvs_flash_init(void) {
+    return nvs_flash_init_partition(kNVSDefaultPartition);
+}
+
+esp_err_t nvs_flash_erase_partition(const char* part_name) {
+    if (!IsValidName(part_name)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char path[PATH_MAX];
+    esp_err_t err = GetPath(path, part_name, NULL, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+    pthread_mutex_lock(&nvs.mutex);
+    err = RemoveEntries(path, /* isPartition: */ true);
+    pthread_mutex_unlock(&nvs.mutex);
+    return err;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    return nvs_flash_erase_partition(kNVSDefaultPartition);
+}
+
+esp_err_t nvs_open_from_partition(
+        const char* part_name,
+        const char* name,
+        nvs_open_mode_t open_mode,
+        nvs_handle_t* out_handle) {
+    if (!IsValidName(part_name) || !out_handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!IsValidName(name)) {
+        return ESP_ERR_NVS_INVALID_NAME;
+    }
+
+    pthread_mutex_lock(&nvs.mutex);
+    if (!IsPartitionInitialized(part_name)) {
+        pthread_mutex_unlock(&nvs.mutex);
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    char path[PATH_MAX];
+    esp_err_t err = GetPath(path, part_name, name, NULL);
+    if (err == ESP_OK) {
+        if (open_mode == NVS_READONLY) {
+            // Like on the target, a namespace that does not exist yet cannot be opened read-only.
+            struct stat st;
+            err = stat(path, &st) ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+        } else {
+            err = MakeDirectory(path);
+        }
+    }
+    if (err == ESP_OK) {
+        err = ESP_ERR_NO_MEM;
+        for (size_t i = 0; i < kNVSMaxHandles; i++) {
+            Handle* h = &nvs.handles[i];
+            if (!h->isOpen) {
+                h->isOpen = true;
+                h->isReadOnly = open_mode == NVS_READONLY;
+                strcpy(h->partition, part_name);
+                strcpy(h->namespace_name, name);
+                *out_handle = (nvs_handle_t)(i + 1);
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&nvs.mutex);
+    return err;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    return nvs_open_from_partition(kNVSDefaultPartition, name, open_mode, out_handle);
+}
+
+void nvs_close(nvs_handle_t handle) {
+    pthread_mutex_lock(&nvs.mutex);
+    Handle* h = GetHandle(handle);
+    if (h) {
+        memset(h, 0, sizeof *h);
+    }
+    pthread_mutex_unlock(&nvs.mutex);
+}
+
+/**
+ * Gets the path of a key of an open handle.
+ */
+static esp_err_t GetKeyPath(nvs_handle_t handle, const char* key, bool isWrite, char path[PATH_MAX]) {
+    if (!IsValidName(key)) {
+        return key && strlen(key) >= NVS_KEY_NAME_MAX_SIZE ? ESP_ERR_NVS_KEY_TOO_LONG : ESP_ERR_NVS_INVALID_NAME;
+    }
+    pthread_mutex_lock(&nvs.mutex);
+    Handle* h = GetHandle(handle);
+    esp_err_t err = ESP_OK;
+    if (!h) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (isWrite && h->isReadOnly) {
+        err = ESP_ERR_NVS_READ_ONLY;
+    } else {
+        err = GetPath(path, h->partition, h->namespace_name, key);
+    }
+    pthread_mutex_unlock(&nvs.mutex);
+    return err;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    if (!length) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char path[PATH_MAX];
+    esp_err_t err = GetKeyPath(handle, key, /* isWrite: */ false, path);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? ESP_ERR_NVS_NOT_FOUND : ESP_FAIL;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return ESP_FAIL;
+    }
+    size_t numBytes = (size_t) st.st_size;
+    if (!out_value) {
+        close(fd);
+        *length = numBytes;
+        return ESP_OK;
+    }
+    if (*length < numBytes) {
+        close(fd);
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    size_t o = 0;
+    while (o < numBytes) {
+        ssize_t n = read(fd, (uint8_t*) out_value + o, numBytes - o);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            close(fd);
+            return ESP_FAIL;
+        }
+        o += (size_t) n;
+    }
+    close(fd);
+    *length = numBytes;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    if (!value && length) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (length > NVS_HOST_MAX_BLOB_SIZE) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    char path[PATH_MAX];
+    esp_err_t err = GetKeyPath(handle, key, /* isWrite: */ true, path);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Temporary files start with a dot, so they are never mistaken for keys.
+    char temporaryPath[PATH_MAX];
+    const char* keyName = strrchr(path, '/') + 1;
+    int m = snprintf(temporaryPath, sizeof temporaryPath, "%.*s.%s.tmp", (int) (keyName - path), path, keyName);
+    if (m <= 0 || m >= PATH_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int fd = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+    size_t o = 0;
+    while (o < length) {
+        ssize_t n = write(fd, (const uint8_t*) value + o, length - o);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            close(fd);
+            unlink(temporaryPath);
+            return ESP_FAIL;
+        }
+        o += (size_t) n;
+    }
+    if (close(fd) || rename(temporaryPath, path)) {
+        unlink(temporaryPath);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    char path[PATH_MAX];
+    esp_err_t err = GetKeyPath(handle, key, /* isWrite: */ true, path);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (unlink(path)) {
+        return errno == ENOENT ? ESP_ERR_NVS_NOT_FOUND : ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle) {
+    pthread_mutex_lock(&nvs.mutex);
+    Handle* h = GetHandle(handle);
+    esp_err_t err = ESP_OK;
+    char path[PATH_MAX];
+    if (!h) {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    } else if (h->isReadOnly) {
+        err = ESP_ERR_NVS_READ_ONLY;
+    } else {
+        err = GetPath(path, h->partition, h->namespace_name, NULL);
+    }
+    if (err == ESP_OK) {
+        err = RemoveEntries(path, /* isPartition: */ false);
+    }
+    pthread_mutex_unlock(&nvs.mutex);
+    return err;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    pthread_mutex_lock(&nvs.mutex);
+    esp_err_t err = GetHandle(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+    pthread_mutex_unlock(&nvs.mutex);
+    return err;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+/**
+ * Appends the blobs of a namespace directory to an iterator, growing it as needed.
+ */
+static nvs_iterator_t AppendEntries(
+        nvs_iterator_t iterator,
+        size_t* capacity,
+        const char* partition,
+        const char* namespace_name) {
+    char path[PATH_MAX];
+    if (GetPath(path, partition, namespace_name, NULL) != ESP_OK) {
+        return iterator;
+    }
+    DIR* dir = opendir(path);
+    if (!dir) {
+        return iterator;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!IsValidName(entry->d_name)) {
+            continue;
+        }
+        if (!iterator || iterator->numEntries == *capacity) {
+            size_t newCapacity = *capacity ? *capacity * 2 : 16;
+            nvs_iterator_t newIterator =
+                    realloc(iterator, sizeof *iterator + newCapacity * sizeof iterator->entries[0]);
+            if (!newIterator) {
+                break;
+            }
+            if (!iterator) {
+                newIterator->numEntries = 0;
+                newIterator->index = 0;
+            }
+            iterator = newIterator;
+            *capacity = newCapacity;
+        }
+        nvs_entry_info_t* info = &iterator->entries[iterator->numEntries++];
+        memset(info, 0, sizeof *info);
+        strcpy(info->namespace_name, namespace_name);
+        strcpy(info->key, entry->d_name);
+        info->type = NVS_TYPE_BLOB;
+    }
+    closedir(dir);
+    return iterator;
+}
+
+static int CompareEntries(const void* a_, const void* b_) {
+    const nvs_entry_info_t* a = a_;
+    const nvs_entry_info_t* b = b_;
+    int c = strcmp(a->namespace_name, b->namespace_name);
+    return c ? c : strcmp(a->key, b->key);
+}
+
+nvs_iterator_t nvs_entry_find(const char* part_name, const char* namespace_name, nvs_type_t type) {
+    if (!IsValidName(part_name) || (type != NVS_TYPE_BLOB && type != NVS_TYPE_ANY)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&nvs.mutex);
+    nvs_iterator_t iterator = NULL;
+    size_t capacity = 0;
+    if (namespace_name) {
+        if (IsValidName(namespace_name)) {
+            iterator = AppendEntries(iterator, &capacity, part_name, namespace_name);
+        }
+    } else {
+        char path[PATH_MAX];
+        DIR* dir = GetPath(path, part_name, NULL, NULL) == ESP_OK ? opendir(path) : NULL;
+        if (dir) {
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (IsValidName(entry->d_name)) {
+                    iterator = AppendEntries(iterator, &capacity, part_name, entry->d_name);
+                }
+            }
+            closedir(dir);
+        }
+    }
+    pthread_mutex_unlock(&nvs.mutex);
+
+    if (iterator && !iterator->numEntries) {
+        free(iterator);
+        return NULL;
+    }
+    if (iterator) {
+        // Directory order is arbitrary. Sorting makes benchmark runs reproducible.
+        qsort(iterator->entries, iterator->numEntries, sizeof iterator->entries[0], CompareEntries);
+    }
+    return iterator;
+}
+
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator) {
+    if (!iterator) {
+        return NULL;
+    }
+    if (++iterator->index >= iterator->numEntries) {
+        free(iterator);
+        return NULL;
+    }
+    return iterator;
+}
+
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t* out_info) {
+    if (!iterator || !out_info) {
+        return;
+    }
+    *out_info = iterator->entries[iterator->index];
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator) {
+    free(iterator);
+}
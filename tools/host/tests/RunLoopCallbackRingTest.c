@@ -0,0 +1,99 @@
+// Copyright (c) 2015-2019 The HomeKit ADK Contributors
+//
+// Licensed under the Apache License, Version 2.0 (the “License”);
+// you may not use this file except in compliance with the License.
+// See [CONTRIBUTORS.md] for the list of HomeKit ADK project authors.
+// This example code is in the Public Domain (or CC0 licensed, at your option.)
+//
+// Unless required by applicable law or agreed to in writing, this
+// software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+// CONDITIONS OF ANY KIND, either express or implied.
+
+// Checks that a callback with the largest context can always be scheduled into the empty scheduled callback ring.
+//
+// The run loop is built with the smallest ring that Kconfig allows. Callbacks of every context size move the ring
+// position before each attempt, so that the largest slot would have to skip the end of the ring at some position.
+
+#include <stdlib.h>
+
+#include "HAP.h"
+#include "HAPPlatform+Init.h"
+#include "HAPPlatformKeyValueStore+Init.h"
+#include "HAPPlatformRunLoop+Init.h"
+
+/**
+ * Number of callbacks with the largest context that were dispatched.
+ */
+static size_t numLargeCallbacks;
+
+static void HandleCallback(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+}
+
+static void HandleLargeCallback(void* _Nullable context HAP_UNUSED, size_t contextSize) {
+    HAPPrecondition(contextSize == UINT8_MAX);
+    numLargeCallbacks++;
+}
+
+static void HandleStop(void* _Nullable context HAP_UNUSED, size_t contextSize HAP_UNUSED) {
+    HAPPlatformRunLoopStop();
+}
+
+/**
+ * Runs the run loop until all scheduled callbacks have been dispatched.
+ */
+static void Drain(void) {
+    HAPError err = HAPPlatformRunLoopScheduleCallback(HandleStop, NULL, 0);
+    if (err) {
+        HAPLogError(&kHAPLog_Default, "Cannot schedule stop callback.");
+        HAPFatalError();
+    }
+    HAPPlatformRunLoopRun();
+}
+
+int main(void) {
+    static HAPPlatformKeyValueStore keyValueStore;
+    HAPPlatformKeyValueStoreCreate(
+            &keyValueStore,
+            &(const HAPPlatformKeyValueStoreOptions) {
+                    .part_name = "nvs", .namespace_prefix = "hap", .read_only = false });
+    HAPPlatformRunLoopCreate(&(const HAPPlatformRunLoopOptions) { .keyValueStore = &keyValueStore });
+
+    static uint8_t contextBytes[UINT8_MAX];
+    size_t numFailures = 0;
+    for (size_t numContextBytes = 0; numContextBytes <= UINT8_MAX; numContextBytes++) {
+        HAPError err = HAPPlatformRunLoopScheduleCallback(HandleCallback, contextBytes, numContextBytes);
+        if (err) {
+            HAPLogError(
+                    &kHAPLog_Default,
+                    "Cannot schedule callback with %lu context bytes.",
+                    (unsigned long) numContextBytes);
+            HAPFatalError();
+        }
+        Drain();
+
+        err = HAPPlatformRunLoopScheduleCallback(HandleLargeCallback, contextBytes, sizeof contextBytes);
+        if (err) {
+            HAPLogError(
+                    &kHAPLog_Default,
+                    "Empty ring rejected the largest callback after a callback with %lu context bytes.",
+                    (unsigned long) numContextBytes);
+            numFailures++;
+            continue;
+        }
+        Drain();
+    }
+
+    HAPPlatformRunLoopRelease();
+
+    if (numFailures || numLargeCallbacks != UINT8_MAX + 1) {
+        HAPLogError(
+                &kHAPLog_Default,
+                "%lu failures, %lu of %d largest callbacks dispatched.",
+                (unsigned long) numFailures,
+                (unsigned long) numLargeCallbacks,
+                UINT8_MAX + 1);
+        return EXIT_FAILURE;
+    }
+    HAPLogInfo(&kHAPLog_Default, "Scheduled callback ring: OK.");
+    return EXIT_SUCCESS;
+}